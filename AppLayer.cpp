@@ -1,27 +1,209 @@
 #include <vector>
+#include <map>
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 #include "constants.h"
 #include "AppLayer.h"
+#include "EventLoop.h"
+#include "IPLayer.h"
+#include "Log.h"
+
+#define INPUT_BUF_LEN (1024)
 
 using namespace std;
 
-AppLayer::AppLayer() {
+/**
+ * With statsMs set, the IP layer's counters are dumped to stderr every statsMs milliseconds
+ */
+AppLayer::AppLayer(IPLayer* ipLayer, int statsMs) {
+	this->ipLayer = ipLayer;
+	this->statsMs = statsMs;
+	loop = NULL;
+}
+
+/**
+ * Registers stdin with loop so commands are read without blocking packet handling
+ */
+void AppLayer::registerEvents(EventLoop* loop) {
+	this->loop = loop;
+	loop->addFd(STDIN_FILENO, onInputReady, this);
+	ipLayer->registerDataReady(loop, onDataReady, this);
+	if (statsMs > 0) {
+		loop->addTimer(statsMs, onStatsTimer, this);
+	}
+}
+
+/**
+ * Writes one line of key=value counters to stderr, stamped with the monotonic clock in ms, so a
+ * script can tail it while the CLI keeps stdout
+ */
+void AppLayer::onStatsTimer(int fd, void* arg) {
+	AppLayer* app = (AppLayer*) arg;
+	stats_snapshot snap;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	app->ipLayer->getStats(&snap);
+	fprintf(stderr, "stats ms=%llu %s\n", (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000,
+			Stats::format(&snap).c_str());
+}
+
+/**
+ * Prints the IP layer's counters as a table per interface, then the drops that were counted
+ */
+void AppLayer::printStats() {
+	stats_snapshot snap;
+	int numItfs;
+
+	ipLayer->getStats(&snap);
+	numItfs = snap.itfs.size() - 1;
+
+	cout << "itf\trx pkts\trx bytes\ttx pkts\ttx bytes" << endl;
+	for (int k = 0; k <= numItfs; k++) {
+		const itf_stats& s = snap.itfs[k];
+		if (k == numItfs && s.rxPackets == 0) {
+			continue;
+		}
+		if (k < numItfs) {
+			cout << k;
+		} else {
+			cout << "unknown";
+		}
+		cout << "\t" << s.rxPackets << "\t" << s.rxBytes << "\t" << s.txPackets << "\t" << s.txBytes << endl;
+	}
+
+	int dropped = 0;
+	cout << "Drops:";
+	for (int r = 0; r < NUM_DROP_REASONS; r++) {
+		if (snap.drops[r] > 0) {
+			cout << " " << Stats::dropName(r) << " " << snap.drops[r];
+			dropped++;
+		}
+	}
+	cout << (dropped ? "" : " none") << endl;
+	cout << "Route lookups " << snap.lookups << " no route " << snap.noRoute << ", flow cache hits " << snap.flowHits
+			<< " misses " << snap.flowMisses << endl;
+}
 
+void AppLayer::onInputReady(int fd, void* arg) {
+	((AppLayer*) arg)->readInput();
 }
 
+void AppLayer::onDataReady(int fd, void* arg) {
+	((AppLayer*) arg)->readData();
+}
+
+/**
+ * Prints every message the IP layer has delivered, then re-arms the wakeup
+ */
+void AppLayer::readData() {
+	rcv_data data;
+
+	do {
+		while (ipLayer->getData(&data)) {
+			struct in_addr src;
+			src.s_addr = data.saddr;
+			cout << "Received " << data.len << " bytes from " << inet_ntoa(src) << ": ";
+			cout.write(data.data, data.len);
+			cout << endl;
+			ipLayer->releaseData(&data);
+		}
+	} while (!ipLayer->armDataReady());
+}
+
+/**
+ * Reads whatever is available on stdin and runs each complete line as a command.
+ * Stops the event loop on end of input.
+ */
+void AppLayer::readInput() {
+	char buf[INPUT_BUF_LEN];
+	ssize_t n;
+	string::size_type eol;
+
+	if ((n = read(STDIN_FILENO, buf, sizeof(buf))) <= 0) {
+		loop->removeFd(STDIN_FILENO);
+		loop->stop();
+		return;
+	}
+
+	pendingInput.append(buf, n);
+	while ((eol = pendingInput.find('\n')) != string::npos) {
+		string command = pendingInput.substr(0, eol);
+		pendingInput.erase(0, eol + 1);
+		if (!command.empty()) {
+			runningApp(command);
+		}
+	}
+}
+
+
+void AppLayer::runningApp(const string& line){
+	istringstream args(line);
+	string command;
+	args >> command;
 
-void AppLayer::runningApp(const string& command){
 	if(command.compare("send") == 0){
-		cout << "The command is " << command << endl;
+		string destIP, message;
+		struct in_addr dest;
+		args >> destIP;
+		getline(args >> ws, message);
+		if (destIP.empty() || message.empty()) {
+			cout << "Usage: send <vip> <message>" << endl;
+		} else if (inet_aton(destIP.c_str(), &dest) == 0) {
+			cout << "Bad address: " << destIP << endl;
+		} else {
+			ipLayer->send(const_cast<char*>(message.data()), message.length(), dest.s_addr);
+		}
 	} else if (command.compare("ipconfig") == 0) {
 		cout << "The command is " << command << endl;
 	} else if (command.compare("routes") == 0) {
-		cout << "The command is " << command << endl;
-	} else if (command.compare("up") == 0) {
-		cout << "The command is " << command << endl;
-	} else if (command.compare("down") == 0) {
-		cout << "The command is " << command << endl;
+		const RouteTable& routes = ipLayer->getRoutes();
+		for (int i = 0; i < routes.size(); i++) {
+			const route_entry* route = routes.at(i);
+			struct in_addr dest;
+			dest.s_addr = route->prefix;
+			cout << inet_ntoa(dest) << "\t";
+			if (routeItf(route) == FWD_LOCAL) {
+				cout << "local";
+			} else {
+				cout << "itf " << routeItf(route);
+			}
+			cout << "\tcost " << (int) route->cost << endl;
+		}
+	} else if (command.compare("up") == 0 || command.compare("down") == 0) {
+		int itfNum;
+		if (!(args >> itfNum)) {
+			cout << "Usage: " << command << " <interface>" << endl;
+		} else if (ipLayer->setInterfaceUp(itfNum, command.compare("up") == 0) == 0) {
+			cout << "Interface " << itfNum << " " << command << endl;
+		}
+	} else if (command.compare("flowcache") == 0) {
+		u_int64_t hits, misses;
+		ipLayer->getFlowCacheStats(&hits, &misses);
+		cout << "Flow cache hits " << hits << " misses " << misses << endl;
+	} else if (command.compare("stats") == 0) {
+		printStats();
+	} else if (command.compare("loglevel") == 0) {
+		string name;
+		int level;
+		if (!(args >> name)) {
+			cout << "Log level " << logLevelName(logLevel) << endl;
+		} else if ((level = logParseLevel(name.c_str())) < 0) {
+			cout << "Usage: loglevel [debug|info|warn|error]" << endl;
+		} else {
+			logSetLevel(level);
+			if (level < LOG_COMPILE_LEVEL) {
+				cout << "Messages below " << logLevelName(LOG_COMPILE_LEVEL) << " are compiled out" << endl;
+			}
+		}
+	} else if (command.compare("pool") == 0) {
+		PacketPool* pool = ipLayer->getPacketPool();
+		cout << "Packet buffers " << pool->getNumBufs() << " heap allocations " << pool->getSlabAllocs() << endl;
 	} else {
 		cout << "The command cannot be recognized. Please re-enter" << endl;
 	}
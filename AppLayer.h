@@ -4,17 +4,30 @@
 #include <vector>
 #include <string>
 #include "constants.h"
+#include "EventLoop.h"
+#include "IPLayer.h"
 
 using namespace std;
 
 class AppLayer {
 
 	private:
+		EventLoop* loop;
+		IPLayer* ipLayer;
+		string pendingInput;
+		int statsMs;
 		void start();
+		void readInput();
+		void readData();
+		void printStats();
+		static void onInputReady(int fd, void* arg);
+		static void onDataReady(int fd, void* arg);
+		static void onStatsTimer(int fd, void* arg);
 
 	public:
-		AppLayer();
-		void runningApp(const string& command);
+		AppLayer(IPLayer* ipLayer, int statsMs = 0);
+		void runningApp(const string& line);
+		void registerEvents(EventLoop* loop);
 };
 
 #endif
@@ -0,0 +1,761 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <deque>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+
+#include "Emulator.h"
+#include "Rip.h"
+#include "LinkState.h"
+
+Emulator::Emulator(int routingMode) {
+	this->routingMode = routingMode;
+	numNodes = 0;
+	net = NULL;
+	expect = NULL;
+	eventMs = 0;
+	lineNum = 0;
+}
+
+Emulator::~Emulator() {
+	stop();
+
+	// every node stops before any link goes, as queued packets point into the network's pool
+	for (vector<emu_node*>::size_type i = 0; i != nodes.size(); i++) {
+		delete nodes[i]->ipl;
+	}
+	for (vector<emu_node*>::size_type i = 0; i != nodes.size(); i++) {
+		delete nodes[i]->link;
+		delete nodes[i];
+	}
+	delete net;
+
+	for (vector<emu_thread*>::size_type i = 0; i != threads.size(); i++) {
+		close(threads[i]->wakeFd);
+		pthread_mutex_destroy(&threads[i]->lock);
+		delete threads[i];
+	}
+	for (vector<emu_expect*>::size_type i = 0; i != oldExpects.size(); i++) {
+		delete oldExpects[i];
+	}
+	delete expect;
+}
+
+/**
+ * Prints a message about the current line of a topology file. Returns -1.
+ */
+int Emulator::error(const char* fmt, ...) {
+	va_list args;
+
+	printf("Topology line %d: ", lineNum);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+
+	return -1;
+}
+
+/**
+ * Adds a point to point link between nodes a and b, creating them if needed. Must be called
+ * before start(). Returns the link's number, or -1 if it cannot be added.
+ */
+int Emulator::addLink(int a, int b, int mtu) {
+	emu_link link;
+
+	if (net != NULL || a < 0 || b < 0 || a == b || mtu < MIN_MTU || mtu > MAX_MTU || (int) links.size() >= EMU_MAX_LINKS) {
+		return -1;
+	}
+	if (a >= numNodes || b >= numNodes) {
+		numNodes = (a > b) ? a + 1 : b + 1;
+		nodeLinks.resize(numNodes);
+	}
+	if (nodeLinks[a].size() >= MAX_INTERFACES || nodeLinks[b].size() >= MAX_INTERFACES) {
+		return -1;
+	}
+
+	link.a = a;
+	link.b = b;
+	link.itfA = nodeLinks[a].size();
+	link.itfB = nodeLinks[b].size();
+	link.mtu = mtu;
+	link.up = true;
+	nodeLinks[a].push_back(links.size());
+	nodeLinks[b].push_back(links.size());
+	links.push_back(link);
+
+	return links.size() - 1;
+}
+
+/**
+ * Builds a ring of numNodes nodes and adds random chords until the average degree is degree.
+ * The same seed always gives the same topology.
+ */
+void Emulator::generateTopology(int numNodes, int degree, unsigned seed) {
+	srand(seed);
+	for (int i = 0; i < numNodes; i++) {
+		addLink(i, (i + 1) % numNodes);
+	}
+	for (int chords = numNodes * (degree - 2) / 2; chords > 0; ) {
+		int a = rand() % numNodes, b = rand() % numNodes;
+		bool linked = (a == b);
+
+		for (vector<int>::size_type i = 0; i != nodeLinks[a].size() && !linked; i++) {
+			const emu_link& l = links[nodeLinks[a][i]];
+			linked = (l.a == b || l.b == b);
+		}
+		if (!linked) {
+			addLink(a, b);
+			chords--;
+		}
+	}
+}
+
+/**
+ * Loads a topology from a file of this form:
+ *
+ *   nodes N            optional; nodes without links still run
+ *   link a b [mtu]     one line per link, nodes numbered from 0
+ *
+ * Blank lines and anything after a '#' are ignored. Returns 0, or -1 after printing what is wrong.
+ */
+int Emulator::loadTopology(const char* fileName) {
+	char line[EMU_MAX_LINE];
+	FILE* file;
+	int ret = 0;
+
+	if ((file = fopen(fileName, "r")) == NULL) {
+		perror("Topology open error:");
+		return -1;
+	}
+
+	lineNum = 0;
+	while (ret == 0 && fgets(line, sizeof(line), file) != NULL) {
+		char word[16];
+		int a, b, mtu = DEFAULT_MTU, fields;
+		char* comment = strchr(line, '#');
+
+		lineNum++;
+		if (comment != NULL) {
+			*comment = '\0';
+		}
+		if ((fields = sscanf(line, "%15s %d %d %d", word, &a, &b, &mtu)) <= 0) {
+			continue;
+		}
+
+		if (strcmp(word, "nodes") == 0 && fields == 2 && a > 0) {
+			if (a > numNodes) {
+				numNodes = a;
+				nodeLinks.resize(numNodes);
+			}
+		} else if (strcmp(word, "link") == 0 && fields >= 3) {
+			if (addLink(a, b, mtu) < 0) {
+				ret = error("bad link %d %d mtu %d", a, b, mtu);
+			}
+		} else {
+			ret = error("expected \"nodes N\" or \"link a b [mtu]\"");
+		}
+	}
+	fclose(file);
+
+	return ret;
+}
+
+/**
+ * Writes the topology in the form loadTopology reads. Returns 0, or -1 if it cannot be written.
+ */
+int Emulator::saveTopology(const char* fileName) {
+	FILE* file;
+
+	if ((file = fopen(fileName, "w")) == NULL) {
+		perror("Topology create error:");
+		return -1;
+	}
+	fprintf(file, "nodes %d\n", numNodes);
+	for (vector<emu_link>::size_type i = 0; i != links.size(); i++) {
+		fprintf(file, "link %d %d %d\n", links[i].a, links[i].b, links[i].mtu);
+	}
+	fclose(file);
+
+	return 0;
+}
+
+/**
+ * Returns the address of side 1 or 2 of link k, network byte order
+ */
+static u_int32_t linkAddr(int k, int side) {
+	return htonl(EMU_ADDR_BASE + ((u_int32_t) k << 2) + side);
+}
+
+/**
+ * Creates every node and starts numThreads threads to run them, nodes dealt out round robin.
+ * Returns 0, or -1 if there is nothing to run.
+ */
+int Emulator::start(int numThreads) {
+	int maxMtu = DEFAULT_MTU;
+
+	if (net != NULL || numNodes == 0 || numThreads < 1) {
+		return -1;
+	}
+
+	for (vector<emu_link>::size_type i = 0; i != links.size(); i++) {
+		if (links[i].mtu > maxMtu) {
+			maxMtu = links[i].mtu;
+		}
+	}
+	net = new MemNetwork(maxMtu);
+
+	// every link exists before any node can send
+	for (int i = 0; i < numNodes; i++) {
+		emu_node* node = new emu_node;
+		vector<itf_info> itfs;
+		vector<int> peers;
+
+		for (vector<int>::size_type j = 0; j != nodeLinks[i].size(); j++) {
+			int k = nodeLinks[i][j];
+			bool sideA = (links[k].a == i);
+			itf_info itf;
+
+			itf.locAddr = linkAddr(k, sideA ? 1 : 2);
+			itf.rmtAddr = linkAddr(k, sideA ? 2 : 1);
+			itf.mtu = links[k].mtu;
+			itf.transport = LINK_UDP;
+			itfs.push_back(itf);
+			peers.push_back(sideA ? links[k].b : links[k].a);
+		}
+
+		node->id = i;
+		node->thread = i % numThreads;
+		node->link = new MemLink(net, itfs, peers);
+		node->okGen = 0;
+		node->okSince = 0;
+		node->delivered = 0;
+		node->misdelivered = 0;
+		nodes.push_back(node);
+	}
+	for (int i = 0; i < numNodes; i++) {
+		nodes[i]->ipl = new IPLayer(nodes[i]->link, 1, routingMode);
+	}
+	computeExpect();
+
+	for (int t = 0; t < numThreads; t++) {
+		emu_thread* thread = new emu_thread;
+
+		thread->emu = this;
+		thread->id = t;
+		thread->stopping = false;
+		pthread_mutex_init(&thread->lock, NULL);
+		if ((thread->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+			perror("Eventfd creation error:");
+		}
+		thread->loop.addFd(thread->wakeFd, onWake, thread);
+		thread->loop.addTimer(EMU_CHECK_MS, onCheck, thread);
+		threads.push_back(thread);
+	}
+
+	// routing starts as each node registers, so nodes on a thread not yet running find their
+	// first messages waiting
+	eventMs = TimerWheel::nowMs();
+	for (int i = 0; i < numNodes; i++) {
+		emu_thread* thread = threads[nodes[i]->thread];
+
+		thread->nodes.push_back(nodes[i]);
+		nodes[i]->ipl->registerEvents(&thread->loop);
+		nodes[i]->ipl->registerDataReady(&thread->loop, onData, nodes[i]);
+	}
+
+	for (int t = 0; t < numThreads; t++) {
+		int err = pthread_create(&threads[t]->thread, NULL, runThread, threads[t]);
+		if (err != 0) {
+			perror("Threading error:");
+		}
+	}
+
+	return 0;
+}
+
+void* Emulator::runThread(void* arg) {
+	((emu_thread*) arg)->loop.run();
+	return NULL;
+}
+
+/**
+ * Stops every thread and waits for them. The nodes keep their state until the emulator is freed.
+ */
+void Emulator::stop() {
+	for (vector<emu_thread*>::size_type i = 0; i != threads.size(); i++) {
+		pthread_mutex_lock(&threads[i]->lock);
+		if (threads[i]->stopping) {
+			pthread_mutex_unlock(&threads[i]->lock);
+			return;
+		}
+		threads[i]->stopping = true;
+		pthread_mutex_unlock(&threads[i]->lock);
+
+		uint64_t one = 1;
+		if (write(threads[i]->wakeFd, &one, sizeof(one)) != sizeof(one)) {
+			// already woken
+		}
+	}
+	for (vector<emu_thread*>::size_type i = 0; i != threads.size(); i++) {
+		pthread_join(threads[i]->thread, NULL);
+	}
+}
+
+/**
+ * Queues cb to run with arg on a thread's loop
+ */
+void Emulator::post(int thread, emu_task_cb cb, void* arg) {
+	emu_thread* t = threads[thread];
+	emu_task task;
+	uint64_t one = 1;
+
+	task.cb = cb;
+	task.arg = arg;
+	pthread_mutex_lock(&t->lock);
+	t->tasks.push_back(task);
+	pthread_mutex_unlock(&t->lock);
+
+	if (write(t->wakeFd, &one, sizeof(one)) != sizeof(one)) {
+		// already woken
+	}
+}
+
+/**
+ * Runs the tasks queued for a thread, then stops its loop if the emulator is stopping
+ */
+void Emulator::onWake(int fd, void* arg) {
+	emu_thread* thread = (emu_thread*) arg;
+	vector<emu_task> tasks;
+	uint64_t count;
+	bool stopping;
+
+	if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+		// nothing pending
+	}
+	pthread_mutex_lock(&thread->lock);
+	tasks.swap(thread->tasks);
+	stopping = thread->stopping;
+	pthread_mutex_unlock(&thread->lock);
+
+	for (vector<emu_task>::size_type i = 0; i != tasks.size(); i++) {
+		tasks[i].cb(tasks[i].arg);
+	}
+	if (stopping) {
+		thread->loop.stop();
+	}
+}
+
+void Emulator::onInterfaceChange(void* arg) {
+	emu_itf_change* change = (emu_itf_change*) arg;
+
+	change->node->ipl->setInterfaceUp(change->itfNum, change->up);
+	delete change;
+}
+
+/**
+ * Takes a link down or brings it back up at both ends, on the threads owning them, and starts
+ * timing the network's convergence on the new state. Returns -1 if there is no such link.
+ */
+int Emulator::setLinkUp(int linkNum, bool up) {
+	if (net == NULL || linkNum < 0 || linkNum >= (int) links.size()) {
+		return -1;
+	}
+	emu_link& link = links[linkNum];
+	emu_itf_change* changeA = new emu_itf_change;
+	emu_itf_change* changeB = new emu_itf_change;
+
+	link.up = up;
+	computeExpect();
+	eventMs = TimerWheel::nowMs();
+
+	changeA->node = nodes[link.a];
+	changeA->itfNum = link.itfA;
+	changeA->up = up;
+	changeB->node = nodes[link.b];
+	changeB->itfNum = link.itfB;
+	changeB->up = up;
+	post(nodes[link.a]->thread, onInterfaceChange, changeA);
+	post(nodes[link.b]->thread, onInterfaceChange, changeB);
+
+	return 0;
+}
+
+/**
+ * Returns the first up link that is not part of the generated ring, which can fail without
+ * splitting the network, or -1 if there is none
+ */
+int Emulator::findChord() {
+	for (vector<emu_link>::size_type i = 0; i != links.size(); i++) {
+		const emu_link& l = links[i];
+		if (l.up && l.b != (l.a + 1) % numNodes && l.a != (l.b + 1) % numNodes) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Publishes what converged routes look like with the links as they are now: hop counts from a
+ * breadth-first search out of every node, over the links that are up
+ */
+void Emulator::computeExpect() {
+	emu_expect* e = new emu_expect;
+
+	e->gen = (expect == NULL) ? 1 : expect->gen + 1;
+	e->dist.assign((size_t) numNodes * numNodes, -1);
+	e->reachable.assign(numNodes, 0);
+
+	for (int src = 0; src < numNodes; src++) {
+		int16_t* dist = &e->dist[(size_t) src * numNodes];
+		deque<int> q;
+
+		dist[src] = 0;
+		q.push_back(src);
+		while (!q.empty()) {
+			int u = q.front();
+			q.pop_front();
+			for (vector<int>::size_type i = 0; i != nodeLinks[u].size(); i++) {
+				const emu_link& l = links[nodeLinks[u][i]];
+				int v = (l.a == u) ? l.b : l.a;
+				if (l.up && dist[v] < 0) {
+					dist[v] = dist[u] + 1;
+					q.push_back(v);
+				}
+			}
+		}
+
+		// every node owns one address per link it is on, up or down
+		for (int v = 0; v < numNodes; v++) {
+			if (dist[v] >= 0 && (routingMode != ROUTING_RIP || dist[v] < RIP_INFINITY)) {
+				e->reachable[src] += nodeLinks[v].size();
+			}
+		}
+	}
+
+	if (expect != NULL) {
+		oldExpects.push_back(expect);
+	}
+	__atomic_store_n(&expect, e, __ATOMIC_RELEASE);
+}
+
+/**
+ * Compares a node's routes with expectation e: every link address its owner can be reached at
+ * must be reachable at the hop count, and no other. Records when the node started to match.
+ */
+void Emulator::checkNode(emu_node* node, const emu_expect* e, u_int64_t now) {
+	const RouteTable& routes = node->ipl->getRoutes();
+	const int16_t* dist = &e->dist[(size_t) node->id * numNodes];
+	u_int32_t numAddrs = links.size() << 2;
+	bool rip = (routingMode == ROUTING_RIP);
+	int matched = 0;
+
+	for (int i = 0; i < routes.size(); i++) {
+		const route_entry* r = routes.at(i);
+		u_int32_t a = ntohl(r->prefix) - EMU_ADDR_BASE;
+		int side = a & 3;
+
+		if (r->len != 32 || a >= numAddrs || side == 0 || side == 3) {
+			continue;
+		}
+		const emu_link& l = links[a >> 2];
+		int d = dist[(side == 1) ? l.a : l.b];
+		bool want = d >= 0 && (!rip || d < RIP_INFINITY);
+		bool have = routeItf(r) != FWD_NO_ROUTE && (!rip || r->cost < RIP_INFINITY);
+
+		if (have != want || (have && r->cost != ((d < LS_MAX_COST) ? d : LS_MAX_COST))) {
+			__atomic_store_n(&node->okGen, 0, __ATOMIC_RELEASE);
+			return;
+		}
+		matched += have;
+	}
+
+	if (matched != e->reachable[node->id]) {
+		__atomic_store_n(&node->okGen, 0, __ATOMIC_RELEASE);
+	} else if (__atomic_load_n(&node->okGen, __ATOMIC_RELAXED) != e->gen) {
+		node->okSince = now;
+		__atomic_store_n(&node->okGen, e->gen, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Checks the routes of every node on a thread against the latest expectation
+ */
+void Emulator::onCheck(int fd, void* arg) {
+	emu_thread* thread = (emu_thread*) arg;
+	const emu_expect* e = __atomic_load_n(&thread->emu->expect, __ATOMIC_ACQUIRE);
+	u_int64_t now = TimerWheel::nowMs();
+
+	for (vector<emu_node*>::size_type i = 0; i != thread->nodes.size(); i++) {
+		thread->emu->checkNode(thread->nodes[i], e, now);
+	}
+}
+
+/**
+ * Waits until every node's routes match the current state of the links, or timeoutMs passes.
+ * Returns the ms from the start or the last link change until the last node matched, to within
+ * EMU_CHECK_MS, or -1 on timeout.
+ */
+long Emulator::waitConverged(int timeoutMs) {
+	u_int64_t deadline = TimerWheel::nowMs() + timeoutMs;
+	u_int32_t gen = expect->gen;
+
+	while (TimerWheel::nowMs() < deadline) {
+		u_int64_t last = eventMs;
+		bool all = true;
+
+		for (int i = 0; i < numNodes && all; i++) {
+			if (__atomic_load_n(&nodes[i]->okGen, __ATOMIC_ACQUIRE) != gen) {
+				all = false;
+			} else if (nodes[i]->okSince > last) {
+				last = nodes[i]->okSince;
+			}
+		}
+		if (all) {
+			return last - eventMs;
+		}
+		usleep(EMU_CHECK_MS * 1000 / 4);
+	}
+
+	return -1;
+}
+
+/**
+ * Returns a node's address on its first link, network byte order, or 0 if it has no links
+ */
+u_int32_t Emulator::getNodeAddr(int nodeNum) {
+	if (nodeNum < 0 || nodeNum >= numNodes || nodeLinks[nodeNum].empty()) {
+		return 0;
+	}
+	int k = nodeLinks[nodeNum][0];
+	return linkAddr(k, (links[k].a == nodeNum) ? 1 : 2);
+}
+
+/**
+ * Returns the hop count from node a to node b over the links now up, or -1 if b is unreachable
+ */
+int Emulator::getDistance(int a, int b) {
+	return expect->dist[(size_t) a * numNodes + b];
+}
+
+/**
+ * Queues a len byte experiment message from node src to node dst, identified by seq. Returns the
+ * IP layer's result: the bytes queued, or -1 if the message could not be.
+ */
+int Emulator::sendMessage(int src, int dst, int len, u_int32_t seq) {
+	static const char zeros[IP_MAXPACKET] = { 0 };
+	u_int32_t hdr[3];
+	struct iovec frags[2];
+	int numFrags = 1;
+
+	if (src < 0 || src >= numNodes || len < (int) sizeof(hdr) || len > IP_MAXPACKET) {
+		return -1;
+	}
+
+	hdr[0] = htonl(EMU_MAGIC);
+	hdr[1] = htonl(dst);
+	hdr[2] = htonl(seq);
+	frags[0].iov_base = hdr;
+	frags[0].iov_len = sizeof(hdr);
+	if (len > (int) sizeof(hdr)) {
+		frags[1].iov_base = (void*) zeros;
+		frags[1].iov_len = len - sizeof(hdr);
+		numFrags = 2;
+	}
+
+	return nodes[src]->ipl->queueSend(frags, numFrags, getNodeAddr(dst));
+}
+
+/**
+ * Counts the experiment messages a node received, checking each was meant for it
+ */
+void Emulator::onData(int fd, void* arg) {
+	emu_node* node = (emu_node*) arg;
+	rcv_data data;
+
+	do {
+		while (node->ipl->getData(&data)) {
+			const u_int32_t* hdr = (const u_int32_t*) data.data;
+
+			if (data.protocol == DATA_PROTOCOL && data.len >= 3 * (int) sizeof(u_int32_t)
+					&& ntohl(hdr[0]) == EMU_MAGIC && (int) ntohl(hdr[1]) == node->id) {
+				__atomic_add_fetch(&node->delivered, 1, __ATOMIC_RELAXED);
+			} else {
+				__atomic_add_fetch(&node->misdelivered, 1, __ATOMIC_RELAXED);
+			}
+			node->ipl->releaseData(&data);
+		}
+	} while (!node->ipl->armDataReady());
+}
+
+/**
+ * Returns the experiment messages received so far, and those received by the wrong node
+ */
+u_int64_t Emulator::getDelivered(u_int64_t* misdelivered) {
+	u_int64_t delivered = 0;
+
+	*misdelivered = 0;
+	for (vector<emu_node*>::size_type i = 0; i != nodes.size(); i++) {
+		delivered += __atomic_load_n(&nodes[i]->delivered, __ATOMIC_RELAXED);
+		*misdelivered += __atomic_load_n(&nodes[i]->misdelivered, __ATOMIC_RELAXED);
+	}
+	return delivered;
+}
+
+/**
+ * Sums the packets carried over every link, routing messages included, and those dropped
+ */
+void Emulator::getLinkStats(u_int64_t* packets, u_int64_t* drops) {
+	*packets = 0;
+	*drops = 0;
+	for (vector<emu_node*>::size_type i = 0; i != nodes.size(); i++) {
+		*packets += __atomic_load_n(&nodes[i]->link->txPackets, __ATOMIC_RELAXED);
+		*drops += __atomic_load_n(&nodes[i]->link->drops, __ATOMIC_RELAXED);
+	}
+}
+
+int Emulator::getNumNodes() {
+	return numNodes;
+}
+
+int Emulator::getNumLinks() {
+	return links.size();
+}
+
+#ifdef EMULATOR_MAIN
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+ * Runs a network of nodes in one process: waits for routing to converge from a cold start, sends
+ * messages between random pairs of nodes and counts their delivery, then fails a link and waits
+ * for routing to converge again. Results go to stderr as key=value pairs; stdout carries whatever
+ * the nodes print.
+ */
+
+#define EMU_WINDOW 4096 // experiment messages in flight at once
+#define EMU_TIMEOUT_MS 120000
+#define EMU_IDLE_MS 1000 // messages still missing when none arrived for this long are lost
+
+static double elapsedMs(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void report(Emulator* emu, const char* event, long convergeMs, u_int64_t pktsBefore, u_int64_t dropsBefore) {
+	u_int64_t pkts, drops;
+
+	emu->getLinkStats(&pkts, &drops);
+	fprintf(stderr, "event=%s nodes=%d links=%d converged=%d converge_ms=%ld link_pkts=%llu link_drops=%llu\n", event,
+			emu->getNumNodes(), emu->getNumLinks(), convergeMs >= 0, convergeMs,
+			(unsigned long long) (pkts - pktsBefore), (unsigned long long) (drops - dropsBefore));
+}
+
+/* emulator [nodes or topology file] [rip|ls] [threads] [messages] [message bytes] [degree] [seed] */
+int main(int argc, char** argv) {
+	const char* topology = (argc > 1) ? argv[1] : "1000";
+	int routingMode = (argc > 2 && strcmp(argv[2], "ls") == 0) ? ROUTING_LINK_STATE : ROUTING_RIP;
+	int numThreads = (argc > 3) ? atoi(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN);
+	int numMsgs = (argc > 4) ? atoi(argv[4]) : 100000;
+	int msgLen = (argc > 5) ? atoi(argv[5]) : 64;
+	int degree = (argc > 6) ? atoi(argv[6]) : 4;
+	unsigned seed = (argc > 7) ? atoi(argv[7]) : 1;
+	Emulator emu(routingMode);
+	struct timespec start;
+	struct rlimit lim;
+	struct rusage usage;
+	u_int64_t pkts, drops, pktsAfter, dropsAfter, delivered, misdelivered, hops = 0;
+	long convergeMs;
+	int sent = 0;
+	double ms;
+
+	if (atoi(topology) > 0) {
+		emu.generateTopology(atoi(topology), degree, seed);
+	} else if (emu.loadTopology(topology) < 0) {
+		return 1;
+	}
+	if (numThreads < 1 || msgLen < 12) {
+		fprintf(stderr, "usage: emulator [nodes or topology file] [rip|ls] [threads] [messages] [message bytes] [degree] [seed]\n");
+		return 1;
+	}
+
+	// a node takes a handful of descriptors: its receive queue, rings and timer
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (emu.start(numThreads) < 0) {
+		fprintf(stderr, "nothing to run\n");
+		return 1;
+	}
+	fprintf(stderr, "nodes=%d links=%d threads=%d routing=%s setup_ms=%.1f\n", emu.getNumNodes(), emu.getNumLinks(),
+			numThreads, (routingMode == ROUTING_RIP) ? "rip" : "ls", elapsedMs(&start));
+
+	convergeMs = emu.waitConverged(EMU_TIMEOUT_MS);
+	report(&emu, "cold_start", convergeMs, 0, 0);
+	if (convergeMs < 0) {
+		return 1;
+	}
+
+	// messages between random pairs, at most EMU_WINDOW of them unaccounted for at a time
+	emu.getLinkStats(&pkts, &drops);
+	srand(seed);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (sent < numMsgs && elapsedMs(&start) < EMU_TIMEOUT_MS) {
+		int src = rand() % emu.getNumNodes(), dst = rand() % emu.getNumNodes();
+
+		if (src == dst || emu.getDistance(src, dst) < 0) {
+			continue;
+		}
+
+		// summing the counters visits every node, so only look every so often
+		while (sent % 256 == 0 && sent - emu.getDelivered(&misdelivered) >= EMU_WINDOW
+				&& elapsedMs(&start) < EMU_TIMEOUT_MS) {
+			usleep(100);
+		}
+		// a full transmit ring is retried, so busy nodes are not left out of the sample
+		while (emu.sendMessage(src, dst, msgLen, sent) < 0 && elapsedMs(&start) < EMU_TIMEOUT_MS) {
+			usleep(100);
+		}
+		hops += emu.getDistance(src, dst);
+		sent++;
+	}
+	for (u_int64_t last = 0, idleMs = 0; idleMs < EMU_IDLE_MS; idleMs += 10) {
+		if ((delivered = emu.getDelivered(&misdelivered)) + misdelivered >= (u_int64_t) sent) {
+			break;
+		}
+		if (delivered != last) {
+			last = delivered;
+			idleMs = 0;
+		}
+		usleep(10000);
+	}
+	ms = elapsedMs(&start);
+	delivered = emu.getDelivered(&misdelivered);
+	emu.getLinkStats(&pktsAfter, &dropsAfter);
+	fprintf(stderr, "event=forwarding msgs=%d msg_bytes=%d delivered=%llu misdelivered=%llu lost=%llu avg_hops=%.2f secs=%.3f msgs_per_s=%.0f link_pkts_per_s=%.0f link_drops=%llu\n",
+			sent, msgLen, (unsigned long long) delivered, (unsigned long long) misdelivered,
+			(unsigned long long) (sent - delivered - misdelivered), (double) hops / sent, ms / 1e3,
+			delivered / (ms / 1e3), (pktsAfter - pkts) / (ms / 1e3), (unsigned long long) (dropsAfter - drops));
+
+	int chord = emu.findChord();
+	if (chord >= 0) {
+		emu.getLinkStats(&pkts, &drops);
+		emu.setLinkUp(chord, false);
+		report(&emu, "link_down", emu.waitConverged(EMU_TIMEOUT_MS), pkts, drops);
+	}
+
+	emu.stop();
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(stderr, "max_rss_mb=%.1f\n", usage.ru_maxrss / 1024.0);
+
+	return 0;
+}
+#endif
@@ -0,0 +1,133 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "constants.h"
+#include "EventLoop.h"
+#include "IPLayer.h"
+#include "MemLink.h"
+
+using namespace std;
+
+#define EMU_ADDR_BASE (10u << 24) // link k joins EMU_ADDR_BASE + 4k + 1 and + 2, a /30 per link
+#define EMU_MAX_LINKS (1 << 22) // links that fit in 10/8 that way
+#define EMU_CHECK_MS 100 // how often each thread checks the routes of its nodes
+#define EMU_MAX_LINE 256
+#define EMU_MAGIC 0x454d5531 // first word of every experiment message
+
+typedef struct {
+	int a; // node on side 1 of the link
+	int b; // node on side 2
+	int itfA; // the link's interface number on a
+	int itfB; // and on b
+	int mtu;
+	bool up;
+} emu_link;
+
+/**
+ * What converged routing looks like for one state of the links: the hop count between every pair
+ * of nodes, and how many link addresses each node should reach. Published whole and never
+ * changed, so the threads checking routes need no lock.
+ */
+typedef struct {
+	u_int32_t gen;
+	vector<int16_t> dist; // dist[a * nodes + b], -1 if b is unreachable from a
+	vector<int> reachable;
+} emu_expect;
+
+typedef struct {
+	int id;
+	int thread;
+	MemLink* link;
+	IPLayer* ipl;
+	u_int32_t okGen; // expectation the routes last matched, 0 while they do not
+	u_int64_t okSince; // ms at which they started to match it
+	u_int64_t delivered; // experiment messages received
+	u_int64_t misdelivered; // received by the wrong node or malformed
+} emu_node;
+
+class Emulator;
+
+typedef void (*emu_task_cb)(void* arg);
+
+typedef struct {
+	emu_task_cb cb;
+	void* arg;
+} emu_task;
+
+typedef struct {
+	emu_node* node;
+	int itfNum;
+	bool up;
+} emu_itf_change;
+
+typedef struct {
+	Emulator* emu;
+	int id;
+	pthread_t thread;
+	EventLoop loop;
+	int wakeFd; // written to run the queued tasks
+	pthread_mutex_t lock; // guards tasks and stopping
+	vector<emu_task> tasks;
+	bool stopping;
+	vector<emu_node*> nodes;
+} emu_thread;
+
+/**
+ * Runs a whole network of nodes inside one process: each node is an IPLayer over a MemLink, and
+ * the nodes are spread over a pool of threads, each running an event loop for its share. The
+ * topology is read from a file or generated from a seed, so experiments can be repeated exactly.
+ * Everything about a node happens on its thread; the caller reaches nodes through tasks queued
+ * to that thread, and learns about routing through expectations the threads check routes
+ * against every EMU_CHECK_MS.
+ */
+class Emulator {
+
+	private:
+		int numNodes;
+		vector<emu_link> links;
+		vector< vector<int> > nodeLinks; // links of each node, in interface order
+		vector<emu_node*> nodes;
+		vector<emu_thread*> threads;
+		MemNetwork* net;
+		int routingMode;
+		emu_expect* expect;
+		u_int64_t eventMs; // when the network started or a link last changed
+		vector<emu_expect*> oldExpects; // freed with the emulator, as checks may still hold them
+		int lineNum;
+
+		int error(const char* fmt, ...);
+		void computeExpect();
+		void checkNode(emu_node* node, const emu_expect* e, u_int64_t now);
+		void post(int thread, emu_task_cb cb, void* arg);
+		static void onCheck(int fd, void* arg);
+		static void onWake(int fd, void* arg);
+		static void onData(int fd, void* arg);
+		static void* runThread(void* arg);
+		static void onInterfaceChange(void* arg);
+
+	public:
+		Emulator(int routingMode = ROUTING_RIP);
+		~Emulator();
+		int loadTopology(const char* fileName);
+		int saveTopology(const char* fileName);
+		void generateTopology(int numNodes, int degree, unsigned seed);
+		int addLink(int a, int b, int mtu = DEFAULT_MTU);
+		int start(int numThreads);
+		void stop();
+		long waitConverged(int timeoutMs);
+		int setLinkUp(int linkNum, bool up);
+		int findChord();
+		int sendMessage(int src, int dst, int len, u_int32_t seq);
+		u_int32_t getNodeAddr(int nodeNum);
+		int getDistance(int a, int b);
+		u_int64_t getDelivered(u_int64_t* misdelivered);
+		void getLinkStats(u_int64_t* packets, u_int64_t* drops);
+		int getNumNodes();
+		int getNumLinks();
+};
+
+#endif
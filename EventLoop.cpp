@@ -0,0 +1,161 @@
+#include <map>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "EventLoop.h"
+
+#define MAX_EVENTS (16)
+
+using namespace std;
+
+EventLoop::EventLoop() {
+	running = false;
+	if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		perror("Epoll creation error:");
+	}
+}
+
+EventLoop::~EventLoop() {
+	for (map<int, event_handler*>::iterator it = handlers.begin(); it != handlers.end(); it++) {
+		if (it->second->isTimer) {
+			close(it->first);
+		}
+		delete it->second;
+	}
+	for (vector<event_handler*>::size_type i = 0; i != retired.size(); i++) {
+		delete retired[i];
+	}
+	close(epollFd);
+}
+
+/**
+ * Registers cb to be called with arg whenever fd becomes readable
+ */
+int EventLoop::addFd(int fd, event_cb cb, void* arg) {
+	struct epoll_event ev;
+	event_handler* handler = new event_handler;
+
+	handler->fd = fd;
+	handler->isTimer = false;
+	handler->cb = cb;
+	handler->arg = arg;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = handler;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		perror("Epoll add error:");
+		delete handler;
+		return -1;
+	}
+
+	handlers[fd] = handler;
+
+	return 0;
+}
+
+/**
+ * Creates a timerfd that fires every intervalMs milliseconds and calls cb with arg on each expiry.
+ * Returns the timer's fd, which can be passed to removeFd.
+ */
+int EventLoop::addTimer(int intervalMs, event_cb cb, void* arg) {
+	int timerFd;
+	struct itimerspec its;
+
+	if ((timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+		perror("Timer creation error:");
+		return -1;
+	}
+
+	its.it_interval.tv_sec = intervalMs / 1000;
+	its.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(timerFd, 0, &its, NULL) == -1) {
+		perror("Timer set error:");
+		close(timerFd);
+		return -1;
+	}
+
+	if (addFd(timerFd, cb, arg) < 0) {
+		close(timerFd);
+		return -1;
+	}
+	handlers[timerFd]->isTimer = true;
+
+	return timerFd;
+}
+
+/**
+ * Unregisters fd. Timers created by addTimer are closed as well.
+ */
+int EventLoop::removeFd(int fd) {
+	map<int, event_handler*>::iterator it = handlers.find(fd);
+
+	if (it == handlers.end()) {
+		return -1;
+	}
+
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+	if (it->second->isTimer) {
+		close(fd);
+	}
+
+	// the handler may still be referenced by events pending in run(), so free it after dispatch
+	it->second->cb = NULL;
+	retired.push_back(it->second);
+	handlers.erase(it);
+
+	return 0;
+}
+
+/**
+ * Dispatches events until stop() is called. Blocks in epoll_wait while idle.
+ */
+void EventLoop::run() {
+	struct epoll_event events[MAX_EVENTS];
+	int n;
+
+	running = true;
+	while (running) {
+		if ((n = epoll_wait(epollFd, events, MAX_EVENTS, -1)) == -1) {
+			if (errno != EINTR) {
+				perror("Epoll wait error:");
+				return;
+			}
+			continue;
+		}
+
+		for (int i = 0; i < n && running; i++) {
+			event_handler* handler = (event_handler*) events[i].data.ptr;
+
+			if (handler->cb == NULL) {
+				continue;
+			}
+
+			if (handler->isTimer) {
+				uint64_t expirations;
+				if (read(handler->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+					continue;
+				}
+			}
+
+			handler->cb(handler->fd, handler->arg);
+		}
+
+		for (vector<event_handler*>::size_type i = 0; i != retired.size(); i++) {
+			delete retired[i];
+		}
+		retired.clear();
+	}
+}
+
+void EventLoop::stop() {
+	running = false;
+}
@@ -0,0 +1,36 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <map>
+#include <vector>
+
+using namespace std;
+
+typedef void (*event_cb)(int fd, void* arg);
+
+typedef struct {
+	int fd;
+	bool isTimer;
+	event_cb cb;
+	void* arg;
+} event_handler;
+
+class EventLoop {
+
+	private:
+		int epollFd;
+		bool running;
+		map<int, event_handler*> handlers;
+		vector<event_handler*> retired;
+
+	public:
+		EventLoop();
+		~EventLoop();
+		int addFd(int fd, event_cb cb, void* arg);
+		int addTimer(int intervalMs, event_cb cb, void* arg);
+		int removeFd(int fd);
+		void run();
+		void stop();
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef FLOWCACHE_H
+#define FLOWCACHE_H
+
+#include <string.h>
+#include <sys/types.h>
+
+#define FLOW_CACHE_SIZE 1024 // entries, must be a power of two
+
+typedef struct {
+	u_int32_t daddr;
+	u_int32_t gen; // route generation the entry was filled under; 0 means empty
+	int nextHop;
+} flow_entry;
+
+/**
+ * Direct-mapped cache of forwarding decisions keyed on destination address, owned by a single
+ * forwarding worker. Entries filled under an older route generation are treated as misses, so
+ * bumping the generation invalidates the whole cache at once.
+ */
+class FlowCache {
+
+	private:
+		flow_entry entries[FLOW_CACHE_SIZE];
+		u_int64_t hits;
+		u_int64_t misses;
+
+		static u_int32_t slot(u_int32_t daddr) {
+			return (daddr * 2654435761u) >> 22 & (FLOW_CACHE_SIZE - 1);
+		}
+
+	public:
+		FlowCache() {
+			memset(entries, 0, sizeof(entries));
+			hits = 0;
+			misses = 0;
+		}
+
+		/**
+		 * Sets *nextHop and returns true if daddr has a decision cached under generation gen
+		 */
+		bool lookup(u_int32_t daddr, u_int32_t gen, int* nextHop) {
+			flow_entry* e = &entries[slot(daddr)];
+
+			if (e->gen == gen && e->daddr == daddr) {
+				*nextHop = e->nextHop;
+				// the worker is the only writer; the atomic store keeps other threads' reads whole
+				__atomic_store_n(&hits, hits + 1, __ATOMIC_RELAXED);
+				return true;
+			}
+
+			__atomic_store_n(&misses, misses + 1, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		/**
+		 * Returns the lookups that hit and missed so far. Safe from any thread.
+		 */
+		u_int64_t getHits() {
+			return __atomic_load_n(&hits, __ATOMIC_RELAXED);
+		}
+
+		u_int64_t getMisses() {
+			return __atomic_load_n(&misses, __ATOMIC_RELAXED);
+		}
+
+		void insert(u_int32_t daddr, u_int32_t gen, int nextHop) {
+			flow_entry* e = &entries[slot(daddr)];
+
+			e->daddr = daddr;
+			e->gen = gen;
+			e->nextHop = nextHop;
+		}
+};
+
+#endif
@@ -0,0 +1,330 @@
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "IPLayer.h"
+#include "LinkLayer.h"
+#include "ipsum.h"
+
+#include "ip.h"
+//#include <netinet/ip.h>
+
+using namespace std;
+
+/*
+ * Microbenchmarks of the forwarding plane: the checksum, header generation, packet validation,
+ * route lookup and packet counting each on their own, then whole bursts of synthetic packets going
+ * from validation through the forwarding decision to transmission over a localhost link. Each
+ * benchmark runs for a fixed time in batches; a batch is timed as a whole, so percentiles are of
+ * the per-packet time within a batch. Results go to stderr, one line of key=value pairs per
+ * benchmark, and may be compared against an earlier run's to catch regressions.
+ */
+
+#define BENCH_BATCH 64 // operations per timed batch
+#define BENCH_PKTS 4096 // distinct packets and addresses cycled through
+#define BENCH_ROUTES 100000
+#define BENCH_MAX_LINE 512
+
+typedef struct {
+	const char* name;
+	vector<double> samples; // ns per operation, one per batch
+	double totalNs;
+	long ops;
+} bench_result;
+
+static volatile int sink; // keeps results the compiler would otherwise drop
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Drives the private fast path of an IPLayer directly. The layer has one interface, to a
+ * localhost port where a second link layer receives and never reads.
+ */
+class FwdBench {
+
+	private:
+		LinkLayer* link;
+		LinkLayer* peer;
+		IPLayer* ipl;
+		vector<u_int32_t> addrs; // destinations covered by the routes, network byte order
+		vector<char> pkts; // BENCH_PKTS valid packets of pktLen bytes, one per address
+		int pktLen;
+		double budgetNs;
+
+		void addSample(bench_result* r, double start, int ops);
+		void makePackets();
+
+	public:
+		FwdBench(int port, int pktLen, double budgetMs, unsigned seed);
+		void ipSum(bench_result* r);
+		void genHeader(bench_result* r);
+		void handleNewPacket(bench_result* r);
+		void getFwdInterface(bench_result* r);
+		void countStats(bench_result* r);
+		void endToEnd(bench_result* r, bool oneFlow);
+};
+
+FwdBench::FwdBench(int port, int pktLen, double budgetMs, unsigned seed) {
+	phy_info phy, peerPhy;
+	itf_info itf;
+	vector<itf_info> itfs;
+	char portStr[16];
+
+	this->pktLen = pktLen;
+	budgetNs = budgetMs * 1e6;
+
+	snprintf(portStr, sizeof(portStr), "%d", port);
+	phy.ipAddr = "127.0.0.1";
+	phy.port = portStr;
+	snprintf(portStr, sizeof(portStr), "%d", port + 1);
+	peerPhy.ipAddr = "127.0.0.1";
+	peerPhy.port = portStr;
+	itf.rmtPhy = peerPhy;
+	itf.locAddr = inet_addr("192.168.0.1");
+	itf.rmtAddr = inet_addr("192.168.0.2");
+	itf.mtu = DEFAULT_MTU;
+	itf.transport = LINK_UDP;
+	itfs.push_back(itf);
+
+	link = new LinkLayer(phy, itfs);
+	peer = new LinkLayer(peerPhy, vector<itf_info>());
+	ipl = new IPLayer(link);
+
+	// prefixes of /8 to /32, most of them /24 as in a real table, all out of interface 0
+	srand(seed);
+	for (int i = 0; i < BENCH_ROUTES; i++) {
+		int len = (rand() % 4 == 0) ? 8 + rand() % 25 : 24;
+		u_int32_t prefix = ((u_int32_t) rand() << 8 ^ rand()) & (len ? ~0u << (32 - len) : 0);
+
+		ipl->addRoute(htonl(prefix), len, 0);
+		if ((int) addrs.size() < BENCH_PKTS) {
+			addrs.push_back(htonl(prefix | ((u_int32_t) rand() & ~(~0u << (32 - len)))));
+		}
+	}
+	makePackets();
+}
+
+/**
+ * Builds a valid packet to each address, from the interface's address
+ */
+void FwdBench::makePackets() {
+	pkts.assign((size_t) BENCH_PKTS * pktLen, 'x');
+	for (int i = 0; i < BENCH_PKTS; i++) {
+		ipl->genHeader((struct iphdr*) &pkts[(size_t) i * pktLen], pktLen - sizeof(struct iphdr),
+				link->getInterfaceAddr(0), addrs[i], DATA_PROTOCOL, i, 0);
+	}
+}
+
+void FwdBench::addSample(bench_result* r, double start, int ops) {
+	double ns = nowNs() - start;
+
+	r->samples.push_back(ns / ops);
+	r->totalNs += ns;
+	r->ops += ops;
+}
+
+/**
+ * Checksums the header of each packet in turn, as a receiver verifying it does
+ */
+void FwdBench::ipSum(bench_result* r) {
+	int k = 0, sum = 0;
+
+	while (r->totalNs < budgetNs) {
+		double start = nowNs();
+		for (int i = 0; i < BENCH_BATCH; i++, k = (k + 1) & (BENCH_PKTS - 1)) {
+			sum += ip_sum(&pkts[(size_t) k * pktLen], sizeof(struct iphdr));
+		}
+		addSample(r, start, BENCH_BATCH);
+	}
+	sink = sum;
+}
+
+void FwdBench::genHeader(bench_result* r) {
+	struct iphdr hdrs[BENCH_BATCH];
+	u_int32_t saddr = link->getInterfaceAddr(0);
+	int k = 0;
+
+	while (r->totalNs < budgetNs) {
+		double start = nowNs();
+		for (int i = 0; i < BENCH_BATCH; i++, k = (k + 1) & (BENCH_PKTS - 1)) {
+			ipl->genHeader(&hdrs[i], pktLen - sizeof(struct iphdr), saddr, addrs[k], DATA_PROTOCOL, k, 0);
+		}
+		addSample(r, start, BENCH_BATCH);
+		sink = hdrs[BENCH_BATCH - 1].check;
+	}
+}
+
+/**
+ * Validates packets and decrements their TTLs. Each batch works on fresh copies, made untimed.
+ */
+void FwdBench::handleNewPacket(bench_result* r) {
+	vector<char> batch((size_t) BENCH_BATCH * pktLen);
+	int k = 0, ok = 0;
+
+	while (r->totalNs < budgetNs) {
+		memcpy(&batch[0], &pkts[(size_t) k * pktLen], batch.size());
+
+		double start = nowNs();
+		for (int i = 0; i < BENCH_BATCH; i++) {
+			ok += ipl->handleNewPacket(&batch[(size_t) i * pktLen], pktLen) == 0;
+		}
+		addSample(r, start, BENCH_BATCH);
+		k = (k + BENCH_BATCH) & (BENCH_PKTS - 1);
+	}
+	sink = ok;
+}
+
+/**
+ * Looks up addresses spread over the whole table, nearly all of them missing the CPU caches
+ */
+void FwdBench::getFwdInterface(bench_result* r) {
+	int k = 0, hops = 0;
+
+	while (r->totalNs < budgetNs) {
+		double start = nowNs();
+		for (int i = 0; i < BENCH_BATCH; i++, k = (k + 1) & (BENCH_PKTS - 1)) {
+			hops += ipl->getFwdInterface(addrs[k]);
+		}
+		addSample(r, start, BENCH_BATCH);
+	}
+	sink = hops;
+}
+
+/**
+ * Counts each packet as the fast path does: received on an interface, then sent out of one
+ */
+void FwdBench::countStats(bench_result* r) {
+	Stats* stats = &ipl->stats;
+
+	while (r->totalNs < budgetNs) {
+		double start = nowNs();
+		u_int64_t* counters = stats->getBlock();
+		for (int i = 0; i < BENCH_BATCH; i++) {
+			stats->countRx(counters, 0, pktLen);
+			stats->countTx(counters, 0, 1, pktLen);
+		}
+		addSample(r, start, BENCH_BATCH);
+	}
+}
+
+/**
+ * Forwards bursts of packets as a worker does once they are received: validation, flow cache and
+ * table lookups, TTL decrement, then one sendmmsg per burst. With oneFlow every packet goes to the
+ * same address, so lookups hit the flow cache; otherwise they cycle over BENCH_PKTS addresses,
+ * more than the cache holds. Filling the burst is not timed.
+ */
+void FwdBench::endToEnd(bench_result* r, bool oneFlow) {
+	fwd_worker* worker = ipl->workers[0];
+	int k = 0;
+
+	while (r->totalNs < budgetNs) {
+		int n = ipl->fillBurst(worker);
+
+		for (int i = 0; i < n; i++, k = (k + 1) & (BENCH_PKTS - 1)) {
+			memcpy(worker->burst.bufs[i], &pkts[oneFlow ? 0 : (size_t) k * pktLen], pktLen);
+			worker->burst.lens[i] = pktLen;
+			worker->burst.itfs[i] = 0;
+		}
+
+		double start = nowNs();
+		ipl->processBurst(worker);
+		addSample(r, start, n);
+	}
+}
+
+static double percentile(vector<double>& sorted, double p) {
+	return sorted[(size_t) (p * (sorted.size() - 1))];
+}
+
+static void report(bench_result* r, int pktLen) {
+	double nsPerPkt = r->totalNs / r->ops;
+
+	sort(r->samples.begin(), r->samples.end());
+	fprintf(stderr, "bench=%s pkt_bytes=%d ops=%ld ns_per_pkt=%.2f pps=%.0f p50_ns=%.2f p90_ns=%.2f p99_ns=%.2f p999_ns=%.2f\n",
+			r->name, pktLen, r->ops, nsPerPkt, 1e9 / nsPerPkt, percentile(r->samples, 0.5),
+			percentile(r->samples, 0.9), percentile(r->samples, 0.99), percentile(r->samples, 0.999));
+}
+
+/**
+ * Compares results with the ns_per_pkt of the same benchmarks in a file of earlier output.
+ * Returns the number more than maxSlowdown percent slower, or -1 if the file cannot be read.
+ */
+static int compareBaseline(const char* fileName, bench_result* results, int count, double maxSlowdown) {
+	char line[BENCH_MAX_LINE];
+	FILE* file;
+	int regressions = 0;
+
+	if ((file = fopen(fileName, "r")) == NULL) {
+		perror("Baseline open error:");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char name[64];
+		const char* ns = strstr(line, " ns_per_pkt=");
+		double baseNs;
+
+		if (sscanf(line, "bench=%63s", name) != 1 || ns == NULL || sscanf(ns, " ns_per_pkt=%lf", &baseNs) != 1) {
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			double curNs = results[i].totalNs / results[i].ops;
+			if (strcmp(results[i].name, name) == 0 && curNs > baseNs * (1 + maxSlowdown / 100)) {
+				fprintf(stderr, "regression bench=%s base_ns_per_pkt=%.2f ns_per_pkt=%.2f slowdown_pct=%.1f\n",
+						name, baseNs, curNs, (curNs / baseNs - 1) * 100);
+				regressions++;
+			}
+		}
+	}
+	fclose(file);
+
+	return regressions;
+}
+
+/* fwdbench [ms per benchmark] [packet bytes] [baseline file] [max slowdown %] [base port] > /dev/null */
+int main(int argc, char** argv) {
+	double budgetMs = (argc > 1) ? atof(argv[1]) : 500;
+	int pktLen = (argc > 2) ? atoi(argv[2]) : 64;
+	const char* baseline = (argc > 3) ? argv[3] : NULL;
+	double maxSlowdown = (argc > 4) ? atof(argv[4]) : 10;
+	int port = (argc > 5) ? atoi(argv[5]) : 19500;
+	bench_result results[7];
+	int numResults = 0;
+
+	if (budgetMs <= 0 || pktLen < (int) sizeof(struct iphdr) || pktLen > DEFAULT_MTU) {
+		fprintf(stderr, "usage: fwdbench [ms per benchmark] [packet bytes, 20 to %d] [baseline file] [max slowdown %%] [base port]\n",
+				DEFAULT_MTU);
+		return 1;
+	}
+
+	FwdBench bench(port, pktLen, budgetMs, 1);
+	const char* names[] = { "ip_sum", "gen_header", "handle_new_packet", "get_fwd_interface", "count_stats",
+			"e2e_one_flow", "e2e_many_flows" };
+	for (int i = 0; i < 7; i++) {
+		results[i].name = names[i];
+		results[i].totalNs = 0;
+		results[i].ops = 0;
+	}
+
+	bench.ipSum(&results[numResults++]);
+	bench.genHeader(&results[numResults++]);
+	bench.handleNewPacket(&results[numResults++]);
+	bench.getFwdInterface(&results[numResults++]);
+	bench.countStats(&results[numResults++]);
+	bench.endToEnd(&results[numResults++], true);
+	bench.endToEnd(&results[numResults++], false);
+
+	fprintf(stderr, "ip_sum_impl=%s\n", ip_sum_name());
+	for (int i = 0; i < numResults; i++) {
+		report(&results[i], pktLen);
+	}
+
+	return (baseline != NULL && compareBaseline(baseline, results, numResults, maxSlowdown) != 0);
+}
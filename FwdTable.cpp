@@ -0,0 +1,325 @@
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "FwdTable.h"
+#include "Log.h"
+
+// table entry layout: valid | extended | 6 bit prefix depth | 24 bit next hop or group index
+#define ENT_VALID 0x80000000u
+#define ENT_EXT 0x40000000u
+#define ENT_DEPTH_SHIFT 24
+#define ENT_DEPTH_MASK 0x3Fu
+#define ENT_DATA_MASK 0x00FFFFFFu
+#define NH_LOCAL ENT_DATA_MASK
+
+#define GROUP_SIZE 256
+#define NUM_LEVELS 3
+
+#define ENT_DEPTH(e) (((e) >> ENT_DEPTH_SHIFT) & ENT_DEPTH_MASK)
+
+using namespace std;
+
+// last address bit covered by each level of the trie, and the number of bits it indexes
+static const int levelEnd[NUM_LEVELS] = {16, 24, 32};
+static const int levelBits[NUM_LEVELS] = {16, 8, 8};
+
+static inline u_int32_t prefixMask(int len) {
+	return (len == 0) ? 0 : (0xFFFFFFFFu << (32 - len));
+}
+
+static inline u_int32_t makeEntry(int depth, int nextHop) {
+	u_int32_t data = (nextHop == FWD_LOCAL) ? NH_LOCAL : ((u_int32_t) nextHop & ENT_DATA_MASK);
+	return ENT_VALID | ((u_int32_t) depth << ENT_DEPTH_SHIFT) | data;
+}
+
+static inline int decodeEntry(u_int32_t e) {
+	if (!(e & ENT_VALID)) {
+		return FWD_NO_ROUTE;
+	}
+	return ((e & ENT_DATA_MASK) == NH_LOCAL) ? FWD_LOCAL : (int) (e & ENT_DATA_MASK);
+}
+
+FwdTable::FwdTable(u_int32_t maxGroups) : tbl16(1 << 16, 0) {
+	this->maxGroups = maxGroups;
+	numGroups = 0;
+	reuseGen = 0;
+
+	// reserve address space for every group now; pages are only backed once touched
+	tbl8 = (u_int32_t*) mmap(NULL, (size_t) maxGroups * GROUP_SIZE * sizeof(u_int32_t),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (tbl8 == MAP_FAILED) {
+		perror("Forwarding table allocation error:");
+		tbl8 = NULL;
+		this->maxGroups = 0;
+	}
+}
+
+FwdTable::~FwdTable() {
+	if (tbl8 != NULL) {
+		munmap(tbl8, (size_t) maxGroups * GROUP_SIZE * sizeof(u_int32_t));
+	}
+}
+
+/**
+ * Returns the index of a free group with every entry set to fill, or ENT_DATA_MASK if none are left
+ */
+u_int32_t FwdTable::allocGroup(u_int32_t fill) {
+	u_int32_t g;
+
+	if (!freeGroups.empty()) {
+		g = freeGroups.front();
+		freeGroups.pop_front();
+
+		// a lookup may still hold a pointer to the group from before it was freed; the bump is
+		// ordered after the delete that unlinked it and before any of the refill below
+		__atomic_store_n(&reuseGen, reuseGen + 1, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	} else if (numGroups < maxGroups) {
+		g = numGroups++;
+	} else {
+		return ENT_DATA_MASK;
+	}
+
+	u_int32_t* group = &tbl8[g * GROUP_SIZE];
+	for (int i = 0; i < GROUP_SIZE; i++) {
+		__atomic_store_n(&group[i], fill, __ATOMIC_RELAXED);
+	}
+
+	return g;
+}
+
+/**
+ * Publishes entry to slot so a concurrent lookup sees either the old or the new value
+ */
+void FwdTable::setEntry(u_int32_t* slot, u_int32_t entry) {
+	__atomic_store_n(slot, entry, __ATOMIC_RELEASE);
+}
+
+/**
+ * Applies an insert or delete of a depth long prefix to one slot the prefix fully covers.
+ * Inserts overwrite entries from equal or shorter prefixes; deletes replace entries of exactly
+ * depth with entry (the next covering route). Extended slots are handled by recursing into
+ * their groups.
+ */
+void FwdTable::fillRange(u_int32_t* slot, int level, int depth, u_int32_t entry, bool remove) {
+	u_int32_t e = *slot;
+
+	if (e & ENT_EXT) {
+		u_int32_t* group = &tbl8[(e & ENT_DATA_MASK) * GROUP_SIZE];
+		for (int i = 0; i < GROUP_SIZE; i++) {
+			fillRange(&group[i], level + 1, depth, entry, remove);
+		}
+		if (remove) {
+			compact(slot);
+		}
+		return;
+	}
+
+	if (remove) {
+		if ((e & ENT_VALID) && (int) ENT_DEPTH(e) == depth) {
+			setEntry(slot, entry);
+		}
+	} else if (!(e & ENT_VALID) || (int) ENT_DEPTH(e) <= depth) {
+		setEntry(slot, entry);
+	}
+}
+
+/**
+ * Inserts or deletes prefix/depth in the level table starting at table. Returns -1 if an insert
+ * needed a group and none was left, in which case the table is as it was.
+ */
+int FwdTable::update(u_int32_t* table, int level, u_int32_t prefix, int depth, u_int32_t entry, bool remove) {
+	int end = levelEnd[level];
+	u_int32_t idx = (prefix >> (32 - end)) & ((1u << levelBits[level]) - 1);
+
+	// the prefix ends in this level: it covers a contiguous run of slots
+	if (depth <= end) {
+		u_int32_t count = 1u << (end - depth);
+		for (u_int32_t i = idx; i < idx + count; i++) {
+			fillRange(&table[i], level, depth, entry, remove);
+		}
+		return 0;
+	}
+
+	// the prefix ends in a deeper level: descend, splitting this slot into a group if needed
+	u_int32_t* slot = &table[idx];
+	if (!(*slot & ENT_EXT)) {
+		if (remove) {
+			return 0;
+		}
+
+		// the new group starts out with whatever route covered the slot
+		u_int32_t g = allocGroup(*slot);
+		if (g == ENT_DATA_MASK) {
+			return -1;
+		}
+		setEntry(slot, ENT_EXT | g);
+	}
+
+	int ret = update(&tbl8[(*slot & ENT_DATA_MASK) * GROUP_SIZE], level + 1, prefix, depth, entry, remove);
+
+	// an insert that failed further down wrote nothing, so a group split off for it is still
+	// uniform and folds back
+	if (remove || ret < 0) {
+		compact(slot);
+	}
+	return ret;
+}
+
+/**
+ * Collapses the group under slot back into a single entry if all of its entries are identical
+ */
+void FwdTable::compact(u_int32_t* slot) {
+	u_int32_t g = *slot & ENT_DATA_MASK;
+	u_int32_t* group = &tbl8[g * GROUP_SIZE];
+
+	if (group[0] & ENT_EXT) {
+		return;
+	}
+	for (int i = 1; i < GROUP_SIZE; i++) {
+		if (group[i] != group[0]) {
+			return;
+		}
+	}
+
+	setEntry(slot, group[0]);
+	freeGroups.push_back(g);
+}
+
+/**
+ * Finds the longest rule strictly shorter than len that covers prefix. Returns false if none does.
+ */
+bool FwdTable::findCovering(u_int32_t prefix, int len, u_int32_t* entry) {
+	for (int l = len - 1; l >= 0; l--) {
+		map<u_int64_t, int>::iterator it = rules.find(((u_int64_t) l << 32) | (prefix & prefixMask(l)));
+		if (it != rules.end()) {
+			*entry = makeEntry(l, it->second);
+			return true;
+		}
+	}
+
+	*entry = 0;
+	return false;
+}
+
+/**
+ * Adds or replaces the route for prefix/len (host byte order). nextHop is an interface number
+ * or FWD_LOCAL. Returns -1 if the route is invalid or the table has no room for it.
+ */
+int FwdTable::addRoute(u_int32_t prefix, int len, int nextHop) {
+	if (len < 0 || len > 32 || nextHop < FWD_LOCAL || nextHop >= (int) NH_LOCAL) {
+		return -1;
+	}
+
+	prefix &= prefixMask(len);
+	if (update(&tbl16[0], 0, prefix, len, makeEntry(len, nextHop), false) < 0) {
+		LOG_WARN("Forwarding table full (%u groups), refusing route %u.%u.%u.%u/%d", maxGroups,
+				prefix >> 24, (prefix >> 16) & 0xFF, (prefix >> 8) & 0xFF, prefix & 0xFF, len);
+		return -1;
+	}
+	rules[((u_int64_t) len << 32) | prefix] = nextHop;
+
+	return 0;
+}
+
+/**
+ * Removes the route for prefix/len, handing its addresses back to the next covering route
+ */
+int FwdTable::removeRoute(u_int32_t prefix, int len) {
+	u_int32_t replacement;
+
+	if (len < 0 || len > 32) {
+		return -1;
+	}
+
+	prefix &= prefixMask(len);
+	map<u_int64_t, int>::iterator it = rules.find(((u_int64_t) len << 32) | prefix);
+	if (it == rules.end()) {
+		return -1;
+	}
+	rules.erase(it);
+
+	findCovering(prefix, len, &replacement);
+	update(&tbl16[0], 0, prefix, len, replacement, true);
+
+	return 0;
+}
+
+/**
+ * Returns the table entry for addr (host byte order)
+ */
+inline u_int32_t FwdTable::walk(u_int32_t addr) {
+	u_int32_t e = __atomic_load_n(&tbl16[addr >> 16], __ATOMIC_ACQUIRE);
+
+	if (e & ENT_EXT) {
+		e = __atomic_load_n(&tbl8[((e & ENT_DATA_MASK) << 8) | ((addr >> 8) & 0xFF)], __ATOMIC_ACQUIRE);
+		if (e & ENT_EXT) {
+			e = __atomic_load_n(&tbl8[((e & ENT_DATA_MASK) << 8) | (addr & 0xFF)], __ATOMIC_ACQUIRE);
+		}
+	}
+
+	return e;
+}
+
+/**
+ * Returns the interface to forward addr (host byte order) on, FWD_LOCAL or FWD_NO_ROUTE
+ */
+int FwdTable::lookup(u_int32_t addr) {
+	u_int32_t gen, e;
+
+	do {
+		gen = __atomic_load_n(&reuseGen, __ATOMIC_ACQUIRE);
+		e = walk(addr);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&reuseGen, __ATOMIC_RELAXED) != gen);
+
+	return decodeEntry(e);
+}
+
+/**
+ * Looks up count addresses at once. The first level is read for every address before any
+ * group is, so the cache misses of a burst overlap instead of running back to back.
+ */
+void FwdTable::lookupBatch(const u_int32_t* addrs, int* nextHops, int count) {
+	u_int32_t entries[count];
+	u_int32_t gen;
+
+	do {
+		gen = __atomic_load_n(&reuseGen, __ATOMIC_ACQUIRE);
+		for (int i = 0; i < count; i++) {
+			entries[i] = __atomic_load_n(&tbl16[addrs[i] >> 16], __ATOMIC_ACQUIRE);
+			if (entries[i] & ENT_EXT) {
+				__builtin_prefetch(&tbl8[((entries[i] & ENT_DATA_MASK) << 8) | ((addrs[i] >> 8) & 0xFF)]);
+			}
+		}
+
+		for (int i = 0; i < count; i++) {
+			u_int32_t e = entries[i];
+			if (e & ENT_EXT) {
+				e = __atomic_load_n(&tbl8[((e & ENT_DATA_MASK) << 8) | ((addrs[i] >> 8) & 0xFF)], __ATOMIC_ACQUIRE);
+				if (e & ENT_EXT) {
+					e = __atomic_load_n(&tbl8[((e & ENT_DATA_MASK) << 8) | (addrs[i] & 0xFF)], __ATOMIC_ACQUIRE);
+				}
+			}
+			nextHops[i] = decodeEntry(e);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&reuseGen, __ATOMIC_RELAXED) != gen);
+}
+
+int FwdTable::numRoutes() {
+	return rules.size();
+}
+
+/**
+ * Returns the bytes held by the lookup structures (first level plus groups in use)
+ */
+size_t FwdTable::memoryUsage() {
+	return tbl16.size() * sizeof(u_int32_t)
+		+ (size_t) (numGroups - freeGroups.size()) * GROUP_SIZE * sizeof(u_int32_t);
+}
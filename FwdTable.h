@@ -0,0 +1,61 @@
+#ifndef FWDTABLE_H
+#define FWDTABLE_H
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <sys/types.h>
+
+using namespace std;
+
+#define FWD_LOCAL (-1) // destination is one of this node's addresses
+#define FWD_NO_ROUTE (-2) // no route covers the destination
+// 256 entry groups for prefixes longer than /16. A /16 with longer prefixes in it takes a group,
+// as does each /24 with prefixes longer than /24, so 2^18 hold a million routes of /24 or shorter
+// but only some 200k host routes scattered over distinct /24s; routes past the cap are refused.
+// Only the groups in use are backed by memory.
+#define DEFAULT_MAX_GROUPS (1 << 18)
+
+/**
+ * Longest-prefix-match forwarding table laid out as a three level multibit trie (DIR-16-8-8).
+ * The first 16 bits of an address index a flat 64K entry table; longer prefixes hang 256 entry
+ * groups off it for bits 16-23 and 24-31. A lookup is at most three dependent loads no matter
+ * how many routes are installed.
+ *
+ * Lookups may run concurrently with a single writer. Entries are published with release stores
+ * after the groups they point to are filled in; a reader racing with a delete may briefly see
+ * the route that was just removed. Groups freed by deletes are reused oldest first, and reusing
+ * one bumps reuseGen before it is refilled: a lookup that sees the generation change under it
+ * may have followed a stale pointer into the group, and starts over.
+ */
+class FwdTable {
+
+	private:
+		vector<u_int32_t> tbl16;
+		u_int32_t* tbl8; // reserved up front so groups never move under concurrent readers
+		u_int32_t maxGroups;
+		u_int32_t numGroups;
+		deque<u_int32_t> freeGroups; // oldest first
+		u_int32_t reuseGen; // bumped each time a freed group is handed out again
+		map<u_int64_t, int> rules; // (length << 32 | prefix) -> next hop
+
+		u_int32_t allocGroup(u_int32_t fill);
+		void setEntry(u_int32_t* slot, u_int32_t entry);
+		void fillRange(u_int32_t* slot, int level, int depth, u_int32_t entry, bool remove);
+		int update(u_int32_t* table, int level, u_int32_t prefix, int depth, u_int32_t entry, bool remove);
+		bool findCovering(u_int32_t prefix, int len, u_int32_t* entry);
+		void compact(u_int32_t* slot);
+		u_int32_t walk(u_int32_t addr);
+
+	public:
+		FwdTable(u_int32_t maxGroups = DEFAULT_MAX_GROUPS);
+		~FwdTable();
+		int addRoute(u_int32_t prefix, int len, int nextHop);
+		int removeRoute(u_int32_t prefix, int len);
+		int lookup(u_int32_t addr);
+		void lookupBatch(const u_int32_t* addrs, int* nextHops, int count);
+		int numRoutes();
+		size_t memoryUsage();
+};
+
+#endif
@@ -1,5 +1,4 @@
 #include <vector>
-#include <queue>
 #include <map>
 #include <pthread.h>
 #include <stdio.h>
@@ -10,227 +9,1220 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <netdb.h>
+#include <stddef.h>
 
 #include "LinkLayer.h"
 #include "constants.h"
 #include "ipsum.h"
+#include "Log.h"
 
 #include "ip.h"
 //#include <netinet/ip.h>
 
 #include "IPLayer.h"
+#include "EventLoop.h"
+#include "FwdTable.h"
+#include "Rip.h"
+#include "LinkState.h"
 
-#define MAX_MSG_LEN (512)
 #define HDR_SIZE sizeof(struct iphdr)
+#define FWD_INVALID (-3) // next hop of a received packet that failed validation
 
 using namespace std;
 
-IPLayer::IPLayer(LinkLayer* link) {
+/**
+ * Returns how many buffers of bufSize bytes the packet pool may grow to
+ */
+static int poolSize(int bufSize) {
+	return (PKT_POOL_BYTES / bufSize < PKT_POOL_SIZE) ? PKT_POOL_BYTES / bufSize : PKT_POOL_SIZE;
+}
+
+/**
+ * Packet buffers are sized to the largest MTU of any interface, so every datagram a neighbor may
+ * send fits in one
+ */
+IPLayer::IPLayer(LinkLayer* link, int numWorkers, int routingMode) : pktPool(link->getMaxMtu(), poolSize(link->getMaxMtu())),
+		txRing(TX_QUEUE_LEN), ctlRing(RCV_QUEUE_LEN), stats(link->getNumInterfaces()) {
 	linkLayer = link;
+	routeGen = 1;
+	nextRcvRing = 0;
+	nextId = 0;
+
+	// each forwarding worker owns a receive socket and its packet buffers. worker 0 uses the
+	// link layer's primary socket; the others join its port through SO_REUSEPORT, which the link
+	// layer must have been created for. A worker without a socket would only spin on errors.
+	if (numWorkers < 1) {
+		numWorkers = 1;
+	}
+	for (int i = 0; i < numWorkers; i++) {
+		fwd_worker* worker = new fwd_worker;
+
+		worker->id = i;
+		worker->rcvRing = new SpscRing(RCV_QUEUE_LEN);
+		worker->reasm = new Reassembler();
+		worker->rcvSocket = (i == 0) ? linkLayer->getRcvSocket() : linkLayer->openRcvSocket();
+		if (worker->rcvSocket < 0) {
+			fprintf(stderr, "No receive socket for forwarding worker %d\n", i);
+			exit(1);
+		}
+		worker->burst.count = 0;
+		worker->burst.bufLen = pktPool.getDataSize();
+		worker->poolBackoffUs = POOL_BACKOFF_MIN_US;
+		for (int j = 0; j < BURST_SIZE; j++) {
+			worker->pkts[j] = NULL;
+		}
+
+		workers.push_back(worker);
+	}
+
+	if (routingMode == ROUTING_LINK_STATE) {
+		routing = new LinkState(&timers, onRoutingSend, onRoutingRoute, this);
+	} else {
+		routing = new Rip(&timers, onRoutingSend, onRoutingRoute, this);
+	}
+	routingProtocol = routing->getProtocol();
+
+	// our own addresses are delivered locally; neighbors are found by the routing protocol
+	for (int i = 0; i < linkLayer->getNumInterfaces(); i++) {
+		routing->addInterface(linkLayer->getInterfaceAddr(i), linkLayer->getRemoteAddr(i));
+	}
+}
+
+/**
+ * Frees the workers and the routing engine. Forwarding threads cannot be stopped, so only a layer
+ * with a single worker, polled by an event loop that has stopped, may be destroyed.
+ */
+IPLayer::~IPLayer() {
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size(); i++) {
+		delete workers[i]->reasm;
+		delete workers[i]->rcvRing;
+		delete workers[i];
+	}
+	delete routing;
+}
+
+/**
+ * Registers the routing timers with loop. With a single forwarding worker the receive socket is
+ * polled by loop as well; with several, each worker gets a thread of its own.
+ */
+void IPLayer::registerEvents(EventLoop* loop) {
+	if (workers.size() == 1) {
+		loop->addFd(workers[0]->rcvSocket, onPacketsReady, workers[0]);
+		workers[0]->pkg.ipl = this;
+	} else {
+		startWorkers();
+	}
+	// the wheel keeps its timerfd armed for the next routing timer only, so an idle node sleeps
+	loop->addFd(timers.getEventFd(), onTimersReady, this);
+
+	// packets the application sends are transmitted from the loop
+	loop->addFd(txRing.getEventFd(), onTransmitReady, this);
+	txRing.prepareWait();
+
+	// routing runs on the loop too, so the routing table has a single writer
+	loop->addFd(ctlRing.getEventFd(), onControlReady, this);
+	ctlRing.prepareWait();
+	routing->start();
+}
+
+void IPLayer::onTransmitReady(int fd, void* arg) {
+	((IPLayer*) arg)->flushTransmit();
+}
+
+/**
+ * Sends everything queued on the transmit ring, one batch per egress interface, then goes back
+ * to waiting for the ring's eventfd
+ */
+void IPLayer::flushTransmit() {
+	pkt_buf* pkts[BURST_SIZE];
+	char* bufs[BURST_SIZE];
+	int lens[BURST_SIZE];
+	int n;
+	u_int64_t* counters = stats.getBlock();
+
+	txRing.clearWakeup();
+	do {
+		while ((n = txRing.dequeueBurst((void**) pkts, BURST_SIZE)) > 0) {
+			for (int i = 0; i < n; i++) {
+				int itfNum = pkts[i]->itfNum;
+				int m = 0;
+
+				if (itfNum < 0) {
+					continue;
+				}
+
+				// gather the remaining packets headed out the same interface
+				for (int j = i; j < n; j++) {
+					if (pkts[j]->itfNum == itfNum) {
+						bufs[m] = PacketPool::data(pkts[j]);
+						lens[m] = pkts[j]->len;
+						pkts[j]->itfNum = -1;
+						m++;
+					}
+				}
+
+				countSent(counters, itfNum, linkLayer->sendBatch(bufs, lens, m, itfNum), lens, m);
+			}
+
+			for (int i = 0; i < n; i++) {
+				pktPool.release(pkts[i]);
+			}
+		}
+	} while (!txRing.prepareWait());
+}
+
+/**
+ * Spawns one forwarding thread per worker
+ */
+void IPLayer::startWorkers() {
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size(); i++) {
+		fwd_worker* worker = workers[i];
+
+		worker->pkg.ipl = this;
+		worker->pkg.toRun = "forwarding";
+		worker->pkg.workerId = worker->id;
 
-	// create thread to handle forwarding tasks
-	pthread_t* fwdWorker;
-	ipl_thread_pkg* pkg = new ipl_thread_pkg;
-	pkg->ipl = this;
-	pkg->toRun = "forwarding";
-	int err = 0;
-	//int err = pthread_create(fwdWorker, NULL, runThread, this);
-	if(err != 0) {
+		int err = pthread_create(&worker->thread, NULL, runThread, &worker->pkg);
+		if(err != 0) {
 			perror("Threading error:");
+		}
 	}
 }
 
-static void IPLayer::runThread(ipl_thread_pkg pkg) {
-	IPLayer ipl = pkg.ipl;
-	string toRun = pkg.toRun;
+void IPLayer::onPacketsReady(int fd, void* arg) {
+	fwd_worker* worker = (fwd_worker*) arg;
+	worker->pkg.ipl->pollForwarding(worker);
+}
+
+void IPLayer::onTimersReady(int fd, void* arg) {
+	((IPLayer*) arg)->timers.run();
+}
+
+void* IPLayer::runThread(void* arg) {
+	ipl_thread_pkg* pkg = (ipl_thread_pkg*) arg;
+	IPLayer* ipl = pkg->ipl;
+	string toRun = pkg->toRun;
 
 	if (toRun == "forwarding") {
-		ipl->runForwarding();
+		ipl->runForwarding(pkg->workerId);
 	} else if (toRun == "routing") {
 		ipl->runRouting();
 	}
+
+	return NULL;
 }
 
-void IPLayer::runForwarding() {
-	int rcvLen;
-	char buf[MAX_MSG_LEN];
+/**
+ * Blocking forwarding loop for one worker, for running the forwarding plane on threads of its own
+ */
+void IPLayer::runForwarding(int workerId) {
+	fwd_worker* worker = workers[workerId];
 
 	while(1) {
-		// get packet
-		rcvLen = linkLayer->listen(buf, MAX_MSG_LEN);
-		if (rcvLen < 0) {
-			printf("IP Layer receive error.");
+		// get up to BURST_SIZE packets, once there are buffers to get them into
+		if (fillBurst(worker) == 0) {
+			continue;
+		}
+		if (linkLayer->listenBatch(worker->rcvSocket, worker->burst, true) < 0) {
+			LOG_WARN("IP layer receive error");
 			continue;
 		} else {
-			printf("IP packet received.");
+			LOG_DEBUG("%d IP packets received", worker->burst.count);
+		}
+
+		processBurst(worker);
+	}
+}
+
+/**
+ * Drains a worker's receive socket without blocking. Called by the event loop when packets are
+ * ready; gives up after MAX_POLL_BURSTS bursts so the CLI and timers are not starved under load.
+ */
+void IPLayer::pollForwarding(fwd_worker* worker) {
+	for (int i = 0; i < MAX_POLL_BURSTS; i++) {
+		if (fillBurst(worker) == 0 || linkLayer->listenBatch(worker->rcvSocket, worker->burst, false) <= 0) {
+			return;
+		}
+
+		processBurst(worker);
+
+		if (worker->burst.count < BURST_SIZE) {
+			return;
+		}
+	}
+}
+
+/**
+ * Gives every empty slot of a worker's burst a buffer from the pool and points the burst at them.
+ * Buffers stay in their slots across bursts, so only packets handed off elsewhere are replaced.
+ * Returns the number of buffers the burst can receive into. If that is none, the pool is
+ * exhausted: the worker sleeps before returning, twice as long each time in a row up to
+ * POOL_BACKOFF_MAX_US, so it gives the buffers' holders time to release them instead of spinning
+ * on a socket it cannot read.
+ */
+int IPLayer::fillBurst(fwd_worker* worker) {
+	int n = 0;
+
+	for (int i = 0; i < BURST_SIZE; i++) {
+		if (worker->pkts[i] == NULL && (worker->pkts[i] = pktPool.alloc()) == NULL) {
+			continue;
+		}
+
+		// keep filled slots contiguous at the front of the burst
+		pkt_buf* pkt = worker->pkts[i];
+		worker->pkts[i] = worker->pkts[n];
+		worker->pkts[n] = pkt;
+		pkt->offset = PKT_HEADROOM;
+		worker->burst.bufs[n] = PacketPool::data(pkt);
+		n++;
+	}
+
+	if (n == 0) {
+		LOG_WARN("Packet pool exhausted, worker %d waits %d us", worker->id, worker->poolBackoffUs);
+		usleep(worker->poolBackoffUs);
+		worker->poolBackoffUs = (worker->poolBackoffUs * 2 < POOL_BACKOFF_MAX_US) ? worker->poolBackoffUs * 2 : POOL_BACKOFF_MAX_US;
+	} else {
+		worker->poolBackoffUs = POOL_BACKOFF_MIN_US;
+	}
+	worker->burst.count = n;
+
+	return n;
+}
+
+/**
+ * Handles every packet in a worker's burst and sends out the ones to be forwarded
+ */
+void IPLayer::processBurst(fwd_worker* worker) {
+	packet_burst& burst = worker->burst;
+	int nextHops[BURST_SIZE];
+	int fwdItfs[BURST_SIZE];
+	u_int32_t daddrs[BURST_SIZE];
+	int idx[BURST_SIZE];
+	pkt_buf* local[BURST_SIZE];
+	int n = 0, noRoute = 0, numLocal = 0;
+	u_int64_t now = 0;
+	u_int64_t* counters = stats.getBlock();
+
+	// load the generation before any lookup, so decisions cached below are never newer than it
+	u_int32_t gen = __atomic_load_n(&routeGen, __ATOMIC_ACQUIRE);
+
+	// validate every packet and try the flow cache; misses are resolved in one batch lookup
+	for (int i = 0; i < burst.count; i++) {
+		nextHops[i] = FWD_INVALID;
+		fwdItfs[i] = -1;
+		stats.countRx(counters, burst.itfs[i], burst.lens[i]);
+		if (handleNewPacket(burst.bufs[i], burst.lens[i]) < 0) {
+			continue;
+		}
+
+		u_int32_t daddr = parseHeader(burst.bufs[i])->daddr;
+		if (!worker->flowCache.lookup(daddr, gen, &nextHops[i])) {
+			daddrs[n] = ntohl(daddr);
+			idx[n] = i;
+			n++;
 		}
+	}
+
+	if (n > 0) {
+		int missHops[BURST_SIZE];
+		fwdTable.lookupBatch(daddrs, missHops, n);
+
+		for (int j = 0; j < n; j++) {
+			// routes out of an interface that is down are treated as missing
+			if (missHops[j] >= 0 && !linkLayer->isInterfaceUp(missHops[j])) {
+				missHops[j] = FWD_NO_ROUTE;
+			}
+			nextHops[idx[j]] = missHops[j];
+			noRoute += missHops[j] == FWD_NO_ROUTE;
+			worker->flowCache.insert(htonl(daddrs[j]), gen, missHops[j]);
+		}
+		stats.countLookups(counters, n, noRoute);
+	}
 
-		//TODO spawn new thread here
-		handleNewPacket(buf, rcvLen);
+	for (int i = 0; i < burst.count; i++) {
+		if (nextHops[i] == FWD_LOCAL && Reassembler::isFragment(parseHeader(burst.bufs[i]))) {
+			// fragments are copied out, so their buffers stay in the burst
+			if (now == 0) {
+				now = TimerWheel::nowMs();
+			}
+			pkt_buf* whole = worker->reasm->add(burst.bufs[i], burst.lens[i], now);
+			if (whole != NULL) {
+				local[numLocal++] = whole;
+			}
+		} else if (nextHops[i] == FWD_LOCAL) {
+			// the buffer moves to the receive queue; fillBurst replaces it before the next burst
+			worker->pkts[i]->len = burst.lens[i];
+			local[numLocal++] = worker->pkts[i];
+			worker->pkts[i] = NULL;
+		} else if (nextHops[i] >= 0 && burst.lens[i] > linkLayer->getMtu(nextHops[i])) {
+			forwardFragmented(burst.bufs[i], burst.lens[i], nextHops[i]);
+		} else if (nextHops[i] >= 0) {
+			fwdItfs[i] = nextHops[i];
+		} else if (nextHops[i] == FWD_NO_ROUTE) {
+			stats.countDrop(counters, DROP_NO_ROUTE);
+		}
+	}
 
-		memset(buf, 0, sizeof(buf));
+	if (numLocal > 0) {
+		deliverLocal(worker, local, numLocal);
 	}
+	flushForwarded(burst, fwdItfs);
 }
 
+/**
+ * Sends every packet in burst that has a forwarding interface, one batch per egress interface
+ */
+void IPLayer::flushForwarded(packet_burst& burst, int* fwdItfs) {
+	char* pkts[BURST_SIZE];
+	int lens[BURST_SIZE];
+	u_int64_t* counters = stats.getBlock();
+
+	for (int i = 0; i < burst.count; i++) {
+		int itfNum = fwdItfs[i];
+		int n = 0;
+
+		if (itfNum < 0) {
+			continue;
+		}
+
+		// gather the remaining packets headed out the same interface
+		for (int j = i; j < burst.count; j++) {
+			if (fwdItfs[j] == itfNum) {
+				pkts[n] = burst.bufs[j];
+				lens[n] = burst.lens[j];
+				fwdItfs[j] = -1;
+				n++;
+			}
+		}
+
+		countSent(counters, itfNum, linkLayer->sendBatch(pkts, lens, n, itfNum), lens, n);
+	}
+}
+
+/**
+ * Counts the first sent of count packets of the given lengths as transmitted out of itfNum, and
+ * the rest as refused by the link layer. sent may be -1, for none.
+ */
+void IPLayer::countSent(u_int64_t* counters, int itfNum, int sent, const int* lens, int count) {
+	u_int64_t bytes = 0;
+
+	if (sent < 0) {
+		sent = 0;
+	}
+	for (int i = 0; i < sent; i++) {
+		bytes += lens[i];
+	}
+	if (sent > 0) {
+		stats.countTx(counters, itfNum, sent, bytes);
+	}
+	if (sent < count) {
+		stats.countDrop(counters, DROP_LINK, count - sent);
+	}
+}
+
+/**
+ * Forwards a packet too big for the egress interface's MTU as fragments of it. The packet may
+ * itself be a fragment, in which case its pieces keep their place in the original datagram.
+ */
+void IPLayer::forwardFragmented(char* packet, int len, int itfNum) {
+	struct iphdr* hdr = parseHeader(packet);
+	int hdrLen = hdr->ihl * 4;
+	struct iovec frag;
+
+	// without ICMP there is no telling the source; the packet is just dropped
+	if (ntohs(hdr->frag_off) & IP_DF) {
+		LOG_DEBUG("Packet too big for interface %d and may not be fragmented, discarding", itfNum);
+		stats.countDrop(DROP_TOO_BIG);
+		return;
+	}
+
+	frag.iov_base = packet + hdrLen;
+	frag.iov_len = len - hdrLen;
+	sendFragments(itfNum, hdr, &frag, 1, len - hdrLen);
+}
+
+/**
+ * Sends the periodic routing update to every neighbor
+ */
 void IPLayer::runRouting() {
+	routing->sendPeriodic();
+}
+
+void IPLayer::onControlReady(int fd, void* arg) {
+	((IPLayer*) arg)->handleControl();
+}
+
+/**
+ * Feeds every queued routing packet to the routing engine, then sends one triggered update
+ * covering all the routes they changed
+ */
+void IPLayer::handleControl() {
+	pkt_buf* pkts[BURST_SIZE];
+	int n;
+
+	ctlRing.clearWakeup();
+	do {
+		while ((n = ctlRing.dequeueBurst((void**) pkts, BURST_SIZE)) > 0) {
+			for (int i = 0; i < n; i++) {
+				struct iphdr* hdr = parseHeader(PacketPool::data(pkts[i]));
+				int hdrLen = hdr->ihl * 4;
+
+				routing->handlePacket(hdr->saddr, PacketPool::data(pkts[i]) + hdrLen, ntohs(hdr->tot_len) - hdrLen);
+				pkts[i]->pool->release(pkts[i]);
+			}
+		}
+	} while (!ctlRing.prepareWait());
+
+	routing->sendTriggered();
 }
 
-void IPLayer::handleNewPacket(char* packet, int len) {
-	int fwdItf;
-	int checksum;
+void IPLayer::onRoutingSend(int itfNum, const char* msg, int len, void* arg) {
+	IPLayer* ipl = (IPLayer*) arg;
+	struct iovec frag;
+
+	frag.iov_base = (void*) msg;
+	frag.iov_len = len;
+	ipl->sendOnInterface(itfNum, ipl->linkLayer->getRemoteAddr(itfNum), ipl->routingProtocol, &frag, 1);
+}
+
+void IPLayer::onRoutingRoute(u_int32_t dest, int itfNum, void* arg) {
+	IPLayer* ipl = (IPLayer*) arg;
+
+	if (itfNum == FWD_NO_ROUTE) {
+		ipl->removeRoute(dest, 32);
+	} else {
+		ipl->addRoute(dest, 32, itfNum);
+	}
+}
+
+const RouteTable& IPLayer::getRoutes() {
+	return routing->getRoutes();
+}
+
+/**
+ * Validates a received packet and decrements its TTL. Returns 0 if the packet should be
+ * delivered or forwarded, or -1 if it was dropped.
+ */
+int IPLayer::handleNewPacket(char* packet, int len) {
 	struct iphdr* hdr;
 
 	// parse header
-	hdr = (struct iphdr*) &packet; //TODO might want to deal with network ordering issues
+	hdr = parseHeader(packet);
 
 	// check to make sure receive length equals header total length
-	if (hdr->tot_len != len) {
-		printf("Partial packet recieved, discarding.");
-		return;
+	if (len < (int) HDR_SIZE || ntohs(hdr->tot_len) != len || hdr->ihl * 4 < (int) HDR_SIZE || hdr->ihl * 4 > len) {
+		LOG_DEBUG("Partial packet received, discarding");
+		stats.countDrop(DROP_MALFORMED);
+		return -1;
 	}
 
-	// verfiy checksum
-	if (hdr->check != ip_sum(packet, sizeof(struct iphdr))) {
-		printf("Invalid checksum, discarding packet.");
-		return;
+	// verfiy checksum: summing a header that includes a correct checksum gives zero
+	if (ip_sum(packet, hdr->ihl * 4) != 0) {
+		LOG_DEBUG("Invalid checksum, discarding packet");
+		stats.countDrop(DROP_CHECKSUM);
+		return -1;
 	}
 
 	// decrement ttl or return if zero
 	if (hdr->ttl == 0) {
-		printf("TTL = 0, discarding packet.");
-		return;
-	} else { // decrement ttl and recalculate checksum
-		hdr->ttl--;
-		hdr->check = ip_sum(packet, sizeof(struct iphdr));
+		LOG_DEBUG("TTL = 0, discarding packet");
+		stats.countDrop(DROP_TTL);
+		return -1;
+	} else { // decrement ttl and patch the checksum
+		decrementTTL(packet);
 	}
 
-	// forward or deliver locally
-	if ((fwdItf = getFwdInterface(hdr->daddr)) == -1) {
-		deliverLocal(packet);
-	} else {
-		linkLayer->send(packet, hdr->tot_len, fwdItf);
+	return 0;
+}
+
+/**
+ * Decrements the TTL of a packet with a verified header, updating its checksum incrementally
+ */
+void IPLayer::decrementTTL(char* packet) {
+	struct iphdr* hdr = parseHeader(packet);
+	u_int8_t ttl = hdr->ttl - 1;
+
+	// ttl shares its 16-bit checksum word with protocol
+	setHeaderBytes(packet, offsetof(struct iphdr, ttl), &ttl, 1);
+}
+
+/**
+ * Overwrites len bytes of the header at offset with data and patches the header checksum with
+ * RFC 1624 arithmetic, one 16-bit word at a time, instead of re-summing the whole header
+ */
+void IPLayer::setHeaderBytes(char* packet, int offset, const void* data, int len) {
+	struct iphdr* hdr = parseHeader(packet);
+	int first = offset & ~1;
+	int end = (offset + len + 1) & ~1;
+	u_int16_t check = hdr->check;
+
+	for (int i = first; i < end; i += 2) {
+		u_int16_t oldWord, newWord;
+		memcpy(&oldWord, packet + i, 2);
+		newWord = oldWord;
+		for (int b = i; b < i + 2; b++) {
+			if (b >= offset && b < offset + len) {
+				((u_int8_t*) &newWord)[b - i] = ((const u_int8_t*) data)[b - offset];
+			}
+		}
+		memcpy(packet + i, &newWord, 2);
+		check = ip_sum_update(check, oldWord, newWord);
 	}
 
+	hdr->check = check;
 }
 
 struct iphdr* IPLayer::parseHeader(char* packet) {
-	struct iphdr* hdr = (struct iphdr*) &packet;
+	struct iphdr* hdr = (struct iphdr*) packet;
 	return hdr;
 }
 
 /**
- * Returns the next string in the receive buffer
+ * Takes the next delivered packet off the workers' receive rings, visiting the rings round-robin.
+ * The payload is read in place from the packet buffer; hand it back with releaseData once done.
+ * Returns false if nothing is queued. Application thread only.
+ */
+bool IPLayer::getData(rcv_data* data) {
+	pkt_buf* pkt = NULL;
+
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size() && pkt == NULL; i++) {
+		fwd_worker* worker = workers[nextRcvRing];
+		nextRcvRing = (nextRcvRing + 1) % workers.size();
+		worker->rcvRing->dequeueBurst((void**) &pkt, 1);
+	}
+	if (pkt == NULL) {
+		return false;
+	}
+
+	struct iphdr* hdr = parseHeader(PacketPool::data(pkt));
+	data->pkt = pkt;
+	data->data = PacketPool::data(pkt) + (hdr->ihl * 4);
+	data->len = ntohs(hdr->tot_len) - (hdr->ihl * 4);
+	data->saddr = hdr->saddr;
+	data->protocol = hdr->protocol;
+
+	return true;
+}
+
+/**
+ * Returns the buffer behind data to its packet pool
  */
-string IPLayer::getData() {
-	string data = rcvQueue.front();
-	rcvQueue.pop();
-	return data;
+void IPLayer::releaseData(rcv_data* data) {
+	data->pkt->pool->release(data->pkt);
+	data->pkt = NULL;
+	data->data = NULL;
 }
 
 /**
  * Return true if the IP layer has buffered data
  */
 bool IPLayer::hasData() {
-	return (rcvQueue.size() > 0);
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size(); i++) {
+		if (workers[i]->rcvRing->getCount() > 0) {
+			return true;
+		}
+	}
+	return false;
 }
 
 /**
- * Copies packet data into receive queue and makes it available for retreival by the application layer
+ * Registers cb with loop to be called when delivered packets are waiting. cb should drain them
+ * with getData and then call armDataReady.
  */
-void IPLayer::deliverLocal(char* packet) {
-	struct iphdr* hdr = (struct iphdr*) &packet;
+void IPLayer::registerDataReady(EventLoop* loop, event_cb cb, void* arg) {
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size(); i++) {
+		loop->addFd(workers[i]->rcvRing->getEventFd(), cb, arg);
+	}
+	armDataReady();
+}
 
-	// computer data length
-	int dataLen = hdr->tot_len - (hdr->ihl * 4);
+/**
+ * Re-arms the data ready wakeup. Returns false if packets arrived in the meantime, in which case
+ * the caller should drain again before going back to the loop.
+ */
+bool IPLayer::armDataReady() {
+	bool armed = true;
 
-	// copy data into string
-	string data (packet, HDR_SIZE, dataLen);
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size(); i++) {
+		workers[i]->rcvRing->clearWakeup();
+		if (!workers[i]->rcvRing->prepareWait()) {
+			armed = false;
+		}
+	}
 
-	// add data buffer to data vector
-	rcvQueue.push(data);
+	return armed;
 }
 
 /**
- * Encapsulates data in IP header and sends via link layer
+ * Hands a burst's count packet buffers addressed to us, and the references to them, to the
+ * worker's receive ring for retrieval by the application layer, in one enqueue. The payloads are
+ * not copied and no lock is taken. Routing packets go to the event loop instead, also in one
+ * enqueue. Buffers may be from a reassembler's pool rather than the IP layer's.
  */
-int IPLayer::send(char* data, int dataLen, char* destIP) {
-	int bytesSent, itfNum;
-	u_int32_t daddr, saddr;
-	struct iphdr* hdr;
+void IPLayer::deliverLocal(fwd_worker* worker, pkt_buf** pkts, int count) {
+	pkt_buf* data[BURST_SIZE];
+	pkt_buf* ctl[BURST_SIZE];
+	int numData = 0, numCtl = 0, n;
 
-	// initialize buffer to store new packet
-	int packetLen = dataLen + sizeof(struct iphdr);
-	char packet[packetLen];
+	for (int i = 0; i < count; i++) {
+		if (parseHeader(PacketPool::data(pkts[i]))->protocol == routingProtocol) {
+			ctl[numCtl++] = pkts[i];
+		} else {
+			data[numData++] = pkts[i];
+		}
+	}
 
-	// convert destination ip in dots-and-number form to network order int form
-	daddr = inet_addr(destIP);
+	if (numCtl > 0 && (n = ctlRing.enqueueBurst((void**) ctl, numCtl)) < numCtl) {
+		LOG_DEBUG("Routing queue full, discarding %d packets", numCtl - n);
+		stats.countDrop(DROP_CTL_QUEUE, numCtl - n);
+		for (int i = n; i < numCtl; i++) {
+			ctl[i]->pool->release(ctl[i]);
+		}
+	}
+
+	// drop if the app is not keeping up rather than letting the ring drain the packet pool
+	if (numData > 0 && (n = worker->rcvRing->enqueueBurst((void**) data, numData)) < numData) {
+		LOG_DEBUG("Receive queue full, discarding %d packets", numData - n);
+		stats.countDrop(DROP_RCV_QUEUE, numData - n);
+		for (int i = n; i < numData; i++) {
+			data[i]->pool->release(data[i]);
+		}
+	}
+}
+
+/**
+ * Resolves the interface and source address for a dataLen byte payload to daddr.
+ * Returns the interface number, or -1 if the packet cannot be sent.
+ */
+int IPLayer::routeSend(int dataLen, u_int32_t daddr, u_int32_t* saddr) {
+	int itfNum;
+
+	if (dataLen < 0 || dataLen > IP_MAXPACKET - (int) HDR_SIZE) {
+		LOG_WARN("Message too long (%d bytes). Aborting send.", dataLen);
+		return -1;
+	}
 
 	// get forwarding interface
-	if ((itfNum = getFwdInterface(daddr)) < 0) {
-		printf("Source address belongs to host. Aborting send.");
+	if ((itfNum = getFwdInterface(daddr)) >= 0 && !linkLayer->isInterfaceUp(itfNum)) {
+		itfNum = FWD_NO_ROUTE;
+	}
+	stats.countLookups(stats.getBlock(), 1, itfNum == FWD_NO_ROUTE);
+	if (itfNum == FWD_LOCAL) {
+		LOG_WARN("Source address belongs to host. Aborting send.");
+		return -1;
+	} else if (itfNum == FWD_NO_ROUTE) {
+		struct in_addr dest;
+		dest.s_addr = daddr;
+		LOG_WARN("No route to %s. Aborting send.", inet_ntoa(dest));
+		return -1;
+	}
+
+	// get local IP address associated with interface
+	*saddr = linkLayer->getInterfaceAddr(itfNum);
+
+	return itfNum;
+}
+
+/**
+ * Sums the lengths of numFrags payload fragments. Returns -1 if there are too many fragments.
+ */
+static int fragsLen(const struct iovec* frags, int numFrags) {
+	int dataLen = 0;
+
+	if (numFrags < 0 || numFrags > MAX_SEND_FRAGS) {
+		LOG_WARN("Too many payload fragments (%d). Aborting send.", numFrags);
 		return -1;
 	}
+	for (int i = 0; i < numFrags; i++) {
+		dataLen += frags[i].iov_len;
+	}
+
+	return dataLen;
+}
+
+/**
+ * Position within a caller's payload fragments, as it is cut into IP fragments
+ */
+typedef struct {
+	const struct iovec* frags;
+	int idx;
+	size_t pos;
+} frag_cursor;
+
+/**
+ * Points out at the next len payload bytes of cur, which are spread over at most MAX_SEND_FRAGS
+ * of the caller's fragments, and moves cur past them. Returns the number of iovecs filled.
+ */
+static int sliceFrags(frag_cursor* cur, int len, struct iovec* out) {
+	int n = 0;
+
+	while (len > 0) {
+		size_t take = cur->frags[cur->idx].iov_len - cur->pos;
+		if (take > (size_t) len) {
+			take = len;
+		}
+		if (take > 0) {
+			out[n].iov_base = (char*) cur->frags[cur->idx].iov_base + cur->pos;
+			out[n].iov_len = take;
+			n++;
+		}
 
-	// get local IP address associated with interface in network order int form
-	saddr = inet_addr(linkLayer->getInterfaceAddr(itfNum));
+		len -= take;
+		cur->pos += take;
+		if (cur->pos == cur->frags[cur->idx].iov_len) {
+			cur->idx++;
+			cur->pos = 0;
+		}
+	}
 
-	// generate new IP header
-	hdr = genHeader(dataLen, saddr, daddr);
+	return n;
+}
 
-	// copy header to packet buffer
-	memcpy(&packet[0], hdr, sizeof(struct iphdr));
+/**
+ * Encapsulates data in IP header and sends it to daddr (network byte order) via the link layer
+ */
+int IPLayer::send(char* data, int dataLen, u_int32_t daddr) {
+	struct iovec frag;
 
-	// copy data to packet buffer
-	memcpy(&packet[sizeof(struct iphdr)], data, dataLen);
+	frag.iov_base = data;
+	frag.iov_len = dataLen;
+	return send(&frag, 1, daddr);
+}
 
-	// send packet via link layer
-	if((bytesSent = linkLayer->send(packet, packetLen, itfNum)) < 0) {
-		printf("Sending error.");
+/**
+ * Encapsulates the concatenation of numFrags payload fragments in an IP header and sends it
+ * via the link layer, in IP fragments if it does not fit the interface's MTU. The headers and
+ * payload go to the kernel as vectors, so the payload is never copied. Returns the number of
+ * bytes sent, headers included.
+ */
+int IPLayer::send(const struct iovec* frags, int numFrags, u_int32_t daddr) {
+	int dataLen, itfNum;
+	u_int32_t saddr;
+
+	if ((dataLen = fragsLen(frags, numFrags)) < 0) {
 		return -1;
-	} else {
-		printf("IP packet length = %d\n Sent %d bytes", packetLen, bytesSent);
 	}
+	if ((itfNum = routeSend(dataLen, daddr, &saddr)) < 0) {
+		return -1;
+	}
+
+	return sendOnInterface(itfNum, daddr, DATA_PROTOCOL, frags, numFrags);
+}
+
+/**
+ * Sends the concatenation of numFrags payload fragments to daddr straight out of itfNum,
+ * from that interface's address, fragmenting it to the interface's MTU. Returns the number of
+ * bytes sent, headers included.
+ */
+int IPLayer::sendOnInterface(int itfNum, u_int32_t daddr, u_int8_t protocol, const struct iovec* frags, int numFrags) {
+	int dataLen;
+	struct iphdr hdr;
+
+	if ((dataLen = fragsLen(frags, numFrags)) < 0) {
+		return -1;
+	}
+
+	genHeader(&hdr, dataLen, linkLayer->getInterfaceAddr(itfNum), daddr, protocol,
+			__atomic_fetch_add(&nextId, 1, __ATOMIC_RELAXED), 0);
+
+	return sendFragments(itfNum, &hdr, frags, numFrags, dataLen);
+}
+
+/**
+ * Sends the dataLen byte payload held in numFrags fragments out of itfNum behind copies of hdr,
+ * cut to the interface's MTU. hdr's fragment offset and more fragments flag are carried over, so
+ * a fragment can be fragmented further; its options are not. Returns the number of bytes sent,
+ * headers included.
+ */
+int IPLayer::sendFragments(int itfNum, const struct iphdr* hdr, const struct iovec* frags, int numFrags, int dataLen) {
+	int maxFrag, off = 0, bytesSent = 0;
+	u_int16_t fragOff = ntohs(hdr->frag_off);
+	int base = (fragOff & IP_OFFMASK) * 8;
+	frag_cursor cur;
+	struct iphdr hdrs[BURST_SIZE];
+	struct iovec iov[BURST_SIZE * (MAX_SEND_FRAGS + 1)];
+	int iovCounts[BURST_SIZE];
+	int lens[BURST_SIZE];
+	u_int64_t* counters = stats.getBlock();
+
+	// it fits: the header goes in front of the caller's fragments as it is
+	if (hdr->ihl * 4 == (int) HDR_SIZE && (int) HDR_SIZE + dataLen <= linkLayer->getMtu(itfNum)) {
+		iov[0].iov_base = (void*) hdr;
+		iov[0].iov_len = HDR_SIZE;
+		memcpy(&iov[1], frags, numFrags * sizeof(struct iovec));
+		lens[0] = HDR_SIZE + dataLen;
+		int ret = linkLayer->sendv(iov, numFrags + 1, itfNum);
+		countSent(counters, itfNum, (ret >= 0) ? 1 : 0, lens, 1);
+		return ret;
+	}
+
+	// fragment offsets are counted in 8 byte units, so all but the last fragment are cut to them
+	maxFrag = (linkLayer->getMtu(itfNum) - HDR_SIZE) & ~7;
+	cur.frags = frags;
+	cur.idx = 0;
+	cur.pos = 0;
+
+	do {
+		int n = 0, m = 0;
+
+		// each fragment's header goes in front of its slice of the caller's fragments
+		do {
+			int len = (dataLen - off < maxFrag) ? dataLen - off : maxFrag;
+			u_int16_t more = (off + len < dataLen) ? IP_MF : (fragOff & IP_MF);
+
+			hdrs[n] = *hdr;
+			hdrs[n].ihl = 5;
+			hdrs[n].tot_len = htons(HDR_SIZE + len);
+			hdrs[n].frag_off = htons(more | ((base + off) / 8));
+			hdrs[n].check = 0;
+			hdrs[n].check = ip_sum((char*) &hdrs[n], HDR_SIZE);
+
+			iov[m].iov_base = &hdrs[n];
+			iov[m].iov_len = HDR_SIZE;
+			iovCounts[n] = 1 + sliceFrags(&cur, len, &iov[m + 1]);
+			lens[n] = HDR_SIZE + len;
+			m += iovCounts[n];
+			bytesSent += HDR_SIZE + len;
+			off += len;
+			n++;
+		} while (n < BURST_SIZE && off < dataLen);
+
+		int sent = linkLayer->sendvBatch(iov, iovCounts, n, itfNum);
+		countSent(counters, itfNum, sent, lens, n);
+		if (sent < n) {
+			return -1;
+		}
+	} while (off < dataLen);
 
 	return bytesSent;
 }
 
 /**
- * Returns pointer to newly populated IP header
+ * Gathers numFrags payload fragments into pool buffers behind new IP headers, fragmenting them
+ * to the interface's MTU, and queues them for transmission by the event loop, which sends queued
+ * packets in bursts. The fragments may be reused as soon as this returns. Safe to call from any
+ * thread. Returns the number of bytes queued, headers included.
  */
-struct iphdr* IPLayer::genHeader(int dataLen, u_int32_t saddr, u_int32_t daddr) {
-	struct iphdr* hdr = new struct iphdr;
+int IPLayer::queueSend(const struct iovec* frags, int numFrags, u_int32_t daddr) {
+	int dataLen, maxFrag, itfNum, off = 0, bytesQueued = 0;
+	u_int32_t saddr;
+	u_int16_t id;
+	frag_cursor cur;
+	pkt_buf* pkts[BURST_SIZE];
+	struct iovec slices[MAX_SEND_FRAGS];
+
+	if ((dataLen = fragsLen(frags, numFrags)) < 0) {
+		return -1;
+	}
+	if ((itfNum = routeSend(dataLen, daddr, &saddr)) < 0) {
+		return -1;
+	}
+
+	maxFrag = linkLayer->getMtu(itfNum);
+	if (maxFrag > pktPool.getDataSize()) {
+		maxFrag = pktPool.getDataSize();
+	}
+	maxFrag = (maxFrag - HDR_SIZE) & ~7;
+	id = __atomic_fetch_add(&nextId, 1, __ATOMIC_RELAXED);
+	cur.frags = frags;
+	cur.idx = 0;
+	cur.pos = 0;
 
+	do {
+		int n = 0, queued;
+
+		do {
+			int len = (dataLen - off < maxFrag) ? dataLen - off : maxFrag;
+			u_int16_t more = (off + len < dataLen) ? IP_MF : 0;
+			pkt_buf* pkt;
+
+			// get a packet buffer from the pool
+			if ((pkt = pktPool.alloc()) == NULL) {
+				LOG_WARN("Packet pool exhausted. Aborting send.");
+				stats.countDrop(DROP_NO_BUFS, n + 1);
+				while (n > 0) {
+					pktPool.release(pkts[--n]);
+				}
+				return -1;
+			}
+
+			// copy this fragment's share of the data to the packet buffer
+			char* data = PacketPool::data(pkt);
+			int numSlices = sliceFrags(&cur, len, slices);
+			for (int i = 0; i < numSlices; i++) {
+				memcpy(data, slices[i].iov_base, slices[i].iov_len);
+				data += slices[i].iov_len;
+			}
+			pkt->len = len;
+
+			// generate new IP header in the headroom in front of the data
+			genHeader((struct iphdr*) PacketPool::prepend(pkt, HDR_SIZE), len, saddr, daddr, DATA_PROTOCOL, id, more | (off / 8));
+			pkt->itfNum = itfNum;
+			bytesQueued += pkt->len;
+			off += len;
+			pkts[n++] = pkt;
+		} while (n < BURST_SIZE && off < dataLen);
+
+		// queue packets for the transmit path; the buffers' references go with them
+		if ((queued = txRing.enqueueBurst((void**) pkts, n)) < n) {
+			LOG_WARN("Transmit queue full. Aborting send.");
+			stats.countDrop(DROP_TX_QUEUE, n - queued);
+			while (n > queued) {
+				pktPool.release(pkts[--n]);
+			}
+			return -1;
+		}
+	} while (off < dataLen);
+
+	return bytesQueued;
+}
+
+/**
+ * Populates the IP header at hdr. fragOff holds the fragment flags and offset, host byte order.
+ */
+void IPLayer::genHeader(struct iphdr* hdr, int dataLen, u_int32_t saddr, u_int32_t daddr, u_int8_t protocol,
+		u_int16_t id, u_int16_t fragOff) {
 	// pack header
 	hdr->version = 4; // IP version 4
 	hdr->ihl = 5; // no options
 	hdr->tos = 0; // no TOS protocol
-	hdr->tot_len = (hdr->ihl * 4) + dataLen; // header length (in bytes) + data length
-	hdr->id = 0; // fragmentation not supported
-	hdr->frag_off = 0; // fragmentation not supported
+	hdr->tot_len = htons((hdr->ihl * 4) + dataLen); // header length (in bytes) + data length, network order
+	hdr->id = htons(id); // shared by the fragments of one datagram
+	hdr->frag_off = htons(fragOff);
 	hdr->ttl = MAX_TTL; // maximum TTL
-	hdr->protocol = 143; // custom protocol (raw string data)
+	hdr->protocol = protocol;
 	hdr->check = 0; // checksum is zero for calculation
 	hdr->saddr = saddr; // source address in network byte order
 	hdr->daddr = daddr; // destination address in network byte order
 
 	// calculate checksum
 	hdr->check = ip_sum((char*) hdr, sizeof(struct iphdr));
-
-	return hdr;
 }
 
 /**
- * Gets the interface number to use for forwarding the given IP address.
- * Returns -1 if the address matches one of the interface addresses.
+ * Gets the interface number to use for forwarding the given IP address (network byte order).
+ * Returns FWD_LOCAL if the address matches one of the interface addresses and FWD_NO_ROUTE if
+ * no route covers it.
  */
 int IPLayer::getFwdInterface(u_int32_t daddr) {
-	// check if network number is equal to the destination of any of the interfaces
+	return fwdTable.lookup(ntohl(daddr));
+}
 
-	// check if network num is in forwarding table
-	int itfNum = fwdTable[daddr];
+/**
+ * Installs a route for prefix/len (network byte order) out of interface itfNum, or FWD_LOCAL
+ */
+int IPLayer::addRoute(u_int32_t prefix, int len, int itfNum) {
+	int ret = fwdTable.addRoute(ntohl(prefix), len, itfNum);
+	invalidateFlows();
+	return ret;
+}
 
-	// return default interface if no matches found
+/**
+ * Installs every route in routes in the forwarding table. Static routes are not handed to the
+ * routing protocol, so they are not advertised, and a host route the protocol learns replaces
+ * a static one for the same address. Returns the number of routes that could not be installed.
+ */
+int IPLayer::addStaticRoutes(const RouteTable& routes) {
+	int failed = 0;
 
-	return itfNum;
+	for (int i = 0; i < routes.size(); i++) {
+		const route_entry* route = routes.at(i);
+		if (fwdTable.addRoute(ntohl(route->prefix), route->len, routeItf(route)) < 0) {
+			failed++;
+		}
+	}
+	invalidateFlows();
+
+	return failed;
+}
+
+int IPLayer::removeRoute(u_int32_t prefix, int len) {
+	int ret = fwdTable.removeRoute(ntohl(prefix), len);
+	invalidateFlows();
+	return ret;
+}
+
+/**
+ * Brings an interface up or down. Packets routed out of a down interface are dropped.
+ */
+int IPLayer::setInterfaceUp(int itfNum, bool up) {
+	if (linkLayer->setInterfaceUp(itfNum, up) < 0) {
+		return -1;
+	}
+	invalidateFlows();
+
+	// withdraw or restore the routes through the interface and tell the other neighbors
+	routing->setInterfaceUp(itfNum, up);
+	routing->sendTriggered();
+	return 0;
 }
 
+/**
+ * Invalidates every worker's flow cache. Must be called after the change it covers is visible.
+ */
+void IPLayer::invalidateFlows() {
+	__atomic_add_fetch(&routeGen, 1, __ATOMIC_RELEASE);
+}
+
+PacketPool* IPLayer::getPacketPool() {
+	return &pktPool;
+}
+
+/**
+ * Sums the flow cache hit and miss counters over all forwarding workers
+ */
+void IPLayer::getFlowCacheStats(u_int64_t* hits, u_int64_t* misses) {
+	*hits = 0;
+	*misses = 0;
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size(); i++) {
+		*hits += workers[i]->flowCache.getHits();
+		*misses += workers[i]->flowCache.getMisses();
+	}
+}
+
+/**
+ * Reads every counter of the layer into snap: the per thread packet counters, summed, and the
+ * forwarding workers' flow cache and reassembly counters
+ */
+void IPLayer::getStats(stats_snapshot* snap) {
+	stats.read(snap);
+	getFlowCacheStats(&snap->flowHits, &snap->flowMisses);
+	for (vector<fwd_worker*>::size_type i = 0; i != workers.size(); i++) {
+		snap->drops[DROP_REASM_TIMEOUT] += workers[i]->reasm->getTimedOut();
+		snap->drops[DROP_REASM_EVICTED] += workers[i]->reasm->getEvicted();
+		snap->drops[DROP_REASM_BAD] += workers[i]->reasm->getDiscarded();
+	}
+}
+
+#ifdef IPLAYER_MAIN
+#include <time.h>
+#include <sched.h>
+
+/*
+ * Streams messages between two nodes over a localhost link, once per MTU, and reports the
+ * goodput. The receiver runs on an event loop thread of its own; the sender keeps at most
+ * BENCH_WINDOW bytes in flight so the receive socket does not overflow.
+ */
+
+#define BENCH_WINDOW (2 << 20)
+#define BENCH_STALL_NS 20000000 // a message not delivered within this is counted lost
+
+typedef struct {
+	IPLayer* ipl;
+	u_int64_t msgs;
+	u_int64_t bytes;
+} bench_rcv;
+
+static void onBenchData(int fd, void* arg) {
+	bench_rcv* rcv = (bench_rcv*) arg;
+	rcv_data data;
+
+	do {
+		while (rcv->ipl->getData(&data)) {
+			__atomic_add_fetch(&rcv->bytes, data.len, __ATOMIC_RELEASE);
+			__atomic_add_fetch(&rcv->msgs, 1, __ATOMIC_RELEASE);
+			rcv->ipl->releaseData(&data);
+		}
+	} while (!rcv->ipl->armDataReady());
+}
+
+static void* runBenchLoop(void* arg) {
+	((EventLoop*) arg)->run();
+	return NULL;
+}
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static LinkLayer* benchLink(int port, int rmtPort, const char* loc, const char* rmt, int mtu) {
+	phy_info phy;
+	itf_info itf;
+	vector<itf_info> itfs;
+	char portStr[16];
+
+	snprintf(portStr, sizeof(portStr), "%d", port);
+	phy.ipAddr = "127.0.0.1";
+	phy.port = portStr;
+	snprintf(portStr, sizeof(portStr), "%d", rmtPort);
+	itf.rmtPhy.ipAddr = "127.0.0.1";
+	itf.rmtPhy.port = portStr;
+	itf.locAddr = inet_addr(loc);
+	itf.rmtAddr = inet_addr(rmt);
+	itf.mtu = mtu;
+	itf.transport = LINK_UDP;
+	itfs.push_back(itf);
+
+	return new LinkLayer(phy, itfs);
+}
+
+/* mtubench [MB per MTU] [message bytes, 0 for one full packet] [base port] > /dev/null */
+int main(int argc, char** argv) {
+	static const int mtus[] = { 512, 1400, 1500, 4000, 9000, 16000, 32000, 65000 };
+	double total = ((argc > 1) ? atof(argv[1]) : 128) * (1 << 20);
+	int fixedLen = (argc > 2) ? atoi(argv[2]) : 0;
+	int port = (argc > 3) ? atoi(argv[3]) : 19000;
+	vector<char> buf(IP_MAXPACKET, 'x');
+
+	for (unsigned k = 0; k < sizeof(mtus) / sizeof(mtus[0]); k++) {
+		int mtu = mtus[k];
+		int msgLen = fixedLen ? fixedLen : mtu - (int) HDR_SIZE;
+		LinkLayer* sendLink = benchLink(port, port + 1, "10.0.0.1", "10.0.0.2", mtu);
+		LinkLayer* rcvLink = benchLink(port + 1, port, "10.0.0.2", "10.0.0.1", mtu);
+		IPLayer* sender = new IPLayer(sendLink);
+		EventLoop* loop = new EventLoop();
+		bench_rcv* rcv = new bench_rcv;
+		pthread_t thread;
+		u_int64_t sentMsgs = 0, sentBytes = 0, lost = 0;
+		double start, end, waitStart;
+
+		rcv->ipl = new IPLayer(rcvLink);
+		rcv->msgs = 0;
+		rcv->bytes = 0;
+		rcv->ipl->registerEvents(loop);
+		rcv->ipl->registerDataReady(loop, onBenchData, rcv);
+		pthread_create(&thread, NULL, runBenchLoop, loop);
+		port += 2;
+
+		start = nowNs();
+		while (sentBytes < total) {
+			// wait for the window to open; whatever has not arrived by the deadline is lost
+			waitStart = 0;
+			while (sentBytes - __atomic_load_n(&rcv->bytes, __ATOMIC_ACQUIRE) - lost * msgLen > BENCH_WINDOW) {
+				if (waitStart == 0) {
+					waitStart = nowNs();
+				} else if (nowNs() - waitStart > BENCH_STALL_NS) {
+					lost = sentMsgs - __atomic_load_n(&rcv->msgs, __ATOMIC_ACQUIRE);
+					break;
+				}
+				sched_yield();
+			}
+
+			if (sender->send(&buf[0], msgLen, inet_addr("10.0.0.2")) < 0) {
+				fprintf(stderr, "send failed at mtu %d\n", mtu);
+				return 1;
+			}
+			sentMsgs++;
+			sentBytes += msgLen;
+		}
+		waitStart = nowNs();
+		while (__atomic_load_n(&rcv->msgs, __ATOMIC_ACQUIRE) < sentMsgs && nowNs() - waitStart < BENCH_STALL_NS) {
+			sched_yield();
+		}
+		end = nowNs();
+
+		u_int64_t rcvdMsgs = __atomic_load_n(&rcv->msgs, __ATOMIC_ACQUIRE);
+		u_int64_t rcvdBytes = __atomic_load_n(&rcv->bytes, __ATOMIC_ACQUIRE);
+		double secs = (end - start) / 1e9;
+		fprintf(stderr, "mtu=%d msg_bytes=%d msgs=%llu rcvd_msgs=%llu lost_msgs=%llu secs=%.3f msgs_per_s=%.0f gbit_per_s=%.3f ns_per_byte=%.3f\n",
+				mtu, msgLen, (unsigned long long) sentMsgs, (unsigned long long) rcvdMsgs,
+				(unsigned long long) (sentMsgs - rcvdMsgs), secs, rcvdMsgs / secs, rcvdBytes * 8 / secs / 1e9,
+				rcvdBytes ? (end - start) / rcvdBytes : 0);
+		// the receiver's loop thread is left to idle; its node is never torn down
+	}
+
+	return 0;
+}
+#endif
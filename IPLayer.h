@@ -3,40 +3,122 @@
 
 #include <map>
 #include <vector>
-#include <queue>
 #include <string>
+#include <pthread.h>
 
 #include "constants.h"
 #include "LinkLayer.h"
+#include "EventLoop.h"
+#include "FwdTable.h"
+#include "FlowCache.h"
+#include "PacketPool.h"
+#include "Ring.h"
+#include "RoutingProtocol.h"
+#include "TimerWheel.h"
+#include "Reassembly.h"
+#include "Stats.h"
 
 #include "ip.h"
 //#include <netinet/ip.h>
 
+#define DATA_PROTOCOL 143 // custom protocol (raw string data)
+
+#define ROUTING_RIP 0 // distance vector
+#define ROUTING_LINK_STATE 1
+
+typedef struct {
+	pkt_buf* pkt; // buffer holding the whole packet; handed back with releaseData
+	const char* data; // payload, read-only
+	int len; // payload length
+	u_int32_t saddr; // source address, network byte order
+	u_int8_t protocol;
+} rcv_data;
+
+typedef struct {
+	int id;
+	int rcvSocket;
+	pthread_t thread;
+	ipl_thread_pkg pkg;
+	FlowCache flowCache;
+	Reassembler* reasm; // fragments addressed to us
+	SpscRing* rcvRing; // packets delivered to the application
+	packet_burst burst;
+	pkt_buf* pkts[BURST_SIZE]; // pool buffers backing burst.bufs
+	int poolBackoffUs; // next wait for buffers while the pool stays exhausted
+} fwd_worker;
+
 class IPLayer {
 
+	// drives the private fast path directly, see FwdBench.cpp
+	friend class FwdBench;
+
 	private:
-		map<u_int32_t, route_entry> routingTable;
-		map<u_int32_t, int> fwdTable;
-		vector<char*> myAddreses;
-		queue<string> rcvQueue;
+		FwdTable fwdTable;
+		u_int32_t routeGen; // bumped on every route or link state change
 		LinkLayer* linkLayer;
+		PacketPool pktPool;
+		vector<fwd_worker*> workers;
+		MpscRing txRing; // packets from queueSend, drained by the event loop
+		MpscRing ctlRing; // routing protocol packets, handled by the event loop
+		Stats stats;
+		TimerWheel timers; // routing timers, run by the event loop
+		RoutingProtocol* routing;
+		u_int8_t routingProtocol; // IP protocol number of routing's messages
+		int nextRcvRing;
+		u_int16_t nextId; // IP identification of the next datagram sent
 
 		int getFwdInterface(u_int32_t daddr);
-		void handleNewPacket(char* packet, int len);
+		int routeSend(int dataLen, u_int32_t daddr, u_int32_t* saddr);
+		int sendOnInterface(int itfNum, u_int32_t daddr, u_int8_t protocol, const struct iovec* frags, int numFrags);
+		int sendFragments(int itfNum, const struct iphdr* hdr, const struct iovec* frags, int numFrags, int dataLen);
+		void forwardFragmented(char* packet, int len, int itfNum);
+		int handleNewPacket(char* packet, int len);
+		void processBurst(fwd_worker* worker);
+		void invalidateFlows();
+		void flushForwarded(packet_burst& burst, int* fwdItfs);
+		void countSent(u_int64_t* counters, int itfNum, int sent, const int* lens, int count);
+		void pollForwarding(fwd_worker* worker);
+		int fillBurst(fwd_worker* worker);
+		void startWorkers();
+		static void onPacketsReady(int fd, void* arg);
+		static void onTimersReady(int fd, void* arg);
 		struct iphdr* parseHeader(char* packet);
 		void decrementTTL(char* packet);
-		void deliverLocal(char* packet);
-		struct iphdr* genHeader(int dataLen, u_int32_t saddr, u_int32_t daddr);
-		static void runThread(ipl_thread_pkg pkg);
+		void setHeaderBytes(char* packet, int offset, const void* data, int len);
+		void deliverLocal(fwd_worker* worker, pkt_buf** pkts, int count);
+		void flushTransmit();
+		static void onTransmitReady(int fd, void* arg);
+		void handleControl();
+		static void onControlReady(int fd, void* arg);
+		static void onRoutingSend(int itfNum, const char* msg, int len, void* arg);
+		static void onRoutingRoute(u_int32_t dest, int itfNum, void* arg);
+		void genHeader(struct iphdr* hdr, int dataLen, u_int32_t saddr, u_int32_t daddr, u_int8_t protocol,
+				u_int16_t id, u_int16_t fragOff);
+		static void* runThread(void* arg);
 
 	public:
-		IPLayer(LinkLayer* linkLayer);
-		int send(char* data, int dataLen, char* destIP);
+		IPLayer(LinkLayer* linkLayer, int numWorkers = 1, int routingMode = ROUTING_RIP);
+		~IPLayer();
+		int send(char* data, int dataLen, u_int32_t daddr);
+		int send(const struct iovec* frags, int numFrags, u_int32_t daddr);
+		int queueSend(const struct iovec* frags, int numFrags, u_int32_t daddr);
 		int receive(char* buf, int bufLen);
 		bool hasData();
-		string getData();
-		void runForwarding();
+		bool getData(rcv_data* data);
+		void releaseData(rcv_data* data);
+		void registerDataReady(EventLoop* loop, event_cb cb, void* arg);
+		bool armDataReady();
+		void runForwarding(int workerId = 0);
 		void runRouting();
+		void registerEvents(EventLoop* loop);
+		int addRoute(u_int32_t prefix, int len, int itfNum);
+		int removeRoute(u_int32_t prefix, int len);
+		int addStaticRoutes(const RouteTable& routes);
+		int setInterfaceUp(int itfNum, bool up);
+		const RouteTable& getRoutes();
+		void getFlowCacheStats(u_int64_t* hits, u_int64_t* misses);
+		void getStats(stats_snapshot* snap);
+		PacketPool* getPacketPool();
 };
 
 #endif
@@ -0,0 +1,446 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "IoUring.h"
+#include "Ring.h"
+#include "Log.h"
+
+IoUring::IoUring() {
+	ringFd = -1;
+	sqMap = MAP_FAILED;
+	cqMap = MAP_FAILED;
+	sqes = (struct io_uring_sqe*) MAP_FAILED;
+	sqMapLen = cqMapLen = sqesLen = 0;
+	sqPending = 0;
+}
+
+IoUring::~IoUring() {
+	if (sqes != MAP_FAILED) {
+		munmap(sqes, sqesLen);
+	}
+	if (cqMap != MAP_FAILED && cqMap != sqMap) {
+		munmap(cqMap, cqMapLen);
+	}
+	if (sqMap != MAP_FAILED) {
+		munmap(sqMap, sqMapLen);
+	}
+	if (ringFd >= 0) {
+		close(ringFd);
+	}
+}
+
+/**
+ * Creates the ring with sqEntries submission slots and, if cqEntries is not 0, that many
+ * completion slots, and maps its shared parts. Returns false if the kernel has no io_uring or
+ * will not let us use it.
+ */
+bool IoUring::setup(u_int32_t sqEntries, u_int32_t cqEntries) {
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	if (cqEntries > 0) {
+		p.flags |= IORING_SETUP_CQSIZE;
+		p.cq_entries = cqEntries;
+	}
+	if ((ringFd = syscall(__NR_io_uring_setup, sqEntries, &p)) < 0) {
+		ringFd = -1;
+		return false;
+	}
+
+	sqMapLen = p.sq_off.array + p.sq_entries * sizeof(u_int32_t);
+	cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		sqMapLen = cqMapLen = (sqMapLen > cqMapLen) ? sqMapLen : cqMapLen;
+	}
+	if ((sqMap = mmap(NULL, sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		return false;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cqMap = sqMap;
+	} else if ((cqMap = mmap(NULL, cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		return false;
+	}
+	sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+	if ((sqes = (struct io_uring_sqe*) mmap(NULL, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES)) == MAP_FAILED) {
+		return false;
+	}
+
+	sqHead = (u_int32_t*) ((char*) sqMap + p.sq_off.head);
+	sqTail = (u_int32_t*) ((char*) sqMap + p.sq_off.tail);
+	sqMask = (u_int32_t*) ((char*) sqMap + p.sq_off.ring_mask);
+	sqArray = (u_int32_t*) ((char*) sqMap + p.sq_off.array);
+	sqFlags = (u_int32_t*) ((char*) sqMap + p.sq_off.flags);
+	cqHead = (u_int32_t*) ((char*) cqMap + p.cq_off.head);
+	cqTail = (u_int32_t*) ((char*) cqMap + p.cq_off.tail);
+	cqMask = (u_int32_t*) ((char*) cqMap + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe*) ((char*) cqMap + p.cq_off.cqes);
+
+	return true;
+}
+
+/**
+ * Returns a zeroed submission slot, queued for the next enter(), or NULL if all are queued
+ */
+struct io_uring_sqe* IoUring::getSqe() {
+	u_int32_t tail = *sqTail + sqPending;
+
+	if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > *sqMask) {
+		return NULL;
+	}
+
+	u_int32_t idx = tail & *sqMask;
+	sqArray[idx] = idx;
+	memset(&sqes[idx], 0, sizeof(struct io_uring_sqe));
+	sqPending++;
+
+	return &sqes[idx];
+}
+
+/**
+ * Submits the queued slots, and any an earlier call failed to, and if waitNr is not 0 waits for
+ * that many completions. Returns the number submitted, or -1 with errno set; EINTR means the
+ * wait was cut short, not the submission.
+ */
+int IoUring::enter(u_int32_t waitNr) {
+	u_int32_t tail = *sqTail + sqPending;
+	u_int32_t toSubmit = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	u_int32_t flags = 0;
+
+	__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+	sqPending = 0;
+
+	// completions the kernel could not fit in the ring are only moved into it by a wait
+	if (waitNr > 0 || (__atomic_load_n(sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	return syscall(__NR_io_uring_enter, ringFd, toSubmit, waitNr, flags, NULL, 0);
+}
+
+/**
+ * Returns the ring's descriptor, which polls readable while completions are waiting
+ */
+int IoUring::getFd() {
+	return ringFd;
+}
+
+UringReceiver::UringReceiver(int sock) {
+	this->sock = sock;
+	bufs = (char*) MAP_FAILED;
+	bufRing = (struct io_uring_buf_ring*) MAP_FAILED;
+	bufsLen = bufRingLen = 0;
+	bufTail = 0;
+	armedGen = 0;
+	armed = false;
+	armedBy = pthread_self();
+	memset(&msgTemplate, 0, sizeof(msgTemplate));
+}
+
+UringReceiver::~UringReceiver() {
+	// the buffers are the kernel's until the ring is gone
+	if (ringFd >= 0) {
+		close(ringFd);
+		ringFd = -1;
+	}
+	if (bufRing != MAP_FAILED) {
+		munmap(bufRing, bufRingLen);
+	}
+	if (bufs != MAP_FAILED) {
+		munmap(bufs, bufsLen);
+	}
+}
+
+/**
+ * Returns a receiver for datagrams of up to maxLen bytes on sock, or NULL if this kernel cannot
+ * run one: io_uring is missing or disabled, or predates provided buffer rings (5.19) or
+ * multishot recvmsg (6.0)
+ */
+UringReceiver* UringReceiver::create(int sock, int maxLen) {
+	UringReceiver* rx = new UringReceiver(sock);
+
+	if (!rx->init(maxLen)) {
+		delete rx;
+		return NULL;
+	}
+
+	return rx;
+}
+
+bool UringReceiver::init(int maxLen) {
+	struct io_uring_buf_reg reg;
+
+	if (!setup(URING_RX_SQ, URING_RX_BUFS * 2)) {
+		return false;
+	}
+
+	// each buffer takes the recvmsg header and the sender's address in front of the datagram
+	bufSize = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + maxLen;
+	bufSize = (bufSize + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+	bufsLen = (size_t) URING_RX_BUFS * bufSize;
+	bufRingLen = URING_RX_BUFS * sizeof(struct io_uring_buf);
+	if ((bufs = (char*) mmap(NULL, bufsLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED
+			|| (bufRing = (struct io_uring_buf_ring*) mmap(NULL, bufRingLen, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		return false;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (u_int64_t) bufRing;
+	reg.ring_entries = URING_RX_BUFS;
+	reg.bgid = URING_BUF_GROUP;
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		return false;
+	}
+	for (int i = 0; i < URING_RX_BUFS; i++) {
+		recycle(i);
+	}
+	__atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+
+	msgTemplate.msg_namelen = sizeof(struct sockaddr_in);
+	arm();
+	if (enter(0) < 0) {
+		return false;
+	}
+
+	// a kernel without multishot recvmsg rejects it on the spot
+	struct io_uring_cqe* cqe = peekCqe();
+	if (cqe != NULL && cqe->res < 0 && !(cqe->flags & IORING_CQE_F_MORE)) {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Queues a new multishot recvmsg on the socket, owned by the calling thread
+ */
+void UringReceiver::arm() {
+	struct io_uring_sqe* sqe = getSqe();
+
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = sock;
+	sqe->addr = (u_int64_t) &msgTemplate;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->user_data = ++armedGen;
+	armedBy = pthread_self();
+	armed = true;
+}
+
+/**
+ * Gives buffer bid back to the kernel. Takes effect when bufRing's tail is next published.
+ */
+void UringReceiver::recycle(int bid) {
+	// not bufRing->bufs: the kernel header's flexible array lands 8 bytes in when compiled as C++
+	struct io_uring_buf* buf = (struct io_uring_buf*) bufRing + (bufTail & (URING_RX_BUFS - 1));
+
+	buf->addr = (u_int64_t) (bufs + (size_t) bid * bufSize);
+	buf->len = bufSize;
+	buf->bid = bid;
+	bufTail++;
+}
+
+/**
+ * Copies received datagrams into buffers first to maxPkts of burst and sets their lengths and
+ * senders' addresses. If block is set and none have come in, waits for one. Returns the number
+ * received, or -1 on error.
+ */
+int UringReceiver::receive(packet_burst& burst, int first, int maxPkts, bool block) {
+	int n = first;
+	bool rearmed = false;
+
+	// the request was posted by another thread; move it to this one
+	if (!pthread_equal(armedBy, pthread_self())) {
+		struct io_uring_sqe* sqe;
+
+		if (armed && (sqe = getSqe()) != NULL) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = armedGen;
+			sqe->user_data = 0;
+		}
+		arm();
+		enter(0);
+	}
+
+	while (1) {
+		struct io_uring_cqe* cqe;
+
+		while (n < maxPkts && (cqe = peekCqe()) != NULL) {
+			if (cqe->flags & IORING_CQE_F_BUFFER) {
+				int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+				if (cqe->res >= 0) {
+					struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*) (bufs + (size_t) bid * bufSize);
+					char* name = (char*) (out + 1);
+					int len = cqe->res - (int) (sizeof(*out) + msgTemplate.msg_namelen + msgTemplate.msg_controllen);
+
+					// a datagram too long for the buffer is truncated, as recvmmsg would
+					if (len > burst.bufLen) {
+						len = burst.bufLen;
+					}
+					memcpy(burst.bufs[n], name + msgTemplate.msg_namelen + msgTemplate.msg_controllen, len);
+					memcpy(&burst.addrs[n], name, sizeof(struct sockaddr_in));
+					burst.lens[n] = len;
+					n++;
+				}
+				recycle(bid);
+			}
+
+			// the request ends when the buffers run out or on an error; a cancelled one is replaced
+			if (cqe->user_data == armedGen && !(cqe->flags & IORING_CQE_F_MORE)) {
+				if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+					LOG_WARN("Receive error: %s", strerror(-cqe->res));
+				}
+				armed = false;
+			}
+			advanceCq();
+		}
+		__atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+
+		// a new request takes whatever is already queued on the socket straight away, so look again
+		if (!armed) {
+			arm();
+			enter(0);
+			if (!rearmed && n < maxPkts) {
+				rearmed = true;
+				continue;
+			}
+		}
+		if (n > first || !block) {
+			break;
+		}
+		if (enter(1) == -1 && errno != EINTR) {
+			LOG_WARN("Receive error: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	return n - first;
+}
+
+UringSender::UringSender() {
+	batchGen = 0;
+	broken = false;
+}
+
+/**
+ * Returns the calling thread's send ring, creating it on first use, or NULL if the kernel has no
+ * io_uring for us or the ring was given up on
+ */
+UringSender* UringSender::get() {
+	static __thread UringSender* sender = NULL;
+	static __thread bool failed = false;
+
+	if (sender == NULL && !failed) {
+		sender = new UringSender();
+		if (!sender->setup(URING_TX_SQ, 0)) {
+			LOG_WARN("No io_uring for sending, using sendmmsg");
+			delete sender;
+			sender = NULL;
+			failed = true;
+		}
+	}
+
+	// a broken ring may still have sends in flight, so it is kept, but not used
+	return (sender != NULL && !sender->broken) ? sender : NULL;
+}
+
+/**
+ * Takes back the slots still on the submission ring, which the kernel has not taken, and
+ * returns how many there were. The kernel only takes slots in enter(), on this thread, so none
+ * can be taken meanwhile.
+ */
+int UringSender::unqueue() {
+	u_int32_t head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	u_int32_t tail = *sqTail;
+
+	__atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+
+	return tail - head;
+}
+
+/**
+ * Sends count datagrams as sendmmsg does, setting msg_len of each one sent, and waits until the
+ * kernel is done with them all, even after an error, since until then it may still read msgs.
+ * Completions carry the batch they belong to, so none can be taken for a later batch's. Returns
+ * the number of datagrams sent before the first that failed, or -1 with errno set if that is the
+ * first. If the ring fails with sends still in flight, it is given up on and the thread goes
+ * back to sendmmsg.
+ */
+int UringSender::sendBatch(int sock, struct mmsghdr* msgs, int count) {
+	int done = 0;
+	int results[URING_TX_SQ];
+
+	batchGen++;
+
+	while (done < count) {
+		int n = (count - done < URING_TX_SQ) ? count - done : URING_TX_SQ;
+		int pending = n; // submitted, or to be, and not completed
+		int run;
+
+		for (int i = 0; i < n; i++) {
+			struct io_uring_sqe* sqe = getSqe();
+
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = sock;
+			sqe->addr = (u_int64_t) &msgs[done + i].msg_hdr;
+			sqe->len = 1;
+			sqe->user_data = (u_int64_t) batchGen << 32 | i;
+			results[i] = -ECANCELED;
+		}
+
+		while (pending > 0) {
+			struct io_uring_cqe* cqe;
+
+			// EAGAIN and EBUSY pass once completions are reaped; the slots are submitted again
+			if (enter(pending) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				int err = errno;
+
+				LOG_WARN("Send error: %s", strerror(err));
+				pending -= unqueue();
+				if (pending > 0) {
+					LOG_ERROR("io_uring failed with %d sends in flight, using sendmmsg", pending);
+					broken = true;
+					errno = err;
+					return (done > 0) ? done : -1;
+				}
+				for (int i = 0; i < n; i++) {
+					if (results[i] == -ECANCELED) {
+						results[i] = -err;
+					}
+				}
+				break;
+			}
+			while ((cqe = peekCqe()) != NULL) {
+				if ((u_int32_t) (cqe->user_data >> 32) == batchGen) {
+					results[cqe->user_data & 0xffffffff] = cqe->res;
+					pending--;
+				}
+				advanceCq();
+			}
+		}
+
+		for (run = 0; run < n && results[run] >= 0; run++) {
+			msgs[done + run].msg_len = results[run];
+		}
+		done += run;
+		if (run < n) {
+			if (done == 0) {
+				errno = -results[run];
+				return -1;
+			}
+			break;
+		}
+	}
+
+	return done;
+}
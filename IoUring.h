@@ -0,0 +1,123 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "constants.h"
+#include "LinkLayer.h"
+
+#define URING_RX_BUFS 512 // provided buffers per receive ring, a power of two
+#define URING_RX_SQ 8 // submission slots of a receive ring; it only ever has a receive and a cancel
+#define URING_TX_SQ BURST_SIZE // submission slots of a send ring, one per packet of a burst
+#define URING_BUF_GROUP 0
+
+/**
+ * A bare io_uring: the shared submission and completion rings and the calls that drive them,
+ * without liburing. Subclasses say what goes on the ring.
+ */
+class IoUring {
+
+	protected:
+		int ringFd;
+		void* sqMap;
+		size_t sqMapLen;
+		void* cqMap;
+		size_t cqMapLen;
+		struct io_uring_sqe* sqes;
+		size_t sqesLen;
+		u_int32_t* sqHead;
+		u_int32_t* sqTail;
+		u_int32_t* sqMask;
+		u_int32_t* sqArray;
+		u_int32_t* sqFlags;
+		u_int32_t* cqHead;
+		u_int32_t* cqTail;
+		u_int32_t* cqMask;
+		struct io_uring_cqe* cqes;
+		u_int32_t sqPending; // sqes filled in since the last submit
+
+		IoUring();
+		bool setup(u_int32_t sqEntries, u_int32_t cqEntries);
+		struct io_uring_sqe* getSqe();
+		int enter(u_int32_t waitNr);
+
+		/** Returns the next completion, or NULL if there is none yet */
+		struct io_uring_cqe* peekCqe() {
+			u_int32_t head = *cqHead;
+
+			if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+				return NULL;
+			}
+			return &cqes[head & *cqMask];
+		}
+
+		/** Hands the completion returned by peekCqe back to the kernel */
+		void advanceCq() {
+			__atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+		}
+
+	public:
+		virtual ~IoUring();
+		int getFd();
+};
+
+/**
+ * Receives datagrams from one UDP socket through io_uring. A single multishot recvmsg stays
+ * posted on the socket; the kernel picks a buffer from a ring of URING_RX_BUFS registered with it
+ * for each datagram and posts a completion naming the buffer, so while datagrams keep coming no
+ * system call is made at all. The ring's descriptor is readable while completions are waiting,
+ * so it goes in an event loop in place of the socket.
+ *
+ * The multishot request belongs to the thread that posted it; the kernel finishes its work on
+ * that thread. A receiver first used from another thread, as a forwarding worker's is, cancels
+ * it and posts a new one from there.
+ */
+class UringReceiver : public IoUring {
+
+	private:
+		int sock;
+		int bufSize; // bytes per provided buffer: the recvmsg header, the sender's address, then the datagram
+		char* bufs;
+		size_t bufsLen;
+		struct io_uring_buf_ring* bufRing;
+		size_t bufRingLen;
+		u_int16_t bufTail; // local copy of bufRing's tail
+		struct msghdr msgTemplate; // how the kernel lays out each buffer
+		u_int64_t armedGen; // user data of the posted multishot recvmsg
+		pthread_t armedBy;
+		bool armed;
+
+		UringReceiver(int sock);
+		bool init(int maxLen);
+		void arm();
+		void recycle(int bid);
+
+	public:
+		static UringReceiver* create(int sock, int maxLen);
+		~UringReceiver();
+		int receive(packet_burst& burst, int first, int maxPkts, bool block);
+};
+
+/**
+ * Sends bursts of datagrams through io_uring, one sendmsg per packet and one system call per
+ * burst, which also waits for them all, so the caller's buffers are free when it returns. Rings
+ * are not shared between threads: each sending thread gets one of its own from get().
+ */
+class UringSender : public IoUring {
+
+	private:
+		u_int32_t batchGen; // in the top half of each send's user data
+		bool broken; // failed with sends in flight; get() no longer hands it out
+
+		UringSender();
+		int unqueue();
+
+	public:
+		static UringSender* get();
+		int sendBatch(int sock, struct mmsghdr* msgs, int count);
+};
+
+#endif
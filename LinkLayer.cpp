@@ -1,4 +1,5 @@
 #include <iostream>
+#include <errno.h>
 #include <vector>
 #include <stdio.h>
 #include <string.h>
@@ -8,49 +9,357 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <netdb.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include "LinkLayer.h"
+#include "ShmRing.h"
+#include "IoUring.h"
+#include "Log.h"
 #include "constants.h"
 
 using namespace std;
 
-LinkLayer::LinkLayer(phy_info localPhy, vector<itf_info> itfs) {
+/**
+ * Opens the link layer's sockets. numRcvSockets is how many receive sockets will share the local
+ * port, one per forwarding worker; only then is the port opened for sharing, so a second node
+ * configured on the same port fails to bind instead of silently taking half of its traffic.
+ */
+LinkLayer::LinkLayer(phy_info localPhy, vector<itf_info> itfs, int backend, int numRcvSockets) {
 	this->localPhy = localPhy;
 	this->itfs = itfs;
-	localAI = new struct addrinfo;
-	rcvSocket = createSocket(localPhy, localAI, true);
+	this->backend = backend;
+	sharedPort = numRcvSockets > 1;
+	rcvSocket = createSocket(localPhy, &localAddr, true, sharedPort);
+	rcvFd = rcvSocket;
+
+	// the receive socket sends for every interface too, so large nodes do not run out of
+	// descriptors and a neighbor can tell which interface a datagram came in on from its source
+	// address and port; each interface's remote address is resolved once up front
+	if ((sendSocket = rcvSocket) < 0 && (sendSocket = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		perror("Socket creation error:");
+	}
+	sendAddrs.resize(itfs.size());
+	itfUp.assign(itfs.size(), 1);
+	for(vector<itf_info>::size_type i = 0; i != itfs.size(); i++){
+		resolveInterface(i);
+	}
+	mapHosts();
+
+	// before the shared memory rings, whose epoll set watches the primary socket through rcvFd
+	if (backend == LINK_BACKEND_URING && rcvSocket >= 0) {
+		if ((rcvFd = addUring(rcvSocket)) < 0) {
+			LOG_WARN("No io_uring for receiving, using sockets");
+			this->backend = LINK_BACKEND_SOCKETS;
+			rcvFd = rcvSocket;
+		}
+	}
+	attachShm();
+
 	cout << "In LinkLayer: "<< endl;
-	cout << "The localPhy info: localhost is " << localPhy.ipAddr << " port is " << localPhy.port << endl;
+	cout << "The localPhy info: localhost is " << localPhy.ipAddr << " port is " << localPhy.port;
+	cout << ", backend is " << ((this->backend == LINK_BACKEND_URING) ? "io_uring" : "sockets") << endl;
 	for(vector<itf_info>::size_type i = 0; i != itfs.size(); i++){
+		struct in_addr loc, rmt;
+		loc.s_addr = itfs[i].locAddr;
+		rmt.s_addr = itfs[i].rmtAddr;
 		cout << "In the " << i << "th itf: " << " Remote phy: address is " << itfs[i].rmtPhy.ipAddr << " port is " << itfs[i].rmtPhy.port << endl;
-		cout << "                 locAddr is " << itfs[i].locAddr << ", rmtAddr is " << itfs[i].rmtAddr << endl;
+		cout << "                 locAddr is " << inet_ntoa(loc);
+		cout << ", rmtAddr is " << inet_ntoa(rmt) << ", mtu is " << itfs[i].mtu;
+		cout << ", transport is " << ((shmTx[i] == NULL) ? "udp" : onShm(i) ? "shm" : "shm once the other end joins, udp until then") << endl;
+	}
+}
+
+/**
+ * Sets up the interfaces of a link layer whose subclass provides the transport; no sockets are
+ * opened
+ */
+LinkLayer::LinkLayer(vector<itf_info> itfs) {
+	this->itfs = itfs;
+	itfUp.assign(itfs.size(), 1);
+	rcvSocket = -1;
+	rcvFd = -1;
+	sharedPort = false;
+	sendSocket = -1;
+	backend = LINK_BACKEND_SOCKETS;
+	memset(&localAddr, 0, sizeof(localAddr));
+	shmTx.assign(itfs.size(), (ShmRing*) NULL);
+	doorbell = NULL;
+	rcvEpoll = -1;
+	udpItfs = true;
+	nextShmRx = 0;
+}
+
+LinkLayer::~LinkLayer() {
+	// the watchers go first; they read the receive rings
+	delete doorbell;
+	for (vector<ShmRing*>::size_type i = 0; i != shmTx.size(); i++) {
+		delete shmTx[i];
+	}
+	for (vector<ShmRing*>::size_type i = 0; i != shmRx.size(); i++) {
+		delete shmRx[i];
+	}
+	if (rcvEpoll >= 0) {
+		close(rcvEpoll);
+	}
+	for (map<int, UringReceiver*>::iterator it = urings.begin(); it != urings.end(); ++it) {
+		delete it->second;
+	}
+	if (sendSocket >= 0 && sendSocket != rcvSocket) {
+		close(sendSocket);
+	}
+	if (rcvSocket >= 0) {
+		close(rcvSocket);
+	}
+}
+
+/**
+ * Resolves and caches the remote address of the specified interface. Dotted quads with numeric
+ * ports skip the resolver. Returns 0, or -1 if the address cannot be resolved, in which case
+ * nothing is sent over the interface.
+ */
+int LinkLayer::resolveInterface(int itfNum) {
+	struct sockaddr_in* addr = &sendAddrs[itfNum];
+	phy_info& phy = itfs[itfNum].rmtPhy;
+	char* end;
+	long port = strtol(phy.port.c_str(), &end, 10);
+	struct addrinfo aiHints, *aiList;
+	int gai_ret;
+
+	memset(addr, 0, sizeof(struct sockaddr_in));
+	if (*end == '\0' && port > 0 && port <= 65535 && inet_pton(AF_INET, phy.ipAddr.c_str(), &addr->sin_addr) == 1) {
+		addr->sin_family = AF_INET;
+		addr->sin_port = htons(port);
+		return 0;
+	}
+
+	memset(&aiHints, 0, sizeof aiHints);
+	aiHints.ai_family = AF_INET; // IPv4
+	aiHints.ai_socktype = SOCK_DGRAM; // UDP
+	if ((gai_ret = getaddrinfo(phy.ipAddr.c_str(), phy.port.c_str(), &aiHints, &aiList)) != 0) {
+		LOG_ERROR("Cannot resolve %s:%s for interface %d: %s", phy.ipAddr.c_str(), phy.port.c_str(), itfNum, gai_strerror(gai_ret));
+		return -1;
+	}
+	memcpy(addr, aiList->ai_addr, sizeof(struct sockaddr_in));
+	freeaddrinfo(aiList);
+
+	return 0;
+}
+
+static u_int64_t endpointKey(const struct sockaddr_in* addr) {
+	return ((u_int64_t) addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+/**
+ * Builds the map from neighbor endpoint to interface. Neighbors send from the socket bound to
+ * their configured address and port, the one each interface sends to, so a datagram's source
+ * tells which interface it came in on, unless two interfaces lead to the same neighbor.
+ */
+void LinkLayer::mapHosts() {
+	hostItfs.clear();
+	for (vector<struct sockaddr_in>::size_type i = 0; i != sendAddrs.size(); i++) {
+		if (sendAddrs[i].sin_family != AF_INET) {
+			continue;
+		}
+		pair<map<u_int64_t, int>::iterator, bool> ins = hostItfs.insert(make_pair(endpointKey(&sendAddrs[i]), (int) i));
+		if (!ins.second) {
+			ins.first->second = -1;
+		}
+	}
+}
+
+/**
+ * Returns the interface a datagram from addr came in on, or -1 if it cannot be told
+ */
+int LinkLayer::rcvInterface(const struct sockaddr_in* addr) {
+	map<u_int64_t, int>::iterator it = hostItfs.find(endpointKey(addr));
+	return (it != hostItfs.end()) ? it->second : -1;
+}
+
+/**
+ * Maps a pair of rings, one each way, for every interface configured with LINK_SHM. The rings are
+ * named by the UDP ports of the two ends, which both know from their configs. An interface whose
+ * rings cannot be set up falls back to UDP, and so does one whose neighbor has not joined the
+ * rings, which it may yet refuse. If any ring is mapped, the receive socket handed out is an
+ * epoll set of the rings' doorbell and the UDP socket, so one event loop entry covers both; the
+ * socket is always in it, since any shared memory neighbor may be on UDP.
+ */
+void LinkLayer::attachShm() {
+	char name[64];
+
+	doorbell = NULL;
+	rcvEpoll = -1;
+	udpItfs = false;
+	nextShmRx = 0;
+	shmTx.assign(itfs.size(), (ShmRing*) NULL);
+
+	for (vector<itf_info>::size_type i = 0; i != itfs.size(); i++) {
+		if (itfs[i].transport != LINK_SHM) {
+			udpItfs = true;
+			continue;
+		}
+		if (sendAddrs[i].sin_family != AF_INET) {
+			LOG_ERROR("No remote port for shared memory interface %d, using UDP", (int) i);
+			udpItfs = true;
+			continue;
+		}
+
+		int locPort = ntohs(localAddr.sin_port), rmtPort = ntohs(sendAddrs[i].sin_port);
+		ShmRing* rx;
+
+		snprintf(name, sizeof(name), SHM_NAME_PREFIX "%d.%d", locPort, rmtPort);
+		shmTx[i] = ShmRing::attach(name, itfs[i].mtu, true);
+		snprintf(name, sizeof(name), SHM_NAME_PREFIX "%d.%d", rmtPort, locPort);
+		rx = (shmTx[i] != NULL) ? ShmRing::attach(name, itfs[i].mtu, false) : NULL;
+		if (rx == NULL) {
+			LOG_ERROR("Cannot set up shared memory for interface %d, using UDP", (int) i);
+			delete shmTx[i];
+			shmTx[i] = NULL;
+			udpItfs = true;
+			continue;
+		}
+		shmRx.push_back(rx);
+		shmRxItfs.push_back(i);
+	}
+
+	if (shmRx.empty()) {
+		return;
+	}
+
+	struct epoll_event ev;
+
+	doorbell = new ShmDoorbell(shmRx);
+	if ((rcvEpoll = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		perror("Epoll creation error:");
+		return;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = doorbell->getEventFd();
+	if (epoll_ctl(rcvEpoll, EPOLL_CTL_ADD, ev.data.fd, &ev) == -1) {
+		perror("Epoll registration error:");
+	}
+	ev.data.fd = rcvFd;
+	if (epoll_ctl(rcvEpoll, EPOLL_CTL_ADD, rcvFd, &ev) == -1) {
+		perror("Epoll registration error:");
+	}
+
+	// arm the rings for the first packet; any left from the last run are read straight away
+	for (vector<ShmRing*>::size_type i = 0; i != shmRx.size(); i++) {
+		if (!shmRx[i]->prepareWait()) {
+			doorbell->ring();
+		}
 	}
 }
 
 /**
- * Returns string representation of IP address associated with the specified interface
+ * Returns the IP address associated with the specified interface, network byte order
  */
-char* LinkLayer::getInterfaceAddr(int itfNum) {
+u_int32_t LinkLayer::getInterfaceAddr(int itfNum) {
 	return itfs[itfNum].locAddr;
 }
 
+/**
+ * Returns the IP address of the neighbor on the specified interface, network byte order
+ */
+u_int32_t LinkLayer::getRemoteAddr(int itfNum) {
+	return itfs[itfNum].rmtAddr;
+}
+
+/**
+ * Returns the largest IP packet, header included, the interface carries in one datagram
+ */
+int LinkLayer::getMtu(int itfNum) {
+	return itfs[itfNum].mtu;
+}
+
+/**
+ * Returns the largest MTU of any interface, which is the most a received datagram can hold
+ */
+int LinkLayer::getMaxMtu() {
+	int mtu = DEFAULT_MTU;
+
+	for (vector<itf_info>::size_type i = 0; i != itfs.size(); i++) {
+		if (itfs[i].mtu > mtu) {
+			mtu = itfs[i].mtu;
+		}
+	}
+
+	return mtu;
+}
+
+int LinkLayer::getNumInterfaces() {
+	return itfs.size();
+}
+
+/**
+ * Marks an interface up or down. Nothing is sent over an interface while it is down.
+ */
+int LinkLayer::setInterfaceUp(int itfNum, bool up) {
+	if (itfNum < 0 || itfNum >= (int) itfs.size()) {
+		LOG_WARN("No such interface: %d", itfNum);
+		return -1;
+	}
+
+	itfUp[itfNum] = up;
+	return 0;
+}
+
+bool LinkLayer::isInterfaceUp(int itfNum) {
+	return itfNum >= 0 && itfNum < (int) itfUp.size() && itfUp[itfNum];
+}
+
 /**
  * Sends dataLen bytes of data over the interface specified by itfNum
  */
 int LinkLayer::send(char* data, int dataLen, int itfNum) {
-	int sendSocket, bytesSent;
-	struct addrinfo *aiDest = new struct addrinfo;
+	struct iovec iov;
+
+	iov.iov_base = data;
+	iov.iov_len = dataLen;
+	return sendv(&iov, 1, itfNum);
+}
 
-	sendSocket = createSocket(itfs[itfNum].rmtPhy, aiDest, false);
+/**
+ * Sends one packet gathered from iovCount buffers over the interface specified by itfNum.
+ * The buffers are handed to the kernel as-is and never copied into a contiguous packet.
+ */
+int LinkLayer::sendv(const struct iovec* iov, int iovCount, int itfNum) {
+	int bytesSent;
+	struct msghdr msg;
+
+	if (itfNum < 0 || itfNum >= (int) sendAddrs.size() || sendAddrs[itfNum].sin_family != AF_INET || sendSocket < 0) {
+		LOG_WARN("No send address for interface %d", itfNum);
+		return -1;
+	}
 
-	if ((bytesSent = sendto(sendSocket, data, dataLen, 0, aiDest->ai_addr, aiDest->ai_addrlen)) == -1) {
-		perror("Send error:");
+	if (!itfUp[itfNum]) {
+		LOG_DEBUG("Interface %d is down, discarding", itfNum);
 		return -1;
 	}
 
-	freeaddrinfo(aiDest);
+	if (onShm(itfNum)) {
+		if (sendShm(iov, &iovCount, 1, itfNum) < 0) {
+			return -1;
+		}
+		bytesSent = 0;
+		for (int i = 0; i < iovCount; i++) {
+			bytesSent += iov[i].iov_len;
+		}
+		return bytesSent;
+	}
 
-	printf("Sent %d bytes over interface %d\n", bytesSent, itfNum);
-	close(sendSocket);
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_name = &sendAddrs[itfNum];
+	msg.msg_namelen = sizeof(struct sockaddr_in);
+	msg.msg_iov = (struct iovec*) iov;
+	msg.msg_iovlen = iovCount;
+
+	if ((bytesSent = sendmsg(sendSocket, &msg, 0)) == -1) {
+		LOG_WARN("Send error: %s", strerror(errno));
+		return -1;
+	}
+
+	LOG_DEBUG("Sent %d bytes over interface %d", bytesSent, itfNum);
 
 	return bytesSent;
 }
@@ -58,15 +367,440 @@ int LinkLayer::send(char* data, int dataLen, int itfNum) {
 int LinkLayer::listen(char* buf, int bufLen) {
 	int bytesRcvd;
 	if ((bytesRcvd = recvfrom(rcvSocket, buf, bufLen-1 , 0, NULL, NULL)) == -1) {
-		perror("Receive error:");
+		LOG_WARN("Receive error: %s", strerror(errno));
+		return -1;
+	}
+
+	return bytesRcvd;
+}
+
+/**
+ * Returns the socket packets are received on, for registration with an event loop. With shared
+ * memory interfaces this is an epoll set covering them and the UDP socket; with the io_uring
+ * backend, the socket's ring stands in for it.
+ */
+int LinkLayer::getRcvSocket() {
+	return (rcvEpoll >= 0) ? rcvEpoll : rcvFd;
+}
+
+/**
+ * Opens an additional receive socket bound to the local port. All receive sockets share the
+ * port through SO_REUSEPORT, so the kernel spreads incoming datagrams across them. With the
+ * io_uring backend the socket's ring is returned in its place. Returns -1 if the socket cannot
+ * be opened, or the link layer was not created for more than one receive socket.
+ */
+int LinkLayer::openRcvSocket() {
+	struct sockaddr_in addr;
+	int sock, fd;
+
+	if (!sharedPort) {
+		LOG_ERROR("Receive port %s is not shared, cannot open another socket on it", localPhy.port.c_str());
+		return -1;
+	}
+	sock = createSocket(localPhy, &addr, true, true);
+
+	if (backend == LINK_BACKEND_URING && sock >= 0 && (fd = addUring(sock)) >= 0) {
+		return fd;
+	}
+
+	return sock;
+}
+
+/**
+ * Sets up an io_uring receiving from sock. Returns its descriptor, or -1 if the kernel cannot run
+ * one.
+ */
+int LinkLayer::addUring(int sock) {
+	UringReceiver* rx = UringReceiver::create(sock, getMaxMtu());
+
+	if (rx == NULL) {
+		return -1;
+	}
+	urings[rx->getFd()] = rx;
+
+	return rx->getFd();
+}
+
+/**
+ * Returns the backend in use, which is LINK_BACKEND_SOCKETS if io_uring was asked for and the
+ * kernel does not have it
+ */
+int LinkLayer::getBackend() {
+	return backend;
+}
+
+/**
+ * Receives up to burst.count packets from the primary receive socket
+ */
+int LinkLayer::listenBatch(packet_burst& burst, bool block) {
+	return listenBatch(getRcvSocket(), burst, block);
+}
+
+/**
+ * Receives packets from sock into the first burst.count buffers of burst with a single syscall,
+ * then sets burst.count to the number received and burst.itfs to the interfaces they came in on.
+ * If block is set, waits for at least one packet; otherwise returns 0 when none are queued.
+ * Returns the number of packets received.
+ */
+int LinkLayer::listenBatch(int sock, packet_burst& burst, bool block) {
+	int pktsRcvd;
+
+	if (sock == rcvEpoll && rcvEpoll >= 0) {
+		return listenShm(burst, block);
+	}
+
+	if ((pktsRcvd = recvUdp(sock, burst, 0, burst.count, block)) == -1) {
+		burst.count = 0;
 		return -1;
 	}
+	burst.count = pktsRcvd;
+
+	return pktsRcvd;
+}
+
+/**
+ * Receives datagrams from sock, a receive socket or the io_uring of one, into buffers first to
+ * maxPkts of burst and sets their lengths and interfaces. Returns the number received, or -1.
+ */
+int LinkLayer::recvUdp(int sock, packet_burst& burst, int first, int maxPkts, bool block) {
+	map<int, UringReceiver*>::iterator it;
+	int pktsRcvd;
+
+	if (urings.empty() || (it = urings.find(sock)) == urings.end()) {
+		return recvBatch(sock, burst, first, maxPkts, block ? MSG_WAITFORONE : MSG_DONTWAIT);
+	}
+
+	if ((pktsRcvd = it->second->receive(burst, first, maxPkts, block)) > 0) {
+		setRcvInterfaces(burst, first, pktsRcvd);
+	}
+
+	return pktsRcvd;
 }
 
 /**
- * Creates UDP socket and populates &aiRet with socket address info
+ * Receives datagrams from sock into buffers first to maxPkts of burst with one recvmmsg, and sets
+ * their lengths and interfaces. Returns the number received, 0 if flags has MSG_DONTWAIT and none
+ * are queued, or -1 on error.
  */
-int LinkLayer::createSocket(phy_info phyInfo, struct addrinfo* aiRet, bool bindSock) {
+int LinkLayer::recvBatch(int sock, packet_burst& burst, int first, int maxPkts, int flags) {
+	int pktsRcvd;
+
+	for (int i = first; i < maxPkts; i++) {
+		burst.iovs[i].iov_base = burst.bufs[i];
+		burst.iovs[i].iov_len = burst.bufLen;
+		memset(&burst.msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+		burst.msgs[i].msg_hdr.msg_name = &burst.addrs[i];
+		burst.msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		burst.msgs[i].msg_hdr.msg_iov = &burst.iovs[i];
+		burst.msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if ((pktsRcvd = recvmmsg(sock, &burst.msgs[first], maxPkts - first, flags, NULL)) == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		LOG_WARN("Receive error: %s", strerror(errno));
+		return -1;
+	}
+
+	for (int i = first; i < first + pktsRcvd; i++) {
+		burst.lens[i] = burst.msgs[i].msg_len;
+	}
+	setRcvInterfaces(burst, first, pktsRcvd);
+
+	return pktsRcvd;
+}
+
+/**
+ * Sets the interfaces of count datagrams received into burst from buffer first on, from their
+ * senders' addresses
+ */
+void LinkLayer::setRcvInterfaces(packet_burst& burst, int first, int count) {
+	// a burst mostly comes from a few neighbors, so the last sender's interface is reused
+	u_int64_t lastSender = 0;
+	int lastItf = -1;
+
+	for (int i = first; i < first + count; i++) {
+		if (i == first || endpointKey(&burst.addrs[i]) != lastSender) {
+			lastSender = endpointKey(&burst.addrs[i]);
+			lastItf = rcvInterface(&burst.addrs[i]);
+		}
+		burst.itfs[i] = lastItf;
+	}
+}
+
+/**
+ * Returns true if the interface specified by itfNum sends over shared memory: its ring is mapped
+ * and the neighbor has joined it
+ */
+bool LinkLayer::onShm(int itfNum) {
+	return shmTx[itfNum] != NULL && shmTx[itfNum]->peerAttached();
+}
+
+/**
+ * Returns true if every neighbor on shared memory has joined its rings, so none of them sends
+ * over UDP
+ */
+bool LinkLayer::shmJoined() {
+	for (vector<int>::size_type i = 0; i != shmRxItfs.size(); i++) {
+		if (!onShm(shmRxItfs[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Copies packets off the receive rings into buffers n to maxPkts of burst, starting with a
+ * different ring each time so a busy neighbor cannot starve the others. Returns the new number
+ * of buffers filled.
+ */
+int LinkLayer::drainShm(packet_burst& burst, int n, int maxPkts) {
+	int numRings = shmRx.size();
+
+	for (int k = 0; k < numRings && n < maxPkts; k++) {
+		int r = (nextShmRx + k) % numRings;
+		n = shmRx[r]->dequeue(burst, n, maxPkts, shmRxItfs[r]);
+	}
+	nextShmRx = (nextShmRx + 1) % numRings;
+
+	return n;
+}
+
+/**
+ * listenBatch for rcvEpoll: takes packets off the shared memory rings, then tops the burst up
+ * from the UDP socket. The rings are read without a system call while they have packets; only
+ * once they are empty are they armed, so the next packet rings the doorbell and makes rcvEpoll
+ * readable. While packets are left behind the doorbell is kept readable instead, so a level
+ * triggered event loop comes back for them.
+ */
+int LinkLayer::listenShm(packet_burst& burst, bool block) {
+	int maxPkts = burst.count;
+	// with neighbors on UDP too, a quarter of every burst is left for the socket
+	bool udp = udpItfs || !shmJoined();
+	int shmMax = udp ? maxPkts - maxPkts / 4 : maxPkts;
+	int n;
+
+	while (1) {
+		n = drainShm(burst, 0, shmMax);
+		if (n < shmMax) {
+			bool armed = true;
+
+			doorbell->clear();
+			for (vector<ShmRing*>::size_type i = 0; i != shmRx.size(); i++) {
+				if (!shmRx[i]->prepareWait()) {
+					armed = false;
+				}
+			}
+			// a packet slipped in before a ring was armed; its sender may not ring
+			if (!armed) {
+				n = drainShm(burst, n, shmMax);
+				doorbell->ring();
+			}
+		} else {
+			doorbell->ring();
+		}
+
+		// the socket is read whenever the rings run short, so a stray datagram cannot keep
+		// rcvEpoll readable for good
+		if (udp || n < shmMax) {
+			int pktsRcvd = recvUdp(rcvFd, burst, n, maxPkts, false);
+			if (pktsRcvd > 0) {
+				n += pktsRcvd;
+			}
+		}
+
+		if (n > 0 || !block) {
+			break;
+		}
+
+		struct epoll_event ev;
+		if (epoll_wait(rcvEpoll, &ev, 1, -1) == -1 && errno != EINTR) {
+			LOG_WARN("Receive error: %s", strerror(errno));
+			burst.count = 0;
+			return -1;
+		}
+	}
+	burst.count = n;
+
+	return n;
+}
+
+/**
+ * Queues count packets on the shared memory ring of the interface specified by itfNum, packet i
+ * gathered from the next iovCounts[i] entries of iov. Returns the number queued, which is short
+ * if the ring fills, or -1 if none could be.
+ */
+int LinkLayer::sendShm(const struct iovec* iov, const int* iovCounts, int count, int itfNum) {
+	int pktsSent = 0;
+
+	while (pktsSent < count) {
+		int n = (count - pktsSent < BURST_SIZE) ? count - pktsSent : BURST_SIZE;
+		int queued = shmTx[itfNum]->enqueue(iov, iovCounts + pktsSent, n);
+
+		if (queued == 0) {
+			errno = ENOBUFS;
+		}
+		if (queued <= 0) {
+			break;
+		}
+		for (int i = 0; i < queued; i++) {
+			iov += iovCounts[pktsSent + i];
+		}
+		pktsSent += queued;
+		if (queued < n) {
+			break;
+		}
+	}
+
+	if (pktsSent == 0) {
+		LOG_WARN("Send error on interface %d: %s", itfNum, strerror(errno));
+		return -1;
+	}
+
+	LOG_DEBUG("Queued %d packets on interface %d", pktsSent, itfNum);
+
+	return pktsSent;
+}
+
+/**
+ * Sends count datagrams to their msg_name addresses from the send socket, with one system call
+ * whichever the backend. Returns the number sent, or -1 if none could be.
+ */
+int LinkLayer::sendMsgs(struct mmsghdr* msgs, int count) {
+	UringSender* tx;
+
+	if (backend == LINK_BACKEND_URING && (tx = UringSender::get()) != NULL) {
+		return tx->sendBatch(sendSocket, msgs, count);
+	}
+
+	return sendmmsg(sendSocket, msgs, count, 0);
+}
+
+/**
+ * Sends count packets over the interface specified by itfNum, BURST_SIZE packets per syscall.
+ * Returns the number of packets sent.
+ */
+int LinkLayer::sendBatch(char** pkts, int* lens, int count, int itfNum) {
+	int pktsSent = 0;
+	struct iovec iovs[BURST_SIZE];
+	struct mmsghdr msgs[BURST_SIZE];
+
+	if (itfNum < 0 || itfNum >= (int) sendAddrs.size() || sendAddrs[itfNum].sin_family != AF_INET || sendSocket < 0) {
+		LOG_WARN("No send address for interface %d", itfNum);
+		return -1;
+	}
+
+	if (!itfUp[itfNum]) {
+		LOG_DEBUG("Interface %d is down, discarding", itfNum);
+		return -1;
+	}
+
+	if (onShm(itfNum)) {
+		int ones[BURST_SIZE];
+
+		for (int i = 0; i < BURST_SIZE; i++) {
+			ones[i] = 1;
+		}
+		while (pktsSent < count) {
+			int n = (count - pktsSent < BURST_SIZE) ? count - pktsSent : BURST_SIZE;
+			int queued;
+
+			for (int i = 0; i < n; i++) {
+				iovs[i].iov_base = pkts[pktsSent + i];
+				iovs[i].iov_len = lens[pktsSent + i];
+			}
+			if ((queued = sendShm(iovs, ones, n, itfNum)) < 0) {
+				return (pktsSent > 0) ? pktsSent : -1;
+			}
+			pktsSent += queued;
+			if (queued < n) {
+				break;
+			}
+		}
+		return pktsSent;
+	}
+
+	while (pktsSent < count) {
+		int n = (count - pktsSent < BURST_SIZE) ? count - pktsSent : BURST_SIZE;
+
+		for (int i = 0; i < n; i++) {
+			iovs[i].iov_base = pkts[pktsSent + i];
+			iovs[i].iov_len = lens[pktsSent + i];
+			memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+			msgs[i].msg_hdr.msg_name = &sendAddrs[itfNum];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		if ((n = sendMsgs(msgs, n)) == -1) {
+			LOG_WARN("Send error: %s", strerror(errno));
+			return (pktsSent > 0) ? pktsSent : -1;
+		}
+		pktsSent += n;
+	}
+
+	LOG_DEBUG("Sent %d packets over interface %d", pktsSent, itfNum);
+
+	return pktsSent;
+}
+
+/**
+ * Sends count packets over the interface specified by itfNum, packet i gathered from the next
+ * iovCounts[i] entries of iov, with as few system calls as possible. Returns the number of
+ * packets sent, or -1 if none could be.
+ */
+int LinkLayer::sendvBatch(const struct iovec* iov, const int* iovCounts, int count, int itfNum) {
+	int pktsSent = 0;
+	struct mmsghdr msgs[BURST_SIZE];
+
+	if (itfNum < 0 || itfNum >= (int) sendAddrs.size() || sendAddrs[itfNum].sin_family != AF_INET || sendSocket < 0) {
+		LOG_WARN("No send address for interface %d", itfNum);
+		return -1;
+	}
+
+	if (!itfUp[itfNum]) {
+		LOG_DEBUG("Interface %d is down, discarding", itfNum);
+		return -1;
+	}
+
+	if (onShm(itfNum)) {
+		return sendShm(iov, iovCounts, count, itfNum);
+	}
+
+	while (pktsSent < count) {
+		int n = (count - pktsSent < BURST_SIZE) ? count - pktsSent : BURST_SIZE;
+		const struct iovec* next = iov;
+
+		for (int i = 0; i < n; i++) {
+			memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+			msgs[i].msg_hdr.msg_name = &sendAddrs[itfNum];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			msgs[i].msg_hdr.msg_iov = (struct iovec*) next;
+			msgs[i].msg_hdr.msg_iovlen = iovCounts[pktsSent + i];
+			next += iovCounts[pktsSent + i];
+		}
+
+		if ((n = sendMsgs(msgs, n)) == -1) {
+			LOG_WARN("Send error: %s", strerror(errno));
+			return (pktsSent > 0) ? pktsSent : -1;
+		}
+		for (int i = 0; i < n; i++) {
+			iov += iovCounts[pktsSent + i];
+		}
+		pktsSent += n;
+	}
+
+	LOG_DEBUG("Sent %d packets over interface %d", pktsSent, itfNum);
+
+	return pktsSent;
+}
+
+/**
+ * Creates UDP socket and populates *addrRet with the resolved socket address
+ */
+int LinkLayer::createSocket(phy_info phyInfo, struct sockaddr_in* addrRet, bool bindSock, bool reusePort) {
 	int sockfd, gai_ret;
 	struct addrinfo aiHints, *aiList, *ai;
 
@@ -77,7 +811,7 @@ int LinkLayer::createSocket(phy_info phyInfo, struct addrinfo* aiRet, bool bindS
 	aiHints.ai_family = AF_INET; // IPv4
 	aiHints.ai_socktype = SOCK_DGRAM; // UDP
 
-	if ((gai_ret = getaddrinfo(phyInfo.ipAddr, phyInfo.port, &aiHints, &aiList)) != 0) {
+	if ((gai_ret = getaddrinfo(phyInfo.ipAddr.c_str(), phyInfo.port.c_str(), &aiHints, &aiList)) != 0) {
 		perror("Get address info error:");
 		return -1;
 	}
@@ -90,6 +824,15 @@ int LinkLayer::createSocket(phy_info phyInfo, struct addrinfo* aiRet, bool bindS
 		}
 
 		if (bindSock) {
+			int reuse = 1;
+			int rcvBuf = SOCKET_RCVBUF;
+			if (reusePort && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+				perror("Socket option error:");
+			}
+			// the kernel caps this at net.core.rmem_max; a smaller buffer only drops sooner
+			if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf)) == -1) {
+				perror("Socket option error:");
+			}
 			if (bind(sockfd, ai->ai_addr, ai->ai_addrlen) == -1) {
 				close(sockfd);
 				perror("Socking binding error:");
@@ -105,8 +848,8 @@ int LinkLayer::createSocket(phy_info phyInfo, struct addrinfo* aiRet, bool bindS
 		return -1;
 	}
 
-	// copy address info data
-	*aiRet = *ai;
+	// copy the address itself; ai points into aiList, which is freed below
+	memcpy(addrRet, ai->ai_addr, sizeof(struct sockaddr_in));
 
 	// free address info list
 	freeaddrinfo(aiList);
@@ -114,6 +857,122 @@ int LinkLayer::createSocket(phy_info phyInfo, struct addrinfo* aiRet, bool bindS
 	return sockfd;
 }
 
+#ifdef LINKLAYER_MAIN
+#include <pthread.h>
+
+typedef struct {
+	LinkLayer* link;
+	int count;
+	int size;
+	double secs;
+} bench_sender;
+
+static double nowSecs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* runBenchSender(void* arg) {
+	bench_sender* s = (bench_sender*) arg;
+	char* pkts[BURST_SIZE];
+	int lens[BURST_SIZE];
+	vector<char> pkt(s->size, 'x');
+	double start = nowSecs();
+
+	for (int i = 0; i < BURST_SIZE; i++) {
+		pkts[i] = &pkt[0];
+		lens[i] = s->size;
+	}
+	for (int i = 0; i < s->count; i += BURST_SIZE) {
+		s->link->sendBatch(pkts, lens, (s->count - i < BURST_SIZE) ? s->count - i : BURST_SIZE, 0);
+	}
+	s->secs = nowSecs() - start;
+
+	return NULL;
+}
+
+/**
+ * Sends count packets of size bytes from rmtPort to locPort with sendBatch on a thread of its own,
+ * while this thread receives them as a node's event loop does: it waits for the receive socket
+ * to poll readable, then drains it a burst at a time. Both ends use the given backend. Writes
+ * one line of key=value pairs to stderr.
+ */
+static void benchBackend(int backend, int locPort, int rmtPort, int count, int size) {
+	char portStr[16];
+	phy_info locPhy, rmtPhy;
+	itf_info itf;
+	vector<itf_info> itfs;
+	bench_sender s;
+	pthread_t thread;
+	packet_burst burst;
+	vector<char> bufs(BURST_SIZE * 2048);
+	long rcvd = 0;
+	double start, last;
+	struct epoll_event ev;
+	int ep = epoll_create1(0);
+
+	locPhy.ipAddr = rmtPhy.ipAddr = "127.0.0.1";
+	snprintf(portStr, sizeof(portStr), "%d", locPort);
+	locPhy.port = portStr;
+	snprintf(portStr, sizeof(portStr), "%d", rmtPort);
+	rmtPhy.port = portStr;
+	itf.locAddr = inet_addr("192.168.1.2");
+	itf.rmtAddr = inet_addr("192.168.1.1");
+	itf.rmtPhy = locPhy;
+	itf.mtu = DEFAULT_MTU;
+	itf.transport = LINK_UDP;
+	itfs.push_back(itf);
+
+	LinkLayer* rcv = new LinkLayer(locPhy, vector<itf_info>(), backend);
+	LinkLayer* snd = new LinkLayer(rmtPhy, itfs, backend);
+	int sock = rcv->getRcvSocket();
+
+	burst.bufLen = 2048;
+	for (int i = 0; i < BURST_SIZE; i++) {
+		burst.bufs[i] = &bufs[i * 2048];
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = sock;
+	epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev);
+
+	s.link = snd;
+	s.count = count;
+	s.size = size;
+	start = last = nowSecs();
+	pthread_create(&thread, NULL, runBenchSender, &s);
+
+	// done once nothing has come in for a while; the rest were dropped by the kernel. io_uring
+	// completes its work on this thread, which cuts epoll_wait short with EINTR.
+	while (1) {
+		int ready = epoll_wait(ep, &ev, 1, 200);
+
+		if (ready == 0 && rcvd > 0) {
+			break;
+		}
+		if (ready < 0) {
+			continue;
+		}
+		for (int i = 0; i < MAX_POLL_BURSTS; i++) {
+			burst.count = BURST_SIZE;
+			if (rcv->listenBatch(sock, burst, false) <= 0) {
+				break;
+			}
+			rcvd += burst.count;
+			last = nowSecs();
+		}
+	}
+	pthread_join(thread, NULL);
+
+	fprintf(stderr, "bench=link_%s pkt_bytes=%d sent=%d rcvd=%ld lost=%ld send_pps=%.0f rcv_pps=%.0f\n",
+			(rcv->getBackend() == LINK_BACKEND_URING && snd->getBackend() == LINK_BACKEND_URING) ? "io_uring" : "sockets",
+			size, count, rcvd, count - rcvd, count / s.secs, rcvd / (last - start));
+
+	delete snd;
+	delete rcv;
+	close(ep);
+}
+
 /* This main just for testing */
 int main(int argc, char ** argv) {
 	int recv_len;
@@ -129,12 +988,26 @@ int main(int argc, char ** argv) {
 	locPhy.port = argv[2];
 	rmtPhy.port = argv[3];
 
-	itf.locAddr = "192.168.1.1";
-	itf.rmtAddr = "192.168.1.1";
+	itf.locAddr = inet_addr("192.168.1.1");
+	itf.rmtAddr = inet_addr("192.168.1.1");
 	itf.rmtPhy = rmtPhy;
+	itf.mtu = DEFAULT_MTU;
+	itf.transport = LINK_UDP;
 
 	itfs.push_back(itf);
 
+	// backend comparison: c <locPort> <rmtPort> [count] [size]. Runs before this node binds
+	// locPort, since the comparison's own receivers take it.
+	if (argv[1][0] == 'c') {
+		int count = (argc > 4) ? atoi(argv[4]) : 1000000;
+		int size = (argc > 5) ? atoi(argv[5]) : 64;
+		int locPort = atoi(argv[2]), rmtPort = atoi(argv[3]);
+
+		benchBackend(LINK_BACKEND_SOCKETS, locPort, rmtPort, count, size);
+		benchBackend(LINK_BACKEND_URING, locPort + 2, rmtPort + 2, count, size);
+		return 0;
+	}
+
 	LinkLayer* ll = new LinkLayer(locPhy, itfs);
 
 	if (argv[1][0] == 'l') { // node is listener
@@ -156,14 +1029,67 @@ int main(int argc, char ** argv) {
 		while (1) {
 			fflush(stdin);
 			printf("Enter message: \n");
-			gets(msg);
+			if (fgets(msg, sizeof(msg), stdin) == NULL) {
+				return 0;
+			}
 			if (ll->send(msg, 512, 0) < 0) {
 				perror("Send error:");
 				return 1;
 			}
 		}
 
+	} else if (argv[1][0] == 'b') { // node is send benchmark: b <locPort> <rmtPort> [count] [size]
+
+		int count = (argc > 4) ? atoi(argv[4]) : 1000000;
+		int size = (argc > 5) ? atoi(argv[5]) : 64;
+		struct timespec start, end;
+
+		memset(msg, 'x', sizeof(msg));
+		if (size > (int) sizeof(msg)) {
+			size = sizeof(msg);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < count; i++) {
+			if (ll->send(msg, size, 0) < 0) {
+				return 1;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "sent %d packets of %d bytes in %.3f s: %.0f pps\n", count, size, secs, count / secs);
+
+	} else if (argv[1][0] == 'B') { // node is batched send benchmark: B <locPort> <rmtPort> [count] [size]
+
+		int count = (argc > 4) ? atoi(argv[4]) : 1000000;
+		int size = (argc > 5) ? atoi(argv[5]) : 64;
+		char* pkts[BURST_SIZE];
+		int lens[BURST_SIZE];
+		struct timespec start, end;
+
+		memset(msg, 'x', sizeof(msg));
+		if (size > (int) sizeof(msg)) {
+			size = sizeof(msg);
+		}
+		for (int i = 0; i < BURST_SIZE; i++) {
+			pkts[i] = msg;
+			lens[i] = size;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < count; i += BURST_SIZE) {
+			if (ll->sendBatch(pkts, lens, BURST_SIZE, 0) < 0) {
+				return 1;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "sent %d packets of %d bytes in %.3f s: %.0f pps\n", count, size, secs, count / secs);
+
 	} else { // invalid argument
 		printf("Invalid argument.");
 	}
 }
+#endif
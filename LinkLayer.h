@@ -1,30 +1,102 @@
 #ifndef LINKLAYER_H
 #define LINKLAYER_H
 
+#include <map>
 #include <vector>
 #include <string>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "constants.h"
 
 
 using namespace std;
 
+#define LINK_BACKEND_SOCKETS 0 // recvmmsg and sendmmsg
+#define LINK_BACKEND_URING 1 // io_uring, where the kernel has it
+
+class ShmRing;
+class ShmDoorbell;
+class UringReceiver;
+
+typedef struct {
+	int count; // number of packets held in the burst (buffers to fill, when passed to listenBatch)
+	int bufLen; // capacity of each buffer in bufs
+	char* bufs[BURST_SIZE];
+	int lens[BURST_SIZE];
+	int itfs[BURST_SIZE]; // interface each packet came in on, -1 if the link layer cannot tell
+	struct sockaddr_in addrs[BURST_SIZE]; // senders' addresses
+	struct iovec iovs[BURST_SIZE];
+	struct mmsghdr msgs[BURST_SIZE];
+} packet_burst;
+
+/**
+ * Point to point links carried over UDP, one datagram per IP packet, or over shared memory rings
+ * for interfaces configured with LINK_SHM. The transport methods are virtual so a node can run
+ * over another transport, such as MemLink's in-process queues, with the IP layer none the wiser.
+ */
 class LinkLayer {
 
 	private:
 		phy_info localPhy;
-		vector<itf_info> itfs;
-		struct addrinfo* localAI;
+		struct sockaddr_in localAddr;
 		int rcvSocket;
-		vector<int> sendSockets;
-		vector< vector<char> > packetQueue;
-		void start();
-		int createSocket(phy_info phyInfo, struct addrinfo* ai, bool bindSock);
+		int rcvFd; // rcvSocket, or the io_uring receiving from it
+		bool sharedPort; // rcvSocket was bound with SO_REUSEPORT, so openRcvSocket may join its port
+		int sendSocket; // rcvSocket, unless that could not be opened
+		vector<struct sockaddr_in> sendAddrs;
+		map<u_int64_t, int> hostItfs; // interface leading to each neighbor address and port, -1 if several do
+		vector<ShmRing*> shmTx; // per interface, NULL unless it runs over shared memory
+		vector<ShmRing*> shmRx;
+		vector<int> shmRxItfs; // interface of each of shmRx
+		ShmDoorbell* doorbell; // rings when a packet arrives on shmRx
+		int rcvEpoll; // the doorbell and rcvSocket, handed out as the receive socket; -1 without shmRx
+		bool udpItfs; // some interface is configured for UDP, or fell back to it
+		int nextShmRx; // ring drained first by the next burst
+		int backend;
+		map<int, UringReceiver*> urings; // by descriptor, handed out in place of the receive sockets
+		int createSocket(phy_info phyInfo, struct sockaddr_in* addrRet, bool bindSock, bool reusePort);
+		int resolveInterface(int itfNum);
+		void mapHosts();
+		int rcvInterface(const struct sockaddr_in* addr);
+		void attachShm();
+		int sendShm(const struct iovec* iov, const int* iovCounts, int count, int itfNum);
+		bool onShm(int itfNum);
+		bool shmJoined();
+		int recvBatch(int sock, packet_burst& burst, int first, int maxPkts, int flags);
+		int recvUdp(int sock, packet_burst& burst, int first, int maxPkts, bool block);
+		void setRcvInterfaces(packet_burst& burst, int first, int count);
+		int addUring(int sock);
+		int sendMsgs(struct mmsghdr* msgs, int count);
+		int drainShm(packet_burst& burst, int n, int maxPkts);
+		int listenShm(packet_burst& burst, bool block);
+
+	protected:
+		vector<itf_info> itfs;
+		vector<char> itfUp;
+
+		LinkLayer(vector<itf_info> itfs);
 
 	public:
-		LinkLayer(phy_info localPhy, vector<itf_info> itfs);
+		LinkLayer(phy_info localPhy, vector<itf_info> itfs, int backend = LINK_BACKEND_SOCKETS, int numRcvSockets = 1);
+		virtual ~LinkLayer();
 		int send(char* data, int dataLen, int itfNum);
+		virtual int sendv(const struct iovec* iov, int iovCount, int itfNum);
 		int listen(char* buf, int bufLen);
-		char* getInterfaceAddr(int itfNum);
+		int listenBatch(packet_burst& burst, bool block = true);
+		virtual int listenBatch(int sock, packet_burst& burst, bool block);
+		virtual int getRcvSocket();
+		virtual int openRcvSocket();
+		virtual int sendBatch(char** pkts, int* lens, int count, int itfNum);
+		virtual int sendvBatch(const struct iovec* iov, const int* iovCounts, int count, int itfNum);
+		u_int32_t getInterfaceAddr(int itfNum);
+		u_int32_t getRemoteAddr(int itfNum);
+		int getMtu(int itfNum);
+		int getMaxMtu();
+		int getNumInterfaces();
+		int setInterfaceUp(int itfNum, bool up);
+		bool isInterfaceUp(int itfNum);
+		int getBackend();
 };
 
 #endif
@@ -0,0 +1,845 @@
+#include <map>
+#include <vector>
+#include <queue>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+
+#include "LinkState.h"
+#include "FwdTable.h"
+#include "Log.h"
+#include "constants.h"
+
+using namespace std;
+
+Spf::Spf() {
+	stale = true;
+	addNode();
+	dist[0] = 0;
+}
+
+/**
+ * Adds an unreachable node with no edges. Returns its index.
+ */
+int Spf::addNode() {
+	adj.push_back(vector<spf_edge>());
+	dist.push_back(LS_INFINITY);
+	parent.push_back(-1);
+	firstHop.push_back(-1);
+	isChanged.push_back(0);
+	return adj.size() - 1;
+}
+
+int Spf::getNumNodes() {
+	return adj.size();
+}
+
+/**
+ * Returns true, with the edge's cost and hop, if u and v are joined by an edge
+ */
+bool Spf::getEdge(int u, int v, int* cost, int* hop) {
+	for (vector<spf_edge>::size_type i = 0; i != adj[u].size(); i++) {
+		if (adj[u][i].node == v) {
+			*cost = adj[u][i].cost;
+			*hop = adj[u][i].hop;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Joins u and v by an edge and lets the distances it shortens propagate from its far end.
+ * hop is our interface for an edge leaving the root, -1 otherwise.
+ */
+void Spf::addEdge(int u, int v, int cost, int hop) {
+	spf_edge e;
+	spf_heap heap;
+
+	e.cost = cost;
+	e.hop = hop;
+	e.node = v;
+	adj[u].push_back(e);
+	e.node = u;
+	adj[v].push_back(e);
+
+	if (stale) {
+		return;
+	}
+
+	// at most one end can get closer through the new edge
+	if (dist[v] != LS_INFINITY && dist[v] + cost < dist[u]) {
+		swap(u, v);
+	}
+	if (dist[u] != LS_INFINITY && dist[u] + cost < dist[v]) {
+		dist[v] = dist[u] + cost;
+		parent[v] = u;
+		firstHop[v] = (u == 0) ? hop : firstHop[u];
+		markChanged(v);
+		heap.push(spf_item(dist[v], v));
+		relax(heap);
+	}
+}
+
+/**
+ * Removes the edge joining u and v. If it was part of the tree, the subtree below it is
+ * recomputed; nothing else can have relied on it.
+ */
+void Spf::removeEdge(int u, int v) {
+	for (vector<spf_edge>::size_type i = 0; i != adj[u].size(); i++) {
+		if (adj[u][i].node == v) {
+			adj[u].erase(adj[u].begin() + i);
+			break;
+		}
+	}
+	for (vector<spf_edge>::size_type i = 0; i != adj[v].size(); i++) {
+		if (adj[v][i].node == u) {
+			adj[v].erase(adj[v].begin() + i);
+			break;
+		}
+	}
+
+	if (stale) {
+		return;
+	}
+
+	if (parent[v] == u) {
+		repairSubtree(v);
+	} else if (parent[u] == v) {
+		repairSubtree(u);
+	}
+}
+
+/**
+ * Removes every edge. The tree is left stale until the next full run.
+ */
+void Spf::clearEdges() {
+	for (vector< vector<spf_edge> >::size_type i = 0; i != adj.size(); i++) {
+		adj[i].clear();
+	}
+	stale = true;
+}
+
+/**
+ * Recomputes the subtree rooted at top after the edge to its parent went away. Its nodes start
+ * from the best edge into the rest of the tree, which is still correct, and Dijkstra finishes
+ * the job from there.
+ */
+void Spf::repairSubtree(int top) {
+	vector<int> sub;
+	spf_heap heap;
+
+	// children are the neighbors whose parent is the node at hand
+	sub.push_back(top);
+	parent[top] = -1;
+	for (vector<int>::size_type i = 0; i != sub.size(); i++) {
+		int x = sub[i];
+		for (vector<spf_edge>::size_type j = 0; j != adj[x].size(); j++) {
+			if (parent[adj[x][j].node] == x) {
+				sub.push_back(adj[x][j].node);
+			}
+		}
+		dist[x] = LS_INFINITY;
+		markChanged(x);
+	}
+	for (vector<int>::size_type i = 0; i != sub.size(); i++) {
+		parent[sub[i]] = -1;
+		firstHop[sub[i]] = -1;
+	}
+
+	for (vector<int>::size_type i = 0; i != sub.size(); i++) {
+		int x = sub[i];
+		for (vector<spf_edge>::size_type j = 0; j != adj[x].size(); j++) {
+			const spf_edge& e = adj[x][j];
+			if (dist[e.node] != LS_INFINITY && dist[e.node] + e.cost < dist[x]) {
+				dist[x] = dist[e.node] + e.cost;
+				parent[x] = e.node;
+				firstHop[x] = (e.node == 0) ? e.hop : firstHop[e.node];
+			}
+		}
+		if (dist[x] != LS_INFINITY) {
+			heap.push(spf_item(dist[x], x));
+		}
+	}
+
+	relax(heap);
+}
+
+/**
+ * Dijkstra from whatever the heap holds, updating the nodes it finds shorter paths to
+ */
+void Spf::relax(spf_heap& heap) {
+	while (!heap.empty()) {
+		int d = heap.top().first;
+		int u = heap.top().second;
+		heap.pop();
+
+		if (d > dist[u]) {
+			continue;
+		}
+		for (vector<spf_edge>::size_type i = 0; i != adj[u].size(); i++) {
+			const spf_edge& e = adj[u][i];
+			if (d + e.cost < dist[e.node]) {
+				dist[e.node] = d + e.cost;
+				parent[e.node] = u;
+				firstHop[e.node] = (u == 0) ? e.hop : firstHop[u];
+				markChanged(e.node);
+				heap.push(spf_item(dist[e.node], e.node));
+			}
+		}
+	}
+}
+
+/**
+ * Computes the whole tree from scratch. Every node is reported as changed.
+ */
+void Spf::runFull() {
+	spf_heap heap;
+
+	for (vector<int>::size_type i = 0; i != dist.size(); i++) {
+		dist[i] = LS_INFINITY;
+		parent[i] = -1;
+		firstHop[i] = -1;
+		markChanged(i);
+	}
+	dist[0] = 0;
+	heap.push(spf_item(0, 0));
+	relax(heap);
+	stale = false;
+}
+
+/**
+ * Brings the tree up to date, with a full run if edges changed while it was stale
+ */
+void Spf::run() {
+	if (stale) {
+		runFull();
+	}
+}
+
+void Spf::markChanged(int node) {
+	if (!isChanged[node]) {
+		isChanged[node] = 1;
+		changed.push_back(node);
+	}
+}
+
+int Spf::getDist(int node) {
+	return dist[node];
+}
+
+int Spf::getFirstHop(int node) {
+	return firstHop[node];
+}
+
+const vector<int>& Spf::getChanged() {
+	return changed;
+}
+
+void Spf::clearChanged() {
+	for (vector<int>::size_type i = 0; i != changed.size(); i++) {
+		isChanged[changed[i]] = 0;
+	}
+	changed.clear();
+}
+
+LinkState::LinkState(TimerWheel* timers, routing_send_cb sendCb, routing_route_cb routeCb, void* arg) {
+	this->timers = timers;
+	this->sendCb = sendCb;
+	this->routeCb = routeCb;
+	cbArg = arg;
+	rebuild = true;
+	originate = true;
+	TimerWheel::initTimer(&refreshTimer, onRefreshTimer, this);
+	TimerWheel::initTimer(&holdTimer, onHoldTimer, this);
+
+	lsdb.push_back(ls_lsa());
+	lsdb[0].routerId = 0;
+	lsdb[0].seq = 0;
+	lsdb[0].node = 0;
+	TimerWheel::initTimer(&lsdb[0].ageTimer, onAgeTimer, this);
+}
+
+LinkState::~LinkState() {
+	for (deque<ls_lsa>::size_type i = 0; i != lsdb.size(); i++) {
+		timers->cancel(&lsdb[i].ageTimer);
+	}
+	timers->cancel(&refreshTimer);
+	timers->cancel(&holdTimer);
+}
+
+u_int8_t LinkState::getProtocol() {
+	return LS_PROTOCOL;
+}
+
+/**
+ * Adds an interface with our address localAddr facing neighborAddr (network byte order).
+ * localAddr is delivered locally; our first address doubles as our router id.
+ * Returns the interface number.
+ */
+int LinkState::addInterface(u_int32_t localAddr, u_int32_t neighborAddr) {
+	int itfNum = neighbors.size();
+	route_entry* route;
+
+	if (itfNum == LS_MAX_ITFS) {
+		LOG_ERROR("Too many interfaces for link-state routing");
+		return -1;
+	}
+	neighbors.push_back(neighborAddr);
+	itfUp.push_back(1);
+
+	if (lsdb[0].addrs.empty()) {
+		lsdb[0].routerId = localAddr;
+		routers[localAddr] = 0;
+	}
+	lsdb[0].addrs.push_back(localAddr);
+	addrOwner[localAddr] = 0;
+
+	route = routingTable.insert(localAddr);
+	setRouteItf(route, FWD_LOCAL);
+	route->cost = 0;
+	routeCb(localAddr, FWD_LOCAL, cbArg);
+
+	rebuild = true;
+	originate = true;
+
+	return itfNum;
+}
+
+/**
+ * Floods our LSA, asks every neighbor for its database, and starts the refreshes
+ */
+void LinkState::start() {
+	ls_packet msg;
+
+	memset(&msg, 0, LS_HDR_SIZE);
+	msg.command = htons(LS_REQUEST);
+	msg.routerId = lsdb[0].routerId;
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (itfUp[i]) {
+			sendCb(i, (const char*) &msg, LS_HDR_SIZE, cbArg);
+		}
+	}
+
+	sendTriggered();
+	timers->schedule(&refreshTimer, LS_REFRESH_MS);
+}
+
+/**
+ * Returns the index of the router with the given id, adding it if it is new
+ */
+int LinkState::getRouter(u_int32_t routerId) {
+	map<u_int32_t, int>::iterator it = routers.find(routerId);
+	int node;
+
+	if (it != routers.end()) {
+		return it->second;
+	}
+
+	node = spf.addNode();
+	lsdb.push_back(ls_lsa());
+	lsdb[node].routerId = routerId;
+	lsdb[node].seq = 0;
+	lsdb[node].node = node;
+	TimerWheel::initTimer(&lsdb[node].ageTimer, onAgeTimer, this);
+	routers[routerId] = node;
+
+	return node;
+}
+
+/**
+ * Returns true, with the link's cost, if router from advertises a link to router to
+ */
+bool LinkState::listsLink(int from, int to, u_int32_t* cost) {
+	const vector<ls_link>& links = lsdb[from].links;
+
+	for (vector<ls_link>::size_type i = 0; i != links.size(); i++) {
+		map<u_int32_t, int>::iterator owner = addrOwner.find(links[i].address);
+		if (owner != addrOwner.end() && owner->second == to) {
+			*cost = links[i].cost;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Returns the first working interface to a neighboring router, or -1
+ */
+int LinkState::hopTo(int node) {
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		map<u_int32_t, int>::iterator owner = addrOwner.find(neighbors[i]);
+		if (itfUp[i] && owner != addrOwner.end() && owner->second == node) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Brings the SPF edge between routers a and b in line with their LSAs. A link only counts
+ * once both ends advertise it.
+ */
+void LinkState::updatePair(int a, int b) {
+	u_int32_t costAB, costBA;
+	int cost = 0, hop = -1, curCost, curHop;
+	bool want = listsLink(a, b, &costAB) && listsLink(b, a, &costBA);
+	bool have = spf.getEdge(a, b, &curCost, &curHop);
+
+	if (want) {
+		cost = (costAB > costBA) ? costAB : costBA;
+		if (a == 0 || b == 0) {
+			hop = hopTo(a == 0 ? b : a);
+			want = hop >= 0;
+		}
+	}
+
+	if (have && (!want || curCost != cost || curHop != hop)) {
+		spf.removeEdge(a, b);
+		have = false;
+	}
+	if (want && !have) {
+		spf.addEdge(a, b, cost, hop);
+	}
+}
+
+/**
+ * Replaces a router's links, updating the edges to every router on either side of the change
+ */
+void LinkState::setLinks(int node, const vector<ls_link>& links) {
+	vector<ls_link> old = lsdb[node].links;
+
+	lsdb[node].links = links;
+	if (rebuild) {
+		return;
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		const vector<ls_link>& side = (pass == 0) ? old : links;
+		for (vector<ls_link>::size_type i = 0; i != side.size(); i++) {
+			map<u_int32_t, int>::iterator owner = addrOwner.find(side[i].address);
+			if (owner != addrOwner.end() && owner->second != node) {
+				updatePair(node, owner->second);
+			}
+		}
+	}
+}
+
+/**
+ * Replaces a router's addresses. Links to them resolve differently afterwards, so the graph is
+ * rebuilt before the next SPF run.
+ */
+void LinkState::setAddrs(int node, const vector<u_int32_t>& addrs) {
+	if (lsdb[node].addrs == addrs) {
+		return;
+	}
+
+	for (vector<u_int32_t>::size_type i = 0; i != lsdb[node].addrs.size(); i++) {
+		map<u_int32_t, int>::iterator owner = addrOwner.find(lsdb[node].addrs[i]);
+		if (owner != addrOwner.end() && owner->second == node) {
+			addrOwner.erase(owner);
+		}
+	}
+	for (vector<u_int32_t>::size_type i = 0; i != addrs.size(); i++) {
+		addrOwner[addrs[i]] = node;
+	}
+	lsdb[node].addrs = addrs;
+	rebuild = true;
+}
+
+/**
+ * Derives every edge from the LSAs again and runs SPF from scratch
+ */
+void LinkState::rebuildGraph() {
+	rebuild = false;
+	spf.clearEdges();
+	for (deque<ls_lsa>::size_type a = 0; a != lsdb.size(); a++) {
+		for (vector<ls_link>::size_type i = 0; i != lsdb[a].links.size(); i++) {
+			map<u_int32_t, int>::iterator owner = addrOwner.find(lsdb[a].links[i].address);
+			if (owner != addrOwner.end() && owner->second != (int) a) {
+				updatePair(a, owner->second);
+			}
+		}
+	}
+	spf.runFull();
+}
+
+/**
+ * Advertises a link to the neighbor on every interface that is up, under a new sequence number
+ */
+void LinkState::originateLsa() {
+	vector<ls_link> links;
+	ls_packet msg;
+
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (itfUp[i]) {
+			ls_link link;
+			link.address = neighbors[i];
+			link.cost = 1;
+			links.push_back(link);
+		}
+	}
+
+	lsdb[0].seq++;
+	setLinks(0, links);
+	flood((const char*) &msg, buildPacket(0, &msg), -1);
+	originate = false;
+}
+
+/**
+ * Points the route to dest at the first hop towards router node, or withdraws it if node is
+ * unreachable
+ */
+void LinkState::setRoute(u_int32_t dest, int node) {
+	int dist = spf.getDist(node);
+	int itfNum = spf.getFirstHop(node);
+	route_entry* route = routingTable.find(dest);
+
+	if (route != NULL && routeItf(route) == FWD_LOCAL) {
+		return;
+	}
+
+	if (dist == LS_INFINITY || itfNum < 0) {
+		if (route != NULL) {
+			routeCb(dest, FWD_NO_ROUTE, cbArg);
+			routingTable.erase(dest);
+		}
+		return;
+	}
+
+	if (route == NULL || routeItf(route) != itfNum) {
+		routeCb(dest, itfNum, cbArg);
+	}
+	route = routingTable.insert(dest);
+	setRouteItf(route, itfNum);
+	route->cost = (dist < LS_MAX_COST) ? dist : LS_MAX_COST;
+}
+
+/**
+ * Updates the routes to the addresses of every router SPF touched
+ */
+void LinkState::installRoutes() {
+	const vector<int>& changed = spf.getChanged();
+
+	for (vector<int>::size_type i = 0; i != changed.size(); i++) {
+		const vector<u_int32_t>& addrs = lsdb[changed[i]].addrs;
+		for (vector<u_int32_t>::size_type j = 0; j != addrs.size(); j++) {
+			setRoute(addrs[j], changed[i]);
+		}
+	}
+	spf.clearChanged();
+}
+
+/**
+ * Re-floods our LSA if it is out of date and brings the routes in line with the database. After
+ * an origination, further ones are held down and go out together when the hold-down ends.
+ */
+void LinkState::sendTriggered() {
+	if (originate && !TimerWheel::isPending(&holdTimer)) {
+		originateLsa();
+		timers->schedule(&holdTimer, TRIGGER_HOLDDOWN_MS);
+	}
+
+	if (rebuild) {
+		rebuildGraph();
+
+		// drop routes to addresses that have no owner any more
+		for (int i = routingTable.size() - 1; i >= 0; i--) {
+			const route_entry* route = routingTable.at(i);
+			if (routeItf(route) != FWD_LOCAL && addrOwner.find(route->prefix) == addrOwner.end()) {
+				routeCb(route->prefix, FWD_NO_ROUTE, cbArg);
+				routingTable.erase(route->prefix);
+			}
+		}
+	} else {
+		spf.run();
+	}
+
+	installRoutes();
+}
+
+/**
+ * Re-floods our LSA so it does not age out elsewhere
+ */
+void LinkState::sendPeriodic() {
+	originateLsa();
+}
+
+void LinkState::onRefreshTimer(wheel_timer* timer, void* arg) {
+	LinkState* ls = (LinkState*) arg;
+
+	ls->sendPeriodic();
+	ls->timers->schedule(timer, LS_REFRESH_MS);
+}
+
+void LinkState::onHoldTimer(wheel_timer* timer, void* arg) {
+	LinkState* ls = (LinkState*) arg;
+
+	if (ls->originate) {
+		ls->sendTriggered();
+	}
+}
+
+/**
+ * Forgets a router whose LSA was not refreshed within LS_MAX_AGE_MS
+ */
+void LinkState::onAgeTimer(wheel_timer* timer, void* arg) {
+	LinkState* ls = (LinkState*) arg;
+	ls_lsa* lsa = (ls_lsa*) ((char*) timer - offsetof(ls_lsa, ageTimer));
+
+	ls->setLinks(lsa->node, vector<ls_link>());
+	ls->setAddrs(lsa->node, vector<u_int32_t>());
+	ls->sendTriggered();
+}
+
+/**
+ * Brings an interface up or down. Our LSA is re-flooded on the next sendTriggered; on the way
+ * up the neighbor is also asked for its database.
+ */
+void LinkState::setInterfaceUp(int itfNum, bool up) {
+	if (itfNum < 0 || itfNum >= (int) neighbors.size() || (bool) itfUp[itfNum] == up) {
+		return;
+	}
+	itfUp[itfNum] = up;
+	originate = true;
+
+	if (up) {
+		ls_packet msg;
+		memset(&msg, 0, LS_HDR_SIZE);
+		msg.command = htons(LS_REQUEST);
+		msg.routerId = lsdb[0].routerId;
+		sendCb(itfNum, (const char*) &msg, LS_HDR_SIZE, cbArg);
+	}
+}
+
+/**
+ * Serializes router node's LSA into msg. Returns the message length.
+ */
+int LinkState::buildPacket(int node, ls_packet* msg) {
+	const ls_lsa& lsa = lsdb[node];
+	int n = 0;
+
+	msg->command = htons(LS_UPDATE);
+	msg->numAddrs = htons(lsa.addrs.size());
+	msg->numLinks = htons(lsa.links.size());
+	msg->reserved = 0;
+	msg->routerId = lsa.routerId;
+	msg->seq = htonl(lsa.seq);
+	for (vector<u_int32_t>::size_type i = 0; i != lsa.addrs.size(); i++) {
+		msg->data[n++] = lsa.addrs[i];
+	}
+	for (vector<ls_link>::size_type i = 0; i != lsa.links.size(); i++) {
+		msg->data[n++] = lsa.links[i].address;
+		msg->data[n++] = htonl(lsa.links[i].cost);
+	}
+
+	return LS_HDR_SIZE + n * sizeof(u_int32_t);
+}
+
+void LinkState::sendLsa(int itfNum, int node) {
+	ls_packet msg;
+	int len = buildPacket(node, &msg);
+	sendCb(itfNum, (const char*) &msg, len, cbArg);
+}
+
+/**
+ * Sends a message out of every interface that is up except exceptItf
+ */
+void LinkState::flood(const char* msg, int len, int exceptItf) {
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (itfUp[i] && (int) i != exceptItf) {
+			sendCb(i, msg, len, cbArg);
+		}
+	}
+}
+
+/**
+ * Handles a link-state message from the neighbor at saddr (network byte order). Route changes
+ * are batched until the next call to sendTriggered. Returns 0, or -1 if the message was
+ * discarded.
+ */
+int LinkState::handlePacket(u_int32_t saddr, const char* msg, int len) {
+	const ls_packet* pkt = (const ls_packet*) msg;
+	int itfNum = -1;
+
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (neighbors[i] == saddr && itfUp[i]) {
+			itfNum = i;
+			break;
+		}
+	}
+	if (itfNum < 0) {
+		LOG_DEBUG("Link-state message from unknown neighbor, discarding");
+		return -1;
+	}
+
+	if (len < (int) LS_HDR_SIZE) {
+		LOG_WARN("Partial link-state message received, discarding");
+		return -1;
+	}
+
+	switch (ntohs(pkt->command)) {
+		case LS_REQUEST:
+			for (deque<ls_lsa>::size_type i = 0; i != lsdb.size(); i++) {
+				if (i == 0 || TimerWheel::isPending(&lsdb[i].ageTimer)) {
+					sendLsa(itfNum, i);
+				}
+			}
+			break;
+		case LS_UPDATE:
+			handleUpdate(itfNum, pkt, len);
+			break;
+		default:
+			LOG_WARN("Unknown link-state command, discarding");
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Stores an LSA that is newer than the one we have and floods it on to the other neighbors
+ */
+void LinkState::handleUpdate(int itfNum, const ls_packet* msg, int len) {
+	int numAddrs = ntohs(msg->numAddrs);
+	int numLinks = ntohs(msg->numLinks);
+	int msgLen = LS_HDR_SIZE + (numAddrs + 2 * numLinks) * sizeof(u_int32_t);
+	u_int32_t seq = ntohl(msg->seq);
+	vector<u_int32_t> addrs;
+	vector<ls_link> links;
+	int node;
+
+	if (numAddrs > LS_MAX_ITFS || numLinks > LS_MAX_ITFS || len < msgLen) {
+		LOG_WARN("Malformed link-state message, discarding");
+		return;
+	}
+
+	// an LSA from an earlier run of ours: take over its sequence number and re-flood
+	if (msg->routerId == lsdb[0].routerId) {
+		if (seq >= lsdb[0].seq) {
+			lsdb[0].seq = seq;
+			originate = true;
+		}
+		return;
+	}
+
+	node = getRouter(msg->routerId);
+	if (TimerWheel::isPending(&lsdb[node].ageTimer) && seq <= lsdb[node].seq) {
+		return;
+	}
+	lsdb[node].seq = seq;
+	timers->schedule(&lsdb[node].ageTimer, LS_MAX_AGE_MS);
+
+	addrs.assign(msg->data, msg->data + numAddrs);
+	for (int i = 0; i < numLinks; i++) {
+		ls_link link;
+		link.address = msg->data[numAddrs + 2 * i];
+		link.cost = ntohl(msg->data[numAddrs + 2 * i + 1]);
+		links.push_back(link);
+	}
+	setAddrs(node, addrs);
+	setLinks(node, links);
+
+	flood((const char*) msg, msgLen, itfNum);
+}
+
+const RouteTable& LinkState::getRoutes() {
+	return routingTable;
+}
+
+#ifdef LINKSTATE_MAIN
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * SPF benchmark: builds a random connected graph (a ring with random chords and random costs),
+ * then times full SPF runs against incremental repairs after removing and re-adding single
+ * edges. Every repaired tree is checked against a full run.
+ */
+
+static double elapsedUs(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e6 + (end.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static bool sameDists(Spf& spf) {
+	Spf ref = spf;
+	ref.runFull();
+	for (int i = 0; i < spf.getNumNodes(); i++) {
+		if (spf.getDist(i) != ref.getDist(i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* lsbench [nodes] [degree] [trials] [seed] */
+int main(int argc, char** argv) {
+	int numNodes = (argc > 1) ? atoi(argv[1]) : 1000;
+	int degree = (argc > 2) ? atoi(argv[2]) : 4;
+	int trials = (argc > 3) ? atoi(argv[3]) : 1000;
+	unsigned seed = (argc > 4) ? atoi(argv[4]) : 1;
+	vector< pair<int, int> > edges;
+	Spf spf;
+	struct timespec start;
+	double fullUs = 0, removeUs = 0, addUs = 0;
+	long affected = 0;
+	int rootHops = 0, mismatches = 0;
+
+	srand(seed);
+	for (int i = 1; i < numNodes; i++) {
+		spf.addNode();
+	}
+	for (int i = 0; i < numNodes * degree / 2; i++) {
+		int u = (i < numNodes) ? i : rand() % numNodes;
+		int v = (i < numNodes) ? (i + 1) % numNodes : rand() % numNodes;
+		int cost, hop;
+		if (u == v || spf.getEdge(u, v, &cost, &hop)) {
+			i--;
+			continue;
+		}
+		spf.addEdge(u, v, 1 + rand() % 10, (u == 0 || v == 0) ? rootHops++ : -1);
+		edges.push_back(make_pair(u, v));
+	}
+
+	for (int t = 0; t < trials; t++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		spf.runFull();
+		fullUs += elapsedUs(&start);
+	}
+	spf.clearChanged();
+
+	for (int t = 0; t < trials; t++) {
+		pair<int, int> e = edges[rand() % edges.size()];
+		int cost = 0, hop = -1;
+
+		spf.getEdge(e.first, e.second, &cost, &hop);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		spf.removeEdge(e.first, e.second);
+		removeUs += elapsedUs(&start);
+		affected += spf.getChanged().size();
+		spf.clearChanged();
+		if (t < 100 && !sameDists(spf)) {
+			mismatches++;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		spf.addEdge(e.first, e.second, cost, hop);
+		addUs += elapsedUs(&start);
+		affected += spf.getChanged().size();
+		spf.clearChanged();
+		if (t < 100 && !sameDists(spf)) {
+			mismatches++;
+		}
+	}
+
+	printf("nodes=%d edges=%d trials=%d full_us=%.2f incr_remove_us=%.2f incr_add_us=%.2f avg_affected=%.1f mismatches=%d\n",
+			numNodes, (int) edges.size(), trials, fullUs / trials, removeUs / trials, addUs / trials,
+			(double) affected / (2 * trials), mismatches);
+
+	return mismatches != 0;
+}
+#endif
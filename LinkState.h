@@ -0,0 +1,161 @@
+#ifndef LINKSTATE_H
+#define LINKSTATE_H
+
+#include <map>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <sys/types.h>
+#include "constants.h"
+#include "RoutingProtocol.h"
+#include "RouteTable.h"
+#include "TimerWheel.h"
+
+using namespace std;
+
+#define LS_PROTOCOL 201
+#define LS_REQUEST 1
+#define LS_UPDATE 2
+#define LS_MAX_ITFS 64
+#define LS_REFRESH_MS 30000 // own advertisement is re-flooded this often
+#define LS_MAX_AGE_MS 90000 // advertisements not refreshed for this long are dropped
+#define LS_INFINITY 0x7FFFFFFF
+#define LS_MAX_COST 255 // route costs are stored in a byte; longer paths show as this
+
+/**
+ * Wire format of a link-state message, all fields in network byte order. An update carries one
+ * link-state advertisement (LSA): the router's addresses followed by one (neighbor address, cost)
+ * pair per link. A request carries no data and asks the neighbor for its whole database.
+ */
+typedef struct {
+	u_int16_t command;
+	u_int16_t numAddrs;
+	u_int16_t numLinks;
+	u_int16_t reserved;
+	u_int32_t routerId;
+	u_int32_t seq;
+	u_int32_t data[3 * LS_MAX_ITFS];
+} ls_packet;
+
+#define LS_HDR_SIZE (4 * sizeof(u_int16_t) + 2 * sizeof(u_int32_t))
+
+typedef struct {
+	u_int32_t address; // neighbor's address on the link
+	u_int32_t cost;
+} ls_link;
+
+typedef struct {
+	u_int32_t routerId;
+	u_int32_t seq;
+	int node; // index in the database and the SPF graph
+	wheel_timer ageTimer; // pending while the LSA is live; never for our own
+	vector<u_int32_t> addrs;
+	vector<ls_link> links;
+} ls_lsa;
+
+typedef struct {
+	int node;
+	int cost;
+	int hop; // our interface, for edges leaving the root
+} spf_edge;
+
+/**
+ * Shortest path tree over an undirected graph, rooted at node 0. Besides computing the tree from
+ * scratch, it repairs it in place when a single edge is added or removed: an added edge only
+ * propagates the distances it shortens, and removing a tree edge only recomputes the subtree
+ * that hung off it. Nodes whose distance or first hop may have changed are collected for the
+ * caller.
+ */
+class Spf {
+
+	private:
+		typedef pair<int, int> spf_item; // (distance, node)
+		typedef priority_queue< spf_item, vector<spf_item>, greater<spf_item> > spf_heap;
+
+		vector< vector<spf_edge> > adj;
+		vector<int> dist;
+		vector<int> parent;
+		vector<int> firstHop;
+		vector<char> isChanged;
+		vector<int> changed;
+		bool stale; // edges changed without repairing the tree; a full run is due
+
+		void markChanged(int node);
+		void relax(spf_heap& heap);
+		void repairSubtree(int root);
+
+	public:
+		Spf();
+		int addNode();
+		int getNumNodes();
+		bool getEdge(int u, int v, int* cost, int* hop);
+		void addEdge(int u, int v, int cost, int hop);
+		void removeEdge(int u, int v);
+		void clearEdges();
+		void runFull();
+		void run();
+		int getDist(int node);
+		int getFirstHop(int node);
+		const vector<int>& getChanged();
+		void clearChanged();
+};
+
+/**
+ * Link-state routing engine. Each router floods an LSA listing its addresses and the neighbors
+ * it has working links to; every router keeps the LSAs in a database and runs SPF over the links
+ * both ends advertise. LSAs are re-flooded every LS_REFRESH_MS and dropped after LS_MAX_AGE_MS
+ * without a refresh; our own is originated at most once per TRIGGER_HOLDDOWN_MS. A change to one
+ * router's links is applied to the shortest path tree incrementally; new routers or addresses
+ * rebuild it.
+ */
+class LinkState : public RoutingProtocol {
+
+	private:
+		RouteTable routingTable; // host routes, keyed by destination
+		deque<ls_lsa> lsdb; // indexed like the SPF nodes; entry 0 is our own. A deque, as LSAs hold timers
+		map<u_int32_t, int> routers; // router id -> index
+		map<u_int32_t, int> addrOwner; // address -> index of the router it belongs to
+		vector<u_int32_t> neighbors; // neighbor address on each interface
+		vector<char> itfUp;
+		Spf spf;
+		bool rebuild; // addresses changed, so every edge has to be derived again
+		bool originate; // our own LSA is out of date
+		TimerWheel* timers;
+		wheel_timer refreshTimer;
+		wheel_timer holdTimer; // pending while origination is held down
+		routing_send_cb sendCb;
+		routing_route_cb routeCb;
+		void* cbArg;
+
+		int getRouter(u_int32_t routerId);
+		bool listsLink(int from, int to, u_int32_t* cost);
+		int hopTo(int node);
+		void updatePair(int a, int b);
+		void setLinks(int node, const vector<ls_link>& links);
+		void setAddrs(int node, const vector<u_int32_t>& addrs);
+		void rebuildGraph();
+		void originateLsa();
+		void installRoutes();
+		void setRoute(u_int32_t dest, int node);
+		int buildPacket(int node, ls_packet* msg);
+		void sendLsa(int itfNum, int node);
+		void flood(const char* msg, int len, int exceptItf);
+		void handleUpdate(int itfNum, const ls_packet* msg, int len);
+		static void onAgeTimer(wheel_timer* timer, void* arg);
+		static void onRefreshTimer(wheel_timer* timer, void* arg);
+		static void onHoldTimer(wheel_timer* timer, void* arg);
+
+	public:
+		LinkState(TimerWheel* timers, routing_send_cb sendCb, routing_route_cb routeCb, void* arg);
+		~LinkState();
+		u_int8_t getProtocol();
+		int addInterface(u_int32_t localAddr, u_int32_t neighborAddr);
+		void start();
+		int handlePacket(u_int32_t saddr, const char* msg, int len);
+		void sendPeriodic();
+		void sendTriggered();
+		void setInterfaceUp(int itfNum, bool up);
+		const RouteTable& getRoutes();
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include <vector>
+#include <pthread.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "Log.h"
+#include "Ring.h"
+
+using namespace std;
+
+#define LOG_WRITE_BUF (64 << 10) // bytes the background thread gathers per write
+
+/*
+ * Each thread that logs gets a ring of message records of its own, so logging threads never
+ * contend. A message is formatted straight into its slot by the calling thread and published by
+ * advancing the ring's tail. A background thread drains every ring and writes what it found
+ * with one write per LOG_WRITE_BUF bytes. It sleeps on a futex while the rings are empty; the
+ * first message logged after it goes to sleep wakes it, and it then gives other messages
+ * LOG_FLUSH_MS to pile up before it drains, so a busy node pays for one wakeup per LOG_FLUSH_MS
+ * and an idle one for none. Messages of one thread come out in order; those of different threads
+ * are ordered by ring, and carry timestamps to sort by.
+ */
+
+typedef struct {
+	u_int64_t ms; // wall clock
+	int level;
+	char text[LOG_MSG_LEN];
+} log_record;
+
+typedef struct {
+	log_record records[LOG_RING_SIZE];
+	u_int32_t head __attribute__((aligned(CACHE_LINE))); // next record to drain
+	u_int64_t reported; // drops already written out
+	u_int32_t tail __attribute__((aligned(CACHE_LINE))); // next record to fill
+	u_int64_t dropped; // messages lost to a full ring
+} log_ring;
+
+int logLevel = LOG_LEVEL_INFO;
+static int logFd = STDOUT_FILENO;
+static vector<log_ring*> rings;
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drainLock = PTHREAD_MUTEX_INITIALIZER; // one drainer at a time
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+static u_int32_t drainerWaiting __attribute__((aligned(CACHE_LINE))); // set by the drainer about to sleep
+static u_int32_t drainerBell; // futex word, bumped by the thread that wakes it
+static __thread log_ring* threadRing = NULL;
+
+static const char* levelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+static u_int64_t nowMs(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (u_int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Writes all len bytes of buf to the log descriptor
+ */
+static void writeAll(const char* buf, int len) {
+	while (len > 0) {
+		ssize_t n = write(logFd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/**
+ * Writes out every message queued on every ring. Caller holds drainLock.
+ */
+static void drain() {
+	static char buf[LOG_WRITE_BUF];
+	int len = 0;
+	vector<log_ring*> all;
+
+	pthread_mutex_lock(&ringsLock);
+	all = rings;
+	pthread_mutex_unlock(&ringsLock);
+
+	for (vector<log_ring*>::size_type i = 0; i != all.size(); i++) {
+		log_ring* ring = all[i];
+		u_int32_t head = ring->head;
+		u_int32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		u_int64_t dropped;
+
+		for (; head != tail; head++) {
+			log_record* rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+			time_t secs = rec->ms / 1000;
+			struct tm tm;
+			int textLen = strnlen(rec->text, LOG_MSG_LEN);
+
+			// leave room for the longest line: the stamp, the level, the text and a newline
+			if (len + LOG_MSG_LEN + 64 > LOG_WRITE_BUF) {
+				writeAll(buf, len);
+				len = 0;
+			}
+			while (textLen > 0 && rec->text[textLen - 1] == '\n') {
+				textLen--;
+			}
+			localtime_r(&secs, &tm);
+			len += strftime(buf + len, 32, "%Y-%m-%d %H:%M:%S", &tm);
+			len += snprintf(buf + len, 64, ".%03d %s ", (int) (rec->ms % 1000), logLevelName(rec->level));
+			memcpy(buf + len, rec->text, textLen);
+			len += textLen;
+			buf[len++] = '\n';
+		}
+		// the records are free for the producer once head moves past them
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+		if ((dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED)) != ring->reported) {
+			if (len + 128 > LOG_WRITE_BUF) {
+				writeAll(buf, len);
+				len = 0;
+			}
+			len += snprintf(buf + len, 128, "%llu log messages dropped, ring full\n",
+					(unsigned long long) (dropped - ring->reported));
+			ring->reported = dropped;
+		}
+	}
+
+	writeAll(buf, len);
+}
+
+/**
+ * Returns true if some ring holds messages not yet drained
+ */
+static bool pending() {
+	bool found = false;
+
+	pthread_mutex_lock(&ringsLock);
+	for (vector<log_ring*>::size_type i = 0; i != rings.size() && !found; i++) {
+		found = __atomic_load_n(&rings[i]->tail, __ATOMIC_SEQ_CST) != __atomic_load_n(&rings[i]->head, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&ringsLock);
+
+	return found;
+}
+
+/**
+ * Wakes the drainer, only if it is asleep or about to be. Called after publishing a message.
+ */
+static void wakeDrain() {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&drainerWaiting, __ATOMIC_RELAXED) && __atomic_exchange_n(&drainerWaiting, 0, __ATOMIC_ACQ_REL)) {
+		__atomic_add_fetch(&drainerBell, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &drainerBell, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+/**
+ * Sleeps until a message is logged, waits LOG_FLUSH_MS for more to gather, drains, and over.
+ * The bell is read before the drainer says it is waiting and the rings are checked after, so a
+ * message published at any point either is seen by the check or bumps the bell it waits on.
+ */
+static void* runDrain(void* arg) {
+	struct timespec delay;
+
+	delay.tv_sec = 0;
+	delay.tv_nsec = LOG_FLUSH_MS * 1000000L;
+	while (1) {
+		u_int32_t bell = __atomic_load_n(&drainerBell, __ATOMIC_ACQUIRE);
+
+		__atomic_store_n(&drainerWaiting, 1, __ATOMIC_SEQ_CST);
+		if (!pending()) {
+			syscall(SYS_futex, &drainerBell, FUTEX_WAIT_PRIVATE, bell, NULL, NULL, 0);
+		}
+		__atomic_store_n(&drainerWaiting, 0, __ATOMIC_RELAXED);
+
+		nanosleep(&delay, NULL);
+		logFlush();
+	}
+
+	return NULL;
+}
+
+/**
+ * Starts the background thread, on the first message logged, and drains the rings once more at
+ * exit so nothing logged before exit is lost
+ */
+static void startDrain() {
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, runDrain, NULL) != 0) {
+		perror("Threading error:");
+		return;
+	}
+	pthread_detach(thread);
+	atexit(logFlush);
+}
+
+/**
+ * Returns the calling thread's ring, creating it on the thread's first message
+ */
+static log_ring* getRing() {
+	if (threadRing == NULL) {
+		log_ring* ring = new log_ring();
+
+		pthread_mutex_lock(&ringsLock);
+		rings.push_back(ring);
+		pthread_mutex_unlock(&ringsLock);
+		threadRing = ring;
+		pthread_once(&startOnce, startDrain);
+	}
+
+	return threadRing;
+}
+
+/**
+ * Queues a message for the background thread, unless its call site has already logged
+ * LOG_RATE_LIMIT messages this second or the thread's ring is full. The first message of a new
+ * second says how many were skipped in the last. Use the LOG_ macros rather than calling this.
+ */
+void logWrite(log_site* site, int level, const char* fmt, ...) {
+	u_int64_t now = nowMs(CLOCK_MONOTONIC_COARSE);
+	u_int64_t start = __atomic_load_n(&site->windowStart, __ATOMIC_RELAXED);
+	u_int32_t skipped = 0;
+	va_list args;
+
+	// a new window: whoever opens it reports the messages skipped in the last one
+	if (now - start >= 1000 && __atomic_compare_exchange_n(&site->windowStart, &start, now, false,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		skipped = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+	}
+	if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) > LOG_RATE_LIMIT) {
+		__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	log_ring* ring = getRing();
+	u_int32_t tail = ring->tail;
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	log_record* rec = &ring->records[tail & (LOG_RING_SIZE - 1)];
+	rec->ms = nowMs(CLOCK_REALTIME_COARSE);
+	rec->level = level;
+	va_start(args, fmt);
+	int len = vsnprintf(rec->text, LOG_MSG_LEN, fmt, args);
+	va_end(args);
+	if (skipped > 0 && len >= 0 && len < LOG_MSG_LEN) {
+		snprintf(rec->text + len, LOG_MSG_LEN - len, " (%u more suppressed)", skipped);
+	}
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	wakeDrain();
+}
+
+/**
+ * Sets the lowest level logged from now on. Levels compiled out stay out.
+ */
+void logSetLevel(int level) {
+	__atomic_store_n(&logLevel, level, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the level named name, as in "debug" or "WARN", or -1 if there is none
+ */
+int logParseLevel(const char* name) {
+	for (int i = 0; i < (int) (sizeof(levelNames) / sizeof(levelNames[0])); i++) {
+		if (strcasecmp(name, levelNames[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char* logLevelName(int level) {
+	return (level >= 0 && level < (int) (sizeof(levelNames) / sizeof(levelNames[0]))) ? levelNames[level] : "?";
+}
+
+/**
+ * Sends log output to fd instead of stdout
+ */
+void logSetOutput(int fd) {
+	pthread_mutex_lock(&drainLock);
+	logFd = fd;
+	pthread_mutex_unlock(&drainLock);
+}
+
+/**
+ * Writes out everything logged so far, on the calling thread
+ */
+void logFlush() {
+	pthread_mutex_lock(&drainLock);
+	drain();
+	pthread_mutex_unlock(&drainLock);
+}
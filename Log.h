@@ -0,0 +1,55 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <sys/types.h>
+
+#define LOG_LEVEL_DEBUG 0 // per packet events, most of them also counted by Stats
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2 // the node is losing packets or refusing work it should be able to do
+#define LOG_LEVEL_ERROR 3
+
+// levels below this are compiled out; build with -DLOG_COMPILE_LEVEL=1 to drop every debug call
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_MSG_LEN 200 // longer messages are truncated
+#define LOG_RING_SIZE 256 // messages buffered per thread, must be a power of two
+#define LOG_RATE_LIMIT 10 // messages per call site per second; the rest are counted and skipped
+#define LOG_FLUSH_MS 20 // how long the background thread lets messages gather once woken
+
+/**
+ * Per call site state for rate limiting. One is declared static by each expansion of LOG_AT.
+ */
+typedef struct {
+	u_int64_t windowStart; // ms
+	u_int32_t count; // messages let through since windowStart
+	u_int32_t suppressed; // and skipped
+} log_site;
+
+extern int logLevel;
+
+/**
+ * Logs a printf style message at level, if both the build and the current log level let it
+ * through. A call below the level costs one load and a branch; nothing is formatted.
+ */
+#define LOG_AT(level, ...) do { \
+	if ((level) >= LOG_COMPILE_LEVEL && (level) >= __atomic_load_n(&logLevel, __ATOMIC_RELAXED)) { \
+		static log_site logSite = { 0, 0, 0 }; \
+		logWrite(&logSite, (level), __VA_ARGS__); \
+	} \
+} while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+void logWrite(log_site* site, int level, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+void logSetLevel(int level);
+int logParseLevel(const char* name);
+const char* logLevelName(int level);
+void logSetOutput(int fd);
+void logFlush();
+
+#endif
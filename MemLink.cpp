@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "MemLink.h"
+#include "Log.h"
+
+/**
+ * Returns the number of pool buffers for packets of up to maxMtu bytes, at most MEM_POOL_BYTES
+ */
+static int poolSize(int maxMtu) {
+	int count = MEM_POOL_BYTES / (maxMtu + PKT_HEADROOM);
+	return (count < MEM_POOL_SIZE) ? count : MEM_POOL_SIZE;
+}
+
+MemNetwork::MemNetwork(int maxMtu) : smallPool(MEM_SMALL_PKT, MEM_SMALL_POOL_SIZE), pool(maxMtu, poolSize(maxMtu)) {
+}
+
+/**
+ * Adds link to the network. Returns its node id.
+ */
+int MemNetwork::attach(MemLink* link) {
+	nodes.push_back(link);
+	return nodes.size() - 1;
+}
+
+MemLink* MemNetwork::getNode(int nodeId) {
+	return nodes[nodeId];
+}
+
+int MemNetwork::getNumNodes() {
+	return nodes.size();
+}
+
+/**
+ * Returns the pool to take a buffer for a len byte packet from
+ */
+PacketPool* MemNetwork::getPool(int len) {
+	return (len <= MEM_SMALL_PKT) ? &smallPool : &pool;
+}
+
+/**
+ * Returns the longest packet the network carries
+ */
+int MemNetwork::getMaxLen() {
+	return pool.getDataSize();
+}
+
+/**
+ * Creates the link layer of a node in net, with peers[i] the node on the other end of itfs[i]
+ */
+MemLink::MemLink(MemNetwork* net, vector<itf_info> itfs, vector<int> peers) : LinkLayer(itfs) {
+	this->net = net;
+	this->peers = peers;
+	rmtItfs.assign(peers.size(), -1);
+	nodeId = net->attach(this);
+	txPackets = 0;
+	rxPackets = 0;
+	drops = 0;
+
+	openRcvSocket();
+}
+
+MemLink::~MemLink() {
+	for (vector<MpscRing*>::size_type i = 0; i != queues.size(); i++) {
+		pkt_buf* pkt;
+
+		while (queues[i]->dequeueBurst((void**) &pkt, 1) == 1) {
+			pkt->pool->release(pkt);
+		}
+		delete queues[i];
+	}
+}
+
+int MemLink::getNodeId() {
+	return nodeId;
+}
+
+/**
+ * Returns the eventfd of the primary receive queue, for registration with an event loop
+ */
+int MemLink::getRcvSocket() {
+	return queues[0]->getEventFd();
+}
+
+/**
+ * Adds a receive queue and returns its eventfd. Senders are spread across the queues by node
+ * id. Must be called before the network starts sending.
+ */
+int MemLink::openRcvSocket() {
+	MpscRing* queue = new MpscRing(MEM_QUEUE_LEN);
+
+	// armed from the start, so the first packet wakes the receiver
+	queue->prepareWait();
+	queues.push_back(queue);
+
+	return queue->getEventFd();
+}
+
+/**
+ * Returns true if packets may be sent over the interface, printing why not otherwise
+ */
+bool MemLink::checkSend(int itfNum) {
+	if (itfNum < 0 || itfNum >= (int) peers.size() || peers[itfNum] < 0 || peers[itfNum] >= net->getNumNodes()) {
+		LOG_WARN("No peer for interface %d", itfNum);
+		return false;
+	}
+
+	if (!itfUp[itfNum]) {
+		LOG_DEBUG("Interface %d is down, discarding", itfNum);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Returns the neighbor's number for interface itfNum, so received packets can be counted against
+ * the interface they came in on. With several links to the same neighbor, our k-th link to it is
+ * taken to be its k-th link to us, as they are when both ends list the links in the same order.
+ * Returns -1 if the neighbor has no link back.
+ */
+int MemLink::getRemoteItf(int itfNum) {
+	int itf = __atomic_load_n(&rmtItfs[itfNum], __ATOMIC_RELAXED);
+	int k = 0;
+
+	if (itf >= 0) {
+		return itf;
+	}
+
+	for (int i = 0; i < itfNum; i++) {
+		k += peers[i] == peers[itfNum];
+	}
+	MemLink* peer = net->getNode(peers[itfNum]);
+	for (vector<int>::size_type i = 0; i != peer->peers.size(); i++) {
+		if (peer->peers[i] == nodeId && k-- == 0) {
+			itf = i;
+			break;
+		}
+	}
+	// any thread may get here first; they all work out the same answer
+	__atomic_store_n(&rmtItfs[itfNum], itf, __ATOMIC_RELAXED);
+
+	return itf;
+}
+
+/**
+ * Gathers one packet from iovCount buffers into a pool buffer. Returns NULL with errno EMSGSIZE
+ * if the packet does not fit a buffer, which is an error, or ENOBUFS if the pool is empty.
+ */
+pkt_buf* MemLink::copyIn(const struct iovec* iov, int iovCount) {
+	pkt_buf* pkt;
+	int len = 0;
+
+	for (int i = 0; i < iovCount; i++) {
+		len += iov[i].iov_len;
+	}
+	if (len > net->getMaxLen()) {
+		errno = EMSGSIZE;
+		LOG_WARN("Send error: %s", strerror(errno));
+		return NULL;
+	}
+
+	if ((pkt = net->getPool(len)->alloc()) == NULL) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+	for (int i = 0; i < iovCount; i++) {
+		memcpy(PacketPool::data(pkt) + pkt->len, iov[i].iov_base, iov[i].iov_len);
+		pkt->len += iov[i].iov_len;
+	}
+
+	return pkt;
+}
+
+/**
+ * Hands count pool buffers to the neighbor on itfNum. Whatever its queue cannot take is dropped.
+ * Returns the number delivered.
+ */
+int MemLink::deliver(int itfNum, pkt_buf** pkts, int count) {
+	MemLink* peer = net->getNode(peers[itfNum]);
+	MpscRing* queue = peer->queues[nodeId % peer->queues.size()];
+	int rmtItf = getRemoteItf(itfNum);
+
+	// while in flight, a buffer's interface is the one it arrives on
+	for (int i = 0; i < count; i++) {
+		pkts[i]->itfNum = rmtItf;
+	}
+	int n = queue->enqueueBurst((void**) pkts, count);
+
+	for (int i = n; i < count; i++) {
+		pkts[i]->pool->release(pkts[i]);
+	}
+	__atomic_add_fetch(&txPackets, n, __ATOMIC_RELAXED);
+	if (n < count) {
+		__atomic_add_fetch(&drops, count - n, __ATOMIC_RELAXED);
+	}
+
+	return n;
+}
+
+/**
+ * Sends one packet gathered from iovCount buffers over the interface specified by itfNum.
+ * Returns the packet length, whether or not the neighbor had room for it.
+ */
+int MemLink::sendv(const struct iovec* iov, int iovCount, int itfNum) {
+	pkt_buf* pkt;
+
+	if (!checkSend(itfNum)) {
+		return -1;
+	}
+
+	if ((pkt = copyIn(iov, iovCount)) == NULL) {
+		if (errno == EMSGSIZE) {
+			return -1;
+		}
+		__atomic_add_fetch(&drops, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	int len = pkt->len;
+	deliver(itfNum, &pkt, 1);
+
+	return len;
+}
+
+/**
+ * Sends count packets over the interface specified by itfNum, enqueueing up to BURST_SIZE at a
+ * time. Returns the number of packets sent, dropped ones included, or -1 if none could be.
+ */
+int MemLink::sendBatch(char** pkts, int* lens, int count, int itfNum) {
+	struct iovec iovs[BURST_SIZE];
+	int iovCounts[BURST_SIZE];
+	int pktsSent = 0;
+
+	while (pktsSent < count) {
+		int n = (count - pktsSent < BURST_SIZE) ? count - pktsSent : BURST_SIZE;
+		int m;
+
+		for (int i = 0; i < n; i++) {
+			iovs[i].iov_base = pkts[pktsSent + i];
+			iovs[i].iov_len = lens[pktsSent + i];
+			iovCounts[i] = 1;
+		}
+		if ((m = sendvBatch(iovs, iovCounts, n, itfNum)) < 0) {
+			return (pktsSent > 0) ? pktsSent : -1;
+		}
+		pktsSent += m;
+	}
+
+	return pktsSent;
+}
+
+/**
+ * Sends count packets over the interface specified by itfNum, packet i gathered from the next
+ * iovCounts[i] entries of iov. Returns the number of packets sent, dropped ones included, or -1
+ * if none could be.
+ */
+int MemLink::sendvBatch(const struct iovec* iov, const int* iovCounts, int count, int itfNum) {
+	pkt_buf* pkts[BURST_SIZE];
+	int pktsSent = 0;
+
+	if (!checkSend(itfNum)) {
+		return -1;
+	}
+
+	while (pktsSent < count) {
+		int n = (count - pktsSent < BURST_SIZE) ? count - pktsSent : BURST_SIZE;
+		int m = 0;
+
+		for (int i = 0; i < n; i++) {
+			pkt_buf* pkt = copyIn(iov, iovCounts[pktsSent + i]);
+
+			iov += iovCounts[pktsSent + i];
+			if (pkt != NULL) {
+				pkts[m++] = pkt;
+			} else if (errno == EMSGSIZE) {
+				deliver(itfNum, pkts, m);
+				return (pktsSent + i > 0) ? pktsSent + i : -1;
+			} else {
+				__atomic_add_fetch(&drops, 1, __ATOMIC_RELAXED);
+			}
+		}
+
+		deliver(itfNum, pkts, m);
+		pktsSent += n;
+	}
+
+	return pktsSent;
+}
+
+/**
+ * Returns the receive queue whose eventfd is sock
+ */
+MpscRing* MemLink::getQueue(int sock) {
+	for (vector<MpscRing*>::size_type i = 0; i != queues.size(); i++) {
+		if (queues[i]->getEventFd() == sock) {
+			return queues[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Copies packets off queue into burst, from buffer n up to burst.count. Packets longer than the
+ * buffers are truncated, as a datagram is. Returns the new number of buffers filled.
+ */
+int MemLink::dequeue(MpscRing* queue, packet_burst& burst, int n) {
+	pkt_buf* pkts[BURST_SIZE];
+	int m = queue->dequeueBurst((void**) pkts, burst.count - n);
+
+	for (int i = 0; i < m; i++) {
+		int len = (pkts[i]->len < burst.bufLen) ? pkts[i]->len : burst.bufLen;
+
+		memcpy(burst.bufs[n + i], PacketPool::data(pkts[i]), len);
+		burst.lens[n + i] = len;
+		burst.itfs[n + i] = pkts[i]->itfNum;
+		pkts[i]->pool->release(pkts[i]);
+	}
+	if (m > 0) {
+		__atomic_add_fetch(&rxPackets, m, __ATOMIC_RELAXED);
+	}
+
+	return n + m;
+}
+
+/**
+ * Receives up to burst.count packets from the queue whose eventfd is sock, then sets burst.count
+ * to the number received. The eventfd stays readable for as long as packets are queued, so the
+ * queue can be polled by an event loop exactly like a socket. If block is set, waits for at
+ * least one packet; otherwise returns 0 when none are queued. Returns the number received.
+ */
+int MemLink::listenBatch(int sock, packet_burst& burst, bool block) {
+	MpscRing* queue = getQueue(sock);
+	int maxPkts = (burst.count < BURST_SIZE) ? burst.count : BURST_SIZE;
+	int n = 0;
+
+	if (queue == NULL) {
+		LOG_WARN("No receive queue with descriptor %d", sock);
+		burst.count = 0;
+		return -1;
+	}
+	burst.count = maxPkts;
+
+	while (true) {
+		n = dequeue(queue, burst, n);
+		if (n == maxPkts) {
+			break;
+		}
+
+		// short of a full burst: rearm, and take whatever slipped in before the rearm
+		queue->clearWakeup();
+		if (!queue->prepareWait()) {
+			if ((n = dequeue(queue, burst, n)) == maxPkts) {
+				// the wakeup was consumed and producers will not write again; keep it readable
+				uint64_t one = 1;
+				if (write(sock, &one, sizeof(one)) != sizeof(one)) {
+					// already readable
+				}
+				break;
+			}
+			continue;
+		}
+		if (n > 0 || !block) {
+			break;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+			LOG_WARN("Receive error: %s", strerror(errno));
+			burst.count = 0;
+			return -1;
+		}
+	}
+	burst.count = n;
+
+	return n;
+}
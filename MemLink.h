@@ -0,0 +1,85 @@
+#ifndef MEMLINK_H
+#define MEMLINK_H
+
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "constants.h"
+#include "LinkLayer.h"
+#include "PacketPool.h"
+#include "Ring.h"
+
+using namespace std;
+
+#define MEM_QUEUE_LEN 4096 // packets waiting on one receive queue; more are dropped, as by a full socket
+#define MEM_POOL_SIZE (1 << 18) // packets in flight over a whole network
+#define MEM_POOL_BYTES (512 << 20) // caps MEM_POOL_SIZE when the MTU is large
+#define MEM_SMALL_PKT 256 // packets up to this long, routing messages mostly, use small buffers
+#define MEM_SMALL_POOL_SIZE (1 << 20)
+
+class MemLink;
+
+/**
+ * The wires between the MemLinks of one process. Links register when they are created and find
+ * their neighbors here by node id. Packets in flight sit in pools shared by the whole network,
+ * one of MTU sized buffers and one of small buffers, so a flood of short routing messages does
+ * not run the network out of memory. Every link must be created before any of them sends.
+ */
+class MemNetwork {
+
+	private:
+		vector<MemLink*> nodes;
+		PacketPool smallPool;
+		PacketPool pool;
+
+	public:
+		MemNetwork(int maxMtu);
+		int attach(MemLink* link);
+		MemLink* getNode(int nodeId);
+		int getNumNodes();
+		PacketPool* getPool(int len);
+		int getMaxLen();
+};
+
+/**
+ * A link layer whose point to point links are in-memory queues between nodes of one process,
+ * so whole networks can run inside a single process without sockets. Each receive "socket" is
+ * the eventfd of a multi-producer ring, and a sender always picks the same ring of its neighbor
+ * by its node id, the way SO_REUSEPORT hashes a sender to one socket. Packets are copied into
+ * the network's pool on send and out of it on receive, like datagrams through the kernel; a full
+ * ring or an empty pool drops the packet, silently as UDP would, and counts the drop.
+ */
+class MemLink : public LinkLayer {
+
+	private:
+		MemNetwork* net;
+		int nodeId;
+		vector<int> peers; // node on the other end of each interface
+		vector<int> rmtItfs; // the neighbor's number for each interface, -1 until first needed
+		vector<MpscRing*> queues; // the first is the primary receive queue
+
+		bool checkSend(int itfNum);
+		int getRemoteItf(int itfNum);
+		pkt_buf* copyIn(const struct iovec* iov, int iovCount);
+		int deliver(int itfNum, pkt_buf** pkts, int count);
+		MpscRing* getQueue(int sock);
+		int dequeue(MpscRing* queue, packet_burst& burst, int n);
+
+	public:
+		u_int64_t txPackets;
+		u_int64_t rxPackets;
+		u_int64_t drops; // packets lost to full rings or an empty pool, counted by the sender
+
+		MemLink(MemNetwork* net, vector<itf_info> itfs, vector<int> peers);
+		~MemLink();
+		int getNodeId();
+		int sendv(const struct iovec* iov, int iovCount, int itfNum);
+		int sendBatch(char** pkts, int* lens, int count, int itfNum);
+		int sendvBatch(const struct iovec* iov, const int* iovCounts, int count, int itfNum);
+		int listenBatch(int sock, packet_burst& burst, bool block);
+		int getRcvSocket();
+		int openRcvSocket();
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <arpa/inet.h>
+
+#include "NodeConfig.h"
+#include "FwdTable.h"
+
+NodeConfig::NodeConfig() {
+	lineNum = 0;
+	inRoutes = false;
+	haveLocal = false;
+}
+
+/**
+ * Prints a message about the current line. Returns -1.
+ */
+int NodeConfig::error(const char* fmt, ...) {
+	va_list args;
+
+	printf("Config line %d: ", lineNum);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+
+	return -1;
+}
+
+/**
+ * Splits line in place at whitespace, dropping any comment. Returns the number of tokens, or
+ * more than max if there were too many to store.
+ */
+static int splitTokens(char* line, char** tokens, int max) {
+	int count = 0;
+	char* p = line;
+
+	while (*p != '\0' && *p != '#') {
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+			p++;
+		}
+		if (*p == '\0' || *p == '#') {
+			break;
+		}
+		if (count < max) {
+			tokens[count] = p;
+		}
+		count++;
+		while (*p != '\0' && *p != '#' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+			p++;
+		}
+		if (*p == '#') {
+			*p = '\0';
+			break;
+		}
+		if (*p != '\0') {
+			*p++ = '\0';
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Parses a whole decimal number from min to max into *value. Returns false if str is not one.
+ */
+static bool parseNumber(const char* str, long min, long max, long* value) {
+	char* end;
+
+	if (*str == '\0') {
+		return false;
+	}
+	*value = strtol(str, &end, 10);
+	return *end == '\0' && *value >= min && *value <= max;
+}
+
+/**
+ * Splits host:port into phy, mapping localhost to the loopback address
+ */
+static bool parseEndpoint(char* str, phy_info* phy) {
+	char* colon = strrchr(str, ':');
+	long port;
+
+	if (colon == NULL || colon == str || !parseNumber(colon + 1, 1, 65535, &port)) {
+		return false;
+	}
+	*colon = '\0';
+	phy->ipAddr = (strcmp(str, "localhost") == 0) ? "127.0.0.1" : str;
+	phy->port = colon + 1;
+
+	return true;
+}
+
+/**
+ * Parses an interface's transport, udp or shm, into *transport
+ */
+static bool parseTransport(const char* token, int* transport) {
+	if (strcmp(token, "udp") == 0) {
+		*transport = LINK_UDP;
+	} else if (strcmp(token, "shm") == 0) {
+		*transport = LINK_SHM;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+int NodeConfig::parseLocal(char** tokens, int count) {
+	if (count != 1 || !parseEndpoint(tokens[0], &localPhy)) {
+		return error("expected host:port");
+	}
+	haveLocal = true;
+	return 0;
+}
+
+int NodeConfig::parseInterface(char** tokens, int count) {
+	itf_info itf;
+	long mtu = DEFAULT_MTU;
+
+	if (count < 3 || count > 5) {
+		return error("expected host:port locIP rmtIP [mtu] [udp|shm]");
+	}
+	if (itfs.size() >= MAX_INTERFACES) {
+		return error("too many interfaces, at most %d", MAX_INTERFACES);
+	}
+	if (!parseEndpoint(tokens[0], &itf.rmtPhy)) {
+		return error("bad endpoint %s, expected host:port", tokens[0]);
+	}
+	if (inet_pton(AF_INET, tokens[1], &itf.locAddr) != 1) {
+		return error("bad local address %s", tokens[1]);
+	}
+	if (inet_pton(AF_INET, tokens[2], &itf.rmtAddr) != 1) {
+		return error("bad remote address %s", tokens[2]);
+	}
+	// the MTU, the transport, or both in that order
+	itf.transport = LINK_UDP;
+	if (count >= 4 && parseTransport(tokens[count - 1], &itf.transport)) {
+		count--;
+	} else if (count == 5) {
+		return error("bad transport %s, expected udp or shm", tokens[4]);
+	}
+	if (count == 4 && !parseNumber(tokens[3], MIN_MTU, MAX_MTU, &mtu)) {
+		return error("bad MTU %s, must be from %d to %d", tokens[3], MIN_MTU, MAX_MTU);
+	}
+	itf.mtu = mtu;
+	itfs.push_back(itf);
+
+	return 0;
+}
+
+int NodeConfig::parseRoute(char** tokens, int count) {
+	char* slash;
+	u_int32_t prefix;
+	long len, itfNum;
+	route_entry* route;
+
+	if (count != 2 || (slash = strchr(tokens[0], '/')) == NULL) {
+		return error("expected prefix/len itfNum");
+	}
+	*slash = '\0';
+	if (inet_pton(AF_INET, tokens[0], &prefix) != 1) {
+		return error("bad prefix %s", tokens[0]);
+	}
+	if (!parseNumber(slash + 1, 0, 32, &len)) {
+		return error("bad prefix length %s", slash + 1);
+	}
+	if (len < 32 && (ntohl(prefix) & (0xffffffffu >> len)) != 0) {
+		return error("%s/%ld has bits set past the prefix length", tokens[0], len);
+	}
+	if (!parseNumber(tokens[1], 0, (long) itfs.size() - 1, &itfNum)) {
+		return error("bad interface %s, this node has %d", tokens[1], (int) itfs.size());
+	}
+	if (staticRoutes.find(prefix, len) != NULL) {
+		return error("duplicate route %s/%ld", tokens[0], len);
+	}
+
+	route = staticRoutes.insert(prefix, len);
+	setRouteItf(route, itfNum);
+
+	return 0;
+}
+
+/**
+ * Parses one line of the file into the configuration. Returns -1 if the line is bad.
+ */
+int NodeConfig::parseLine(char* line) {
+	char* tokens[CONFIG_MAX_TOKENS];
+	int count = splitTokens(line, tokens, CONFIG_MAX_TOKENS);
+
+	if (count == 0) {
+		return 0;
+	}
+	if (count > CONFIG_MAX_TOKENS) {
+		return error("too many fields");
+	}
+
+	if (!haveLocal) {
+		return parseLocal(tokens, count);
+	}
+	if (!inRoutes && count == 1 && strcmp(tokens[0], CONFIG_ROUTES) == 0) {
+		inRoutes = true;
+		return 0;
+	}
+	return inRoutes ? parseRoute(tokens, count) : parseInterface(tokens, count);
+}
+
+/**
+ * Loads the configuration from the named file. Returns 0, or -1 after printing what is wrong.
+ */
+int NodeConfig::load(const char* fileName) {
+	FILE* file;
+	int ret;
+
+	if ((file = fopen(fileName, "r")) == NULL) {
+		perror("Config open error:");
+		return -1;
+	}
+	setvbuf(file, NULL, _IOFBF, CONFIG_READ_BUF);
+	ret = load(file);
+	fclose(file);
+
+	return ret;
+}
+
+/**
+ * Loads the configuration from an open file. Returns 0, or -1 after printing what is wrong.
+ */
+int NodeConfig::load(FILE* file) {
+	char line[CONFIG_MAX_LINE];
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		lineNum++;
+		if (strchr(line, '\n') == NULL && !feof(file)) {
+			return error("longer than %d characters", CONFIG_MAX_LINE - 2);
+		}
+		if (parseLine(line) < 0) {
+			return -1;
+		}
+	}
+	if (ferror(file)) {
+		perror("Config read error:");
+		return -1;
+	}
+	if (!haveLocal) {
+		return error("no host:port for this node");
+	}
+
+	return 0;
+}
+
+const phy_info& NodeConfig::getLocalPhy() {
+	return localPhy;
+}
+
+const vector<itf_info>& NodeConfig::getInterfaces() {
+	return itfs;
+}
+
+const RouteTable& NodeConfig::getStaticRoutes() {
+	return staticRoutes;
+}
+
+#ifdef NODECONFIG_MAIN
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+ * Writes a node file with the given numbers of interfaces and static /24 routes, then times
+ * loading it and installing the routes in a forwarding table, the two steps a node's startup
+ * spends time on before it opens its sockets. Exits with 1 if over the budget, if one is given.
+ */
+
+static double elapsedMs(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* configbench [interfaces] [routes] [budget ms] [file] */
+int main(int argc, char** argv) {
+	int numItfs = (argc > 1) ? atoi(argv[1]) : 10000;
+	int numRoutes = (argc > 2) ? atoi(argv[2]) : 1000000;
+	double budgetMs = (argc > 3) ? atof(argv[3]) : 0;
+	const char* fileName = (argc > 4) ? argv[4] : "/tmp/configbench.config";
+	NodeConfig config;
+	FwdTable fwdTable;
+	struct timespec start;
+	struct rusage usage;
+	double loadMs, installMs;
+	int refused = 0;
+	long fileBytes;
+	FILE* file;
+
+	if (numItfs < 1 || numItfs > MAX_INTERFACES || numRoutes < 0 || numRoutes > (1 << 24)) {
+		fprintf(stderr, "usage: configbench [interfaces] [routes] [budget ms] [file]\n");
+		return 1;
+	}
+
+	if ((file = fopen(fileName, "w")) == NULL) {
+		perror("Config create error:");
+		return 1;
+	}
+	fprintf(file, "localhost:17000\n");
+	for (int i = 0; i < numItfs; i++) {
+		fprintf(file, "localhost:%d 10.%d.%d.1 10.%d.%d.2 %d\n", 20000 + i % 40000, i >> 8, i & 255, i >> 8, i & 255,
+				(i % 4 == 0) ? 9000 : DEFAULT_MTU);
+	}
+	fprintf(file, "routes\n");
+	for (int i = 0; i < numRoutes; i++) {
+		// distinct /24s spread over 100.0.0.0/8 and up
+		u_int32_t prefix = (100u << 24) + ((u_int32_t) i << 8);
+		fprintf(file, "%u.%u.%u.0/24 %d\n", prefix >> 24, (prefix >> 16) & 255, (prefix >> 8) & 255, i % numItfs);
+	}
+	fileBytes = ftell(file);
+	fclose(file);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (config.load(fileName) < 0) {
+		return 1;
+	}
+	loadMs = elapsedMs(&start);
+
+	const RouteTable& routes = config.getStaticRoutes();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < routes.size(); i++) {
+		const route_entry* route = routes.at(i);
+		if (fwdTable.addRoute(ntohl(route->prefix), route->len, routeItf(route)) < 0) {
+			refused++;
+		}
+	}
+	installMs = elapsedMs(&start);
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("interfaces=%d routes=%d file_mb=%.1f load_ms=%.1f load_mb_per_s=%.0f ns_per_line=%.0f install_ms=%.1f refused=%d startup_ms=%.1f route_table_mb=%.1f max_rss_mb=%.1f budget_ms=%.0f\n",
+			(int) config.getInterfaces().size(), routes.size(), fileBytes / 1048576.0, loadMs,
+			fileBytes / 1048576.0 / (loadMs / 1e3), loadMs * 1e6 / (numItfs + numRoutes + 2), installMs,
+			refused, loadMs + installMs, routes.memoryUsage() / 1048576.0, usage.ru_maxrss / 1024.0, budgetMs);
+
+	return (refused > 0 || (budgetMs > 0 && loadMs + installMs > budgetMs));
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef NODECONFIG_H
+#define NODECONFIG_H
+
+#include <vector>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "constants.h"
+#include "RouteTable.h"
+
+using namespace std;
+
+#define CONFIG_MAX_LINE 1024
+#define CONFIG_MAX_TOKENS 8
+#define CONFIG_READ_BUF (1 << 20) // stdio buffer for the config file
+#define CONFIG_ROUTES "routes" // line starting the static routes section
+
+/**
+ * A node's configuration, read from a file of this form:
+ *
+ *   host:port                        our UDP endpoint
+ *   host:port locIP rmtIP [mtu] [udp|shm]
+ *                                    one line per interface; shm for a neighbor on this host
+ *   routes                           optional, followed by static routes
+ *   prefix/len itfNum                one per line; itfNum counts interfaces from 0
+ *
+ * Blank lines and anything after a '#' are ignored. The file is read a line at a time and each
+ * line goes straight into the interface list or the route table, so neither the file nor any
+ * token array is held in memory. The first bad line stops loading and is reported with its
+ * line number.
+ */
+class NodeConfig {
+
+	private:
+		phy_info localPhy;
+		vector<itf_info> itfs;
+		RouteTable staticRoutes; // no expiries; itfNum and len set, cost 0
+		int lineNum;
+		bool inRoutes;
+		bool haveLocal;
+
+		int parseLine(char* line);
+		int parseLocal(char** tokens, int count);
+		int parseInterface(char** tokens, int count);
+		int parseRoute(char** tokens, int count);
+		int error(const char* fmt, ...);
+
+	public:
+		NodeConfig();
+		int load(const char* fileName);
+		int load(FILE* file);
+		const phy_info& getLocalPhy();
+		const vector<itf_info>& getInterfaces();
+		const RouteTable& getStaticRoutes();
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "PacketPool.h"
+
+using namespace std;
+
+// small per-thread index into each pool's caches, assigned on first use
+static int nextThreadId = 0;
+static __thread int threadId = -1;
+
+PacketPool::PacketPool(int dataSize, int maxBufs, bool threadCaches) {
+	bufSize = PKT_HEADROOM + dataSize;
+	this->maxBufs = maxBufs;
+	numBufs = 0;
+	freeList = NULL;
+	freeCount = 0;
+	slabAllocs = 0;
+	this->threadCaches = threadCaches;
+	pthread_mutex_init(&lock, NULL);
+	memset(caches, 0, sizeof(caches));
+
+	// start with one slab so the first packets do not pay for it
+	grow();
+}
+
+PacketPool::~PacketPool() {
+	for (vector<void*>::size_type i = 0; i != slabs.size(); i++) {
+		free(slabs[i]);
+	}
+	pthread_mutex_destroy(&lock);
+}
+
+/**
+ * Allocates another slab of buffers onto the shared free list. Must be called with lock held.
+ * Returns the number of buffers added.
+ */
+int PacketPool::grow() {
+	size_t stride = ((size_t) bufSize + 63) & ~(size_t) 63;
+	int count = PKT_SLAB_SIZE;
+
+	// jumbo buffers come in smaller slabs, but always enough to refill a cache
+	if (stride * count > PKT_SLAB_BYTES) {
+		count = PKT_SLAB_BYTES / stride;
+		if (count < PKT_CACHE_SIZE) {
+			count = PKT_CACHE_SIZE;
+		}
+	}
+
+	if (numBufs + count > maxBufs) {
+		count = maxBufs - numBufs;
+	}
+	if (count <= 0) {
+		return 0;
+	}
+
+	// descriptors and data come from one allocation; data is kept cache line aligned
+	size_t descSize = ((sizeof(pkt_buf) * count) + 63) & ~(size_t) 63;
+	char* slab;
+	if (posix_memalign((void**) &slab, 64, descSize + stride * count) != 0) {
+		perror("Packet pool allocation error:");
+		return 0;
+	}
+	slabs.push_back(slab);
+	slabAllocs++;
+
+	pkt_buf* descs = (pkt_buf*) slab;
+	for (int i = 0; i < count; i++) {
+		descs[i].pool = this;
+		descs[i].buf = slab + descSize + stride * i;
+		descs[i].next = freeList;
+		freeList = &descs[i];
+	}
+	numBufs += count;
+	freeCount += count;
+
+	return count;
+}
+
+/**
+ * Returns the calling thread's cache, or NULL if the thread has none
+ */
+pkt_cache* PacketPool::getCache() {
+	if (!threadCaches) {
+		return NULL;
+	}
+	if (threadId < 0) {
+		threadId = __atomic_fetch_add(&nextThreadId, 1, __ATOMIC_RELAXED);
+	}
+	return (threadId < PKT_MAX_THREADS) ? &caches[threadId] : NULL;
+}
+
+/**
+ * Moves up to half a cache's worth of buffers from the shared list into cache
+ */
+int PacketPool::refill(pkt_cache* cache) {
+	pthread_mutex_lock(&lock);
+	if (freeList == NULL) {
+		grow();
+	}
+	while (freeList != NULL && cache->count < PKT_CACHE_SIZE / 2) {
+		cache->bufs[cache->count++] = freeList;
+		freeList = freeList->next;
+		freeCount--;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return cache->count;
+}
+
+/**
+ * Moves count buffers from the top of cache back to the shared list
+ */
+void PacketPool::flush(pkt_cache* cache, int count) {
+	pthread_mutex_lock(&lock);
+	while (count-- > 0) {
+		pkt_buf* pkt = cache->bufs[--cache->count];
+		pkt->next = freeList;
+		freeList = pkt;
+		freeCount++;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Returns an empty buffer holding one reference, with PKT_HEADROOM bytes free in front of it,
+ * or NULL if the pool is exhausted
+ */
+pkt_buf* PacketPool::alloc() {
+	pkt_cache* cache = getCache();
+	pkt_buf* pkt;
+
+	if (cache != NULL) {
+		if (cache->count == 0 && refill(cache) == 0) {
+			return NULL;
+		}
+		pkt = cache->bufs[--cache->count];
+	} else {
+		pthread_mutex_lock(&lock);
+		if (freeList == NULL) {
+			grow();
+		}
+		if ((pkt = freeList) != NULL) {
+			freeList = pkt->next;
+			freeCount--;
+		}
+		pthread_mutex_unlock(&lock);
+		if (pkt == NULL) {
+			return NULL;
+		}
+	}
+
+	pkt->refCount = 1;
+	pkt->offset = PKT_HEADROOM;
+	pkt->len = 0;
+
+	return pkt;
+}
+
+/**
+ * Drops a reference to pkt, returning it to the pool once no references are left
+ */
+void PacketPool::release(pkt_buf* pkt) {
+	if (__atomic_sub_fetch(&pkt->refCount, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+
+	pkt_cache* cache = getCache();
+	if (cache != NULL) {
+		if (cache->count == PKT_CACHE_SIZE) {
+			flush(cache, PKT_CACHE_SIZE / 2);
+		}
+		cache->bufs[cache->count++] = pkt;
+	} else {
+		pthread_mutex_lock(&lock);
+		pkt->next = freeList;
+		freeList = pkt;
+		freeCount++;
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+/**
+ * Returns the packet bytes available in each buffer, not counting headroom
+ */
+int PacketPool::getDataSize() {
+	return bufSize - PKT_HEADROOM;
+}
+
+int PacketPool::getNumBufs() {
+	return numBufs;
+}
+
+/**
+ * Returns how many times the pool has gone to the heap. Constant once the pool is warm.
+ */
+u_int64_t PacketPool::getSlabAllocs() {
+	return slabAllocs;
+}
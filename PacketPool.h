@@ -0,0 +1,96 @@
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+
+using namespace std;
+
+#define PKT_HEADROOM 64 // bytes kept free in front of the data for prepending headers
+#define PKT_SLAB_SIZE 1024 // buffers allocated per slab when the pool grows
+#define PKT_SLAB_BYTES (4 << 20) // fewer buffers per slab if they would take more than this
+#define PKT_CACHE_SIZE 64 // buffers held by each thread's cache
+#define PKT_MAX_THREADS 64 // threads with a cache of their own; others use the shared list
+
+class PacketPool;
+
+typedef struct pkt_buf {
+	struct pkt_buf* next; // free list link
+	PacketPool* pool;
+	int refCount;
+	int offset; // start of the packet within buf
+	int len; // packet length
+	int itfNum; // egress interface while queued for transmit
+	char* buf; // bufSize bytes, PKT_HEADROOM of which precede the initial offset
+} pkt_buf;
+
+typedef struct {
+	int count;
+	pkt_buf* bufs[PKT_CACHE_SIZE];
+} __attribute__((aligned(64))) pkt_cache;
+
+/**
+ * Fixed-size, reference-counted packet buffers. Buffers are carved out of slabs allocated in
+ * bulk, so once the pool has grown to the working set no further heap allocation happens.
+ * Each thread allocates from and frees to a cache of its own and only touches the shared free
+ * list, under a lock, to move half a cache's worth of buffers at a time. A small pool of large
+ * buffers can do without the caches, which would otherwise strand much of it on idle threads.
+ */
+class PacketPool {
+
+	private:
+		int bufSize;
+		int maxBufs;
+		int numBufs;
+		pkt_buf* freeList;
+		int freeCount;
+		pthread_mutex_t lock;
+		vector<void*> slabs;
+		pkt_cache caches[PKT_MAX_THREADS];
+		bool threadCaches;
+		u_int64_t slabAllocs;
+
+		int grow();
+		int refill(pkt_cache* cache);
+		void flush(pkt_cache* cache, int count);
+		pkt_cache* getCache();
+
+	public:
+		PacketPool(int dataSize, int maxBufs, bool threadCaches = true);
+		~PacketPool();
+		pkt_buf* alloc();
+		void release(pkt_buf* pkt);
+		int getDataSize();
+		int getNumBufs();
+		u_int64_t getSlabAllocs();
+
+		/**
+		 * Takes another reference to pkt; it is returned to the pool when the last one is released
+		 */
+		static void ref(pkt_buf* pkt) {
+			__atomic_add_fetch(&pkt->refCount, 1, __ATOMIC_RELAXED);
+		}
+
+		/**
+		 * Returns a pointer to the start of the packet
+		 */
+		static char* data(pkt_buf* pkt) {
+			return pkt->buf + pkt->offset;
+		}
+
+		/**
+		 * Grows the packet by len bytes at the front, into the headroom. Returns the new start,
+		 * or NULL if there is not enough headroom left.
+		 */
+		static char* prepend(pkt_buf* pkt, int len) {
+			if (pkt->offset < len) {
+				return NULL;
+			}
+			pkt->offset -= len;
+			pkt->len += len;
+			return pkt->buf + pkt->offset;
+		}
+};
+
+#endif
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "Reassembly.h"
+#include "ipsum.h"
+
+#define HDR_SIZE sizeof(struct iphdr)
+
+Reassembler::Reassembler(int maxPending, int maxBufs) : pool(REASM_BUF_SIZE, maxBufs, false) {
+	this->maxPending = maxPending;
+	pending = 0;
+	completed = 0;
+	timedOut = 0;
+	evicted = 0;
+	discarded = 0;
+
+	entries = new reasm_entry[maxPending];
+	freeList = NULL;
+	for (int i = maxPending - 1; i >= 0; i--) {
+		entries[i].hashNext = freeList;
+		freeList = &entries[i];
+	}
+	for (int i = 0; i < REASM_HASH_SIZE; i++) {
+		hashTable[i] = NULL;
+	}
+	ageList.ageNext = &ageList;
+	ageList.agePrev = &ageList;
+}
+
+Reassembler::~Reassembler() {
+	while (ageList.ageNext != &ageList) {
+		drop(ageList.ageNext);
+	}
+	delete[] entries;
+}
+
+static void setHole(char* payload, int first, int last, int next) {
+	reasm_hole hole;
+
+	hole.last = last;
+	hole.next = next;
+	memcpy(payload + first, &hole, sizeof(hole));
+}
+
+reasm_entry* Reassembler::lookup(const struct iphdr* hdr, u_int32_t h) {
+	for (reasm_entry* e = hashTable[h]; e != NULL; e = e->hashNext) {
+		if (e->saddr == hdr->saddr && e->daddr == hdr->daddr && e->id == hdr->id && e->protocol == hdr->protocol) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Starts reassembling the datagram hdr belongs to, evicting the oldest one if every entry is in
+ * use. Returns NULL if no buffer is free.
+ */
+reasm_entry* Reassembler::create(const struct iphdr* hdr, u_int32_t h, u_int64_t now) {
+	reasm_entry* e;
+	pkt_buf* pkt;
+
+	if (freeList == NULL) {
+		drop(ageList.ageNext);
+		count(&evicted);
+	}
+	if ((pkt = pool.alloc()) == NULL) {
+		return NULL;
+	}
+
+	e = freeList;
+	freeList = e->hashNext;
+
+	e->saddr = hdr->saddr;
+	e->daddr = hdr->daddr;
+	e->id = hdr->id;
+	e->protocol = hdr->protocol;
+	e->totalLen = -1;
+	e->maxEnd = 0;
+	e->expires = now + REASM_TIMEOUT_MS;
+	e->pkt = pkt;
+
+	// the whole datagram starts out as one hole
+	e->firstHole = 0;
+	setHole(PacketPool::data(pkt) + HDR_SIZE, 0, REASM_MAX_PAYLOAD - 1, REASM_NO_HOLE);
+
+	e->hashNext = hashTable[h];
+	hashTable[h] = e;
+	e->ageNext = &ageList;
+	e->agePrev = ageList.agePrev;
+	ageList.agePrev->ageNext = e;
+	ageList.agePrev = e;
+	pending++;
+
+	return e;
+}
+
+/**
+ * Takes e off the hash table and the age list and puts it back on the free list. The buffer
+ * is left to the caller.
+ */
+void Reassembler::remove(reasm_entry* e) {
+	reasm_entry** link = &hashTable[hash(e->saddr, e->daddr, e->id, e->protocol)];
+
+	while (*link != e) {
+		link = &(*link)->hashNext;
+	}
+	*link = e->hashNext;
+
+	e->agePrev->ageNext = e->ageNext;
+	e->ageNext->agePrev = e->agePrev;
+
+	e->hashNext = freeList;
+	freeList = e;
+	pending--;
+}
+
+/**
+ * Abandons a partial datagram
+ */
+void Reassembler::drop(reasm_entry* e) {
+	pool.release(e->pkt);
+	remove(e);
+}
+
+/**
+ * Copies payload bytes first to last into e and updates its holes (RFC 815). A fragment without
+ * more following also ends every hole past it. Returns false if the fragment contradicts the
+ * datagram's length as established by the fragments before it.
+ */
+bool Reassembler::fill(reasm_entry* e, const char* data, int first, int last, bool more) {
+	char* payload = PacketPool::data(e->pkt) + HDR_SIZE;
+	int coverLast = more ? last : REASM_MAX_PAYLOAD - 1;
+	int prev = -1;
+	int cur = e->firstHole;
+
+	if (e->totalLen >= 0 && (last >= e->totalLen || (!more && last + 1 != e->totalLen))) {
+		return false;
+	}
+	if (!more) {
+		if (e->maxEnd > last + 1) {
+			return false;
+		}
+		e->totalLen = last + 1;
+	}
+
+	while (cur != REASM_NO_HOLE) {
+		reasm_hole hole;
+		memcpy(&hole, payload + cur, sizeof(hole));
+
+		if (first > hole.last || coverLast < cur) {
+			prev = cur;
+			cur = hole.next;
+			continue;
+		}
+
+		// replace the hole with what the fragment leaves of it on either side. fragments other
+		// than the last are multiples of 8 bytes long, so every hole has room for its descriptor
+		int link = hole.next;
+		if (coverLast < hole.last) {
+			setHole(payload, coverLast + 1, hole.last, link);
+			link = coverLast + 1;
+		}
+		if (first > cur) {
+			setHole(payload, cur, first - 1, link);
+			link = cur;
+		}
+
+		if (prev < 0) {
+			e->firstHole = link;
+		} else {
+			reasm_hole prevHole;
+			memcpy(&prevHole, payload + prev, sizeof(prevHole));
+			setHole(payload, prev, prevHole.last, link);
+		}
+
+		// the new holes lie outside the fragment, so the walk carries on after them
+		if (coverLast < hole.last) {
+			prev = coverLast + 1;
+		} else if (first > cur) {
+			prev = cur;
+		}
+		cur = hole.next;
+	}
+
+	memcpy(payload + first, data, last - first + 1);
+	if (last + 1 > e->maxEnd) {
+		e->maxEnd = last + 1;
+	}
+
+	return true;
+}
+
+/**
+ * Finishes the header of a datagram with no holes left and hands its buffer over
+ */
+pkt_buf* Reassembler::complete(reasm_entry* e) {
+	pkt_buf* pkt = e->pkt;
+	struct iphdr* hdr = (struct iphdr*) PacketPool::data(pkt);
+
+	// options were left behind with the first fragment's header
+	hdr->ihl = 5;
+	hdr->tot_len = htons(HDR_SIZE + e->totalLen);
+	hdr->frag_off = 0;
+	hdr->check = 0;
+	hdr->check = ip_sum((char*) hdr, HDR_SIZE);
+	pkt->len = HDR_SIZE + e->totalLen;
+
+	remove(e);
+	count(&completed);
+
+	return pkt;
+}
+
+/**
+ * Adds a received fragment, whose header has been validated, to the datagram it belongs to. The
+ * fragment is copied and stays the caller's. Returns the datagram, in a buffer holding one
+ * reference, if this fragment completed it, and NULL otherwise.
+ */
+pkt_buf* Reassembler::add(const char* packet, int len, u_int64_t now) {
+	const struct iphdr* hdr = (const struct iphdr*) packet;
+	int hdrLen = hdr->ihl * 4;
+	int dataLen = len - hdrLen;
+	u_int16_t fragOff = ntohs(hdr->frag_off);
+	int first = (fragOff & IP_OFFMASK) * 8;
+	int last = first + dataLen - 1;
+	bool more = (fragOff & IP_MF) != 0;
+	u_int32_t h;
+	reasm_entry* e;
+
+	expire(now);
+
+	if (dataLen <= 0 || last >= REASM_MAX_PAYLOAD || (more && dataLen % 8 != 0)) {
+		count(&discarded);
+		return NULL;
+	}
+
+	h = hash(hdr->saddr, hdr->daddr, hdr->id, hdr->protocol);
+	if ((e = lookup(hdr, h)) == NULL && (e = create(hdr, h, now)) == NULL) {
+		count(&discarded);
+		return NULL;
+	}
+
+	if (!fill(e, packet + hdrLen, first, last, more)) {
+		drop(e);
+		count(&discarded);
+		return NULL;
+	}
+	if (first == 0) {
+		memcpy(PacketPool::data(e->pkt), packet, HDR_SIZE);
+	}
+
+	if (e->firstHole == REASM_NO_HOLE && e->totalLen >= 0) {
+		return complete(e);
+	}
+	return NULL;
+}
+
+/**
+ * Drops every datagram whose time is up. Returns the number dropped.
+ */
+int Reassembler::expire(u_int64_t now) {
+	int n = 0;
+
+	while (ageList.ageNext != &ageList && ageList.ageNext->expires <= now) {
+		drop(ageList.ageNext);
+		count(&timedOut);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Returns the number of datagrams being reassembled
+ */
+int Reassembler::getPending() {
+	return pending;
+}
+
+#ifdef REASSEMBLY_MAIN
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Fragments datagrams the way IPLayer does and feeds the fragments of several datagrams at a
+ * time to a reassembler in random order, dropping some if asked to. Time moves 1 ms per group,
+ * so datagrams that lost a fragment time out. Payloads are checked on a first, untimed pass.
+ */
+
+#define BENCH_MTU 1400
+
+static u_int32_t xorshift(u_int32_t* state) {
+	u_int32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* appends the fragments of one datagram of payload to pkts */
+static void fragment(vector< vector<char> >& pkts, const vector<char>& payload, u_int16_t id) {
+	int maxFrag = (BENCH_MTU - HDR_SIZE) & ~7;
+
+	for (int off = 0; off < (int) payload.size(); off += maxFrag) {
+		int len = ((int) payload.size() - off < maxFrag) ? (int) payload.size() - off : maxFrag;
+		vector<char> pkt(HDR_SIZE + len);
+		struct iphdr* hdr = (struct iphdr*) &pkt[0];
+
+		memset(hdr, 0, HDR_SIZE);
+		hdr->version = 4;
+		hdr->ihl = 5;
+		hdr->tot_len = htons(HDR_SIZE + len);
+		hdr->id = htons(id);
+		hdr->frag_off = htons((off / 8) | ((off + len < (int) payload.size()) ? IP_MF : 0));
+		hdr->ttl = 16;
+		hdr->protocol = 143;
+		hdr->saddr = htonl(0x0a000001);
+		hdr->daddr = htonl(0x0a000002);
+		hdr->check = ip_sum((char*) hdr, HDR_SIZE);
+		memcpy(&pkt[HDR_SIZE], &payload[off], len);
+		pkts.push_back(pkt);
+	}
+}
+
+static void shuffle(vector<int>& order, u_int32_t* rng) {
+	for (int i = (int) order.size() - 1; i > 0; i--) {
+		int j = xorshift(rng) % (i + 1);
+		int t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+}
+
+/* reasmbench [datagram bytes] [datagrams] [interleave] [loss %] [seed] */
+int main(int argc, char** argv) {
+	int size = (argc > 1) ? atoi(argv[1]) : 65000;
+	int count = (argc > 2) ? atoi(argv[2]) : 20000;
+	int interleave = (argc > 3) ? atoi(argv[3]) : 16;
+	double loss = (argc > 4) ? atof(argv[4]) / 100 : 0;
+	u_int32_t rng = (argc > 5) ? atoi(argv[5]) : 1;
+	vector<char> payload(size);
+	vector< vector<char> > pkts;
+	vector<int> order;
+	Reassembler reasm;
+	struct timespec start, end;
+	u_int64_t now = 0, fragsFed = 0;
+	int maxPending = 0, bad = 0, verified = 0;
+
+	if (size < 1 || size > REASM_MAX_PAYLOAD || interleave < 1) {
+		fprintf(stderr, "usage: reasmbench [datagram bytes] [datagrams] [interleave] [loss %%] [seed]\n");
+		return 1;
+	}
+
+	for (int i = 0; i < size; i++) {
+		payload[i] = (char) xorshift(&rng);
+	}
+	for (int d = 0; d < interleave; d++) {
+		fragment(pkts, payload, d);
+	}
+	for (int i = 0; i < (int) pkts.size(); i++) {
+		order.push_back(i);
+	}
+	int perDatagram = pkts.size() / interleave;
+
+	// checking pass: every datagram that comes out must match what went in
+	for (int group = 0; group < 64; group++) {
+		shuffle(order, &rng);
+		for (int i = 0; i < (int) order.size(); i++) {
+			vector<char>& pkt = pkts[order[i]];
+			pkt_buf* whole = reasm.add(&pkt[0], pkt.size(), now);
+			if (whole != NULL) {
+				struct iphdr* hdr = (struct iphdr*) PacketPool::data(whole);
+				if (whole->len != (int) HDR_SIZE + size || ntohs(hdr->tot_len) != HDR_SIZE + size || hdr->frag_off != 0
+						|| ip_sum((char*) hdr, HDR_SIZE) != 0 || memcmp(PacketPool::data(whole) + HDR_SIZE, &payload[0], size) != 0) {
+					bad++;
+				}
+				verified++;
+				whole->pool->release(whole);
+			}
+		}
+		now++;
+	}
+	if (interleave <= REASM_MAX_PENDING && verified != 64 * interleave) {
+		bad++;
+	}
+
+	// timed pass. each group reuses the fragments under new ids
+	u_int64_t completed = reasm.getCompleted();
+	u_int32_t dropThreshold = (u_int32_t) (loss * 4294967295.0);
+	int groups = (count + interleave - 1) / interleave;
+	u_int16_t nextId = interleave;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int group = 0; group < groups; group++) {
+		for (int i = 0; i < (int) pkts.size(); i++) {
+			((struct iphdr*) &pkts[i][0])->id = htons(nextId + i / perDatagram);
+		}
+		nextId += interleave;
+		shuffle(order, &rng);
+
+		for (int i = 0; i < (int) order.size(); i++) {
+			if (dropThreshold != 0 && xorshift(&rng) < dropThreshold) {
+				continue;
+			}
+			vector<char>& pkt = pkts[order[i]];
+			pkt_buf* whole = reasm.add(&pkt[0], pkt.size(), now);
+			if (whole != NULL) {
+				whole->pool->release(whole);
+			}
+			fragsFed++;
+		}
+		if (reasm.getPending() > maxPending) {
+			maxPending = reasm.getPending();
+		}
+		now++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	completed = reasm.getCompleted() - completed;
+	printf("datagram_bytes=%d datagrams=%d fragments_per_datagram=%d interleave=%d loss_pct=%.1f ns_per_fragment=%.1f datagrams_per_s=%.0f gbit_per_s=%.2f completed=%llu timed_out=%llu evicted=%llu discarded=%llu max_pending=%d buffer_mb=%.1f verified=%d bad=%d\n",
+			size, groups * interleave, perDatagram, interleave, loss * 100, fragsFed ? secs * 1e9 / fragsFed : 0,
+			completed / secs, completed * size * 8 / secs / 1e9, (unsigned long long) completed,
+			(unsigned long long) reasm.getTimedOut(), (unsigned long long) reasm.getEvicted(),
+			(unsigned long long) reasm.getDiscarded(), maxPending, REASM_POOL_SIZE * (double) REASM_BUF_SIZE / (1 << 20),
+			verified, bad);
+
+	return bad != 0;
+}
+#endif
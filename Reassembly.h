@@ -0,0 +1,124 @@
+#ifndef REASSEMBLY_H
+#define REASSEMBLY_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "PacketPool.h"
+
+#include "ip.h"
+//#include <netinet/ip.h>
+
+// ip.h only defines the fragment flags for BSD builds
+#ifndef IP_MF
+#define IP_DF 0x4000 // don't fragment
+#define IP_MF 0x2000 // more fragments
+#define IP_OFFMASK 0x1fff // fragment offset, in 8 byte units
+#endif
+
+#define REASM_MAX_PENDING 64 // datagrams being reassembled at once, per reassembler
+#define REASM_POOL_SIZE 128 // reassembly buffers; those not pending hold datagrams awaiting delivery
+#define REASM_HASH_SIZE 128 // hash chains, must be a power of two
+#define REASM_TIMEOUT_MS 2000 // from the first fragment of a datagram
+#define REASM_MAX_PAYLOAD (IP_MAXPACKET - (int) sizeof(struct iphdr))
+#define REASM_BUF_SIZE (IP_MAXPACKET + 8) // the largest datagram, and room for a hole descriptor at its end
+#define REASM_NO_HOLE 0xffff
+
+typedef struct {
+	u_int16_t last; // payload offset of the hole's last byte
+	u_int16_t next; // payload offset of the next hole, REASM_NO_HOLE if this is the last
+} reasm_hole;
+
+/**
+ * A datagram being reassembled. Its holes are described RFC 815 style, by descriptors written into
+ * the holes themselves, so tracking them costs no memory beyond the datagram's buffer.
+ */
+typedef struct reasm_entry {
+	struct reasm_entry* hashNext; // next entry on the hash chain, or on the free list
+	struct reasm_entry* ageNext; // entries in order of arrival, which is also expiry order
+	struct reasm_entry* agePrev;
+	u_int32_t saddr;
+	u_int32_t daddr;
+	u_int16_t id;
+	u_int8_t protocol;
+	u_int16_t firstHole; // payload offset of the first hole, REASM_NO_HOLE once there are none
+	int totalLen; // payload length, -1 until the last fragment has arrived
+	int maxEnd; // end of the furthest fragment received
+	u_int64_t expires; // ms
+	pkt_buf* pkt; // the header goes at the start of the packet and the payload right behind it
+} reasm_entry;
+
+/**
+ * Puts IPv4 datagrams back together from their fragments. Entries and buffers are allocated up
+ * front and looked up by (saddr, daddr, id, protocol). A datagram not complete within
+ * REASM_TIMEOUT_MS of its first fragment is dropped, and when every entry is in use the oldest
+ * makes way for the newcomer, so a flood of partial datagrams can never pin more than the
+ * preallocated memory. Not thread safe; each forwarding worker owns one.
+ */
+class Reassembler {
+
+	private:
+		reasm_entry* entries;
+		int maxPending;
+		int pending;
+		reasm_entry* freeList;
+		reasm_entry* hashTable[REASM_HASH_SIZE];
+		reasm_entry ageList; // list head; ageList.ageNext is the oldest entry
+		PacketPool pool;
+
+		static u_int32_t hash(u_int32_t saddr, u_int32_t daddr, u_int16_t id, u_int8_t protocol) {
+			u_int64_t key = ((u_int64_t) saddr << 32 | daddr) ^ ((u_int64_t) id << 8 | protocol);
+			return (u_int32_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (REASM_HASH_SIZE - 1);
+		}
+		reasm_entry* lookup(const struct iphdr* hdr, u_int32_t h);
+		reasm_entry* create(const struct iphdr* hdr, u_int32_t h, u_int64_t now);
+		void remove(reasm_entry* e);
+		void drop(reasm_entry* e);
+		bool fill(reasm_entry* e, const char* data, int first, int last, bool more);
+		pkt_buf* complete(reasm_entry* e);
+
+		// written by the owning worker only, read by any thread
+		u_int64_t completed;
+		u_int64_t timedOut;
+		u_int64_t evicted;
+		u_int64_t discarded; // malformed or inconsistent fragments, and fragments without a buffer
+
+		/**
+		 * Adds one to a counter. The atomic store keeps other threads' reads whole.
+		 */
+		static void count(u_int64_t* counter) {
+			__atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+		}
+
+	public:
+		Reassembler(int maxPending = REASM_MAX_PENDING, int maxBufs = REASM_POOL_SIZE);
+		~Reassembler();
+		pkt_buf* add(const char* packet, int len, u_int64_t now);
+		int expire(u_int64_t now);
+		int getPending();
+
+		u_int64_t getCompleted() {
+			return __atomic_load_n(&completed, __ATOMIC_RELAXED);
+		}
+
+		u_int64_t getTimedOut() {
+			return __atomic_load_n(&timedOut, __ATOMIC_RELAXED);
+		}
+
+		u_int64_t getEvicted() {
+			return __atomic_load_n(&evicted, __ATOMIC_RELAXED);
+		}
+
+		u_int64_t getDiscarded() {
+			return __atomic_load_n(&discarded, __ATOMIC_RELAXED);
+		}
+
+		/**
+		 * Returns true if the packet with header hdr is a fragment of a larger datagram
+		 */
+		static bool isFragment(const struct iphdr* hdr) {
+			return (hdr->frag_off & htons(IP_MF | IP_OFFMASK)) != 0;
+		}
+};
+
+#endif
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "Ring.h"
+
+/**
+ * Rounds size up to a power of two so indices can wrap with a mask
+ */
+static u_int32_t ringSize(u_int32_t size) {
+	u_int32_t n = 1;
+	while (n < size) {
+		n <<= 1;
+	}
+	return n;
+}
+
+static int createEventFd() {
+	int fd;
+	if ((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		perror("Eventfd creation error:");
+	}
+	return fd;
+}
+
+static void writeEventFd(int fd) {
+	uint64_t one = 1;
+	if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+		// the counter is already non-zero; the consumer will wake anyway
+	}
+}
+
+static void readEventFd(int fd) {
+	uint64_t count;
+	if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+		// nothing pending
+	}
+}
+
+SpscRing::SpscRing(u_int32_t size) {
+	size = ringSize(size);
+	slots = (void**) calloc(size, sizeof(void*));
+	mask = size - 1;
+	head = cachedTail = 0;
+	tail = cachedHead = 0;
+	waiting = 0;
+	eventFd = createEventFd();
+}
+
+SpscRing::~SpscRing() {
+	free(slots);
+	close(eventFd);
+}
+
+/**
+ * Adds up to count pointers to the ring. Producer only. Returns the number added.
+ */
+int SpscRing::enqueueBurst(void** objs, int count) {
+	u_int32_t t = tail;
+	u_int32_t free = mask + 1 - (t - cachedHead);
+
+	if (free < (u_int32_t) count) {
+		cachedHead = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+		free = mask + 1 - (t - cachedHead);
+		if (free < (u_int32_t) count) {
+			count = free;
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		slots[(t + i) & mask] = objs[i];
+	}
+	__atomic_store_n(&tail, t + count, __ATOMIC_RELEASE);
+
+	if (count > 0) {
+		notify();
+	}
+
+	return count;
+}
+
+/**
+ * Takes up to count pointers off the ring. Consumer only. Returns the number taken.
+ */
+int SpscRing::dequeueBurst(void** objs, int count) {
+	u_int32_t h = head;
+	u_int32_t avail = cachedTail - h;
+
+	if (avail < (u_int32_t) count) {
+		cachedTail = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+		avail = cachedTail - h;
+		if (avail < (u_int32_t) count) {
+			count = avail;
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		objs[i] = slots[(h + i) & mask];
+	}
+	__atomic_store_n(&head, h + count, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+/**
+ * Announces that the consumer is about to sleep on the eventfd. Returns false if the ring is not
+ * empty after all, in which case the consumer should keep draining instead.
+ */
+bool SpscRing::prepareWait() {
+	__atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&tail, __ATOMIC_SEQ_CST) != head) {
+		__atomic_store_n(&waiting, 0, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Resets the eventfd after the consumer has woken up
+ */
+void SpscRing::clearWakeup() {
+	readEventFd(eventFd);
+}
+
+/**
+ * Wakes the consumer if it announced it is sleeping
+ */
+void SpscRing::notify() {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(&waiting, 0, __ATOMIC_ACQ_REL)) {
+		writeEventFd(eventFd);
+	}
+}
+
+int SpscRing::getEventFd() {
+	return eventFd;
+}
+
+u_int32_t SpscRing::getCount() {
+	return __atomic_load_n(&tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+MpscRing::MpscRing(u_int32_t size) {
+	size = ringSize(size);
+	slots = (mpsc_slot*) calloc(size, sizeof(mpsc_slot));
+	mask = size - 1;
+	head = tail = 0;
+	waiting = 0;
+	eventFd = createEventFd();
+
+	// a slot is free for the producer claiming position p once its seq equals p
+	for (u_int32_t i = 0; i < size; i++) {
+		slots[i].seq = i;
+	}
+}
+
+MpscRing::~MpscRing() {
+	free(slots);
+	close(eventFd);
+}
+
+/**
+ * Adds up to count pointers to the ring. Safe to call from any number of threads.
+ * Returns the number added.
+ */
+int MpscRing::enqueueBurst(void** objs, int count) {
+	u_int32_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+	u_int32_t n;
+
+	// claim a run of slots
+	do {
+		u_int32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+		u_int32_t free = mask + 1 - (t - h);
+		n = (free < (u_int32_t) count) ? free : count;
+		if (n == 0) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&tail, &t, t + n, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	// fill and publish them
+	for (u_int32_t i = 0; i < n; i++) {
+		mpsc_slot* slot = &slots[(t + i) & mask];
+		slot->obj = objs[i];
+		__atomic_store_n(&slot->seq, t + i + 1, __ATOMIC_RELEASE);
+	}
+
+	notify();
+
+	return n;
+}
+
+/**
+ * Takes up to count published pointers off the ring, stopping at the first slot a producer has
+ * claimed but not yet filled. Consumer only. Returns the number taken.
+ */
+int MpscRing::dequeueBurst(void** objs, int count) {
+	u_int32_t h = head;
+	int n = 0;
+
+	while (n < count) {
+		mpsc_slot* slot = &slots[h & mask];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != h + 1) {
+			break;
+		}
+		objs[n++] = slot->obj;
+
+		// hand the slot to the producer that claims it on the next lap
+		__atomic_store_n(&slot->seq, h + mask + 1, __ATOMIC_RELEASE);
+		h++;
+	}
+	__atomic_store_n(&head, h, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+bool MpscRing::prepareWait() {
+	__atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&slots[head & mask].seq, __ATOMIC_SEQ_CST) == head + 1) {
+		__atomic_store_n(&waiting, 0, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+void MpscRing::clearWakeup() {
+	readEventFd(eventFd);
+}
+
+void MpscRing::notify() {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(&waiting, 0, __ATOMIC_ACQ_REL)) {
+		writeEventFd(eventFd);
+	}
+}
+
+int MpscRing::getEventFd() {
+	return eventFd;
+}
+
+#ifdef RING_MAIN
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+/*
+ * Stress test and benchmark. Producers enqueue numbered items in random burst sizes while the
+ * main thread dequeues them, checks that every producer's items arrive once each and in order,
+ * and sleeps on the ring's eventfd whenever it runs dry, the way IPLayer's consumers do. If a
+ * sleep times out with items on the ring, a producer missed a consumer's prepareWait and the
+ * wakeup was lost. The benchmark runs the same loop without sleeping and pauses and reports items
+ * per second.
+ */
+
+#define RING_TEST_SIZE 1024
+#define RING_TEST_BURST 32
+#define RING_WAIT_MS 1000 // a sleep longer than this with items waiting is a lost wakeup
+#define RING_ID_SHIFT 40 // items are producer id << RING_ID_SHIFT | sequence number from 1
+
+typedef struct {
+	int (*enqueue)(void* ring, void** objs, int count);
+	int (*dequeue)(void* ring, void** objs, int count);
+	bool (*prepareWait)(void* ring);
+	void (*clearWakeup)(void* ring);
+	int (*getEventFd)(void* ring);
+} ring_ops;
+
+typedef struct {
+	void* ring;
+	const ring_ops* ops;
+	u_int64_t id;
+	long items;
+	int burst;
+	bool stress; // bursts of random size up to burst, and pauses so the consumer goes to sleep
+	pthread_t thread;
+} ring_producer;
+
+typedef struct {
+	long items;
+	long orderErrors;
+	long sleeps;
+	long lostWakeups;
+	double secs;
+} ring_result;
+
+static int spscEnqueue(void* ring, void** objs, int count) { return ((SpscRing*) ring)->enqueueBurst(objs, count); }
+static int spscDequeue(void* ring, void** objs, int count) { return ((SpscRing*) ring)->dequeueBurst(objs, count); }
+static bool spscPrepareWait(void* ring) { return ((SpscRing*) ring)->prepareWait(); }
+static void spscClearWakeup(void* ring) { ((SpscRing*) ring)->clearWakeup(); }
+static int spscGetEventFd(void* ring) { return ((SpscRing*) ring)->getEventFd(); }
+
+static int mpscEnqueue(void* ring, void** objs, int count) { return ((MpscRing*) ring)->enqueueBurst(objs, count); }
+static int mpscDequeue(void* ring, void** objs, int count) { return ((MpscRing*) ring)->dequeueBurst(objs, count); }
+static bool mpscPrepareWait(void* ring) { return ((MpscRing*) ring)->prepareWait(); }
+static void mpscClearWakeup(void* ring) { ((MpscRing*) ring)->clearWakeup(); }
+static int mpscGetEventFd(void* ring) { return ((MpscRing*) ring)->getEventFd(); }
+
+static const ring_ops spscOps = {spscEnqueue, spscDequeue, spscPrepareWait, spscClearWakeup, spscGetEventFd};
+static const ring_ops mpscOps = {mpscEnqueue, mpscDequeue, mpscPrepareWait, mpscClearWakeup, mpscGetEventFd};
+
+static u_int32_t xorshift(u_int32_t* state) {
+	u_int32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static double nowSecs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* runProducer(void* arg) {
+	ring_producer* p = (ring_producer*) arg;
+	u_int32_t rng = 0x9e3779b9 ^ (u_int32_t) p->id;
+	void* objs[RING_TEST_BURST];
+	long seq = 1, bursts = 0;
+
+	while (seq <= p->items) {
+		int n = p->stress ? 1 + xorshift(&rng) % p->burst : p->burst;
+		int done = 0;
+
+		if (n > p->items - seq + 1) {
+			n = p->items - seq + 1;
+		}
+		for (int i = 0; i < n; i++) {
+			objs[i] = (void*) (uintptr_t) ((p->id << RING_ID_SHIFT) | (u_int64_t) (seq + i));
+		}
+		while (done < n) {
+			int k = p->ops->enqueue(p->ring, objs + done, n - done);
+			if (k == 0) {
+				sched_yield();
+			}
+			done += k;
+		}
+		seq += n;
+
+		if (p->stress && ++bursts % 64 == 0) {
+			usleep(xorshift(&rng) % 100);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Runs numProducers producers of items each against ring and consumes everything they send.
+ * Under stress the consumer sleeps whenever the ring is empty; otherwise it spins.
+ */
+static void runTest(void* ring, const ring_ops* ops, int numProducers, long items, int burst, bool stress, ring_result* r) {
+	ring_producer producers[numProducers];
+	long expected[numProducers];
+	long total = items * numProducers;
+	void* objs[RING_TEST_BURST];
+	struct pollfd pfd;
+
+	r->items = 0;
+	r->orderErrors = 0;
+	r->sleeps = 0;
+	r->lostWakeups = 0;
+	pfd.fd = ops->getEventFd(ring);
+	pfd.events = POLLIN;
+
+	double start = nowSecs();
+	for (int i = 0; i < numProducers; i++) {
+		producers[i].ring = ring;
+		producers[i].ops = ops;
+		producers[i].id = i;
+		producers[i].items = items;
+		producers[i].burst = burst;
+		producers[i].stress = stress;
+		expected[i] = 1;
+		pthread_create(&producers[i].thread, NULL, runProducer, &producers[i]);
+	}
+
+	while (r->items < total) {
+		int n = ops->dequeue(ring, objs, RING_TEST_BURST);
+
+		if (n == 0 && !stress) {
+			sched_yield();
+		} else if (n == 0) {
+			ops->clearWakeup(ring);
+			if (!ops->prepareWait(ring)) {
+				continue;
+			}
+			r->sleeps++;
+			if (poll(&pfd, 1, RING_WAIT_MS) == 0 && (n = ops->dequeue(ring, objs, RING_TEST_BURST)) > 0) {
+				r->lostWakeups++;
+			}
+		}
+
+		for (int i = 0; i < n; i++) {
+			u_int64_t item = (uintptr_t) objs[i];
+			u_int64_t id = item >> RING_ID_SHIFT;
+			if (id >= (u_int64_t) numProducers || (long) (item & ((1ull << RING_ID_SHIFT) - 1)) != expected[id]) {
+				r->orderErrors++;
+			} else {
+				expected[id]++;
+			}
+		}
+		r->items += n;
+	}
+	r->secs = nowSecs() - start;
+
+	for (int i = 0; i < numProducers; i++) {
+		pthread_join(producers[i].thread, NULL);
+	}
+}
+
+/* ringtest [items per producer] [mpsc producers] */
+int main(int argc, char** argv) {
+	long items = (argc > 1) ? atol(argv[1]) : 2000000;
+	int maxProducers = (argc > 2) ? atoi(argv[2]) : 4;
+	long failures = 0;
+	ring_result r;
+
+	if (items < 1 || items >= (1l << RING_ID_SHIFT) || maxProducers < 1 || maxProducers > 64) {
+		fprintf(stderr, "usage: ringtest [items per producer] [mpsc producers, 1 to 64]\n");
+		return 1;
+	}
+
+	// stress: random bursts, producers pausing so the consumer sleeps and wakes often
+	for (int producers = 1; producers <= maxProducers; producers *= 2) {
+		for (int type = 0; type < 2; type++) {
+			if (type == 0 && producers > 1) {
+				continue;
+			}
+			SpscRing spsc(RING_TEST_SIZE);
+			MpscRing mpsc(RING_TEST_SIZE);
+			runTest(type == 0 ? (void*) &spsc : (void*) &mpsc, type == 0 ? &spscOps : &mpscOps, producers, items,
+					RING_TEST_BURST, true, &r);
+			printf("test=%s producers=%d items=%ld order_errors=%ld sleeps=%ld lost_wakeups=%ld\n",
+					type == 0 ? "spsc" : "mpsc", producers, r.items, r.orderErrors, r.sleeps, r.lostWakeups);
+			failures += r.orderErrors + r.lostWakeups;
+		}
+	}
+
+	// throughput: fixed bursts, a consumer that spins instead of sleeping
+	for (int burst = 1; burst <= RING_TEST_BURST; burst *= RING_TEST_BURST) {
+		for (int producers = 1; producers <= maxProducers; producers *= 2) {
+			for (int type = 0; type < 2; type++) {
+				if (type == 0 && producers > 1) {
+					continue;
+				}
+				SpscRing spsc(RING_TEST_SIZE);
+				MpscRing mpsc(RING_TEST_SIZE);
+				runTest(type == 0 ? (void*) &spsc : (void*) &mpsc, type == 0 ? &spscOps : &mpscOps, producers, items,
+						burst, false, &r);
+				printf("bench=%s producers=%d burst=%d items=%ld secs=%.3f ops_per_s=%.0f\n", type == 0 ? "spsc" : "mpsc",
+						producers, burst, r.items, r.secs, r.items / r.secs);
+				failures += r.orderErrors;
+			}
+		}
+	}
+
+	return failures > 0;
+}
+#endif
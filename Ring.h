@@ -0,0 +1,80 @@
+#ifndef RING_H
+#define RING_H
+
+#include <sys/types.h>
+
+#define CACHE_LINE 64
+
+/**
+ * Bounded lock-free single-producer single-consumer ring of pointers. Head and tail live on
+ * cache lines of their own, and each side keeps a private copy of the other side's index so it
+ * only reads the shared one when the ring looks full (or empty).
+ *
+ * A consumer that wants to sleep calls prepareWait() and, if it returns true, waits for the
+ * ring's eventfd to become readable. Producers only write the eventfd when a consumer has
+ * announced it is about to sleep, so a busy consumer costs them no syscalls.
+ */
+class SpscRing {
+
+	private:
+		void** slots;
+		u_int32_t mask;
+		int eventFd;
+
+		// consumer side
+		u_int32_t head __attribute__((aligned(CACHE_LINE)));
+		u_int32_t cachedTail;
+
+		// producer side
+		u_int32_t tail __attribute__((aligned(CACHE_LINE)));
+		u_int32_t cachedHead;
+
+		// set by a consumer about to sleep
+		int waiting __attribute__((aligned(CACHE_LINE)));
+
+	public:
+		SpscRing(u_int32_t size);
+		~SpscRing();
+		int enqueueBurst(void** objs, int count);
+		int dequeueBurst(void** objs, int count);
+		bool prepareWait();
+		void clearWakeup();
+		void notify();
+		int getEventFd();
+		u_int32_t getCount();
+};
+
+/**
+ * Bounded lock-free multi-producer single-consumer ring of pointers. Producers claim a run of
+ * slots with one compare-and-swap on the tail and then publish each slot through its sequence
+ * number, so a slow producer holds back only the consumer, never the other producers.
+ * Sleeping works as for SpscRing.
+ */
+class MpscRing {
+
+	private:
+		typedef struct {
+			u_int32_t seq;
+			void* obj;
+		} mpsc_slot;
+
+		mpsc_slot* slots;
+		u_int32_t mask;
+		int eventFd;
+
+		u_int32_t head __attribute__((aligned(CACHE_LINE)));
+		u_int32_t tail __attribute__((aligned(CACHE_LINE)));
+		int waiting __attribute__((aligned(CACHE_LINE)));
+
+	public:
+		MpscRing(u_int32_t size);
+		~MpscRing();
+		int enqueueBurst(void** objs, int count);
+		int dequeueBurst(void** objs, int count);
+		bool prepareWait();
+		void clearWakeup();
+		void notify();
+		int getEventFd();
+};
+
+#endif
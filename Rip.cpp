@@ -0,0 +1,620 @@
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "Rip.h"
+#include "FwdTable.h"
+#include "Log.h"
+#include "constants.h"
+
+using namespace std;
+
+Rip::Rip(TimerWheel* timers, routing_send_cb sendCb, routing_route_cb routeCb, void* arg)
+		: routingTable(timers, onRouteExpired, this) {
+	this->timers = timers;
+	this->sendCb = sendCb;
+	this->routeCb = routeCb;
+	cbArg = arg;
+	triggeredUpdates = true;
+	memset(&stats, 0, sizeof(stats));
+	TimerWheel::initTimer(&periodicTimer, onPeriodicTimer, this);
+	TimerWheel::initTimer(&holdTimer, onHoldTimer, this);
+}
+
+Rip::~Rip() {
+	timers->cancel(&periodicTimer);
+	timers->cancel(&holdTimer);
+}
+
+u_int8_t Rip::getProtocol() {
+	return RIP_PROTOCOL;
+}
+
+/**
+ * Adds an interface with our address localAddr facing neighborAddr (network byte order). Both
+ * get routes that never expire: localAddr is delivered locally and the neighbor is one hop away.
+ * Returns the interface number.
+ */
+int Rip::addInterface(u_int32_t localAddr, u_int32_t neighborAddr) {
+	int itfNum = neighbors.size();
+	route_entry* route;
+
+	neighbors.push_back(neighborAddr);
+	itfUp.push_back(1);
+
+	route = getRoute(localAddr);
+	setRoute(route, FWD_LOCAL, 0);
+	routingTable.clearExpiry(route);
+
+	route = getRoute(neighborAddr);
+	setRoute(route, itfNum, 1);
+	routingTable.clearExpiry(route);
+
+	return itfNum;
+}
+
+/**
+ * Asks every neighbor for its table, sends it ours, and starts the periodic updates
+ */
+void Rip::start() {
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (itfUp[i]) {
+			sendRequest(i);
+			sendUpdate(i, NULL);
+		}
+	}
+	changed.clear();
+	timers->schedule(&periodicTimer, ROUTING_INTERVAL_MS);
+}
+
+void Rip::onPeriodicTimer(wheel_timer* timer, void* arg) {
+	Rip* rip = (Rip*) arg;
+
+	rip->sendPeriodic();
+	rip->timers->schedule(timer, ROUTING_INTERVAL_MS);
+}
+
+/**
+ * Times out a learned route: a live route is poisoned and the neighbors are told, a poisoned
+ * one has been advertised as such for long enough and is removed
+ */
+void Rip::onRouteExpired(route_entry* route, void* arg) {
+	Rip* rip = (Rip*) arg;
+
+	if (route->cost < RIP_INFINITY) {
+		rip->poisonRoute(route);
+		rip->sendTriggered();
+	} else {
+		rip->routingTable.erase(route->prefix);
+	}
+}
+
+/**
+ * Returns the route to dest, creating an unreachable one if there is none
+ */
+route_entry* Rip::getRoute(u_int32_t dest) {
+	route_entry* route = routingTable.find(dest);
+
+	if (route == NULL) {
+		route = routingTable.insert(dest);
+		route->cost = RIP_INFINITY;
+	}
+
+	return route;
+}
+
+/**
+ * Points route at itfNum with the given cost, updating the forwarding plane and queueing the
+ * route for the next triggered update. The caller takes care of the route's expiry.
+ */
+void Rip::setRoute(route_entry* route, int itfNum, int cost) {
+	bool reachable = cost < RIP_INFINITY;
+	bool wasReachable = route->cost < RIP_INFINITY;
+
+	// a cost change alone leaves the forwarding plane as it is
+	if (reachable != wasReachable || (reachable && itfNum != routeItf(route))) {
+		routeCb(route->prefix, reachable ? itfNum : FWD_NO_ROUTE, cbArg);
+	}
+
+	setRouteItf(route, itfNum);
+	route->cost = cost;
+	changed.push_back(route->prefix);
+	stats.routeChanges++;
+}
+
+/**
+ * Marks a route unreachable. It is kept, and advertised as such, for one more timeout so the
+ * news reaches the neighbors before the route is forgotten.
+ */
+void Rip::poisonRoute(route_entry* route) {
+	setRoute(route, routeItf(route), RIP_INFINITY);
+	routingTable.setExpiry(route, ROUTE_TIMEOUT_MS);
+}
+
+/**
+ * Handles a RIP message from the neighbor at saddr (network byte order). Route changes are
+ * batched until the next call to sendTriggered. Returns 0, or -1 if the message was discarded.
+ */
+int Rip::handlePacket(u_int32_t saddr, const char* msg, int len) {
+	const rip_packet* pkt = (const rip_packet*) msg;
+	int itfNum = -1;
+	int numEntries;
+
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (neighbors[i] == saddr && itfUp[i]) {
+			itfNum = i;
+			break;
+		}
+	}
+	if (itfNum < 0) {
+		LOG_DEBUG("RIP message from unknown neighbor, discarding");
+		return -1;
+	}
+
+	if (len < (int) RIP_HDR_SIZE) {
+		LOG_WARN("Partial RIP message received, discarding");
+		return -1;
+	}
+	numEntries = ntohs(pkt->numEntries);
+	if (numEntries > MAX_ROUTES || len < (int) (RIP_HDR_SIZE + numEntries * sizeof(rip_entry))) {
+		LOG_WARN("Malformed RIP message, discarding");
+		return -1;
+	}
+
+	stats.updatesRcvd++;
+	switch (ntohs(pkt->command)) {
+		case RIP_REQUEST:
+			sendUpdate(itfNum, NULL);
+			break;
+		case RIP_RESPONSE:
+			handleResponse(itfNum, pkt, numEntries);
+			break;
+		default:
+			LOG_WARN("Unknown RIP command, discarding");
+			return -1;
+	}
+
+	return 0;
+}
+
+void Rip::handleResponse(int itfNum, const rip_packet* msg, int numEntries) {
+	for (int i = 0; i < numEntries; i++) {
+		u_int32_t cost = ntohl(msg->entries[i].cost);
+		route_entry* route = routingTable.find(msg->entries[i].address);
+
+		cost = (cost >= RIP_INFINITY - 1) ? RIP_INFINITY : cost + 1;
+
+		if (route == NULL) {
+			if (cost < RIP_INFINITY) {
+				route = getRoute(msg->entries[i].address);
+				setRoute(route, itfNum, cost);
+				routingTable.setExpiry(route, ROUTE_TIMEOUT_MS);
+			}
+			continue;
+		}
+
+		// local and directly connected routes are not learned
+		if (!routingTable.expires(route) && route->cost < RIP_INFINITY) {
+			continue;
+		}
+
+		if (routeItf(route) == itfNum) {
+			// whatever the current next hop says goes, including that the route is gone
+			if (cost < RIP_INFINITY) {
+				if ((int) cost != route->cost) {
+					setRoute(route, itfNum, cost);
+				}
+				routingTable.setExpiry(route, ROUTE_TIMEOUT_MS);
+			} else if (route->cost < RIP_INFINITY) {
+				poisonRoute(route);
+			}
+		} else if ((int) cost < route->cost) {
+			setRoute(route, itfNum, cost);
+			routingTable.setExpiry(route, ROUTE_TIMEOUT_MS);
+		}
+	}
+}
+
+/**
+ * Sends routes out of itfNum in messages of up to MAX_ROUTES entries: the whole table, or just
+ * the destinations in dests. Routes through itfNum are advertised back as unreachable.
+ */
+void Rip::sendUpdate(int itfNum, const vector<u_int32_t>* dests) {
+	rip_packet msg;
+	int n = 0;
+	int next = 0;
+	int total = (dests == NULL) ? routingTable.size() : dests->size();
+
+	msg.command = htons(RIP_RESPONSE);
+	while (next < total) {
+		const route_entry* route;
+
+		if (dests == NULL) {
+			route = routingTable.at(next++);
+		} else if ((route = routingTable.find((*dests)[next++])) == NULL) {
+			continue;
+		}
+
+		// split horizon with poison reverse
+		int cost = (routeItf(route) == itfNum) ? RIP_INFINITY : route->cost;
+		msg.entries[n].cost = htonl(cost);
+		msg.entries[n].address = route->prefix;
+		if (++n == MAX_ROUTES) {
+			sendMessage(itfNum, &msg, n);
+			n = 0;
+		}
+	}
+
+	if (n > 0) {
+		sendMessage(itfNum, &msg, n);
+	}
+}
+
+void Rip::sendRequest(int itfNum) {
+	rip_packet msg;
+
+	msg.command = htons(RIP_REQUEST);
+	sendMessage(itfNum, &msg, 0);
+}
+
+void Rip::sendMessage(int itfNum, rip_packet* msg, int numEntries) {
+	int len = RIP_HDR_SIZE + numEntries * sizeof(rip_entry);
+
+	msg->numEntries = htons(numEntries);
+	sendCb(itfNum, (const char*) msg, len, cbArg);
+	stats.updatesSent++;
+	stats.bytesSent += len;
+}
+
+/**
+ * Sends the whole table to every neighbor
+ */
+void Rip::sendPeriodic() {
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (itfUp[i]) {
+			sendUpdate(i, NULL);
+		}
+	}
+
+	// the full table covers anything a triggered update was waiting to send
+	changed.clear();
+}
+
+/**
+ * Sends the routes that changed since the last update to every neighbor. Changes made during
+ * the hold-down after a triggered update go out together when it ends.
+ */
+void Rip::sendTriggered() {
+	if (!triggeredUpdates || changed.empty() || TimerWheel::isPending(&holdTimer)) {
+		return;
+	}
+
+	sort(changed.begin(), changed.end());
+	changed.erase(unique(changed.begin(), changed.end()), changed.end());
+
+	u_int64_t sent = stats.updatesSent;
+	for (vector<u_int32_t>::size_type i = 0; i != neighbors.size(); i++) {
+		if (itfUp[i]) {
+			sendUpdate(i, &changed);
+		}
+	}
+	stats.triggeredSent += stats.updatesSent - sent;
+	changed.clear();
+	timers->schedule(&holdTimer, TRIGGER_HOLDDOWN_MS);
+}
+
+void Rip::onHoldTimer(wheel_timer* timer, void* arg) {
+	((Rip*) arg)->sendTriggered();
+}
+
+/**
+ * Turns triggered updates on or off; with them off, changes wait for the next periodic update
+ */
+void Rip::setTriggeredUpdates(bool enabled) {
+	triggeredUpdates = enabled;
+}
+
+/**
+ * Brings an interface up or down. Routes through a downed interface are poisoned; bringing it
+ * back up restores the neighbor's route and asks it for its table.
+ */
+void Rip::setInterfaceUp(int itfNum, bool up) {
+	if (itfNum < 0 || itfNum >= (int) neighbors.size() || (bool) itfUp[itfNum] == up) {
+		return;
+	}
+	itfUp[itfNum] = up;
+
+	if (!up) {
+		for (int i = 0; i < routingTable.size(); i++) {
+			route_entry* route = routingTable.at(i);
+			if (routeItf(route) == itfNum && route->cost < RIP_INFINITY) {
+				poisonRoute(route);
+			}
+		}
+		return;
+	}
+
+	route_entry* route = getRoute(neighbors[itfNum]);
+	if (route->cost > 1 || routeItf(route) != itfNum) {
+		setRoute(route, itfNum, 1);
+	}
+	routingTable.clearExpiry(route);
+
+	sendRequest(itfNum);
+	sendUpdate(itfNum, NULL);
+}
+
+const RouteTable& Rip::getRoutes() {
+	return routingTable;
+}
+
+rip_stats Rip::getStats() {
+	return stats;
+}
+
+#ifdef RIP_MAIN
+#include <stdlib.h>
+#include <time.h>
+#include <deque>
+
+/*
+ * Convergence benchmark: runs one engine per node of a generated topology (a ring with random
+ * chords) and delivers messages in memory. All engines share a timer wheel running in virtual
+ * time. Messages are delivered in waves, one wave per SIM_DELAY_MS link delay; while nothing is
+ * in flight, time skips ahead to the next timer.
+ */
+
+#define SIM_DELAY_MS 1
+#define MAX_SIM_MS (4 * RIP_INFINITY * ROUTING_INTERVAL_MS)
+
+typedef struct {
+	int node;
+	u_int32_t saddr;
+	vector<char> data;
+} sim_msg;
+
+typedef struct {
+	Rip* rip;
+	vector<int> peers; // node on the other end of each interface
+	vector<u_int32_t> addrs; // our address on each interface
+	vector<u_int32_t> peerAddrs;
+} sim_node;
+
+static TimerWheel wheel(false);
+static vector<sim_node> nodes;
+static deque<sim_msg> inFlight;
+static map<u_int32_t, int> owner; // address -> node
+
+static void simSend(int itfNum, const char* msg, int len, void* arg) {
+	sim_node* node = (sim_node*) arg;
+	sim_msg m;
+
+	m.node = node->peers[itfNum];
+	m.saddr = node->addrs[itfNum];
+	m.data.assign(msg, msg + len);
+	inFlight.push_back(m);
+}
+
+static void simRoute(u_int32_t dest, int itfNum, void* arg) {
+}
+
+static void addLink(int a, int b) {
+	int link = owner.size() / 2;
+	u_int32_t addrA = htonl((10u << 24) | ((u_int32_t) link << 2) | 1);
+	u_int32_t addrB = htonl((10u << 24) | ((u_int32_t) link << 2) | 2);
+
+	nodes[a].peers.push_back(b);
+	nodes[a].addrs.push_back(addrA);
+	nodes[a].peerAddrs.push_back(addrB);
+	nodes[b].peers.push_back(a);
+	nodes[b].addrs.push_back(addrB);
+	nodes[b].peerAddrs.push_back(addrA);
+	owner[addrA] = a;
+	owner[addrB] = b;
+}
+
+static bool linked(int a, int b) {
+	for (vector<int>::size_type i = 0; i != nodes[a].peers.size(); i++) {
+		if (nodes[a].peers[i] == b) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Checks that every node reaches every address at its hop distance, skipping links in down
+ */
+static bool converged(const vector< pair<int, int> >& down) {
+	int n = nodes.size();
+
+	for (int src = 0; src < n; src++) {
+		vector<int> dist(n, -1);
+		deque<int> q;
+
+		dist[src] = 0;
+		q.push_back(src);
+		while (!q.empty()) {
+			int u = q.front();
+			q.pop_front();
+			for (vector<int>::size_type i = 0; i != nodes[u].peers.size(); i++) {
+				int v = nodes[u].peers[i];
+				pair<int, int> link(min(u, v), max(u, v));
+				if (dist[v] < 0 && find(down.begin(), down.end(), link) == down.end()) {
+					dist[v] = dist[u] + 1;
+					q.push_back(v);
+				}
+			}
+		}
+
+		const RouteTable& routes = nodes[src].rip->getRoutes();
+		for (map<u_int32_t, int>::iterator it = owner.begin(); it != owner.end(); it++) {
+			const route_entry* r = routes.find(it->first);
+			int expect = (dist[it->second] < 0 || dist[it->second] >= RIP_INFINITY) ? RIP_INFINITY : dist[it->second];
+			int cost = (r == NULL) ? RIP_INFINITY : r->cost;
+			if (cost != expect) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Runs the network until every node has the right cost to every address, checked whenever no
+ * messages are in flight, or until MAX_SIM_MS pass. Triggered updates are sent after each node
+ * has handled its share of a wave. Returns the virtual time taken in ms, or -1 if the network did
+ * not converge.
+ */
+static long runNetwork(const vector< pair<int, int> >& down, int* waves) {
+	u_int64_t start = wheel.getTime();
+	u_int64_t when;
+
+	*waves = 0;
+	while (wheel.getTime() - start <= MAX_SIM_MS) {
+		if (inFlight.empty()) {
+			if (converged(down)) {
+				return wheel.getTime() - start;
+			}
+			if (!wheel.nextExpiry(&when)) {
+				break;
+			}
+			wheel.advance(max(when, wheel.getTime()));
+			continue;
+		}
+
+		deque<sim_msg> wave;
+		wave.swap(inFlight);
+		for (deque<sim_msg>::iterator it = wave.begin(); it != wave.end(); it++) {
+			nodes[it->node].rip->handlePacket(it->saddr, &it->data[0], it->data.size());
+		}
+		for (vector<sim_node>::size_type i = 0; i != nodes.size(); i++) {
+			nodes[i].rip->sendTriggered();
+		}
+		(*waves)++;
+		wheel.advance(wheel.getTime() + SIM_DELAY_MS);
+	}
+
+	return -1;
+}
+
+static void totals(u_int64_t* msgs, u_int64_t* bytes) {
+	*msgs = 0;
+	*bytes = 0;
+	for (vector<sim_node>::size_type i = 0; i != nodes.size(); i++) {
+		rip_stats s = nodes[i].rip->getStats();
+		*msgs += s.updatesSent;
+		*bytes += s.bytesSent;
+	}
+}
+
+static double elapsedMs(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void build(int numNodes, int degree, unsigned seed, bool triggered) {
+	for (vector<sim_node>::size_type i = 0; i != nodes.size(); i++) {
+		delete nodes[i].rip;
+	}
+	nodes.assign(numNodes, sim_node());
+	owner.clear();
+	inFlight.clear();
+
+	srand(seed);
+	for (int i = 0; i < numNodes; i++) {
+		addLink(i, (i + 1) % numNodes);
+	}
+	for (int chords = numNodes * (degree - 2) / 2; chords > 0; ) {
+		int a = rand() % numNodes, b = rand() % numNodes;
+		if (a != b && !linked(a, b)) {
+			addLink(a, b);
+			chords--;
+		}
+	}
+
+	for (int i = 0; i < numNodes; i++) {
+		nodes[i].rip = new Rip(&wheel, simSend, simRoute, &nodes[i]);
+		nodes[i].rip->setTriggeredUpdates(triggered);
+		for (vector<u_int32_t>::size_type j = 0; j != nodes[i].addrs.size(); j++) {
+			nodes[i].rip->addInterface(nodes[i].addrs[j], nodes[i].peerAddrs[j]);
+		}
+	}
+}
+
+/**
+ * Fails a chord, which leaves the ring to keep the graph connected, and adds it to down
+ */
+static void failChord(vector< pair<int, int> >& down) {
+	int numNodes = nodes.size();
+
+	for (int a = 0; a < numNodes; a++) {
+		for (vector<int>::size_type i = 0; i != nodes[a].peers.size(); i++) {
+			int b = nodes[a].peers[i];
+			if (b == (a + 1) % numNodes || a == (b + 1) % numNodes) {
+				continue;
+			}
+
+			down.push_back(make_pair(min(a, b), max(a, b)));
+			nodes[a].rip->setInterfaceUp(i, false);
+			for (vector<int>::size_type j = 0; j != nodes[b].peers.size(); j++) {
+				if (nodes[b].peers[j] == a) {
+					nodes[b].rip->setInterfaceUp(j, false);
+				}
+			}
+			nodes[a].rip->sendTriggered();
+			nodes[b].rip->sendTriggered();
+			return;
+		}
+	}
+}
+
+/**
+ * Runs the network until it converges and prints the results
+ */
+static void converge(bool triggered, const char* event, const vector< pair<int, int> >& down) {
+	struct timespec start;
+	u_int64_t msgsBefore, bytesBefore, msgs, bytes;
+	int waves;
+	long simMs;
+	double ms;
+
+	totals(&msgsBefore, &bytesBefore);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	simMs = runNetwork(down, &waves);
+	ms = elapsedMs(&start);
+
+	totals(&msgs, &bytes);
+	printf("mode=%s event=%s nodes=%d links=%d converged=%d waves=%d converge_ms=%ld msgs=%llu bytes=%llu cpu_ms=%.2f\n",
+			triggered ? "triggered" : "periodic", event, (int) nodes.size(), (int) owner.size() / 2,
+			simMs >= 0, waves, simMs, (unsigned long long) (msgs - msgsBefore),
+			(unsigned long long) (bytes - bytesBefore), ms);
+}
+
+/* ripbench [nodes] [degree] [seed] */
+int main(int argc, char** argv) {
+	int numNodes = (argc > 1) ? atoi(argv[1]) : 100;
+	int degree = (argc > 2) ? atoi(argv[2]) : 4;
+	unsigned seed = (argc > 3) ? atoi(argv[3]) : 1;
+
+	for (int triggered = 1; triggered >= 0; triggered--) {
+		vector< pair<int, int> > down;
+
+		build(numNodes, degree, seed, triggered);
+		for (int i = 0; i < numNodes; i++) {
+			nodes[i].rip->start();
+		}
+		converge(triggered, "cold_start", down);
+
+		failChord(down);
+		converge(triggered, "link_down", down);
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,93 @@
+#ifndef RIP_H
+#define RIP_H
+
+#include <map>
+#include <vector>
+#include <sys/types.h>
+#include "constants.h"
+#include "RoutingProtocol.h"
+#include "RouteTable.h"
+#include "TimerWheel.h"
+
+using namespace std;
+
+#define RIP_PROTOCOL 200
+#define RIP_INFINITY 16
+#define RIP_REQUEST 1
+#define RIP_RESPONSE 2
+
+/**
+ * Wire format of a RIP message, all fields in network byte order. A message carries at most
+ * MAX_ROUTES entries and is sent truncated to numEntries.
+ */
+typedef struct {
+	u_int32_t cost;
+	u_int32_t address;
+} rip_entry;
+
+typedef struct {
+	u_int16_t command;
+	u_int16_t numEntries;
+	rip_entry entries[MAX_ROUTES];
+} rip_packet;
+
+#define RIP_HDR_SIZE (2 * sizeof(u_int16_t))
+
+typedef struct {
+	u_int64_t updatesSent; // messages sent, requests included
+	u_int64_t bytesSent; // RIP payload bytes sent
+	u_int64_t triggeredSent; // messages sent by triggered updates
+	u_int64_t updatesRcvd;
+	u_int64_t routeChanges;
+} rip_stats;
+
+/**
+ * Distance-vector routing engine. Keeps the routing table, answers requests, and sends periodic
+ * full updates plus triggered updates that carry only the routes changed since the last one,
+ * at most one per TRIGGER_HOLDDOWN_MS. Routes learned from a neighbor are advertised back to it
+ * as unreachable (split horizon with poison reverse). Learned routes carry an expiry that a
+ * refresh pushes back; the route table checks expiries off the timer wheel.
+ */
+class Rip : public RoutingProtocol {
+
+	private:
+		RouteTable routingTable; // host routes, keyed by destination
+		vector<u_int32_t> neighbors; // neighbor address on each interface
+		vector<char> itfUp;
+		vector<u_int32_t> changed; // destinations changed since the last triggered update
+		TimerWheel* timers;
+		wheel_timer periodicTimer;
+		wheel_timer holdTimer; // pending while triggered updates are held down
+		bool triggeredUpdates;
+		routing_send_cb sendCb;
+		routing_route_cb routeCb;
+		void* cbArg;
+		rip_stats stats;
+
+		route_entry* getRoute(u_int32_t dest);
+		void setRoute(route_entry* route, int itfNum, int cost);
+		void poisonRoute(route_entry* route);
+		void sendUpdate(int itfNum, const vector<u_int32_t>* dests);
+		void sendRequest(int itfNum);
+		void sendMessage(int itfNum, rip_packet* msg, int numEntries);
+		void handleResponse(int itfNum, const rip_packet* msg, int numEntries);
+		static void onRouteExpired(route_entry* route, void* arg);
+		static void onPeriodicTimer(wheel_timer* timer, void* arg);
+		static void onHoldTimer(wheel_timer* timer, void* arg);
+
+	public:
+		Rip(TimerWheel* timers, routing_send_cb sendCb, routing_route_cb routeCb, void* arg);
+		~Rip();
+		u_int8_t getProtocol();
+		int addInterface(u_int32_t localAddr, u_int32_t neighborAddr);
+		void start();
+		int handlePacket(u_int32_t saddr, const char* msg, int len);
+		void sendPeriodic();
+		void sendTriggered();
+		void setInterfaceUp(int itfNum, bool up);
+		void setTriggeredUpdates(bool enabled);
+		const RouteTable& getRoutes();
+		rip_stats getStats();
+};
+
+#endif
@@ -0,0 +1,393 @@
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RouteTable.h"
+#include "FwdTable.h"
+
+using namespace std;
+
+RouteTable::RouteTable(TimerWheel* timers, route_expiry_cb expiryCb, void* arg) {
+	this->timers = timers;
+	this->expiryCb = expiryCb;
+	cbArg = arg;
+	routes = NULL;
+	count = 0;
+	capacity = 0;
+	index = NULL;
+	indexMask = 0;
+	grow();
+}
+
+RouteTable::~RouteTable() {
+	for (map<u_int64_t, expiry_bucket>::iterator it = buckets.begin(); it != buckets.end(); it++) {
+		timers->cancel(&it->second.timer);
+	}
+	free(routes);
+	delete[] index;
+}
+
+/**
+ * Returns the index slot holding (prefix, len), or the empty slot it would go in
+ */
+u_int32_t RouteTable::findSlot(u_int32_t prefix, int len) const {
+	u_int64_t k = key(prefix, len);
+	u_int32_t slot = hash(k);
+
+	while (index[slot] != 0) {
+		const route_entry* route = &routes[index[slot] - 1];
+		if (route->prefix == prefix && route->len == len) {
+			break;
+		}
+		slot = (slot + 1) & indexMask;
+	}
+
+	return slot;
+}
+
+/**
+ * Doubles the record array, keeping the index at most half full
+ */
+void RouteTable::grow() {
+	u_int32_t newCapacity = capacity ? 2 * capacity : ROUTE_MIN_CAPACITY;
+	void* mem;
+
+	if (posix_memalign(&mem, ROUTE_ALIGN, newCapacity * sizeof(route_entry)) != 0) {
+		perror("Route table allocation error:");
+		exit(1);
+	}
+	if (count > 0) {
+		memcpy(mem, routes, count * sizeof(route_entry));
+	}
+	free(routes);
+	routes = (route_entry*) mem;
+	capacity = newCapacity;
+
+	if (2 * capacity > indexMask + 1) {
+		rehash(2 * capacity);
+	}
+}
+
+void RouteTable::rehash(u_int32_t size) {
+	delete[] index;
+	index = new u_int32_t[size];
+	memset(index, 0, size * sizeof(u_int32_t));
+	indexMask = size - 1;
+
+	for (u_int32_t i = 0; i < count; i++) {
+		index[findSlot(routes[i].prefix, routes[i].len)] = i + 1;
+	}
+}
+
+route_entry* RouteTable::find(u_int32_t prefix, int len) {
+	u_int32_t slot = findSlot(prefix, len);
+	return index[slot] ? &routes[index[slot] - 1] : NULL;
+}
+
+const route_entry* RouteTable::find(u_int32_t prefix, int len) const {
+	u_int32_t slot = findSlot(prefix, len);
+	return index[slot] ? &routes[index[slot] - 1] : NULL;
+}
+
+/**
+ * Returns the route for (prefix, len), adding an unreachable one that never expires if there
+ * is none
+ */
+route_entry* RouteTable::insert(u_int32_t prefix, int len) {
+	u_int32_t slot = findSlot(prefix, len);
+
+	if (index[slot] != 0) {
+		return &routes[index[slot] - 1];
+	}
+
+	if (count == capacity) {
+		grow();
+		slot = findSlot(prefix, len);
+	}
+
+	route_entry* route = &routes[count];
+	memset(route, 0, sizeof(route_entry));
+	route->prefix = prefix;
+	route->len = len;
+	setRouteItf(route, FWD_NO_ROUTE);
+	index[slot] = ++count;
+
+	return route;
+}
+
+/**
+ * Removes the route for (prefix, len), if there is one. The last record takes its place.
+ */
+void RouteTable::erase(u_int32_t prefix, int len) {
+	u_int32_t slot = findSlot(prefix, len);
+	u_int32_t r, last = count - 1;
+
+	if (index[slot] == 0) {
+		return;
+	}
+	r = index[slot] - 1;
+
+	// close the gap, moving back any entry that probed past the freed slot
+	index[slot] = 0;
+	for (u_int32_t next = (slot + 1) & indexMask; index[next] != 0; next = (next + 1) & indexMask) {
+		const route_entry* route = &routes[index[next] - 1];
+		u_int32_t home = hash(key(route->prefix, route->len));
+
+		if (((next - home) & indexMask) >= ((next - slot) & indexMask)) {
+			index[slot] = index[next];
+			index[next] = 0;
+			slot = next;
+		}
+	}
+
+	if (r != last) {
+		index[findSlot(routes[last].prefix, routes[last].len)] = r + 1;
+		routes[r] = routes[last];
+	}
+	count--;
+}
+
+/**
+ * Sets a route to expire delayMs from now. A route pushed back keeps its place in the expiry
+ * buckets, so a refresh costs a single store; one brought forward is queued again, and the
+ * entry left behind is dropped when its bucket comes up.
+ */
+void RouteTable::setExpiry(route_entry* route, u_int64_t delayMs) {
+	u_int64_t when = timers->getTime() + delayMs;
+	u_int32_t expiry = (u_int32_t) when ? (u_int32_t) when : 1;
+	bool sooner = route->expiry == 0 || (int32_t) (expiry - route->expiry) < 0;
+
+	route->expiry = expiry;
+	if (!route->timed || sooner) {
+		queue(route, when);
+	}
+}
+
+/**
+ * Makes a route never expire
+ */
+void RouteTable::clearExpiry(route_entry* route) {
+	route->expiry = 0;
+}
+
+bool RouteTable::expires(const route_entry* route) const {
+	return route->expiry != 0;
+}
+
+/**
+ * Puts a route in the bucket covering when, starting the bucket's timer if it is new
+ */
+void RouteTable::queue(route_entry* route, u_int64_t when) {
+	u_int64_t time = (when + ROUTE_EXPIRY_GRAIN_MS - 1) / ROUTE_EXPIRY_GRAIN_MS * ROUTE_EXPIRY_GRAIN_MS;
+	map<u_int64_t, expiry_bucket>::iterator it = buckets.find(time);
+
+	if (it == buckets.end()) {
+		u_int64_t now = timers->getTime();
+		expiry_bucket* bucket = &buckets[time];
+
+		bucket->table = this;
+		bucket->time = time;
+		TimerWheel::initTimer(&bucket->timer, onBucketTimer, bucket);
+		timers->schedule(&bucket->timer, (time > now) ? time - now : 0);
+		it = buckets.find(time);
+	}
+
+	it->second.keys.push_back(key(route->prefix, route->len));
+	route->timed = 1;
+}
+
+/**
+ * Checks the routes in a bucket: those whose expiry has passed are handed to the expiry
+ * callback, those refreshed since they were queued move on to the bucket of their new expiry
+ */
+void RouteTable::onBucketTimer(wheel_timer* timer, void* arg) {
+	expiry_bucket* bucket = (expiry_bucket*) arg;
+	RouteTable* table = bucket->table;
+	vector<u_int64_t> keys;
+
+	keys.swap(bucket->keys);
+	table->buckets.erase(bucket->time);
+
+	// a route brought forward, or erased and added back, while queued can be listed twice
+	sort(keys.begin(), keys.end());
+	keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+	u_int64_t now = table->timers->getTime();
+	for (vector<u_int64_t>::size_type i = 0; i != keys.size(); i++) {
+		route_entry* route = table->find((u_int32_t) keys[i], keys[i] >> 32);
+
+		if (route == NULL || !route->timed) {
+			continue;
+		}
+		route->timed = 0;
+		if (route->expiry == 0) {
+			continue;
+		}
+
+		int32_t left = (int32_t) (route->expiry - (u_int32_t) now);
+		if (left > 0) {
+			table->queue(route, now + left);
+		} else {
+			table->expiryCb(route, table->cbArg);
+		}
+	}
+}
+
+int RouteTable::size() const {
+	return count;
+}
+
+route_entry* RouteTable::at(int i) {
+	return &routes[i];
+}
+
+const route_entry* RouteTable::at(int i) const {
+	return &routes[i];
+}
+
+/**
+ * Returns the bytes held by the records, the index and the expiry buckets
+ */
+size_t RouteTable::memoryUsage() const {
+	size_t bytes = capacity * sizeof(route_entry) + (indexMask + 1) * sizeof(u_int32_t);
+
+	for (map<u_int64_t, expiry_bucket>::const_iterator it = buckets.begin(); it != buckets.end(); it++) {
+		bytes += sizeof(expiry_bucket) + it->second.keys.capacity() * sizeof(u_int64_t);
+	}
+
+	return bytes;
+}
+
+#ifdef ROUTETABLE_MAIN
+#include <time.h>
+#include <malloc.h>
+#include <arpa/inet.h>
+
+/*
+ * Memory and lookup benchmark: fills route tables with random host routes and reports the heap
+ * bytes each layout takes per route, against the layouts routes used to have. legacy_route is
+ * the original string based entry, timer_route the one with an embedded wheel timer, both in a
+ * std::map keyed by destination.
+ */
+
+typedef struct {
+	char* dest;
+	char* nextHop;
+	int cost;
+	int TTL;
+} legacy_route;
+
+typedef struct {
+	u_int32_t dest;
+	u_int32_t nextHop;
+	int itfNum;
+	int cost;
+	wheel_timer timer;
+} timer_route;
+
+static size_t heapUsed() {
+	return mallinfo2().uordblks;
+}
+
+static double elapsedNs(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void onExpired(route_entry* route, void* arg) {
+}
+
+static void report(const char* layout, int numRoutes, size_t bytes, double lookupNs) {
+	printf("layout=%s routes=%d bytes=%zu bytes_per_route=%.1f lookup_ns=%.1f\n",
+			layout, numRoutes, bytes, (double) bytes / numRoutes, lookupNs);
+}
+
+/* routebench [routes] [seed] */
+int main(int argc, char** argv) {
+	int numRoutes = (argc > 1) ? atoi(argv[1]) : 1000000;
+	unsigned seed = (argc > 2) ? atoi(argv[2]) : 1;
+	vector<u_int32_t> dests;
+	struct timespec start;
+	size_t before;
+	volatile int sink = 0;
+
+	srand(seed);
+	while ((int) dests.size() < numRoutes) {
+		dests.push_back(((u_int32_t) rand() << 16) ^ rand());
+	}
+	sort(dests.begin(), dests.end());
+	dests.erase(unique(dests.begin(), dests.end()), dests.end());
+	numRoutes = dests.size();
+	random_shuffle(dests.begin(), dests.end());
+
+	{
+		map<u_int32_t, legacy_route>* routes = new map<u_int32_t, legacy_route>;
+		before = heapUsed();
+		for (int i = 0; i < numRoutes; i++) {
+			struct in_addr addr;
+			legacy_route* route = &(*routes)[dests[i]];
+			addr.s_addr = dests[i];
+			route->dest = strdup(inet_ntoa(addr));
+			route->nextHop = strdup("10.10.168.73");
+			route->cost = 1;
+			route->TTL = 12;
+		}
+		size_t bytes = heapUsed() - before;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < numRoutes; i++) {
+			sink += routes->find(dests[i])->second.cost;
+		}
+		report("legacy_strings", numRoutes, bytes, elapsedNs(&start) / numRoutes);
+		for (map<u_int32_t, legacy_route>::iterator it = routes->begin(); it != routes->end(); it++) {
+			free(it->second.dest);
+			free(it->second.nextHop);
+		}
+		delete routes;
+	}
+
+	{
+		map<u_int32_t, timer_route>* routes = new map<u_int32_t, timer_route>;
+		before = heapUsed();
+		for (int i = 0; i < numRoutes; i++) {
+			timer_route* route = &(*routes)[dests[i]];
+			route->dest = dests[i];
+			route->cost = 1;
+		}
+		size_t bytes = heapUsed() - before;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < numRoutes; i++) {
+			sink += routes->find(dests[i])->second.cost;
+		}
+		report("map_timer", numRoutes, bytes, elapsedNs(&start) / numRoutes);
+		delete routes;
+	}
+
+	for (int expiring = 0; expiring <= 1; expiring++) {
+		TimerWheel wheel(false);
+		before = heapUsed();
+		RouteTable* routes = new RouteTable(&wheel, onExpired, NULL);
+		for (int i = 0; i < numRoutes; i++) {
+			route_entry* route = routes->insert(dests[i]);
+			setRouteItf(route, 0);
+			route->cost = 1;
+			if (expiring) {
+				routes->setExpiry(route, ROUTE_TIMEOUT_MS);
+			}
+		}
+		size_t bytes = heapUsed() - before;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < numRoutes; i++) {
+			sink += routes->find(dests[i])->cost;
+		}
+		report(expiring ? "route_table_expiring" : "route_table", numRoutes, bytes, elapsedNs(&start) / numRoutes);
+		delete routes;
+	}
+
+	printf("route_entry_bytes=%zu\n", sizeof(route_entry));
+	return sink == 0;
+}
+#endif
@@ -0,0 +1,77 @@
+#ifndef ROUTETABLE_H
+#define ROUTETABLE_H
+
+#include <map>
+#include <vector>
+#include <sys/types.h>
+#include "constants.h"
+#include "TimerWheel.h"
+
+using namespace std;
+
+#define ROUTE_ALIGN 64 // the record array starts on a cache line
+#define ROUTE_MIN_CAPACITY 16
+#define ROUTE_EXPIRY_GRAIN_MS 128 // expiries are checked in buckets this wide, so fire up to this late
+
+// called when a route's expiry passes; may set a new expiry, or erase the route
+typedef void (*route_expiry_cb)(route_entry* route, void* arg);
+
+typedef struct {
+	wheel_timer timer;
+	class RouteTable* table;
+	u_int64_t time;
+	vector<u_int64_t> keys; // routes to check when the bucket comes up
+} expiry_bucket;
+
+/**
+ * Routing table kept as a contiguous array of packed route_entry records, with an open addressing
+ * hash index on (prefix, length). Removing a route moves the last record into its place, so
+ * inserting or erasing a route invalidates pointers to records.
+ *
+ * Expiries are stored in the records themselves. A route with an expiry sits in one bucket of
+ * ROUTE_EXPIRY_GRAIN_MS on the timer wheel; refreshing it only rewrites the record, and a route
+ * whose bucket comes up before its expiry moves on to a later bucket then. A busy table thus
+ * pays nothing per refresh and at most one bucket move per timeout.
+ */
+class RouteTable {
+
+	private:
+		route_entry* routes;
+		u_int32_t count;
+		u_int32_t capacity;
+		u_int32_t* index; // record number + 1 per slot, 0 if the slot is empty
+		u_int32_t indexMask;
+		TimerWheel* timers;
+		route_expiry_cb expiryCb;
+		void* cbArg;
+		map<u_int64_t, expiry_bucket> buckets; // bucket time -> bucket
+
+		static u_int64_t key(u_int32_t prefix, int len) {
+			return (u_int64_t) len << 32 | prefix;
+		}
+		u_int32_t hash(u_int64_t key) const {
+			return (u_int32_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & indexMask;
+		}
+		u_int32_t findSlot(u_int32_t prefix, int len) const;
+		void grow();
+		void rehash(u_int32_t size);
+		void queue(route_entry* route, u_int64_t when);
+		static void onBucketTimer(wheel_timer* timer, void* arg);
+
+	public:
+		RouteTable(TimerWheel* timers = NULL, route_expiry_cb expiryCb = NULL, void* arg = NULL);
+		~RouteTable();
+		route_entry* find(u_int32_t prefix, int len = 32);
+		const route_entry* find(u_int32_t prefix, int len = 32) const;
+		route_entry* insert(u_int32_t prefix, int len = 32);
+		void erase(u_int32_t prefix, int len = 32);
+		void setExpiry(route_entry* route, u_int64_t delayMs);
+		void clearExpiry(route_entry* route);
+		bool expires(const route_entry* route) const;
+		int size() const;
+		route_entry* at(int i);
+		const route_entry* at(int i) const;
+		size_t memoryUsage() const;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef ROUTINGPROTOCOL_H
+#define ROUTINGPROTOCOL_H
+
+#include <map>
+#include <sys/types.h>
+#include "constants.h"
+#include "RouteTable.h"
+
+using namespace std;
+
+// sends a routing message out of interface itfNum to the neighbor on the other end
+typedef void (*routing_send_cb)(int itfNum, const char* msg, int len, void* arg);
+// points dest (network byte order) at itfNum in the forwarding plane; FWD_NO_ROUTE withdraws it
+typedef void (*routing_route_cb)(u_int32_t dest, int itfNum, void* arg);
+
+/**
+ * Interface between the IP layer and a routing protocol engine. Engines do no I/O of their own:
+ * messages go out through a routing_send_cb and route changes through a routing_route_cb, and
+ * their timers run on a TimerWheel the caller drives. All calls, timers included, must come from
+ * a single thread.
+ */
+class RoutingProtocol {
+
+	public:
+		virtual ~RoutingProtocol() {}
+
+		// IP protocol number the engine's messages are carried under
+		virtual u_int8_t getProtocol() = 0;
+		// adds an interface with our address localAddr facing neighborAddr, network byte order
+		virtual int addInterface(u_int32_t localAddr, u_int32_t neighborAddr) = 0;
+		virtual void start() = 0;
+		// handles a message from the neighbor at saddr; returns -1 if it was discarded
+		virtual int handlePacket(u_int32_t saddr, const char* msg, int len) = 0;
+		// sends a full update now; engines schedule their own periodic work from start()
+		virtual void sendPeriodic() = 0;
+		// acts on the changes batched up since the last call
+		virtual void sendTriggered() = 0;
+		virtual void setInterfaceUp(int itfNum, bool up) = 0;
+		virtual const RouteTable& getRoutes() = 0;
+};
+
+#endif
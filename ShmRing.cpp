@@ -0,0 +1,449 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ShmRing.h"
+#include "Log.h"
+
+static long futexWake(u_int32_t* word, int count, bool shared) {
+	return syscall(SYS_futex, word, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+ShmRing::ShmRing(char* base, size_t mapLen, bool sender) {
+	this->base = base;
+	this->mapLen = mapLen;
+	this->sender = sender;
+	hdr = (shm_ring_hdr*) base;
+	mask = hdr->numSlots - 1;
+}
+
+/**
+ * Unmaps the ring and takes this process off it. The segment stays, for the other end and for
+ * the next run.
+ */
+ShmRing::~ShmRing() {
+	pid_t self = getpid();
+
+	__atomic_compare_exchange_n(sender ? &hdr->txPid : &hdr->rxPid, &self, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	munmap(base, mapLen);
+}
+
+static bool isAlive(pid_t pid) {
+	return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/**
+ * Bytes per slot for packets of up to mtu bytes
+ */
+static u_int32_t slotSizeFor(int mtu) {
+	return (SHM_SLOT_HDR + mtu + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+}
+
+/**
+ * Sizes the segment open on fd for packets of up to mtu bytes and sets up an empty ring in it.
+ * Returns the mapping, or NULL.
+ */
+static char* initSegment(int fd, int mtu, size_t* mapLen) {
+	u_int32_t slotSize = slotSizeFor(mtu);
+	u_int32_t numSlots = SHM_RING_SLOTS;
+	u_int32_t dataOffset = (sizeof(shm_ring_hdr) + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+	char* base;
+
+	while (numSlots > SHM_MIN_SLOTS && (size_t) numSlots * slotSize > SHM_RING_BYTES) {
+		numSlots >>= 1;
+	}
+	*mapLen = dataOffset + (size_t) numSlots * slotSize;
+	// truncating to 0 first zeroes whatever an earlier run left
+	if (ftruncate(fd, 0) == -1 || ftruncate(fd, *mapLen) == -1
+			|| (base = (char*) mmap(NULL, *mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		return NULL;
+	}
+
+	// a slot is free for the sender claiming position p once its seq equals p
+	shm_ring_hdr* hdr = (shm_ring_hdr*) base;
+	hdr->numSlots = numSlots;
+	hdr->slotSize = slotSize;
+	hdr->dataOffset = dataOffset;
+	for (u_int32_t i = 0; i < numSlots; i++) {
+		((shm_slot*) (base + dataOffset + (size_t) i * slotSize))->seq = i;
+	}
+	__atomic_store_n(&hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return base;
+}
+
+/**
+ * Maps the shared memory segment called name as its sending or receiving end, for packets of up
+ * to mtu bytes. The ends attach one at a time under a lock on the segment. If the other end is
+ * attached and alive, this end joins its ring, and a sender first gives up any slots its dead
+ * predecessor left half filled. Otherwise the segment is set up afresh. Returns NULL if it cannot
+ * be set up, if the live other end set it up for another MTU, or if another live process already
+ * holds this end.
+ */
+ShmRing* ShmRing::attach(const char* name, int mtu, bool sender) {
+	int fd;
+	char* base = NULL;
+	size_t mapLen = 0;
+	struct stat st;
+	pid_t self = getpid();
+	ShmRing* ring = NULL;
+
+	if ((fd = shm_open(name, O_RDWR | O_CREAT, 0600)) == -1) {
+		LOG_ERROR("Cannot open shared memory ring %s: %s", name, strerror(errno));
+		return NULL;
+	}
+	if (flock(fd, LOCK_EX) == -1) {
+		LOG_ERROR("Cannot lock shared memory ring %s: %s", name, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(shm_ring_hdr)) {
+		mapLen = st.st_size;
+		if ((base = (char*) mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+			base = NULL;
+		}
+	}
+
+	shm_ring_hdr* hdr = (shm_ring_hdr*) base;
+	if (hdr != NULL && hdr->magic == SHM_MAGIC) {
+		pid_t own = sender ? hdr->txPid : hdr->rxPid;
+		pid_t peer = sender ? hdr->rxPid : hdr->txPid;
+
+		bool refused = true;
+
+		if (own != self && isAlive(own)) {
+			LOG_ERROR("Shared memory ring %s already has a %s, process %d", name, sender ? "sender" : "receiver", (int) own);
+		} else if (!isAlive(peer)) {
+			refused = false; // left over from an earlier run
+		} else if ((hdr->numSlots & (hdr->numSlots - 1)) != 0
+				|| hdr->dataOffset + (size_t) hdr->numSlots * hdr->slotSize > mapLen) {
+			LOG_ERROR("Shared memory ring %s is corrupt", name);
+		} else if (hdr->slotSize != slotSizeFor(mtu)) {
+			LOG_ERROR("Shared memory ring %s holds packets of up to %u bytes, but the MTU is %d", name,
+					hdr->slotSize - SHM_SLOT_HDR, mtu);
+		} else {
+			ring = new ShmRing(base, mapLen, sender);
+			refused = false;
+		}
+
+		if (refused) {
+			// an earlier process that held this end and died would otherwise look attached
+			if (own != 0 && own != self && !isAlive(own)) {
+				__atomic_store_n(sender ? &hdr->txPid : &hdr->rxPid, 0, __ATOMIC_RELEASE);
+			}
+			munmap(base, mapLen);
+			close(fd);
+			return NULL;
+		}
+	}
+
+	if (ring == NULL) {
+		if (base != NULL) {
+			munmap(base, mapLen);
+		}
+		if ((base = initSegment(fd, mtu, &mapLen)) == NULL) {
+			LOG_ERROR("Cannot create shared memory ring %s: %s", name, strerror(errno));
+			close(fd);
+			return NULL;
+		}
+		ring = new ShmRing(base, mapLen, sender);
+	} else if (sender) {
+		int lost = ring->reclaim();
+		if (lost > 0) {
+			LOG_WARN("Shared memory ring %s: gave up %d packets its last sender never finished", name, lost);
+		}
+	}
+
+	__atomic_store_n(sender ? &ring->hdr->txPid : &ring->hdr->rxPid, self, __ATOMIC_RELEASE);
+	// unlocked by hand: the mapping keeps the file open, and with it the lock, past close
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	return ring;
+}
+
+/**
+ * Publishes as empty every slot between head and tail that was claimed and never filled, which
+ * happens only if its sender died in between; the receiver would otherwise stop at the first of
+ * them for good. Only while attaching, when no other sender is at work on the ring. Returns the
+ * number of slots given up.
+ */
+int ShmRing::reclaim() {
+	u_int32_t t = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+	int lost = 0;
+
+	// the receiver stops at the first of these slots, so it cannot move head past them meanwhile
+	for (u_int32_t p = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE); p != t; p++) {
+		shm_slot* slot = getSlot(p);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == p) {
+			slot->len = SHM_SLOT_EMPTY;
+			__atomic_store_n(&slot->seq, p + 1, __ATOMIC_RELEASE);
+			lost++;
+		}
+	}
+	if (lost > 0) {
+		wake();
+	}
+
+	return lost;
+}
+
+/**
+ * Wakes the receiver, only if it is about to sleep. Called after publishing slots.
+ */
+void ShmRing::wake() {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(&hdr->waiting, 0, __ATOMIC_ACQ_REL)) {
+		__atomic_add_fetch(&hdr->bell, 1, __ATOMIC_RELEASE);
+		futexWake(&hdr->bell, INT_MAX, true);
+	}
+}
+
+/**
+ * Returns true once the other end has joined the ring. Until then a sender should not use it:
+ * the other end may yet refuse the ring, for one sized to another MTU, and fall back to UDP.
+ */
+bool ShmRing::peerAttached() {
+	return __atomic_load_n(sender ? &hdr->rxPid : &hdr->txPid, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * Returns the longest packet a slot holds
+ */
+int ShmRing::getMaxLen() {
+	return hdr->slotSize - SHM_SLOT_HDR;
+}
+
+u_int32_t* ShmRing::getBell() {
+	return &hdr->bell;
+}
+
+/**
+ * Gathers count packets into slots, packet i from the next iovCounts[i] entries of iov, and
+ * publishes them. Safe to call from any number of threads. Only the packets ahead of one too
+ * long for a slot are sent. Returns the number queued, which is short if the ring fills, or -1
+ * with errno EMSGSIZE if the first packet is too long.
+ */
+int ShmRing::enqueue(const struct iovec* iov, const int* iovCounts, int count) {
+	int lens[BURST_SIZE];
+	const struct iovec* next = iov;
+	u_int32_t t = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+	u_int32_t n;
+
+	if (count > BURST_SIZE) {
+		count = BURST_SIZE;
+	}
+	for (int i = 0; i < count; i++) {
+		lens[i] = 0;
+		for (int j = 0; j < iovCounts[i]; j++) {
+			lens[i] += next[j].iov_len;
+		}
+		next += iovCounts[i];
+		if (lens[i] > getMaxLen()) {
+			if (i == 0) {
+				errno = EMSGSIZE;
+				return -1;
+			}
+			count = i;
+			break;
+		}
+	}
+
+	// claim a run of slots
+	do {
+		u_int32_t h = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		u_int32_t free = mask + 1 - (t - h);
+		n = (free < (u_int32_t) count) ? free : count;
+		if (n == 0) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&hdr->tail, &t, t + n, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	// write the packets in place and publish them
+	for (u_int32_t i = 0; i < n; i++) {
+		shm_slot* slot = getSlot(t + i);
+		char* data = slot->data;
+
+		for (int j = 0; j < iovCounts[i]; j++) {
+			memcpy(data, iov[j].iov_base, iov[j].iov_len);
+			data += iov[j].iov_len;
+		}
+		iov += iovCounts[i];
+		slot->len = lens[i];
+		__atomic_store_n(&slot->seq, t + i + 1, __ATOMIC_RELEASE);
+	}
+
+	wake();
+
+	return n;
+}
+
+/**
+ * Copies packets off the ring into burst, from buffer n up to maxPkts, stopping at the first
+ * slot a sender has claimed but not yet filled, and marks them as come in on itfNum. Slots given
+ * up by reclaim() are skipped. Packets
+ * longer than the buffers are truncated, as a datagram is. Receiver only. Returns the new number
+ * of buffers filled.
+ */
+int ShmRing::dequeue(packet_burst& burst, int n, int maxPkts, int itfNum) {
+	u_int32_t h = hdr->head;
+
+	while (n < maxPkts) {
+		shm_slot* slot = getSlot(h);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != h + 1) {
+			break;
+		}
+
+		if (slot->len != SHM_SLOT_EMPTY) {
+			int len = (slot->len < (u_int32_t) burst.bufLen) ? (int) slot->len : burst.bufLen;
+			memcpy(burst.bufs[n], slot->data, len);
+			burst.lens[n] = len;
+			burst.itfs[n] = itfNum;
+			n++;
+		}
+
+		// hand the slot to the sender that claims it on the next lap
+		__atomic_store_n(&slot->seq, h + mask + 1, __ATOMIC_RELEASE);
+		h++;
+	}
+	__atomic_store_n(&hdr->head, h, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/**
+ * Announces that the receiver is about to sleep. Returns false if a packet arrived in the
+ * meantime, in which case it should not.
+ */
+bool ShmRing::prepareWait() {
+	u_int32_t h = hdr->head;
+
+	__atomic_store_n(&hdr->waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&getSlot(h)->seq, __ATOMIC_SEQ_CST) == h + 1) {
+		__atomic_store_n(&hdr->waiting, 0, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Starts watching the bells of rings, one thread per FUTEX_WAITV_MAX - 1 of them
+ */
+ShmDoorbell::ShmDoorbell(const vector<ShmRing*>& rings) {
+	this->rings = rings;
+	pending = 0;
+	readable = false;
+	stopping = 0;
+	if ((eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		perror("Eventfd creation error:");
+	}
+
+	for (int first = 0; first < (int) rings.size(); first += FUTEX_WAITV_MAX - 1) {
+		shm_watcher* w = new shm_watcher;
+
+		w->bell = this;
+		w->first = first;
+		w->count = ((int) rings.size() - first < FUTEX_WAITV_MAX - 1) ? (int) rings.size() - first : FUTEX_WAITV_MAX - 1;
+		if (pthread_create(&w->thread, NULL, runWatcher, w) != 0) {
+			perror("Threading error:");
+			delete w;
+			continue;
+		}
+		watchers.push_back(w);
+	}
+}
+
+ShmDoorbell::~ShmDoorbell() {
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	futexWake(&stopping, INT_MAX, false);
+	for (vector<shm_watcher*>::size_type i = 0; i != watchers.size(); i++) {
+		pthread_join(watchers[i]->thread, NULL);
+		delete watchers[i];
+	}
+	close(eventFd);
+}
+
+void* ShmDoorbell::runWatcher(void* arg) {
+	shm_watcher* w = (shm_watcher*) arg;
+	w->bell->watch(w);
+	return NULL;
+}
+
+/**
+ * Waits on a watcher's bells until the doorbell is destroyed. The bells are read before the
+ * eventfd is written and waited on with those values, so a bell rung at any point after the
+ * read either is covered by that write or makes the next wait return at once.
+ */
+void ShmDoorbell::watch(shm_watcher* w) {
+	struct futex_waitv waiters[FUTEX_WAITV_MAX];
+
+	memset(waiters, 0, sizeof(waiters));
+	for (int i = 0; i < w->count; i++) {
+		waiters[i].uaddr = (uintptr_t) rings[w->first + i]->getBell();
+		waiters[i].flags = FUTEX_32;
+		waiters[i].val = __atomic_load_n(rings[w->first + i]->getBell(), __ATOMIC_ACQUIRE);
+	}
+	waiters[w->count].uaddr = (uintptr_t) &stopping;
+	waiters[w->count].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+	waiters[w->count].val = 0;
+
+	while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+		if (syscall(SYS_futex_waitv, waiters, w->count + 1, 0, NULL, CLOCK_MONOTONIC) == -1
+				&& errno != EAGAIN && errno != EINTR) {
+			LOG_ERROR("Shared memory doorbell wait error: %s", strerror(errno));
+			return;
+		}
+
+		for (int i = 0; i < w->count; i++) {
+			waiters[i].val = __atomic_load_n(rings[w->first + i]->getBell(), __ATOMIC_ACQUIRE);
+		}
+		uint64_t one = 1;
+		if (write(eventFd, &one, sizeof(one)) != sizeof(one)) {
+			// already readable
+		}
+		__atomic_store_n(&pending, 1, __ATOMIC_RELEASE);
+	}
+}
+
+int ShmDoorbell::getEventFd() {
+	return eventFd;
+}
+
+/**
+ * Makes the eventfd unreadable, if a watcher or ring() may have left it readable. Receiver only.
+ */
+void ShmDoorbell::clear() {
+	if (__atomic_exchange_n(&pending, 0, __ATOMIC_ACQ_REL) || readable) {
+		uint64_t count;
+		if (read(eventFd, &count, sizeof(count)) != sizeof(count)) {
+			// nothing pending
+		}
+		readable = false;
+	}
+}
+
+/**
+ * Makes the eventfd readable, so an event loop comes back for packets left on the rings.
+ * Receiver only; a system call only the first time after clear().
+ */
+void ShmDoorbell::ring() {
+	if (!readable) {
+		uint64_t one = 1;
+		if (write(eventFd, &one, sizeof(one)) != sizeof(one)) {
+			// already readable
+		}
+		readable = true;
+	}
+}
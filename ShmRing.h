@@ -0,0 +1,122 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "constants.h"
+#include "LinkLayer.h"
+#include "Ring.h"
+
+using namespace std;
+
+#define SHM_MAGIC 0x53484d32 // set last by whoever sets a segment up
+#define SHM_NAME_PREFIX "/vipn." // segments are /dev/shm/vipn.<sender port>.<receiver port>
+#define SHM_RING_SLOTS 1024 // packets a ring holds, fewer if the MTU is large
+#define SHM_RING_BYTES (16 << 20) // caps SHM_RING_SLOTS
+#define SHM_MIN_SLOTS 16
+#define SHM_SLOT_HDR 8 // sequence number and length in front of each slot's packet
+#define SHM_SLOT_EMPTY 0xffffffff // length of a slot given up because its sender died filling it
+
+/**
+ * Header of a ring's shared memory segment. The indices and the wakeup words are shared by two
+ * processes, so each sits on a cache line of its own as in MpscRing.
+ */
+typedef struct {
+	u_int32_t magic;
+	u_int32_t numSlots; // a power of two
+	u_int32_t slotSize; // bytes per slot, SHM_SLOT_HDR included
+	u_int32_t dataOffset; // of the first slot from the start of the segment
+	pid_t txPid; // process sending on the ring, 0 once it detaches
+	pid_t rxPid; // process receiving from it
+	u_int32_t tail __attribute__((aligned(CACHE_LINE))); // next slot to claim, any sending thread
+	u_int32_t head __attribute__((aligned(CACHE_LINE))); // next slot to take, the receiver
+	u_int32_t waiting __attribute__((aligned(CACHE_LINE))); // set by a receiver about to sleep
+	u_int32_t bell; // futex word, bumped by the sender that wakes it
+} shm_ring_hdr;
+
+typedef struct {
+	u_int32_t seq;
+	u_int32_t len;
+	char data[];
+} shm_slot;
+
+/**
+ * One direction of a point to point link between two processes on a host: a ring of packet
+ * slots in a POSIX shared memory segment, mapped by both. Senders claim slots as MpscRing's
+ * producers do and gather packets straight into them, so a packet is copied once on its way
+ * and, while the receiver is busy, no system call is made on either side. A receiver about to
+ * sleep says so in the header; the sender that sees it bumps the header's bell and wakes it with
+ * a futex, which ShmDoorbell turns into an eventfd for the receiver's event loop.
+ *
+ * Each end records its process in the header as it attaches, one end at a time under a lock
+ * on the segment. An end that finds the other one alive joins the ring, provided its slots fit
+ * the MTU; otherwise the segment is left over from an earlier run and is set up afresh, sized
+ * to this end's MTU. So a node that restarts next to a live neighbor picks up where it left off,
+ * and nothing has to be cleaned up by hand after a crash or an MTU change. An end that refuses
+ * a ring never records itself, so the end that set it up sees no peer and keeps to UDP.
+ */
+class ShmRing {
+
+	private:
+		shm_ring_hdr* hdr;
+		char* base;
+		size_t mapLen;
+		u_int32_t mask;
+		bool sender; // attached as the sending end
+
+		ShmRing(char* base, size_t mapLen, bool sender);
+		int reclaim();
+		void wake();
+
+		shm_slot* getSlot(u_int32_t pos) {
+			return (shm_slot*) (base + hdr->dataOffset + (size_t) (pos & mask) * hdr->slotSize);
+		}
+
+	public:
+		static ShmRing* attach(const char* name, int mtu, bool sender);
+		~ShmRing();
+		int enqueue(const struct iovec* iov, const int* iovCounts, int count);
+		int dequeue(packet_burst& burst, int n, int maxPkts, int itfNum);
+		bool prepareWait();
+		bool peerAttached();
+		u_int32_t* getBell();
+		int getMaxLen();
+};
+
+typedef struct {
+	class ShmDoorbell* bell;
+	int first; // rings watched by this thread
+	int count;
+	pthread_t thread;
+} shm_watcher;
+
+/**
+ * Watches the bells of a set of receive rings with futex_waitv and makes an eventfd readable
+ * whenever one rings, so an event loop can sleep on shared memory rings next to its sockets.
+ * Each watcher thread covers as many rings as one futex_waitv call takes.
+ */
+class ShmDoorbell {
+
+	private:
+		vector<ShmRing*> rings;
+		vector<shm_watcher*> watchers;
+		int eventFd;
+		int pending; // set by a watcher after it writes the eventfd
+		bool readable; // the receiver left the eventfd readable, or may have
+		u_int32_t stopping; // futex word watched along with the bells
+
+		void watch(shm_watcher* w);
+		static void* runWatcher(void* arg);
+
+	public:
+		ShmDoorbell(const vector<ShmRing*>& rings);
+		~ShmDoorbell();
+		int getEventFd();
+		void clear();
+		void ring();
+};
+
+#endif
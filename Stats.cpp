@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Stats.h"
+
+__thread int statsThreadId = -1;
+static int nextThreadId = 0;
+
+static const char* dropNames[NUM_DROP_REASONS] = { "malformed", "checksum", "ttl", "no_route", "too_big",
+		"rcv_queue", "ctl_queue", "tx_queue", "no_bufs", "link", "reasm_timeout", "reasm_evicted", "reasm_bad" };
+
+/**
+ * Returns a zeroed block of len counters starting on a cache line
+ */
+static u_int64_t* allocBlock(int len) {
+	void* block;
+
+	if (posix_memalign(&block, STATS_LINE, len * sizeof(u_int64_t)) != 0) {
+		perror("Stats allocation error:");
+		exit(1);
+	}
+	memset(block, 0, len * sizeof(u_int64_t));
+
+	return (u_int64_t*) block;
+}
+
+/**
+ * Sets up counters for numItfs interfaces. Only the shared block is allocated up front.
+ */
+Stats::Stats(int numItfs) {
+	int perLine = STATS_LINE / sizeof(u_int64_t);
+
+	this->numItfs = numItfs;
+	blockLen = NUM_DROP_REASONS + 2 + (numItfs + 1) * 4;
+	blockLen = (blockLen + perLine - 1) / perLine * perLine;
+	memset(blocks, 0, sizeof(blocks));
+	blocks[STATS_MAX_THREADS] = allocBlock(blockLen);
+}
+
+Stats::~Stats() {
+	for (int i = 0; i <= STATS_MAX_THREADS; i++) {
+		free(blocks[i]);
+	}
+}
+
+/**
+ * Slow path of getBlock: numbers the calling thread if it is new to every Stats, and gives it a
+ * block of this one if it has none yet
+ */
+u_int64_t* Stats::claimBlock() {
+	if (statsThreadId < 0) {
+		statsThreadId = __atomic_fetch_add(&nextThreadId, 1, __ATOMIC_RELAXED);
+	}
+	if (statsThreadId >= STATS_MAX_THREADS) {
+		return blocks[STATS_MAX_THREADS];
+	}
+
+	// published with a release store, so a reader never sums a block before it is zeroed
+	u_int64_t* block = allocBlock(blockLen);
+	__atomic_store_n(&blocks[statsThreadId], block, __ATOMIC_RELEASE);
+
+	return block;
+}
+
+/**
+ * Sums every thread's counters into snap. The flow cache and reassembly counters belong to the
+ * forwarding workers and are left to the caller.
+ */
+void Stats::read(stats_snapshot* snap) {
+	snap->itfs.assign(numItfs + 1, itf_stats());
+	memset(snap->drops, 0, sizeof(snap->drops));
+	snap->lookups = 0;
+	snap->noRoute = 0;
+	snap->flowHits = 0;
+	snap->flowMisses = 0;
+
+	for (int i = 0; i <= STATS_MAX_THREADS; i++) {
+		u_int64_t* block = __atomic_load_n(&blocks[i], __ATOMIC_ACQUIRE);
+
+		if (block == NULL) {
+			continue;
+		}
+		for (int r = 0; r < NUM_DROP_REASONS; r++) {
+			snap->drops[r] += __atomic_load_n(&block[r], __ATOMIC_RELAXED);
+		}
+		snap->lookups += __atomic_load_n(&block[NUM_DROP_REASONS], __ATOMIC_RELAXED);
+		snap->noRoute += __atomic_load_n(&block[NUM_DROP_REASONS + 1], __ATOMIC_RELAXED);
+		for (int k = 0; k <= numItfs; k++) {
+			u_int64_t* c = &block[rxIdx(k)];
+
+			snap->itfs[k].rxPackets += __atomic_load_n(&c[0], __ATOMIC_RELAXED);
+			snap->itfs[k].rxBytes += __atomic_load_n(&c[1], __ATOMIC_RELAXED);
+			snap->itfs[k].txPackets += __atomic_load_n(&c[2], __ATOMIC_RELAXED);
+			snap->itfs[k].txBytes += __atomic_load_n(&c[3], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/**
+ * Returns the name of a drop reason as used in formatted output
+ */
+const char* Stats::dropName(int reason) {
+	return (reason >= 0 && reason < NUM_DROP_REASONS) ? dropNames[reason] : "unknown";
+}
+
+/**
+ * Formats snap as a single line of space separated key=value pairs, for scripts to parse. The
+ * counters of packets received on an unknown interface are left out while they are zero.
+ */
+string Stats::format(const stats_snapshot* snap) {
+	char buf[160];
+	string line;
+	int numItfs = snap->itfs.size() - 1;
+
+	for (int k = 0; k <= numItfs; k++) {
+		const itf_stats* s = &snap->itfs[k];
+		char itf[16];
+
+		if (k == numItfs && s->rxPackets == 0) {
+			continue;
+		}
+		if (k < numItfs) {
+			snprintf(itf, sizeof(itf), "itf%d", k);
+		} else {
+			snprintf(itf, sizeof(itf), "unknown");
+		}
+		snprintf(buf, sizeof(buf), "%s_rx_pkts=%llu %s_rx_bytes=%llu %s_tx_pkts=%llu %s_tx_bytes=%llu ",
+				itf, (unsigned long long) s->rxPackets, itf, (unsigned long long) s->rxBytes,
+				itf, (unsigned long long) s->txPackets, itf, (unsigned long long) s->txBytes);
+		line += buf;
+	}
+	for (int r = 0; r < NUM_DROP_REASONS; r++) {
+		snprintf(buf, sizeof(buf), "drop_%s=%llu ", dropNames[r], (unsigned long long) snap->drops[r]);
+		line += buf;
+	}
+	snprintf(buf, sizeof(buf), "lookups=%llu no_route=%llu flow_hits=%llu flow_misses=%llu",
+			(unsigned long long) snap->lookups, (unsigned long long) snap->noRoute,
+			(unsigned long long) snap->flowHits, (unsigned long long) snap->flowMisses);
+	line += buf;
+
+	return line;
+}
@@ -0,0 +1,133 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <vector>
+#include <string>
+#include <sys/types.h>
+
+using namespace std;
+
+#define STATS_MAX_THREADS 64 // threads with counters of their own; others share one block
+#define STATS_LINE 64 // bytes per cache line; blocks are padded to whole lines
+
+enum drop_reason {
+	DROP_MALFORMED, // length or header length inconsistent with what was received
+	DROP_CHECKSUM,
+	DROP_TTL,
+	DROP_NO_ROUTE,
+	DROP_TOO_BIG, // over the egress MTU with the don't fragment flag set
+	DROP_RCV_QUEUE, // the application was not keeping up
+	DROP_CTL_QUEUE, // routing was not keeping up
+	DROP_TX_QUEUE, // queueSend outran the event loop
+	DROP_NO_BUFS, // packet pool exhausted
+	DROP_LINK, // the link layer refused the packet, an interface being down included
+	DROP_REASM_TIMEOUT, // fragments of datagrams never completed; these four are counted by the
+	DROP_REASM_EVICTED, // workers' reassemblers and filled in when the counters are read
+	DROP_REASM_BAD,
+	NUM_DROP_REASONS
+};
+
+typedef struct {
+	u_int64_t rxPackets;
+	u_int64_t rxBytes;
+	u_int64_t txPackets;
+	u_int64_t txBytes;
+} itf_stats;
+
+/**
+ * Counters summed over every thread at one point in time
+ */
+typedef struct {
+	vector<itf_stats> itfs; // one per interface, then one for packets received on an unknown one
+	u_int64_t drops[NUM_DROP_REASONS];
+	u_int64_t lookups; // forwarding table lookups; flow cache hits never reach the table
+	u_int64_t noRoute; // lookups that found no route
+	u_int64_t flowHits;
+	u_int64_t flowMisses;
+} stats_snapshot;
+
+extern __thread int statsThreadId;
+
+/**
+ * Packet counters of one IP layer. Each thread counts into a block of its own, padded to whole
+ * cache lines, with plain loads and stores, so counting costs an add per counter and no line
+ * ever bounces between cores. Blocks are allocated on a thread's first count and only summed
+ * when the counters are read, which may happen on any thread; a read sees every count made
+ * before it, give or take the ones in flight. Threads beyond STATS_MAX_THREADS share one last
+ * block and count into it atomically.
+ */
+class Stats {
+
+	private:
+		int numItfs;
+		int blockLen; // counters per block
+		u_int64_t* blocks[STATS_MAX_THREADS + 1];
+
+		u_int64_t* claimBlock();
+
+		static int rxIdx(int itfNum) {
+			return NUM_DROP_REASONS + 2 + itfNum * 4;
+		}
+
+	public:
+		Stats(int numItfs);
+		~Stats();
+		void read(stats_snapshot* snap);
+		static string format(const stats_snapshot* snap);
+		static const char* dropName(int reason);
+
+		/**
+		 * Returns the calling thread's counter block, to pass to the counting methods
+		 */
+		u_int64_t* getBlock() {
+			int id = statsThreadId;
+
+			if (id >= 0 && id < STATS_MAX_THREADS && blocks[id] != NULL) {
+				return blocks[id];
+			}
+			return claimBlock();
+		}
+
+		/**
+		 * Adds n to counter idx of the calling thread's block
+		 */
+		void add(u_int64_t* block, int idx, u_int64_t n) {
+			if (block == blocks[STATS_MAX_THREADS]) {
+				__atomic_add_fetch(&block[idx], n, __ATOMIC_RELAXED);
+			} else {
+				// the only writer; the atomic store just keeps readers from seeing a torn value
+				__atomic_store_n(&block[idx], block[idx] + n, __ATOMIC_RELAXED);
+			}
+		}
+
+		/**
+		 * Counts a packet of len bytes received on itfNum, or on an unknown interface if it is
+		 * out of range
+		 */
+		void countRx(u_int64_t* block, int itfNum, int len) {
+			int idx = rxIdx((itfNum >= 0 && itfNum < numItfs) ? itfNum : numItfs);
+			add(block, idx, 1);
+			add(block, idx + 1, len);
+		}
+
+		void countTx(u_int64_t* block, int itfNum, int pkts, u_int64_t bytes) {
+			int idx = rxIdx(itfNum) + 2;
+			add(block, idx, pkts);
+			add(block, idx + 1, bytes);
+		}
+
+		void countDrop(u_int64_t* block, int reason, int pkts = 1) {
+			add(block, reason, pkts);
+		}
+
+		void countDrop(int reason, int pkts = 1) {
+			add(getBlock(), reason, pkts);
+		}
+
+		void countLookups(u_int64_t* block, int lookups, int noRoute) {
+			add(block, NUM_DROP_REASONS, lookups);
+			add(block, NUM_DROP_REASONS + 1, noRoute);
+		}
+};
+
+#endif
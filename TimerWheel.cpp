@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel(bool realTime) {
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		counts[level] = 0;
+		for (int i = 0; i < WHEEL_SIZE; i++) {
+			slots[level][i].next = &slots[level][i];
+			slots[level][i].prev = &slots[level][i];
+		}
+	}
+
+	this->realTime = realTime;
+	now = realTime ? nowMs() : 0;
+	cur = now;
+	armedAt = 0;
+	timerFd = -1;
+	if (realTime && (timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+		perror("Timer creation error:");
+	}
+}
+
+TimerWheel::~TimerWheel() {
+	if (timerFd >= 0) {
+		close(timerFd);
+	}
+}
+
+void TimerWheel::initTimer(wheel_timer* timer, timer_cb cb, void* arg) {
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+	timer->level = 0;
+	timer->cb = cb;
+	timer->arg = arg;
+}
+
+bool TimerWheel::isPending(const wheel_timer* timer) {
+	return timer->next != NULL;
+}
+
+u_int64_t TimerWheel::nowMs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Files a timer under the coarsest level whose span, counted from the current tick, still
+ * reaches its expiry. Higher levels are indexed by block, so a timer is always cascaded down
+ * at the start of the block it expires in.
+ */
+void TimerWheel::add(wheel_timer* timer) {
+	u_int64_t expires = (timer->expires < cur) ? cur : timer->expires;
+	int level = 0;
+	int idx;
+
+	if (expires - cur < WHEEL_SIZE) {
+		idx = expires & WHEEL_MASK;
+	} else {
+		for (level = 1; level < WHEEL_LEVELS - 1; level++) {
+			if ((expires >> (level * WHEEL_BITS)) - (cur >> (level * WHEEL_BITS)) < WHEEL_SIZE) {
+				break;
+			}
+		}
+
+		// too far out for the top level: park it in the last block it covers and re-file it then
+		int shift = level * WHEEL_BITS;
+		if ((expires >> shift) - (cur >> shift) >= WHEEL_SIZE) {
+			expires = ((cur >> shift) + WHEEL_SIZE - 1) << shift;
+		}
+		idx = (expires >> shift) & WHEEL_MASK;
+	}
+
+	wheel_timer* head = &slots[level][idx];
+	timer->level = level;
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+	counts[level]++;
+}
+
+void TimerWheel::unlink(wheel_timer* timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+	counts[timer->level]--;
+}
+
+/**
+ * Schedules a timer to fire delayMs from now, rescheduling it if it is already pending
+ */
+void TimerWheel::schedule(wheel_timer* timer, u_int64_t delayMs) {
+	if (timer->next != NULL) {
+		unlink(timer);
+	}
+	if (realTime) {
+		now = nowMs();
+	}
+
+	timer->expires = now + delayMs;
+	add(timer);
+
+	if (armedAt == 0 || timer->expires < armedAt) {
+		arm(timer->expires);
+	}
+}
+
+/**
+ * Stops a timer from firing. Cancelling a timer that is not pending does nothing.
+ */
+void TimerWheel::cancel(wheel_timer* timer) {
+	if (timer->next != NULL) {
+		unlink(timer);
+	}
+}
+
+/**
+ * Moves every timer in the current slot of level down to the levels below
+ */
+void TimerWheel::cascade(int level) {
+	wheel_timer* head = &slots[level][(cur >> (level * WHEEL_BITS)) & WHEEL_MASK];
+
+	while (head->next != head) {
+		wheel_timer* timer = head->next;
+		unlink(timer);
+		add(timer);
+	}
+}
+
+/**
+ * Runs every timer that expires up to and including now, in expiry order. Callbacks may
+ * schedule and cancel timers, themselves included. Returns the number of timers run.
+ */
+int TimerWheel::advance(u_int64_t now) {
+	int ran = 0;
+
+	while (cur <= now) {
+		// nothing due at level 0: jump to the next boundary at which a higher level cascades
+		if (counts[0] == 0) {
+			int level = 1;
+			while (level < WHEEL_LEVELS && counts[level] == 0) {
+				level++;
+			}
+			if (level == WHEEL_LEVELS) {
+				cur = now + 1;
+				break;
+			}
+
+			u_int64_t span = (u_int64_t) 1 << (level * WHEEL_BITS);
+			u_int64_t next = (cur + span - 1) & ~(span - 1);
+			if (next > now) {
+				cur = now + 1;
+				break;
+			}
+			cur = next;
+		}
+
+		// at a block boundary, pull the new block's timers down from the coarsest level first
+		if ((cur & WHEEL_MASK) == 0) {
+			int top = 1;
+			while (top < WHEEL_LEVELS - 1 && (cur & (((u_int64_t) 1 << ((top + 1) * WHEEL_BITS)) - 1)) == 0) {
+				top++;
+			}
+			for (int level = top; level >= 1; level--) {
+				cascade(level);
+			}
+		}
+
+		// callbacks see the time of the tick they run on
+		if (cur > this->now) {
+			this->now = cur;
+		}
+
+		wheel_timer* head = &slots[0][cur & WHEEL_MASK];
+		while (head->next != head) {
+			wheel_timer* timer = head->next;
+			unlink(timer);
+			timer->cb(timer, timer->arg);
+			ran++;
+		}
+
+		cur++;
+	}
+
+	if (now > this->now) {
+		this->now = now;
+	}
+
+	return ran;
+}
+
+/**
+ * Handles the timerfd becoming readable: runs the timers that are due and re-arms for the next
+ */
+void TimerWheel::run() {
+	u_int64_t expirations;
+	u_int64_t when;
+
+	if (read(timerFd, &expirations, sizeof(expirations)) == -1) {
+		// spurious wakeup; the timers are still checked below
+	}
+
+	armedAt = 0;
+	advance(nowMs());
+	arm(nextExpiry(&when) ? when : 0);
+}
+
+/**
+ * Sets *when to the earliest time a pending timer can fire (or has to be cascaded, which may be
+ * a little sooner). Returns false if no timer is pending.
+ */
+bool TimerWheel::nextExpiry(u_int64_t* when) {
+	bool found = false;
+
+	for (int i = 0; counts[0] > 0 && i < WHEEL_SIZE; i++) {
+		wheel_timer* head = &slots[0][(cur + i) & WHEEL_MASK];
+		if (head->next != head) {
+			*when = cur + i;
+			found = true;
+			break;
+		}
+	}
+
+	for (int level = 1; level < WHEEL_LEVELS; level++) {
+		int shift = level * WHEEL_BITS;
+		u_int64_t base = (cur + ((u_int64_t) 1 << shift) - 1) >> shift;
+
+		for (int k = 0; counts[level] > 0 && k < WHEEL_SIZE; k++) {
+			wheel_timer* head = &slots[level][(base + k) & WHEEL_MASK];
+			if (head->next != head) {
+				u_int64_t t = (base + k) << shift;
+				if (!found || t < *when) {
+					*when = t;
+					found = true;
+				}
+				break;
+			}
+		}
+	}
+
+	return found;
+}
+
+/**
+ * Arms the timerfd for when (absolute, ms), or disarms it if when is 0
+ */
+void TimerWheel::arm(u_int64_t when) {
+	struct itimerspec its;
+
+	if (!realTime || when == armedAt) {
+		return;
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = when / 1000;
+	its.it_value.tv_nsec = (when % 1000) * 1000000L;
+	if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		perror("Timer arm error:");
+		return;
+	}
+	armedAt = when;
+}
+
+/**
+ * Returns the current time in ms: the clock in real time mode, otherwise the time the wheel was
+ * last advanced to (or, inside a callback, the tick it runs on)
+ */
+u_int64_t TimerWheel::getTime() {
+	if (realTime) {
+		now = nowMs();
+	}
+	return now;
+}
+
+int TimerWheel::getEventFd() {
+	return timerFd;
+}
+
+#ifdef TIMERWHEEL_MAIN
+#include <stdlib.h>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Schedules, reschedules and cancels timers with random delays on a wheel in virtual time, then
+ * runs it to the end and checks that every pending timer fired once, at its expiry.
+ */
+
+typedef struct {
+	TimerWheel* wheel;
+	int fired;
+	int late;
+} bench_state;
+
+static void onFire(wheel_timer* timer, void* arg) {
+	bench_state* state = (bench_state*) arg;
+
+	state->fired++;
+	if (state->wheel->getTime() != timer->expires) {
+		state->late++;
+	}
+}
+
+static double elapsedNs(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+/* wheelbench [timers] [max delay ms] [seed] */
+int main(int argc, char** argv) {
+	int numTimers = (argc > 1) ? atoi(argv[1]) : 1000000;
+	int maxDelay = (argc > 2) ? atoi(argv[2]) : 600000;
+	unsigned seed = (argc > 3) ? atoi(argv[3]) : 1;
+	vector<wheel_timer> timers(numTimers);
+	TimerWheel wheel(false);
+	bench_state state;
+	struct timespec start;
+	double scheduleNs, rescheduleNs, cancelNs, runNs;
+	int cancelled = 0, ran;
+	u_int64_t when;
+
+	state.wheel = &wheel;
+	state.fired = 0;
+	state.late = 0;
+	srand(seed);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < numTimers; i++) {
+		TimerWheel::initTimer(&timers[i], onFire, &state);
+		wheel.schedule(&timers[i], rand() % maxDelay);
+	}
+	scheduleNs = elapsedNs(&start);
+
+	// move a little way in, so rescheduled timers land relative to a new current tick
+	wheel.advance(wheel.getTime() + 1000);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < numTimers; i++) {
+		if (TimerWheel::isPending(&timers[i])) {
+			wheel.schedule(&timers[i], rand() % maxDelay);
+		}
+	}
+	rescheduleNs = elapsedNs(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < numTimers; i += 4) {
+		if (TimerWheel::isPending(&timers[i])) {
+			wheel.cancel(&timers[i]);
+			cancelled++;
+		}
+	}
+	cancelNs = elapsedNs(&start);
+
+	int pending = 0;
+	for (int i = 0; i < numTimers; i++) {
+		pending += TimerWheel::isPending(&timers[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ran = state.fired;
+	while (wheel.nextExpiry(&when)) {
+		wheel.advance(when);
+	}
+	runNs = elapsedNs(&start);
+	ran = state.fired - ran;
+
+	printf("timers=%d max_delay_ms=%d schedule_ns=%.1f reschedule_ns=%.1f cancel_ns=%.1f run_ns_per_timer=%.1f pending=%d fired=%d late=%d\n",
+			numTimers, maxDelay, scheduleNs / numTimers, rescheduleNs / numTimers,
+			cancelled ? cancelNs / cancelled : 0, ran ? runNs / ran : 0, pending, ran, state.late);
+
+	return (ran != pending || state.late != 0);
+}
+#endif
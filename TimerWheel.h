@@ -0,0 +1,70 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <sys/types.h>
+
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+typedef struct wheel_timer wheel_timer;
+typedef void (*timer_cb)(wheel_timer* timer, void* arg);
+
+/**
+ * A timer, embedded in whatever it times. Set it up once with TimerWheel::initTimer; it may then
+ * be scheduled, rescheduled and cancelled any number of times, and must not be moved or freed
+ * while pending.
+ */
+struct wheel_timer {
+	wheel_timer* next; // NULL while not pending
+	wheel_timer* prev;
+	u_int64_t expires; // ms
+	int level;
+	timer_cb cb;
+	void* arg;
+};
+
+/**
+ * Hierarchical timing wheel with millisecond ticks: four levels of 256 slots, each covering 256
+ * times the span of the one below. A timer sits in the slot of the coarsest level its expiry
+ * still fits in and moves down a level each time the wheel below wraps, so schedule, cancel and
+ * reschedule are O(1) no matter how many timers are pending.
+ *
+ * In real time mode the wheel keeps a timerfd armed for the earliest pending timer; register
+ * it with an event loop and call run() when it is readable. Nothing fires while no timer is due,
+ * so an idle wheel costs no CPU. Otherwise time only moves when advance() is called, which suits
+ * simulations.
+ */
+class TimerWheel {
+
+	private:
+		wheel_timer slots[WHEEL_LEVELS][WHEEL_SIZE]; // list heads
+		int counts[WHEEL_LEVELS];
+		u_int64_t cur; // next tick to process
+		u_int64_t now;
+		bool realTime;
+		int timerFd;
+		u_int64_t armedAt; // expiry the timerfd is armed for, 0 if disarmed
+
+		void add(wheel_timer* timer);
+		void unlink(wheel_timer* timer);
+		void cascade(int level);
+		void arm(u_int64_t when);
+
+	public:
+		TimerWheel(bool realTime = true);
+		~TimerWheel();
+		static void initTimer(wheel_timer* timer, timer_cb cb, void* arg);
+		static bool isPending(const wheel_timer* timer);
+		static u_int64_t nowMs();
+		void schedule(wheel_timer* timer, u_int64_t delayMs);
+		void cancel(wheel_timer* timer);
+		int advance(u_int64_t now);
+		void run();
+		bool nextExpiry(u_int64_t* when);
+		u_int64_t getTime();
+		int getEventFd();
+};
+
+#endif
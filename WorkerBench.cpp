@@ -0,0 +1,206 @@
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "IPLayer.h"
+#include "LinkLayer.h"
+#include "EventLoop.h"
+#include "ipsum.h"
+
+#include "ip.h"
+//#include <netinet/ip.h>
+
+using namespace std;
+
+/*
+ * Forwarding throughput against the number of forwarding workers. For each worker count a node
+ * is set up on a localhost port with that many SO_REUSEPORT receive sockets and one interface to
+ * a second port that receives and never reads. Sender threads blast valid packets at the node
+ * from many source ports, so the kernel spreads them over the workers, and the node's counters
+ * give the packets forwarded per second. One key=value line per worker count goes to stderr.
+ * Nodes are not torn down between runs; each gets ports of its own.
+ */
+
+#define BENCH_SOCKETS 16 // source ports per sender thread
+#define BENCH_FLOWS 1024 // distinct destinations
+#define BENCH_WARMUP_MS 200
+
+typedef struct {
+	struct sockaddr_in dest;
+	vector<char>* pkts; // BENCH_FLOWS packets of pktLen bytes
+	int pktLen;
+	int id;
+	volatile bool stop;
+	u_int64_t sent;
+	pthread_t thread;
+} bench_sender;
+
+static double nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void* runLoop(void* arg) {
+	((EventLoop*) arg)->run();
+	return NULL;
+}
+
+/**
+ * Sends bursts round robin over BENCH_SOCKETS sockets until told to stop
+ */
+static void* runSender(void* arg) {
+	bench_sender* s = (bench_sender*) arg;
+	int socks[BENCH_SOCKETS];
+	struct mmsghdr msgs[BURST_SIZE];
+	struct iovec iovs[BURST_SIZE];
+	int next = s->id * BURST_SIZE;
+
+	for (int i = 0; i < BENCH_SOCKETS; i++) {
+		if ((socks[i] = socket(AF_INET, SOCK_DGRAM, 0)) == -1
+				|| connect(socks[i], (struct sockaddr*) &s->dest, sizeof(s->dest)) == -1) {
+			perror("Sender socket error:");
+			return NULL;
+		}
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+	for (int k = 0; !s->stop; k = (k + 1) % BENCH_SOCKETS) {
+		for (int i = 0; i < BURST_SIZE; i++, next = (next + 1) % BENCH_FLOWS) {
+			iovs[i].iov_base = &(*s->pkts)[(size_t) next * s->pktLen];
+			iovs[i].iov_len = s->pktLen;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = sendmmsg(socks[k], msgs, BURST_SIZE, 0);
+		if (n > 0) {
+			s->sent += n;
+		}
+	}
+
+	for (int i = 0; i < BENCH_SOCKETS; i++) {
+		close(socks[i]);
+	}
+	return NULL;
+}
+
+/**
+ * Builds a valid packet to each of BENCH_FLOWS addresses in 10.1.0.0/16
+ */
+static void makePackets(vector<char>& pkts, int pktLen) {
+	pkts.assign((size_t) BENCH_FLOWS * pktLen, 'x');
+	for (int i = 0; i < BENCH_FLOWS; i++) {
+		struct iphdr* hdr = (struct iphdr*) &pkts[(size_t) i * pktLen];
+
+		memset(hdr, 0, sizeof(struct iphdr));
+		hdr->version = 4;
+		hdr->ihl = 5;
+		hdr->tot_len = htons(pktLen);
+		hdr->id = htons(i);
+		hdr->ttl = MAX_TTL;
+		hdr->protocol = DATA_PROTOCOL;
+		hdr->saddr = inet_addr("10.2.0.1");
+		hdr->daddr = htonl(ntohl(inet_addr("10.1.0.0")) + i);
+		hdr->check = ip_sum((char*) hdr, sizeof(struct iphdr));
+	}
+}
+
+static u_int64_t sumRx(const stats_snapshot* snap) {
+	u_int64_t n = 0;
+	for (vector<itf_stats>::size_type i = 0; i != snap->itfs.size(); i++) {
+		n += snap->itfs[i].rxPackets;
+	}
+	return n;
+}
+
+/* workerbench [ms per run] [packet bytes] [max workers] [sender threads] [base port] > /dev/null */
+int main(int argc, char** argv) {
+	double budgetMs = (argc > 1) ? atof(argv[1]) : 1000;
+	int pktLen = (argc > 2) ? atoi(argv[2]) : 64;
+	int maxWorkers = (argc > 3) ? atoi(argv[3]) : 8;
+	int numSenders = (argc > 4) ? atoi(argv[4]) : 4;
+	int port = (argc > 5) ? atoi(argv[5]) : 19700;
+	vector<char> pkts;
+	double basePps = 0;
+
+	if (budgetMs <= 0 || pktLen < (int) sizeof(struct iphdr) || pktLen > DEFAULT_MTU || maxWorkers < 1 || numSenders < 1) {
+		fprintf(stderr, "usage: workerbench [ms per run] [packet bytes, 20 to %d] [max workers] [sender threads] [base port]\n",
+				DEFAULT_MTU);
+		return 1;
+	}
+	makePackets(pkts, pktLen);
+
+	for (int workers = 1; workers <= maxWorkers; workers *= 2, port += 2) {
+		phy_info phy, sinkPhy;
+		itf_info itf;
+		vector<itf_info> itfs;
+		char portStr[16];
+		stats_snapshot before, after;
+		pthread_t loopThread;
+		vector<bench_sender> senders(numSenders);
+		u_int64_t sent = 0;
+
+		snprintf(portStr, sizeof(portStr), "%d", port);
+		phy.ipAddr = "127.0.0.1";
+		phy.port = portStr;
+		snprintf(portStr, sizeof(portStr), "%d", port + 1);
+		sinkPhy.ipAddr = "127.0.0.1";
+		sinkPhy.port = portStr;
+		itf.rmtPhy = sinkPhy;
+		itf.locAddr = inet_addr("192.168.0.1");
+		itf.rmtAddr = inet_addr("192.168.0.2");
+		itf.mtu = DEFAULT_MTU;
+		itf.transport = LINK_UDP;
+		itfs.push_back(itf);
+
+		new LinkLayer(sinkPhy, vector<itf_info>());
+		LinkLayer* link = new LinkLayer(phy, itfs, LINK_BACKEND_SOCKETS, workers);
+		IPLayer* ipl = new IPLayer(link, workers);
+		EventLoop* loop = new EventLoop();
+		ipl->addRoute(inet_addr("10.1.0.0"), 16, 0);
+		ipl->registerEvents(loop);
+		pthread_create(&loopThread, NULL, runLoop, loop);
+
+		for (int i = 0; i < numSenders; i++) {
+			senders[i].dest.sin_family = AF_INET;
+			senders[i].dest.sin_port = htons(port);
+			senders[i].dest.sin_addr.s_addr = inet_addr("127.0.0.1");
+			senders[i].pkts = &pkts;
+			senders[i].pktLen = pktLen;
+			senders[i].id = i;
+			senders[i].stop = false;
+			senders[i].sent = 0;
+			pthread_create(&senders[i].thread, NULL, runSender, &senders[i]);
+		}
+
+		usleep(BENCH_WARMUP_MS * 1000);
+		ipl->getStats(&before);
+		double start = nowNs();
+		usleep(budgetMs * 1000);
+		ipl->getStats(&after);
+		double secs = (nowNs() - start) / 1e9;
+
+		for (int i = 0; i < numSenders; i++) {
+			senders[i].stop = true;
+			pthread_join(senders[i].thread, NULL);
+			sent += senders[i].sent;
+		}
+
+		double fwdPps = (after.itfs[0].txPackets - before.itfs[0].txPackets) / secs;
+		if (workers == 1) {
+			basePps = fwdPps;
+		}
+		fprintf(stderr, "bench=workers workers=%d cpus=%ld pkt_bytes=%d senders=%d secs=%.3f rcv_pps=%.0f fwd_pps=%.0f speedup=%.2f sent_pkts=%llu\n",
+				workers, sysconf(_SC_NPROCESSORS_ONLN), pktLen, numSenders, secs, (sumRx(&after) - sumRx(&before)) / secs,
+				fwdPps, basePps > 0 ? fwdPps / basePps : 0, (unsigned long long) sent);
+		// the node's threads are left to idle; it is never torn down
+	}
+
+	return 0;
+}
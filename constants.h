@@ -3,32 +3,76 @@
 
 #define MAX_ROUTES 128
 #define MAX_TTL 120
+#define BURST_SIZE 32
+#define DEFAULT_MTU 1400 // largest IP packet per link datagram, header included, unless configured
+#define MIN_MTU 68 // RFC 791
+#define MAX_MTU 65507 // largest UDP payload over IPv4
+#define MAX_POLL_BURSTS 8
+#define PKT_POOL_SIZE 16384
+#define PKT_POOL_BYTES (256 << 20) // caps PKT_POOL_SIZE when the MTU is large
+#define POOL_BACKOFF_MIN_US 100 // first wait of a forwarding worker that finds the packet pool empty
+#define POOL_BACKOFF_MAX_US 10000 // doubled each time it is still empty, up to this
+#define SOCKET_RCVBUF (4 << 20) // requested receive buffer per socket, so a burst of jumbo datagrams fits
+#define RCV_QUEUE_LEN 1024
+#define TX_QUEUE_LEN 1024
+#define MAX_SEND_FRAGS 8
+#define ROUTING_INTERVAL_MS 5000
+#define ROUTE_TIMEOUT_MS 12000 // a learned route not refreshed for this long is poisoned, then removed
+#define TRIGGER_HOLDDOWN_MS 100 // minimum gap between triggered updates
+
+#define MAX_INTERFACES 65534 // route_entry keeps interface numbers in 16 bits; the top two codes are taken
+
+#define LINK_UDP 0 // an interface's transport: datagrams to the neighbor's UDP endpoint
+#define LINK_SHM 1 // or shared memory rings, for a neighbor on the same host
 
 #include <netinet/in.h>
+#include <sys/types.h>
 #include <string>
-#include "IPLayer.h"
+
+class IPLayer;
 
 typedef struct {
-	char* ipAddr;
-	char* port;
+	std::string ipAddr; // host name or dotted quad of the UDP endpoint
+	std::string port;
 } phy_info;
 
 typedef struct {
-	char* locAddr;
-	char* rmtAddr;
+	u_int32_t locAddr; // our virtual IP on the interface, network byte order
+	u_int32_t rmtAddr; // the neighbor's, network byte order
 	phy_info rmtPhy;
+	int mtu; // largest IP packet sent over the interface in one datagram, header included
+	int transport; // LINK_UDP or LINK_SHM
 } itf_info;
 
+/**
+ * One route, packed into 12 bytes. Interfaces are point to point, so the next hop is the
+ * neighbor on the outgoing interface and is not stored.
+ */
 typedef struct {
-	char* dest;
-	char* nextHop;
-	int cost;
-	int TTL;
+	u_int32_t prefix; // network byte order
+	u_int32_t expiry; // ms on the timer wheel's clock, wrapping; 0 if the route never expires
+	u_int16_t itf; // outgoing interface; read and written through routeItf and setRouteItf
+	u_int8_t len : 6; // prefix length
+	u_int8_t timed : 1; // queued for an expiry check
+	u_int8_t cost;
 } route_entry;
 
+/**
+ * Returns a route's outgoing interface number, FWD_LOCAL or FWD_NO_ROUTE. Those two are stored
+ * as their low 16 bits, the codes above the last interface number.
+ */
+static inline int routeItf(const route_entry* route) {
+	return (route->itf >= MAX_INTERFACES) ? (int) route->itf - 0x10000 : route->itf;
+}
+
+static inline void setRouteItf(route_entry* route, int itfNum) {
+	route->itf = (u_int16_t) itfNum;
+}
+
 typedef struct {
 	IPLayer* ipl;
-	string toRun;
+	std::string toRun;
+	int workerId;
 } ipl_thread_pkg;
 
 #endif
@@ -5,8 +5,14 @@
  From ping examples in W.Richard Stevens "UNIX NETWORK PROGRAMMING" book.
 ************************************************************/
 #include <inttypes.h>
+#include <string.h>
 
-int ip_sum(char* packet, int n) {
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IPSUM_X86 1
+#endif
+
+int ip_sum_16(char* packet, int n) {
   uint16_t *p = (uint16_t*)packet;
   uint16_t answer;
   long sum = 0;
@@ -28,3 +34,450 @@ int ip_sum(char* packet, int n) {
   answer = ~sum;                /* ones-complement, truncate*/
   return answer;
 }
+
+/************************************************************
+ Wide versions. Since 2^16 == 1 (mod 0xffff), the ones-complement
+ sum of 16-bit words equals the ones-complement sum of the same
+ bytes taken as 32- or 64-bit words, folded down at the end. Words
+ are loaded relative to the start of the buffer, so alignment does
+ not matter, and a short tail is zero-padded at its end just like
+ the odd byte above. Results are bit-identical to ip_sum_16 for
+ every length up to 64KB.
+************************************************************/
+
+/* folds a 64-bit partial sum plus its deferred carries to a 16-bit checksum */
+static int fold64(uint64_t sum, uint64_t carries) {
+  sum += carries;
+  if (sum < carries) /* end-around carry */
+    sum++;
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  return (uint16_t)~sum;
+}
+
+/* places a bits wide value read from byte offset k where it sits within a 64-bit word */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WORD_AT(v, k, bits) ((uint64_t)(v) << (8 * (k)))
+#else
+#define WORD_AT(v, k, bits) ((uint64_t)(v) << (64 - (bits) - 8 * (k)))
+#endif
+
+/* adds n bytes to sum as 64-bit words, counting carries out of the top bit in *carries */
+static uint64_t sum64(const char* p, int n, uint64_t sum, uint64_t* carries) {
+  uint64_t w0, w1, w2, w3;
+  uint64_t c = 0;
+
+  while (n >= 32) {
+    memcpy(&w0, p, 8);
+    memcpy(&w1, p + 8, 8);
+    memcpy(&w2, p + 16, 8);
+    memcpy(&w3, p + 24, 8);
+    sum += w0; c += (sum < w0);
+    sum += w1; c += (sum < w1);
+    sum += w2; c += (sum < w2);
+    sum += w3; c += (sum < w3);
+    p += 32;
+    n -= 32;
+  }
+
+  while (n >= 8) {
+    memcpy(&w0, p, 8);
+    sum += w0; c += (sum < w0);
+    p += 8;
+    n -= 8;
+  }
+
+  /* mop up the last 0-7 bytes, zero-padded. the tail word is assembled in a register;
+     writing it byte by byte to memory and reloading it would stall store forwarding */
+  if (n > 0) {
+    uint32_t v4;
+    uint16_t v2;
+    int k = 0;
+    w0 = 0;
+    if (n & 4) {
+      memcpy(&v4, p, 4);
+      w0 = WORD_AT(v4, 0, 32);
+      k = 4;
+    }
+    if (n & 2) {
+      memcpy(&v2, p + k, 2);
+      w0 |= WORD_AT(v2, k, 16);
+      k += 2;
+    }
+    if (n & 1)
+      w0 |= WORD_AT((uint8_t)p[k], k, 8);
+    sum += w0; c += (sum < w0);
+  }
+
+  *carries += c;
+  return sum;
+}
+
+int ip_sum_64(char* packet, int n) {
+  uint64_t carries = 0;
+  uint64_t sum = sum64(packet, n, 0, &carries);
+  return fold64(sum, carries);
+}
+
+#ifdef IPSUM_X86
+/* 32-bit lanes are widened to 64 bits before adding, so the accumulators cannot overflow */
+__attribute__((target("sse2")))
+int ip_sum_sse2(char* packet, int n) {
+  const char* p = packet;
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = zero, acc1 = zero;
+  uint64_t lanes[2], sum, carries = 0;
+
+  while (n >= 32) {
+    __m128i v0 = _mm_loadu_si128((const __m128i*)p);
+    __m128i v1 = _mm_loadu_si128((const __m128i*)(p + 16));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+    p += 32;
+    n -= 32;
+  }
+
+  _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+  sum = lanes[0];
+  sum += lanes[1]; carries += (sum < lanes[1]);
+
+  sum = sum64(p, n, sum, &carries);
+  return fold64(sum, carries);
+}
+
+__attribute__((target("avx2")))
+int ip_sum_avx2(char* packet, int n) {
+  const char* p = packet;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = zero, acc1 = zero;
+  uint64_t lanes[4], sum, carries = 0;
+
+  while (n >= 64) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)p);
+    __m256i v1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+    p += 64;
+    n -= 64;
+  }
+
+  _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+  sum = lanes[0];
+  sum += lanes[1]; carries += (sum < lanes[1]);
+  sum += lanes[2]; carries += (sum < lanes[2]);
+  sum += lanes[3]; carries += (sum < lanes[3]);
+
+  sum = sum64(p, n, sum, &carries);
+  return fold64(sum, carries);
+}
+#endif
+
+/************************************************************
+ Runtime dispatch. The widest version the CPU supports is
+ picked once at startup; ip_sum then costs one indirect call.
+************************************************************/
+static int (*ip_sum_impl)(char*, int) = ip_sum_64;
+static const char* ip_sum_impl_name = "64";
+
+__attribute__((constructor))
+static void ip_sum_select(void) {
+#ifdef IPSUM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    ip_sum_impl = ip_sum_avx2;
+    ip_sum_impl_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    ip_sum_impl = ip_sum_sse2;
+    ip_sum_impl_name = "sse2";
+  }
+#endif
+}
+
+int ip_sum(char* packet, int n) {
+  return ip_sum_impl(packet, n);
+}
+
+const char* ip_sum_name(void) {
+  return ip_sum_impl_name;
+}
+
+/************************************************************
+ Incremental checksum update, RFC 1624 eqn. 3:
+   HC' = ~(~HC + ~m + m')
+ Unlike eqn. 2 this never produces 0xFFFF for a header whose
+ full recomputation would give 0x0000.
+************************************************************/
+int ip_sum_update(int check, int oldWord, int newWord) {
+  uint32_t sum;
+
+  sum = (uint16_t)~check + (uint16_t)~oldWord + (uint16_t)newWord;
+  sum = (sum >> 16) + (sum & 0xffff); /* add hi 16 to low 16 */
+  sum += (sum >> 16);           /* add carry */
+  return (uint16_t)~sum;        /* ones-complement, truncate*/
+}
+
+#ifdef IPSUM_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/************************************************************
+ Test harness and benchmark. Mode u checks ip_sum_update the
+ way IPLayer uses it to decrement the TTL: for every TTL and
+ every value of the checksum field, a valid header carrying
+ that checksum gets its TTL decremented, the checksum patched
+ over the ttl and protocol word, and the result compared with
+ a full recompute and checked to verify. Then does the same
+ for random changes to random words of random headers.
+
+ Mode k checks that every kernel the CPU runs gives the same
+ result as ip_sum_16 for every length up to 2KB at 64
+ alignments, then for lengths up to 64KB in odd steps at 8
+ alignments, over random bytes and over all ones (the most
+ carries). Bytes past the end are random, so a kernel that
+ reads too far is caught too.
+
+ Mode b times each kernel on buffers of 20 bytes to 64KB.
+************************************************************/
+
+#define HDR_LEN 20
+#define ID_OFF 4
+#define TTL_OFF 8 /* ttl and protocol share a word */
+#define CHECK_OFF 10
+
+#define MAX_LEN 65536
+#define SMALL_LEN 2048 /* every length up to here is checked at every alignment */
+#define LARGE_STEP 61 /* odd, so large lengths hit every tail size */
+#define MAX_ALIGN 64
+
+typedef struct {
+  const char* name;
+  int (*sum)(char*, int);
+} kernel;
+
+static uint32_t xorshift(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static uint16_t get16(const uint8_t* hdr, int off) {
+  uint16_t w;
+  memcpy(&w, hdr + off, 2);
+  return w;
+}
+
+static void put16(uint8_t* hdr, int off, uint16_t w) {
+  memcpy(hdr + off, &w, 2);
+}
+
+/* sets the id word so that a header carrying check in its checksum field verifies */
+static void solve_id(uint8_t* hdr, uint16_t check) {
+  uint32_t sum;
+
+  put16(hdr, ID_OFF, 0);
+  put16(hdr, CHECK_OFF, 0);
+  sum = (uint16_t)~ip_sum_16((char*)hdr, HDR_LEN);
+  sum += check;
+  sum = (sum >> 16) + (sum & 0xffff);
+  put16(hdr, ID_OFF, (uint16_t)~sum);
+  put16(hdr, CHECK_OFF, check);
+}
+
+/* changes the word at off to w, patching the checksum; returns 1 if it matches a recompute */
+static int patch_ok(uint8_t* hdr, int off, uint16_t w, long* invalid) {
+  uint16_t check = ip_sum_update(get16(hdr, CHECK_OFF), get16(hdr, off), w);
+  uint16_t full;
+
+  put16(hdr, off, w);
+  put16(hdr, CHECK_OFF, check);
+  if (ip_sum_16((char*)hdr, HDR_LEN) != 0)
+    (*invalid)++;
+  put16(hdr, CHECK_OFF, 0);
+  full = ip_sum_16((char*)hdr, HDR_LEN);
+  put16(hdr, CHECK_OFF, check);
+  return check == full;
+}
+
+static int test_update(long cases, uint32_t rng) {
+  static const uint8_t base[HDR_LEN] = {0x45, 0, 0, 84, 0, 0, 0x40, 0, 0, 143, 0, 0, 10, 0, 0, 1, 10, 0, 0, 2};
+  uint8_t hdr[HDR_LEN];
+  long ttlCases = 0, ttlBad = 0, ttlInvalid = 0, rndBad = 0, rndInvalid = 0;
+
+  for (int ttl = 1; ttl <= 255; ttl++) {
+    for (uint32_t check = 0; check <= 0xffff; check++) {
+      uint16_t word;
+
+      memcpy(hdr, base, HDR_LEN);
+      hdr[TTL_OFF] = ttl;
+      solve_id(hdr, check);
+      word = get16(hdr, TTL_OFF);
+      ((uint8_t*)&word)[0] = ttl - 1;
+      ttlBad += !patch_ok(hdr, TTL_OFF, word, &ttlInvalid);
+      ttlCases++;
+    }
+  }
+  printf("test=ttl_decrement cases=%ld mismatches=%ld invalid=%ld\n", ttlCases, ttlBad, ttlInvalid);
+
+  for (long i = 0; i < cases; i++) {
+    int off;
+
+    for (int k = 0; k < HDR_LEN; k += 2)
+      put16(hdr, k, xorshift(&rng));
+    solve_id(hdr, xorshift(&rng));
+    do {
+      off = 2 * (xorshift(&rng) % (HDR_LEN / 2));
+    } while (off == CHECK_OFF);
+    rndBad += !patch_ok(hdr, off, xorshift(&rng), &rndInvalid);
+  }
+  printf("test=random_word cases=%ld mismatches=%ld invalid=%ld\n", cases, rndBad, rndInvalid);
+
+  return (ttlBad + ttlInvalid + rndBad + rndInvalid) > 0;
+}
+
+/* fills the kernels the CPU can run into kernels, ip_sum_16 first; returns how many */
+static int get_kernels(kernel* kernels) {
+  int n = 0;
+
+  kernels[n].name = "16";
+  kernels[n++].sum = ip_sum_16;
+  kernels[n].name = "64";
+  kernels[n++].sum = ip_sum_64;
+#ifdef IPSUM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    kernels[n].name = "sse2";
+    kernels[n++].sum = ip_sum_sse2;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels[n].name = "avx2";
+    kernels[n++].sum = ip_sum_avx2;
+  }
+#endif
+  return n;
+}
+
+/* checks every kernel against ip_sum_16 at len bytes from each of the first aligns offsets */
+static long check_len(char* buf, int len, int aligns, const kernel* kernels, int numKernels, long* cases) {
+  long bad = 0;
+
+  for (int a = 0; a < aligns; a++) {
+    int ref = ip_sum_16(buf + a, len);
+    for (int k = 1; k < numKernels; k++) {
+      int got = kernels[k].sum(buf + a, len);
+      if (got != ref) {
+        if (bad < 10)
+          printf("mismatch impl=%s len=%d align=%d got=0x%04x want=0x%04x\n", kernels[k].name, len, a, got, ref);
+        bad++;
+      }
+      (*cases)++;
+    }
+  }
+  return bad;
+}
+
+static int test_kernels(uint32_t rng) {
+  kernel kernels[4];
+  int numKernels = get_kernels(kernels);
+  char* buf = (char*)malloc(MAX_LEN + 2 * MAX_ALIGN);
+  long cases = 0, bad = 0;
+
+  for (int pattern = 0; pattern < 2; pattern++) {
+    for (int i = 0; i < MAX_LEN + 2 * MAX_ALIGN; i++)
+      buf[i] = (char)xorshift(&rng);
+
+    for (int len = 0; len <= MAX_LEN; len = (len < SMALL_LEN) ? len + 1 : len + LARGE_STEP) {
+      /* all ones: only the bytes summed, so the tail past them stays random */
+      if (pattern == 1)
+        memset(buf, 0xff, len + MAX_ALIGN);
+      bad += check_len(buf, len, (len <= SMALL_LEN) ? MAX_ALIGN : 8, kernels, numKernels, &cases);
+    }
+    bad += check_len(buf, MAX_LEN - 1, 8, kernels, numKernels, &cases);
+    bad += check_len(buf, MAX_LEN, 8, kernels, numKernels, &cases);
+  }
+
+  printf("test=kernels impls=");
+  for (int k = 1; k < numKernels; k++)
+    printf("%s%s", kernels[k].name, (k < numKernels - 1) ? "," : "");
+  printf(" cases=%ld mismatches=%ld\n", cases, bad);
+
+  free(buf);
+  return bad > 0;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench_kernels(int ms) {
+  static const int sizes[] = {20, 40, 64, 128, 256, 576, 1500, 4096, 9000, 16384, 32768, 65535};
+  kernel kernels[4];
+  int numKernels = get_kernels(kernels);
+  char* buf = (char*)malloc(MAX_LEN);
+  uint32_t rng = 1;
+  volatile int sink = 0;
+
+  for (int i = 0; i < MAX_LEN; i++)
+    buf[i] = (char)xorshift(&rng);
+
+  for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    for (int k = 0; k < numKernels; k++) {
+      double start = now_ns(), elapsed;
+      long calls = 0;
+
+      do {
+        for (int i = 0; i < 1024; i++)
+          sink += kernels[k].sum(buf, sizes[s]);
+        calls += 1024;
+        elapsed = now_ns() - start;
+      } while (elapsed < ms * 1e6);
+
+      fprintf(stderr, "bench=ip_sum impl=%s bytes=%d calls=%ld ns_per_call=%.2f gb_per_s=%.2f\n", kernels[k].name,
+          sizes[s], calls, elapsed / calls, (double)sizes[s] * calls / elapsed);
+    }
+  }
+
+  free(buf);
+  return 0;
+}
+
+/*
+ * ipsumtest u [random cases] [seed]
+ * ipsumtest k [seed]
+ * ipsumtest b [ms per size and kernel]
+ */
+int main(int argc, char** argv) {
+  char mode = (argc > 1) ? argv[1][0] : '\0';
+
+  if (mode == 'u') {
+    long cases = (argc > 2) ? atol(argv[2]) : 10000000;
+    uint32_t seed = (argc > 3) ? strtoul(argv[3], NULL, 10) : 1;
+    if (cases >= 0 && seed != 0)
+      return test_update(cases, seed);
+  } else if (mode == 'k') {
+    uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1;
+    if (seed != 0)
+      return test_kernels(seed);
+  } else if (mode == 'b') {
+    int ms = (argc > 2) ? atoi(argv[2]) : 100;
+    if (ms > 0)
+      return bench_kernels(ms);
+  }
+
+  fprintf(stderr, "usage: ipsumtest u [random cases] [seed, not 0]\n"
+      "       ipsumtest k [seed, not 0]\n"
+      "       ipsumtest b [ms per size and kernel]\n");
+  return 1;
+}
+#endif
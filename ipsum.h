@@ -5,4 +5,18 @@
 //for IP, len should always be the size of the ip header (sizeof (struct ip))
 int ip_sum(char* packet, int len);
 
+//the individual implementations ip_sum picks from at startup. all return identical results
+//for len up to 64KB; ip_sum_sse2 and ip_sum_avx2 exist on x86 only
+int ip_sum_16(char* packet, int len);
+int ip_sum_64(char* packet, int len);
+int ip_sum_sse2(char* packet, int len);
+int ip_sum_avx2(char* packet, int len);
+
+//name of the implementation ip_sum dispatches to ("avx2", "sse2" or "64")
+const char* ip_sum_name(void);
+
+//incrementally update checksum check after one 16-bit word it covers changes from oldWord to
+//newWord (RFC 1624, eqn. 3). words are in the same byte order as the checksum field
+int ip_sum_update(int check, int oldWord, int newWord);
+
 #endif
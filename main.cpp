@@ -1,79 +1,48 @@
 #include <iostream>
-#include <fstream>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <stdlib.h>
 
 #include "AppLayer.h"
 #include "LinkLayer.h"
+#include "IPLayer.h"
+#include "EventLoop.h"
+#include "NodeConfig.h"
 
 using namespace std;
 
-const string DEFAULT_IP = "127.0.0.1";
-
 int main (int argc, char** argv){
 
-	ifstream myReader;
-	char* fileName = argv[1];
-	myReader.open(fileName);
-	cout << "The file name is " <<  fileName << endl;
-	string line = "";
-	string fileInfo[128];
-	int count = 0;
-	while(getline(myReader,line)) {
-		char *pch;
-		char *linecopy = new char[line.length() + 1];
-		strcpy(linecopy,line.c_str());
-		pch = strtok(linecopy, ": ");
-		while(pch != NULL) {
-			string str = pch;
-			fileInfo[count] = str;
-//			cout << pch << endl;
-			pch = strtok(NULL, " : ");
-			cout << "The string info " << count << " is " << fileInfo[count] << endl;
-			count++;
-		}
-	}
+	NodeConfig config;
 
-	if(fileInfo[0].compare("localhost") == 0){
-		fileInfo[0] = DEFAULT_IP;
+	if (argc < 2) {
+		cout << "Usage: " << argv[0] << " <node file> [forwarding workers] [rip|ls] [stats interval ms] [sockets|uring]" << endl;
+		return 1;
 	}
-
-	vector<itf_info> nodeItfs;
-
-	for(int i = 2; i < count;){
-		if(fileInfo[i].compare("localhost") == 0){
-			fileInfo[i] = DEFAULT_IP;
-		}
-		itf_info newItf;
-		phy_info newPhy;
-		newPhy.ipAddr = const_cast<char* >(fileInfo[i].c_str());
-		i++;
-		newPhy.port = const_cast<char* >(fileInfo[i].c_str());
-		i++;
-		newItf.rmtPhy = newPhy;
-		newItf.locAddr = const_cast<char* >(fileInfo[i].c_str());
-		i++;
-		newItf.rmtAddr = const_cast<char* >(fileInfo[i].c_str());
-		i++;
-		nodeItfs.push_back(newItf);
+	cout << "The file name is " << argv[1] << endl;
+	if (config.load(argv[1]) < 0) {
+		return 1;
 	}
 
-	phy_info myPhyInfo;
-	myPhyInfo.ipAddr = const_cast<char* >(fileInfo[0].c_str());
-	myPhyInfo.port = const_cast<char* >(fileInfo[1].c_str());
-
-	LinkLayer nodeLink(myPhyInfo, nodeItfs);
-
-	string input = "";
-	AppLayer myApp;
-	while(1){
-		cin >> input;
-		myApp.runningApp(input);
+	int backend = (argc > 5 && strcmp(argv[5], "uring") == 0) ? LINK_BACKEND_URING : LINK_BACKEND_SOCKETS;
+	int numWorkers = (argc > 2) ? atoi(argv[2]) : 1;
+	LinkLayer nodeLink(config.getLocalPhy(), config.getInterfaces(), backend, numWorkers);
+	int routingMode = (argc > 3 && strcmp(argv[3], "ls") == 0) ? ROUTING_LINK_STATE : ROUTING_RIP;
+	IPLayer nodeIP(&nodeLink, numWorkers, routingMode);
+	if (nodeIP.addStaticRoutes(config.getStaticRoutes()) > 0) {
+		cout << "Some static routes could not be installed" << endl;
 	}
+	AppLayer myApp(&nodeIP, (argc > 4) ? atoi(argv[4]) : 0);
+
+	// run the CLI, packet handling and routing timers off a single reactor
+	EventLoop loop;
+	nodeIP.registerEvents(&loop);
+	myApp.registerEvents(&loop);
+	loop.run();
 
 	return 0;
 }